@@ -0,0 +1,330 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Availability statistics from IOC event lists.  The fleet report has a
+// pool of threads each taking the next IOC, fetching its events, and
+// working them out, so the fetches overlap and the arithmetic is spread
+// over the cores.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "alive_client.h"
+
+
+enum { State_Unknown, State_Up, State_Down };
+
+// seconds of [from, to) inside [start, end)
+static uint32_t overlap( time_t from, time_t to, time_t start, time_t end)
+{
+  if( from < start)
+    from = start;
+  if( to > end)
+    to = end;
+  return (to > from) ? (uint32_t) (to - from) : 0;
+}
+
+// Events come oldest first, so this is one pass.  The state before the
+// first event is unknown, and time after the daemon's current time isn't
+// counted.
+void alive_ioc_availability( struct alive_ioc_event_db *events,
+                             time_t start, time_t end,
+                             struct alive_availability *avail)
+{
+  struct alive_ioc_event_item *item;
+  time_t last, t;
+  int state, conflict;
+  int down_periods;
+  int i;
+
+  avail->up_time = avail->down_time = avail->unknown_time = 0;
+  avail->conflict_time = 0;
+  avail->failures = avail->boots = avail->recoveries = 0;
+  avail->availability = avail->mtbf = avail->mttr = 0.0;
+
+  if( end > events->current_time)
+    end = events->current_time;
+  if( end <= start)
+    return;
+
+  state = State_Unknown;
+  conflict = 0;
+  down_periods = 0;
+  last = 0;
+  for( i = 0; i < events->number; i++)
+    {
+      item = &(events->instances[i]);
+      t = item->time;
+      if( t >= end)
+        break;
+      if( t < last)
+        t = last;
+
+      // time spent in the state up to this event
+      switch( state)
+        {
+        case State_Up:
+          avail->up_time += overlap( last, t, start, end);
+          break;
+        case State_Down:
+          avail->down_time += overlap( last, t, start, end);
+          break;
+        default:
+          avail->unknown_time += overlap( last, t, start, end);
+          break;
+        }
+      if( conflict)
+        avail->conflict_time += overlap( last, t, start, end);
+      last = t;
+
+      switch( item->event)
+        {
+        case FAIL:
+          if( (state != State_Down) && (t >= start) )
+            avail->failures++;
+          state = State_Down;
+          break;
+        case BOOT:
+        case RECOVER:
+          if( t >= start)
+            {
+              if( item->event == BOOT)
+                avail->boots++;
+              else
+                avail->recoveries++;
+            }
+          // the down period may have started before the window
+          if( (state == State_Down) && (t > start) )
+            down_periods++;
+          state = State_Up;
+          break;
+        case CONFLICT_START:
+          conflict = 1;
+          break;
+        case CONFLICT_STOP:
+          conflict = 0;
+          break;
+        }
+    }
+
+  switch( state)
+    {
+    case State_Up:
+      avail->up_time += overlap( last, end, start, end);
+      break;
+    case State_Down:
+      avail->down_time += overlap( last, end, start, end);
+      down_periods++;
+      break;
+    default:
+      avail->unknown_time += overlap( last, end, start, end);
+      break;
+    }
+  if( conflict)
+    avail->conflict_time += overlap( last, end, start, end);
+
+  if( avail->up_time + avail->down_time)
+    avail->availability = (double) avail->up_time /
+      (avail->up_time + avail->down_time);
+  if( avail->failures)
+    avail->mtbf = (double) avail->up_time / avail->failures;
+  if( down_periods)
+    avail->mttr = (double) avail->down_time / down_periods;
+}
+
+
+struct availability_work
+{
+  char *server;
+  int port;
+  time_t start;
+  time_t end;
+  struct alive_availability_report *report;
+
+  pthread_mutex_t lock;
+  int next;
+};
+
+static void *availability_worker( void *arg)
+{
+  struct availability_work *work = arg;
+  struct alive_availability *avail;
+  struct alive_ioc_event_db *events;
+  int i;
+
+  while( 1)
+    {
+      pthread_mutex_lock( &work->lock);
+      i = work->next++;
+      pthread_mutex_unlock( &work->lock);
+      if( i >= work->report->number)
+        break;
+
+      avail = &(work->report->iocs[i]);
+      events = alive_get_ioc_event_db( work->server, work->port,
+                                       avail->ioc_name);
+      if( events == NULL)
+        continue;
+      alive_ioc_availability( events, work->start, work->end, avail);
+      avail->valid = 1;
+      alive_free_ioc_event_db( events);
+    }
+
+  return NULL;
+}
+
+struct alive_availability_report *alive_get_availability( char *server,
+                                                          int port,
+                                                          int number,
+                                                          char **names,
+                                                          time_t start,
+                                                          time_t end,
+                                                          int threads)
+{
+  struct alive_availability_report *report;
+  struct availability_work work;
+  struct alive_db *db;
+  pthread_t *tids;
+  int started;
+  int i;
+
+  // the IOCs are whatever the daemon knows of
+  db = alive_get_iocs( server, port, number, names);
+  if( db == NULL)
+    return NULL;
+
+  report = calloc( 1, sizeof( struct alive_availability_report));
+  if( report == NULL)
+    {
+      alive_free_db( db);
+      return NULL;
+    }
+  report->start = start;
+  report->end = (end > db->current_time) ? db->current_time : end;
+  report->number = db->number_ioc;
+  report->iocs = calloc( db->number_ioc + 1,
+                         sizeof( struct alive_availability));
+  if( report->iocs == NULL)
+    {
+      free( report);
+      alive_free_db( db);
+      return NULL;
+    }
+  // names are taken over from the database
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      report->iocs[i].ioc_name = db->ioc[i].ioc_name;
+      db->ioc[i].ioc_name = NULL;
+    }
+  alive_free_db( db);
+
+  if( threads < 1)
+    threads = 1;
+  if( threads > report->number)
+    threads = report->number;
+
+  work.server = server;
+  work.port = port;
+  work.start = start;
+  work.end = end;
+  work.report = report;
+  work.next = 0;
+  pthread_mutex_init( &work.lock, NULL);
+
+  tids = malloc( (threads ? threads : 1) * sizeof( pthread_t));
+  started = 0;
+  if( tids != NULL)
+    for( ; started < threads; started++)
+      if( pthread_create( &tids[started], NULL, availability_worker, &work))
+        break;
+  if( !started)
+    // do it all here instead
+    availability_worker( &work);
+  for( i = 0; i < started; i++)
+    pthread_join( tids[i], NULL);
+  free( tids);
+  pthread_mutex_destroy( &work.lock);
+
+  return report;
+}
+
+void alive_free_availability_report( struct alive_availability_report *report)
+{
+  int i;
+
+  if( report == NULL)
+    return;
+  for( i = 0; i < report->number; i++)
+    free( report->iocs[i].ioc_name);
+  free( report->iocs);
+  free( report);
+}
+
+struct alive_availability_report *alive_cache_availability(
+                                            struct alive_event_cache *cache,
+                                            int number, char **names,
+                                            time_t start, time_t end)
+{
+  struct alive_availability_report *report;
+  struct alive_event_cache_view *view;
+  char **cached;
+  int number_cached;
+  time_t last;
+  int i;
+
+  cached = NULL;
+  number_cached = 0;
+  if( !number)
+    {
+      cached = alive_event_cache_names( cache, &number_cached);
+      if( cached == NULL)
+        return NULL;
+      number = number_cached;
+      names = cached;
+    }
+
+  report = calloc( 1, sizeof( struct alive_availability_report));
+  if( report != NULL)
+    report->iocs = calloc( number + 1, sizeof( struct alive_availability));
+  if( (report == NULL) || (report->iocs == NULL) )
+    {
+      free( report);
+      alive_event_cache_free_names( cached, number_cached);
+      return NULL;
+    }
+  report->start = start;
+  report->number = number;
+
+  // the end is the last refresh, as the time after is unknown
+  last = 0;
+  for( i = 0; i < number; i++)
+    {
+      report->iocs[i].ioc_name = strdup( names[i]);
+      view = alive_event_cache_map( cache, names[i]);
+      if( view == NULL)
+        continue;
+      if( view->events.current_time > last)
+        last = view->events.current_time;
+      alive_ioc_availability( &view->events, start, 
+                              (end > view->events.current_time) ?
+                              view->events.current_time : end,
+                              &(report->iocs[i]));
+      report->iocs[i].valid = 1;
+      alive_event_cache_unmap( view);
+    }
+  report->end = (end > last) ? last : end;
+
+  alive_event_cache_free_names( cached, number_cached);
+  return report;
+}
@@ -12,21 +12,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
+#include <stddef.h>
 
 //#include <netdb.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "alive_client.h"
 #include "alive_version.h"
-
-
-// defined in bytes
-#define EVENT_SIZE (4) 
+#include "alive_trace.h"
+#include "alive_wire.h"
 
 
 #ifndef DEF_SERVER
@@ -36,8 +42,6 @@
   #define DEF_DB_PORT 5679
 #endif
 
-#define CLIENT_PROTOCOL_VERSION (4)
-
 
 enum BufferType { Buffer_Unknown, Buffer_External, Buffer_Copy, Buffer_Socket };
 
@@ -51,6 +55,7 @@ struct buffer_struct
   // next are needed for Buffer_Socket only
   int socket;
   int buffer_size;  // maximum amount of data that can be read at a time
+  int received;     // total read from the socket, for tracing
 };
 
 
@@ -69,6 +74,38 @@ static int get_server_addr(char *server, int port, int *sockfd)
   
   int lsockfd;
   
+  // a path is a local UNIX socket, such as one served by alive-proxy
+  if( server[0] == '/')
+    {
+      struct sockaddr_un u_addr;
+
+      if( strlen( server) >= sizeof(u_addr.sun_path) )
+        {
+          printf( "Socket path too long!\n");
+          return 1;
+        }
+      memset( &u_addr, 0, sizeof(u_addr) );
+      u_addr.sun_family = AF_UNIX;
+      strcpy( u_addr.sun_path, server);
+
+      lsockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if( lsockfd == -1)
+        {
+          printf( "Can't open socket!\n");
+          return 1;
+        }
+      TRACE_BEGIN( Trace_Connect, 0, 0, NULL);
+      result = connect(lsockfd, (struct sockaddr *)&u_addr, sizeof(u_addr));
+      TRACE_END( Trace_Connect, 0, -1);
+      if( result == -1)
+        {
+          printf( "Can't connect to server!\n");
+          close( lsockfd);
+          return 1;
+        }
+      *sockfd = lsockfd;
+      return 0;
+    }
    
   snprintf( port_str, 8, "%d", port);
   
@@ -76,7 +113,10 @@ static int get_server_addr(char *server, int port, int *sockfd)
   hints.ai_family = AF_INET;      
   hints.ai_socktype = SOCK_STREAM;
   
-  if( (status = getaddrinfo(server, port_str, &hints, &servinfo)) != 0 )
+  TRACE_BEGIN( Trace_Getaddrinfo, 0, 0, NULL);
+  status = getaddrinfo(server, port_str, &hints, &servinfo);
+  TRACE_END( Trace_Getaddrinfo, 0, -1);
+  if( status != 0 )
     {
       printf( "getaddrinfo error: %s\n", gai_strerror(status));
       return 1;
@@ -97,7 +137,9 @@ static int get_server_addr(char *server, int port, int *sockfd)
       return 1;
     }
 
+  TRACE_BEGIN( Trace_Connect, 0, 0, NULL);
   result = connect(lsockfd, (struct sockaddr *)&r_addr, sizeof(r_addr) );
+  TRACE_END( Trace_Connect, 0, -1);
   if( result == -1)
     {
       printf( "Can't connect to server!\n");
@@ -112,36 +154,36 @@ static int get_server_addr(char *server, int port, int *sockfd)
 
 
 
-/* static struct buffer_struct *init_buffer_data( char *buffer, int buffer_size, int copy_flag) */
-/* { */
-/*   struct buffer_struct *bs; */
+static struct buffer_struct *init_buffer_data( char *buffer, int buffer_size, int copy_flag)
+{
+  struct buffer_struct *bs;
 
-/*   bs = calloc( 1, sizeof(struct buffer_struct)); */
-/*   if( bs == NULL) */
-/*     return NULL; */
+  bs = calloc( 1, sizeof(struct buffer_struct));
+  if( bs == NULL)
+    return NULL;
   
-/*   if( copy_flag) */
-/*     { */
-/*       bs->buffer = malloc( sizeof(char) * buffer_size); */
-/*       if( bs->buffer == NULL) */
-/*         { */
-/*           free( bs); */
-/*           return NULL; */
-/*         } */
-/*       memcpy( bs->buffer, buffer, buffer_size); */
-/*       bs->type = Buffer_Copy; */
-/*     } */
-/*   else */
-/*     { */
-/*       bs->buffer = buffer; */
-/*       bs->type = Buffer_External; */
-/*     } */
-/*   bs->amount = buffer_size; */
+  if( copy_flag)
+    {
+      bs->buffer = malloc( sizeof(char) * buffer_size);
+      if( bs->buffer == NULL)
+        {
+          free( bs);
+          return NULL;
+        }
+      memcpy( bs->buffer, buffer, buffer_size);
+      bs->type = Buffer_Copy;
+    }
+  else
+    {
+      bs->buffer = buffer;
+      bs->type = Buffer_External;
+    }
+  bs->amount = buffer_size;
   
-/*   // sd->offset set to zero by calloc() */
+  // sd->offset set to zero by calloc()
 
-/*   return bs; */
-/* } */
+  return bs;
+}
 
 static struct buffer_struct *init_buffer_stream( int socket, int buffer_size)
 {
@@ -216,14 +258,22 @@ static int load_buffer( struct buffer_struct *bs, int number)
       bs->amount = left;
       bs->offset = 0;
       
+      TRACE_BEGIN( Trace_Read, 0, 0, NULL);
       while( bs->amount < number) 
         {
           addlen = read( bs->socket, &(bs->buffer[bs->amount]), 
                          bs->buffer_size - bs->amount);
+          if( addlen > 0)
+            {
+              if( !bs->received)
+                TRACE_INSTANT( Trace_FirstByte, 0);
+              bs->received += addlen;
+            }
           bs->amount += addlen;
           if( !addlen)
             break;
         }
+      TRACE_END( Trace_Read, 0, bs->amount - left);
 
       return bs->amount;
     }
@@ -249,26 +299,19 @@ static int get_buffer_dataptr( struct buffer_struct *bs, int number,
   return *retnumber != number;
 }
 
-static int get_buffer_uint8( struct buffer_struct *bs, uint8_t *val)
+// The next block of a size, tested once for all of its fields, or NULL
+// if it isn't all there.
+static const char *get_buffer_block( struct buffer_struct *bs, int size)
 {
-  if( load_buffer_test( bs, sizeof(uint8_t)))
-    return 1;
-
-  *val = *((uint8_t *) &(bs->buffer[bs->offset]) );
-  bs->offset += sizeof(uint8_t);
-
-  return 0;
-}
+  const char *p;
 
-static int get_buffer_uint16( struct buffer_struct *bs, uint16_t *val)
-{
-  if( load_buffer_test( bs, sizeof(uint16_t)))
-    return 1;
+  if( load_buffer_test( bs, size))
+    return NULL;
 
-  *val = ntohs( *((uint16_t *) &(bs->buffer[bs->offset]) ));
-  bs->offset += sizeof(uint16_t);
+  p = &(bs->buffer[bs->offset]);
+  bs->offset += size;
 
-  return 0;
+  return p;
 }
 
 static int get_buffer_uint32( struct buffer_struct *bs, uint32_t *val)
@@ -323,339 +366,1766 @@ static char *get_buffer_string( struct buffer_struct *bs, int bytes)
 }
 
 
-static struct alive_env *get_environment( struct buffer_struct *bs)
+// Reads a string into *str, keeping the old one if it is the same.
+// Returns 1 if the data ran out, leaving *str NULL.
+static int refresh_string( struct buffer_struct *bs, int bytes, char **str)
 {
-  struct alive_env *env;
+  int len;
+  char *p;
 
-  int i;
+  if( load_buffer_test( bs, bytes))
+    goto Missing;
 
-  uint8_t data_exists;
+  switch( bytes)
+    {
+    case 1:
+      len = *((uint8_t *) &(bs->buffer[bs->offset]) );
+      break;
+    case 2:
+      len =  ntohs( *((uint16_t *) &(bs->buffer[bs->offset]) ));
+      break;
+    default:
+      len = ntohl( *((uint32_t *) &(bs->buffer[bs->offset]) ));
+      break;
+    }
+  bs->offset += bytes;
 
-  if( get_buffer_uint8( bs, &data_exists) || (data_exists == 0) )
-    return NULL;
+  if( load_buffer_test( bs, len))
+    goto Missing;
+  p = &(bs->buffer[bs->offset]);
+  bs->offset += len;
 
+  len = strnlen( p, len);
+  if( (*str != NULL) && !strncmp( *str, p, len) && ((*str)[len] == '\0') )
+    return 0;
+  free( *str);
+  // if returns NULL, that gets returned
+  *str = strndup( p, len);
+  return 0;
 
-  env = calloc( 1, sizeof( struct alive_env));
-  if( env == NULL)
-    return NULL;
+ Missing:
+  free( *str);
+  *str = NULL;
+  return 1;
+}
 
-  if( get_buffer_uint16( bs, &env->number_envvar) )
-    return NULL;
-  env->envvar_key = calloc( env->number_envvar, sizeof( char *));
-  env->envvar_value = calloc( env->number_envvar, sizeof( char *));
-  for( i = 0; i < env->number_envvar; i++)
+static void free_envvars( struct alive_env *env)
+{
+  int j;
+
+  for( j = 0; j < env->number_envvar; j++)
     {
-      env->envvar_key[i] = get_buffer_string( bs, 1);
-      env->envvar_value[i] = get_buffer_string( bs, 2);
+      free( env->envvar_key[j]);
+      free( env->envvar_value[j]);
     }
+  free( env->envvar_key);
+  free( env->envvar_value);
+  env->envvar_key = env->envvar_value = NULL;
+  env->number_envvar = 0;
+}
 
-  if( get_buffer_uint16( bs, &env->extra_type) )
+#define PARAM( os, member, name, label, type, optional) \
+  { name, label, type, optional, \
+    offsetof( struct alive_iocinfo_extra_##os, member) }
+
+// the names are those alivedb has always taken, not the member names
+static const struct alive_os_param vxworks_params[] =
+  { PARAM( vxworks, bootdev, "boot_device", "boot device", PARAM_STRING, 0),
+    PARAM( vxworks, unitnum, "unit_number", "unit number", PARAM_UINT32, 0),
+    PARAM( vxworks, procnum, "processor_number", "processor number",
+           PARAM_UINT32, 0),
+    PARAM( vxworks, boothost_name, "boot_host_name", "boot host name",
+           PARAM_STRING, 0),
+    PARAM( vxworks, bootfile, "boot_file", "boot file", PARAM_STRING, 0),
+    PARAM( vxworks, address, "address", "IP address", PARAM_STRING, 1),
+    PARAM( vxworks, backplane_address, "backplane_address", 
+           "backplane IP address", PARAM_STRING, 1),
+    PARAM( vxworks, boothost_address, "boot_host_address", 
+           "boot host IP address", PARAM_STRING, 1),
+    PARAM( vxworks, gateway_address, "gateway_address", "gateway IP address",
+           PARAM_STRING, 1),
+    PARAM( vxworks, flags, "flags", "flags", PARAM_UINT32, 0),
+    PARAM( vxworks, target_name, "target_name", "target name", 
+           PARAM_STRING, 1),
+    PARAM( vxworks, startup_script, "startup_script", "startup script",
+           PARAM_STRING, 1),
+    PARAM( vxworks, other, "other", "other", PARAM_STRING, 1) };
+
+static const struct alive_os_param linux_params[] =
+  { PARAM( linux, user, "user", "user", PARAM_STRING, 0),
+    PARAM( linux, group, "group", "group", PARAM_STRING, 0),
+    PARAM( linux, hostname, "hostname", "hostname", PARAM_STRING, 0) };
+
+static const struct alive_os_param darwin_params[] =
+  { PARAM( darwin, user, "user", "user", PARAM_STRING, 0),
+    PARAM( darwin, group, "group", "group", PARAM_STRING, 0),
+    PARAM( darwin, hostname, "hostname", "hostname", PARAM_STRING, 0) };
+
+static const struct alive_os_param windows_params[] =
+  { PARAM( windows, user, "user", "user", PARAM_STRING, 0),
+    PARAM( windows, machine, "machine", "machine", PARAM_STRING, 0) };
+
+#define NUMBER_PARAMS( p) ((int) (sizeof( p) / sizeof( p[0])))
+
+// indexed by enum alive_os_type
+static const struct alive_os_schema os_schemas[] =
+  { { NULL, NULL, 0, 0, NULL },
+    { "vxworks", "vxWorks Boot Parameters", 
+      sizeof( struct alive_iocinfo_extra_vxworks),
+      NUMBER_PARAMS( vxworks_params), vxworks_params },
+    { "linux", "Linux Parameters", sizeof( struct alive_iocinfo_extra_linux),
+      NUMBER_PARAMS( linux_params), linux_params },
+    { "darwin", "Darwin Parameters", 
+      sizeof( struct alive_iocinfo_extra_darwin),
+      NUMBER_PARAMS( darwin_params), darwin_params },
+    { "windows", "Windows Parameters", 
+      sizeof( struct alive_iocinfo_extra_windows),
+      NUMBER_PARAMS( windows_params), windows_params } };
+
+#define NUMBER_OS_SCHEMAS NUMBER_PARAMS( os_schemas)
+
+const struct alive_os_schema *alive_os_schema( int os_type)
+{
+  if( (os_type < 0) || (os_type >= NUMBER_OS_SCHEMAS) || 
+      (os_schemas[os_type].params == NULL) )
     return NULL;
-  switch( env->extra_type)
+  return &os_schemas[os_type];
+}
+
+int alive_find_os_param( char *os, char *name, 
+                         const struct alive_os_param **param)
+{
+  const struct alive_os_schema *schema;
+  int i, j;
+
+  for( i = 0; i < NUMBER_OS_SCHEMAS; i++)
     {
-    case VXWORKS:
-      {
-        struct alive_iocinfo_extra_vxworks *vw;
-
-        vw = env->extra = calloc( 1, sizeof(struct alive_iocinfo_extra_vxworks) );
-        if( vw == NULL)
-          goto Error1;
-          
-        vw->bootdev = get_buffer_string( bs, 1);
-        if( get_buffer_uint32( bs, &vw->unitnum) )
-          return NULL;
-        if( get_buffer_uint32( bs, &vw->procnum) )
-          return NULL;
-        vw->boothost_name = get_buffer_string( bs, 1);
-        vw->bootfile = get_buffer_string( bs, 1);
-        vw->address = get_buffer_string( bs, 1);
-        vw->backplane_address = get_buffer_string( bs, 1);
-        vw->boothost_address = get_buffer_string( bs, 1);
-        vw->gateway_address = get_buffer_string( bs, 1);
-        if( get_buffer_uint32( bs, &vw->flags) )
-          return NULL;
-        vw->target_name = get_buffer_string( bs, 1);
-        vw->startup_script = get_buffer_string( bs, 1);
-        vw->other = get_buffer_string( bs, 1);
-      }
-      break;
-    case LINUX:
-      {
-        struct alive_iocinfo_extra_linux *lnx;
-                
-        lnx = env->extra = calloc( 1, sizeof(struct alive_iocinfo_extra_linux) );
-        if( lnx == NULL)
-          goto Error1;
-          
-        lnx->user = get_buffer_string( bs, 1);
-        lnx->group = get_buffer_string( bs, 1);
-        lnx->hostname = get_buffer_string( bs, 1);
-      }
-      break;
-    case DARWIN:
-      {
-        struct alive_iocinfo_extra_darwin *dar;
-
-        dar = env->extra = calloc( 1, sizeof(struct alive_iocinfo_extra_darwin) );
-        if( dar == NULL)
-          goto Error1;
-          
-        dar->user = get_buffer_string( bs, 1);
-        dar->group = get_buffer_string( bs, 1);
-        dar->hostname = get_buffer_string( bs, 1);
-      }
-      break;
-    case WINDOWS:
-      {
-        struct alive_iocinfo_extra_windows *win;
-                
-        win = env->extra = calloc( 1, sizeof(struct alive_iocinfo_extra_windows) );
-        if( win == NULL)
-          goto Error1;
-                
-        win->user = get_buffer_string( bs, 1);
-        win->machine = get_buffer_string( bs, 1);
-      }
+      schema = &os_schemas[i];
+      if( (schema->name == NULL) || strcasecmp( os, schema->name) )
+        continue;
+      for( j = 0; j < schema->number; j++)
+        if( !strcasecmp( name, schema->params[j].name) )
+          {
+            *param = &schema->params[j];
+            return i;
+          }
       break;
     }
+  return -1;
+}
 
-  return env;
+static void free_env_extra( struct alive_env *env)
+{
+  const struct alive_os_schema *schema;
+  int i;
 
- Error1:
-  free( env);
+  if( env->extra == NULL)
+    return;
 
-  return NULL;
+  schema = alive_os_schema( env->extra_type);
+  if( schema != NULL)
+    for( i = 0; i < schema->number; i++)
+      if( schema->params[i].type == PARAM_STRING)
+        free( *((char **) ((char *) env->extra + schema->params[i].offset)) );
+  free( env->extra);
+  env->extra = NULL;
 }
 
-
-struct alive_db *alive_get_iocs( char *server, int port, int number, 
-                                 char **names)
+void alive_free_env(  struct alive_env *env )
 {
-  struct alive_db *db;
-  struct alive_ioc *ioc;
-
-  struct buffer_struct *bs;
-  int sockfd;
+  if( env == NULL)
+    return;
 
-  uint16_t version;
+  free_envvars( env);
+  free_env_extra( env);
+  free( env);
+}
 
-  uint32_t o32;
-  uint16_t o16;
-  uint8_t o8;
+// Decodes an environment into *envp, which can start out NULL, keeping
+// whatever of the old one is unchanged.  On error *envp is freed.
+static int refresh_environment( struct buffer_struct *bs, 
+                                struct alive_env **envp)
+{
+  struct alive_env *env;
+  const struct alive_os_schema *schema;
+  char *field;
 
   int i;
 
-  if( get_server_addr( server, port, &sockfd) )
-    return NULL;
+  struct alive_wire_env_flag flag;
+  struct alive_wire_env_count count;
+  struct alive_wire_env_extra extra;
+  const char *p;
 
+  uint16_t number;
 
- 
-  // only works for INCOMING stream
-  bs = init_buffer_stream( sockfd, 1024);
-  if( bs == NULL)
+  p = get_buffer_block( bs, ALIVE_WIRE_SIZE( env_flag));
+  if( p != NULL)
+    alive_wire_get_env_flag( p, &flag);
+  if( (p == NULL) || (flag.present == 0) )
     {
-      printf("Can't create socket buffer!\n");
-      return NULL;
+      alive_free_env( *envp);
+      *envp = NULL;
+      return 0;
     }
 
-  db = malloc( sizeof( struct alive_db) );
-
-  if( !number) // all of them
+  env = *envp;
+  if( env == NULL)
     {
-      o16 = htons(1);
-      write( sockfd, &o16, sizeof(o16));
+      env = *envp = calloc( 1, sizeof( struct alive_env));
+      if( env == NULL)
+        return 1;
     }
-  else if( number != 1) // some of them
-    {
-      o16 = htons(2);
-      write( sockfd, &o16, sizeof(o16));
-
-      o16 = htons( number);
-      write( sockfd, &o16, sizeof(o16));
 
-      for( i = 0; i < number; i ++)
-        {
-          o8 = strlen( names[i]);
-          write( sockfd, &o8, sizeof(o8));
-          write( sockfd, names[i], o8);
-        }
+  if( (p = get_buffer_block( bs, ALIVE_WIRE_SIZE( env_count))) == NULL)
+    goto Error;
+  alive_wire_get_env_count( p, &count);
+  number = count.number;
+  if( (number != env->number_envvar) || (env->envvar_key == NULL) )
+    {
+      free_envvars( env);
+      env->envvar_key = calloc( number, sizeof( char *));
+      env->envvar_value = calloc( number, sizeof( char *));
+      if( number && 
+          ((env->envvar_key == NULL) || (env->envvar_value == NULL)) )
+        goto Error;
+      env->number_envvar = number;
     }
-  else // one of them
+  for( i = 0; i < env->number_envvar; i++)
     {
-      o16 = htons(3);
-      write( sockfd, &o16, sizeof(o16));
-
-      o8 = strlen( *names);
-      write( sockfd, &o8, sizeof(o8));
-      write( sockfd, *names, o8);
+      refresh_string( bs, 1, &env->envvar_key[i]);
+      refresh_string( bs, 2, &env->envvar_value[i]);
     }
 
-  shutdown( sockfd, SHUT_WR);
-
- 
-  if( load_buffer_test(bs, 12) )
+  if( (p = get_buffer_block( bs, ALIVE_WIRE_SIZE( env_extra))) == NULL)
     goto Error;
-  get_buffer_uint16( bs, &version);
-  if( version != CLIENT_PROTOCOL_VERSION)
+  alive_wire_get_env_extra( p, &extra);
+  number = extra.extra_type;
+  schema = alive_os_schema( number);
+  if( (number != env->extra_type) || (env->extra == NULL) )
     {
-      printf("Unable to handle this protocol version.\n");
-      goto Error;
+      free_env_extra( env);
+      env->extra_type = number;
+      if( schema == NULL)
+        return 0;
+      env->extra = calloc( 1, schema->size);
+      if( env->extra == NULL)
+        goto Error;
     }
-  get_buffer_uint32( bs, &o32);
-  db->current_time = o32;
-  get_buffer_uint32( bs, &o32);
-  db->start_time = o32;
-  get_buffer_uint16( bs, &db->number_ioc);
+  if( schema == NULL)
+    return 0;
 
-  db->ioc = calloc( db->number_ioc, sizeof( struct alive_ioc) );
-  for( i = 0; i < db->number_ioc; i++)
+  for( i = 0; i < schema->number; i++)
     {
-      ioc = &(db->ioc[i]);
-
-      if((ioc->ioc_name = get_buffer_string( bs, 1)) == NULL)
-        {
-          printf("Missing data.\n");
-          goto Error;
-        }
-
-      if( load_buffer_test(bs, 13) )
+      field = (char *) env->extra + schema->params[i].offset;
+      if( schema->params[i].type == PARAM_UINT32)
         {
-          printf("Missing data.\n");
-          goto Error;
+          if( get_buffer_uint32( bs, (uint32_t *) field) )
+            goto Error;
         }
-      get_buffer_uint8( bs, &ioc->status);
-      get_buffer_uint32( bs, &o32);
-      ioc->time_value = o32;
-      get_buffer_uint32( bs, &ioc->raw_ip_address);
-      get_buffer_uint32( bs, &ioc->user_msg);
-
-      ioc->environment = get_environment( bs);
+      else
+        refresh_string( bs, 1, (char **) field);
     }
 
-  shutdown( sockfd, SHUT_RD);
-  close(sockfd);
+  return 0;
 
-  free_buffer( bs);
+ Error:
+  alive_free_env( env);
+  *envp = NULL;
 
-  return db;
+  return 1;
+}
 
- Error:
+static struct alive_env *get_environment( struct buffer_struct *bs)
+{
+  struct alive_env *env = NULL;
 
-  shutdown( sockfd, SHUT_RD);
-  close(sockfd);
+  refresh_environment( bs, &env);
 
-  return NULL;
+  return env;
 }
 
-struct alive_db *alive_get_db( char *server, int port)
+
+// Builds a request; number and names are only used for some opcodes.
+static char *build_request( int opcode, int number, char **names, 
+                            int *length)
 {
-  return alive_get_iocs( server, port, 0, NULL);
+  char *request, *p;
+  uint16_t o16;
+  int len;
+  int i;
+
+  len = 2;
+  if( opcode == REQUEST_SOME_IOCS)
+    len += 2;
+  else if( opcode != REQUEST_ALL_IOCS)
+    number = 1;
+  else
+    number = 0;
+  for( i = 0; i < number; i++)
+    len += 1 + strnlen( names[i], 255);
+
+  request = malloc( len);
+  if( request == NULL)
+    return NULL;
+
+  p = request;
+  o16 = htons( opcode);
+  memcpy( p, &o16, sizeof(o16));
+  p += sizeof(o16);
+  if( opcode == REQUEST_SOME_IOCS)
+    {
+      o16 = htons( number);
+      memcpy( p, &o16, sizeof(o16));
+      p += sizeof(o16);
+    }
+  for( i = 0; i < number; i++)
+    {
+      *p = strnlen( names[i], 255);
+      memcpy( p + 1, names[i], (uint8_t) *p);
+      p += 1 + (uint8_t) *p;
+    }
+
+  *length = len;
+  return request;
 }
 
-struct alive_db *alive_get_ioc( char *server, int port, char *name)
+static int write_request( int sockfd, int opcode, int number, char **names)
 {
-  return alive_get_iocs( server, port, 1, &name);
+  char *request;
+  int length;
+  int ret;
+
+  request = build_request( opcode, number, names, &length);
+  if( request == NULL)
+    return 1;
+  TRACE_BEGIN( Trace_Write, 0, 0, NULL);
+  ret = (write( sockfd, request, length) != length);
+  TRACE_END( Trace_Write, 0, length);
+  free( request);
+  shutdown( sockfd, SHUT_WR);
+
+  return ret;
 }
 
-void alive_free_env(  struct alive_env *env )
+// The response to a request, to be decoded from the buffer returned.
+// With the shared response cache on, it comes from there, with *response
+// set and *sockfd of -1; otherwise it is read from a new connection as
+// it is decoded.
+static struct buffer_struct *start_response( char *server, int port,
+                                             int opcode, int number,
+                                             char **names, int *sockfd,
+                                             struct alive_response **response)
 {
-  int j;
-
-  if( env == NULL)
-    return;
+  struct buffer_struct *bs;
+  char *request, *data;
+  int length;
 
-  for( j = 0; j < env->number_envvar; j++)
+  *sockfd = -1;
+  *response = NULL;
+  if( alive_response_cache_ttl() )
     {
-      free( env->envvar_key[j]);
-      free( env->envvar_value[j]);
+      request = build_request( opcode, number, names, &length);
+      if( request == NULL)
+        return NULL;
+      *response = alive_response_fetch( server, port, request, length);
+      free( request);
+      if( *response == NULL)
+        return NULL;
+      // the shared bytes are only read
+      data = alive_response_data( *response, &length);
+      bs = init_buffer_data( data, length, 0);
+      if( bs == NULL)
+        {
+          alive_response_release( *response);
+          *response = NULL;
+        }
+      return bs;
     }
-  free( env->envvar_key);
-  free( env->envvar_value);
-  
-  switch(env->extra_type)
-    {
-    case VXWORKS:
-      {
-        struct alive_iocinfo_extra_vxworks *vw;
-
-        vw = env->extra;
-        free(vw->bootdev);
-        free(vw->boothost_name);
-        free(vw->bootfile);
-        free(vw->address);
-        free(vw->backplane_address);
-        free(vw->boothost_address);
-        free(vw->gateway_address);
-        free(vw->target_name);
-        free(vw->startup_script);
-        free(vw->other);
-        free(vw);
-      }
-      break;
-    case LINUX:
-      {
-        struct alive_iocinfo_extra_linux *lnx;
 
-        lnx = env->extra;
-        free(lnx->user);
-        free(lnx->group);
-        free(lnx->hostname);
-        free(lnx);
-      }
-      break;
-    case DARWIN:
-      {
-        struct alive_iocinfo_extra_darwin *dar;
+  if( get_server_addr( server, port, sockfd) )
+    return NULL;
 
-        dar = env->extra;
-        free(dar->user);
-        free(dar->group);
-        free(dar->hostname);
-        free(dar);
-      }
-      break;
-    case WINDOWS:
-      {
-        struct alive_iocinfo_extra_windows *win;
-                
-        win = env->extra;
-        free(win->user);
-        free(win->machine);
-        free(win);
-      }
-      break;
+  // only works for INCOMING stream
+  bs = init_buffer_stream( *sockfd, 1024);
+  if( bs == NULL)
+    {
+      printf("Can't create socket buffer!\n");
+      close( *sockfd);
+      return NULL;
     }
-  free( env);
-}
 
-void alive_free_ioc( struct alive_ioc *ioc)
-{
-  free( ioc->ioc_name);
-  alive_free_env( ioc->environment);
+  write_request( *sockfd, opcode, number, names);
+  return bs;
 }
 
-void alive_free_db( struct alive_db *iocs)
+// returns the bytes received, for tracing
+static int finish_response( struct buffer_struct *bs, int sockfd,
+                            struct alive_response *response)
 {
-  int i;
-  
-  for( i = 0; i < iocs->number_ioc; i++)
+  int received;
+
+  if( sockfd != -1)
     {
-      /* free( iocs->ioc[i].ioc_name); */
-      /* free_alive_env( iocs->ioc[i].environment); */
-      alive_free_ioc( &(iocs->ioc[i]) );
+      shutdown( sockfd, SHUT_RD);
+      close(sockfd);
     }
-  free(iocs->ioc);
-  free(iocs);
+  received = (response != NULL) ? bs->amount : bs->received;
+  free_buffer( bs);
+  if( response != NULL)
+    alive_response_release( response);
+
+  return received;
 }
 
+// decodes one IOC record of a database response, returning 1 if short
+static int decode_ioc( struct buffer_struct *bs, struct alive_ioc *ioc)
+{
+  struct alive_wire_ioc w;
+  const char *p;
 
+  if((ioc->ioc_name = get_buffer_string( bs, 1)) == NULL)
+    return 1;
 
-/* // TEMPORARY FUNCTION! */
-/* // Will disappear when events added to API */
-/* static struct alive_env *unpack_alive_env( char *data, int length) */
-/* { */
-/*   struct buffer_struct *bs; */
-/*   struct alive_env *env; */
+  if( (p = get_buffer_block( bs, ALIVE_WIRE_SIZE( ioc))) == NULL)
+    return 1;
+  alive_wire_get_ioc( p, &w);
+  ioc->status = w.status;
+  ioc->time_value = w.time;
+  ioc->raw_ip_address = w.ip;
+  ioc->user_msg = w.user_msg;
+
+  ioc->environment = get_environment( bs);
+
+  return 0;
+}
+
+// decodes a database response (opcodes 1, 2, and 3)
+static struct alive_db *decode_db( struct buffer_struct *bs)
+{
+  struct alive_db *db;
+
+  struct alive_wire_db_header header;
+  const char *p;
+
+  int i;
+
+  if( (p = get_buffer_block( bs, ALIVE_WIRE_SIZE( db_header))) == NULL)
+    return NULL;
+  alive_wire_get_db_header( p, &header);
+  if( header.version != CLIENT_PROTOCOL_VERSION)
+    {
+      printf("Unable to handle this protocol version.\n");
+      return NULL;
+    }
+
+  db = malloc( sizeof( struct alive_db) );
+  if( db == NULL)
+    return NULL;
+  db->current_time = header.current_time;
+  db->start_time = header.start_time;
+  db->number_ioc = header.number;
+
+  db->ioc = calloc( db->number_ioc, sizeof( struct alive_ioc) );
+  for( i = 0; i < db->number_ioc; i++)
+    if( decode_ioc( bs, &(db->ioc[i])) )
+      {
+        printf("Missing data.\n");
+        goto Error;
+      }
+
+  return db;
+
+ Error:
+  // only the IOCs decoded so far are filled in
+  db->number_ioc = i + 1;
+  alive_free_db( db);
+
+  return NULL;
+}
+
+struct alive_db *alive_get_iocs( char *server, int port, int number, 
+                                 char **names)
+{
+  struct alive_db *db;
+
+  struct buffer_struct *bs;
+  struct alive_response *response;
+  int sockfd;
+  int received;
+  int opcode;
+
+  if( !number) // all of them
+    opcode = REQUEST_ALL_IOCS;
+  else if( number != 1) // some of them
+    opcode = REQUEST_SOME_IOCS;
+  else // one of them
+    opcode = REQUEST_ONE_IOC;
+
+  TRACE_BEGIN( Trace_GetIocs, 0, opcode, number ? names[0] : NULL);
+  bs = start_response( server, port, opcode, number, names, &sockfd, 
+                       &response);
+  if( bs == NULL)
+    {
+      TRACE_END( Trace_GetIocs, 0, -1);
+      return NULL;
+    }
+
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  db = decode_db( bs);
+  TRACE_END( Trace_Decode, 0, -1);
+
+  received = finish_response( bs, sockfd, response);
+  TRACE_END( Trace_GetIocs, 0, received);
+
+  return db;
+}
+
+struct alive_db *alive_decode_db( char *data, int length)
+{
+  struct buffer_struct *bs;
+  struct alive_db *db;
+
+  bs = init_buffer_data( data, length, 0);
+  if( bs == NULL)
+    return NULL;
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  db = decode_db( bs);
+  TRACE_END( Trace_Decode, 0, length);
+  free_buffer( bs);
+
+  return db;
+}
+
+///////////////////////////////////////////////////////////////////
+
+char *alive_request_raw( char *server, int port, char *request, 
+                         int request_length, int *response_length)
+{
+  struct buffer_struct *bs;
+  int sockfd;
+  char *data;
+  int size;
+  uint16_t opcode;
+
+  opcode = 0;
+  if( request_length >= sizeof(opcode))
+    {
+      memcpy( &opcode, request, sizeof(opcode));
+      opcode = ntohs( opcode);
+    }
+  TRACE_BEGIN( Trace_RequestRaw, 0, opcode, NULL);
+  if( get_server_addr( server, port, &sockfd) )
+    {
+      TRACE_END( Trace_RequestRaw, 0, -1);
+      return NULL;
+    }
+
+  bs = init_buffer_stream( sockfd, 4096);
+  if( bs == NULL)
+    {
+      printf("Can't create socket buffer!\n");
+      close(sockfd);
+      TRACE_END( Trace_RequestRaw, 0, -1);
+      return NULL;
+    }
+
+  TRACE_BEGIN( Trace_Write, 0, 0, NULL);
+  write( sockfd, request, request_length);
+  TRACE_END( Trace_Write, 0, request_length);
+  shutdown( sockfd, SHUT_WR);
+
+  // keep asking for more than is there until the server closes
+  size = bs->buffer_size;
+  while( load_buffer( bs, size) >= size)
+    size = 2 * bs->buffer_size;
+
+  shutdown( sockfd, SHUT_RD);
+  close(sockfd);
+
+  // hand over the buffer itself rather than copy it
+  data = bs->buffer;
+  *response_length = bs->amount;
+  bs->type = Buffer_External;
+  free_buffer( bs);
+  TRACE_END( Trace_RequestRaw, 0, *response_length);
+
+  return data;
+}
+
+
+// Non-blocking requests, driven by the caller's own event loop.
+
+enum RequestState { Request_Connecting, Request_Sending, Request_Receiving,
+                    Request_Done, Request_Failed };
+
+struct alive_request
+{
+  int fd;
+  int state;
+
+  char *request;
+  int request_length;
+  int sent;
+
+  char *response;
+  int length;
+  int size;
+
+  uint64_t trace_id;  // zero when not traced
+};
+
+// the request's own span ends once, however the request ends
+static void trace_request_end( struct alive_request *req, int bytes)
+{
+  if( req->trace_id)
+    {
+      TRACE_END( Trace_Request, req->trace_id, bytes);
+      req->trace_id = 0;
+    }
+}
+
+struct alive_request *alive_request_start( char *server, int port, 
+                                           int type, int number, 
+                                           char **names)
+{
+  struct alive_request *req;
+  struct sockaddr_storage addr;
+  socklen_t addr_length;
+  int family;
+  uint64_t trace_id;
+
+  trace_id = 0;
+  if( alive_tracing)
+    {
+      trace_id = alive_trace_new_id();
+      TRACE_BEGIN( Trace_Request, trace_id, type, 
+                   (number && (names != NULL)) ? names[0] : NULL);
+    }
+
+  memset( &addr, 0, sizeof(addr));
+  if( server[0] == '/')
+    {
+      struct sockaddr_un *u_addr = (struct sockaddr_un *) &addr;
+
+      if( strlen( server) >= sizeof(u_addr->sun_path) )
+        {
+          if( trace_id)
+            TRACE_END( Trace_Request, trace_id, -1);
+          return NULL;
+        }
+      u_addr->sun_family = family = AF_UNIX;
+      strcpy( u_addr->sun_path, server);
+      addr_length = sizeof(struct sockaddr_un);
+    }
+  else
+    {
+      struct sockaddr_in *r_addr = (struct sockaddr_in *) &addr;
+
+      r_addr->sin_family = family = AF_INET;
+      r_addr->sin_port = htons(port);
+      // numeric addresses avoid a blocking name lookup
+      if( inet_pton( AF_INET, server, &r_addr->sin_addr) != 1)
+        {
+          struct addrinfo hints;
+          struct addrinfo *servinfo;
+          int status;
+
+          memset(&hints, 0, sizeof hints);
+          hints.ai_family = AF_INET;      
+          hints.ai_socktype = SOCK_STREAM;
+          TRACE_BEGIN( Trace_Getaddrinfo, 0, 0, NULL);
+          status = getaddrinfo(server, NULL, &hints, &servinfo);
+          TRACE_END( Trace_Getaddrinfo, 0, -1);
+          if( status != 0 )
+            {
+              printf( "getaddrinfo error: %s\n", gai_strerror(status));
+              if( trace_id)
+                TRACE_END( Trace_Request, trace_id, -1);
+              return NULL;
+            }
+          r_addr->sin_addr = ((struct sockaddr_in *) servinfo->ai_addr)->sin_addr;
+          freeaddrinfo(servinfo);
+        }
+      addr_length = sizeof(struct sockaddr_in);
+    }
+
+  req = calloc( 1, sizeof( struct alive_request));
+  if( req == NULL)
+    {
+      if( trace_id)
+        TRACE_END( Trace_Request, trace_id, -1);
+      return NULL;
+    }
+  req->trace_id = trace_id;
+  req->request = build_request( type, number, names, &req->request_length);
+  req->size = 4096;
+  req->response = malloc( req->size);
+  req->fd = socket( family, SOCK_STREAM, 0);
+  if( (req->request == NULL) || (req->response == NULL) || (req->fd == -1) )
+    {
+      alive_request_free( req);
+      return NULL;
+    }
+  fcntl( req->fd, F_SETFL, fcntl( req->fd, F_GETFL) | O_NONBLOCK);
+
+  req->state = Request_Sending;
+  if( req->trace_id)
+    TRACE_BEGIN( Trace_Connect, req->trace_id, 0, NULL);
+  if( connect( req->fd, (struct sockaddr *) &addr, addr_length) == -1)
+    {
+      if( errno != EINPROGRESS)
+        {
+          if( req->trace_id)
+            TRACE_END( Trace_Connect, req->trace_id, -1);
+          alive_request_free( req);
+          return NULL;
+        }
+      req->state = Request_Connecting;
+    }
+  else if( req->trace_id)
+    {
+      TRACE_END( Trace_Connect, req->trace_id, -1);
+      TRACE_BEGIN( Trace_Write, req->trace_id, 0, NULL);
+    }
+
+  return req;
+}
+
+int alive_request_fd( struct alive_request *req)
+{
+  return req->fd;
+}
+
+int alive_request_poll_events( struct alive_request *req)
+{
+  if( (req->state == Request_Connecting) || (req->state == Request_Sending) )
+    return POLLOUT;
+  if( req->state == Request_Receiving)
+    return POLLIN;
+  return 0;
+}
+
+int alive_request_process( struct alive_request *req)
+{
+  int n;
+  int err;
+  socklen_t len;
+  char *p;
+  int start_length;
+
+  if( req->state == Request_Connecting)
+    {
+      len = sizeof(err);
+      if( getsockopt( req->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err)
+        {
+          req->state = Request_Failed;
+          if( req->trace_id)
+            TRACE_END( Trace_Connect, req->trace_id, -1);
+          trace_request_end( req, -1);
+          return -1;
+        }
+      req->state = Request_Sending;
+      if( req->trace_id && !req->sent)
+        {
+          TRACE_END( Trace_Connect, req->trace_id, -1);
+          TRACE_BEGIN( Trace_Write, req->trace_id, 0, NULL);
+        }
+    }
+
+  if( req->state == Request_Sending)
+    {
+      while( req->sent < req->request_length)
+        {
+          n = write( req->fd, req->request + req->sent, 
+                     req->request_length - req->sent);
+          if( n < 0)
+            {
+              if( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+                return 0;
+              if( errno == EINTR)
+                continue;
+              // still connecting, when called before the socket was ready
+              if( errno == ENOTCONN)
+                {
+                  req->state = Request_Connecting;
+                  if( req->trace_id)
+                    {
+                      TRACE_END( Trace_Write, req->trace_id, 0);
+                      TRACE_BEGIN( Trace_Connect, req->trace_id, 0, NULL);
+                    }
+                  return 0;
+                }
+              req->state = Request_Failed;
+              trace_request_end( req, -1);
+              return -1;
+            }
+          req->sent += n;
+        }
+      shutdown( req->fd, SHUT_WR);
+      req->state = Request_Receiving;
+      if( req->trace_id)
+        TRACE_END( Trace_Write, req->trace_id, req->sent);
+    }
+
+  if( req->state == Request_Receiving)
+    {
+      TRACE_BEGIN( Trace_Read, 0, 0, NULL);
+      start_length = req->length;
+      while( 1)
+        {
+          if( req->length == req->size)
+            {
+              p = realloc( req->response, 2 * req->size);
+              if( p == NULL)
+                {
+                  req->state = Request_Failed;
+                  break;
+                }
+              req->response = p;
+              req->size *= 2;
+            }
+          n = read( req->fd, req->response + req->length, 
+                    req->size - req->length);
+          if( n < 0)
+            {
+              if( (errno == EAGAIN) || (errno == EWOULDBLOCK) )
+                break;
+              if( errno == EINTR)
+                continue;
+              req->state = Request_Failed;
+              break;
+            }
+          if( n == 0)
+            {
+              close( req->fd);
+              req->fd = -1;
+              req->state = Request_Done;
+              break;
+            }
+          if( !req->length && req->trace_id)
+            TRACE_INSTANT( Trace_FirstByte, req->trace_id);
+          req->length += n;
+        }
+      TRACE_END( Trace_Read, 0, req->length - start_length);
+      if( req->state == Request_Receiving)
+        return 0;
+    }
+
+  if( req->state == Request_Done)
+    {
+      trace_request_end( req, req->length);
+      return 1;
+    }
+  trace_request_end( req, -1);
+  return -1;
+}
+
+char *alive_request_response( struct alive_request *req, int *length)
+{
+  if( req->state != Request_Done)
+    return NULL;
+  *length = req->length;
+  return req->response;
+}
+
+void alive_request_free( struct alive_request *req)
+{
+  if( req == NULL)
+    return;
+  // given up on before it finished
+  trace_request_end( req, -1);
+  if( req->fd != -1)
+    close( req->fd);
+  free( req->request);
+  free( req->response);
+  free( req);
+}
+
+
+// These skip over wire structures without decoding them, returning the
+// new position, or NULL if the data runs past the end.
+
+static char *skip_string( char *p, char *end, int bytes)
+{
+  int len;
+
+  if( end - p < bytes)
+    return NULL;
+  if( bytes == 1)
+    len = *((uint8_t *) p);
+  else
+    len = ntohs( *((uint16_t *) p));
+  p += bytes;
+  if( end - p < len)
+    return NULL;
+  return p + len;
+}
+
+static char *skip_environment( char *p, char *end)
+{
+  const struct alive_os_schema *schema;
+  struct alive_wire_env_flag flag;
+  struct alive_wire_env_count count;
+  struct alive_wire_env_extra extra;
+  int i;
+
+  if( end - p < ALIVE_WIRE_SIZE( env_flag))
+    return NULL;
+  alive_wire_get_env_flag( p, &flag);
+  p += ALIVE_WIRE_SIZE( env_flag);
+  if( flag.present == 0)
+    return p;
+
+  if( end - p < ALIVE_WIRE_SIZE( env_count))
+    return NULL;
+  alive_wire_get_env_count( p, &count);
+  p += ALIVE_WIRE_SIZE( env_count);
+  for( i = 0; (i < count.number) && (p != NULL); i++)
+    {
+      p = skip_string( p, end, 1);
+      if( p != NULL)
+        p = skip_string( p, end, 2);
+    }
+  if( (p == NULL) || (end - p < ALIVE_WIRE_SIZE( env_extra)) )
+    return NULL;
+  alive_wire_get_env_extra( p, &extra);
+  p += ALIVE_WIRE_SIZE( env_extra);
+
+  schema = alive_os_schema( extra.extra_type);
+  if( schema != NULL)
+    for( i = 0; (i < schema->number) && (p != NULL); i++)
+      {
+        if( schema->params[i].type == PARAM_STRING)
+          p = skip_string( p, end, 1);
+        else if( end - p < (int) sizeof(uint32_t))
+          return NULL;
+        else
+          p += sizeof(uint32_t);
+      }
+
+  return p;
+}
+
+// Fills in *records, growing it past *size entries as needed.
+static int find_db_records( char *data, int length, 
+                            struct alive_raw_record **records, int *size)
+{
+  struct alive_raw_record *r;
+  struct alive_wire_db_header header;
+  char *p, *end;
+  uint16_t number;
+  int i;
+
+  if( length < ALIVE_WIRE_SIZE( db_header))
+    return -1;
+  alive_wire_get_db_header( data, &header);
+  if( header.version != CLIENT_PROTOCOL_VERSION)
+    return -1;
+  number = header.number;
+
+  if( (*records == NULL) || (number > *size) )
+    {
+      r = realloc( *records, (number ? number : 1) * 
+                   sizeof( struct alive_raw_record));
+      if( r == NULL)
+        return -1;
+      *records = r;
+      *size = number ? number : 1;
+    }
+  r = *records;
+
+  p = data + ALIVE_WIRE_SIZE( db_header);
+  end = data + length;
+  for( i = 0; i < number; i++)
+    {
+      r[i].offset = p - data;
+      if( end - p < 1)
+        break;
+      r[i].name_length = *((uint8_t *) p);
+      r[i].name = p + 1;
+      p = skip_string( p, end, 1);
+      if( (p == NULL) || (end - p < ALIVE_WIRE_SIZE( ioc)) )
+        break;
+      p = skip_environment( p + ALIVE_WIRE_SIZE( ioc), end);
+      if( p == NULL)
+        break;
+      r[i].length = (p - data) - r[i].offset;
+    }
+  if( i < number)
+    return -1;
+
+  return number;
+}
+
+int alive_raw_db_records( char *data, int length, 
+                          struct alive_raw_record **records)
+{
+  int size = 0;
+  int number;
+
+  *records = NULL;
+  number = find_db_records( data, length, records, &size);
+  if( number < 0)
+    {
+      free( *records);
+      *records = NULL;
+    }
+
+  return number;
+}
+
+
+// Decoding a whole response in two passes.  The first finds where each
+// IOC record starts, using only the length prefixes; the records are
+// then independent, so threads decode them at once, each taking chunks
+// of them until none are left.  Every IOC goes in its own slot of the
+// array made for the count, so the result is what decode_db() gives.
+
+// below this many IOCs, starting threads costs more than it saves
+#define PARALLEL_DECODE_MIN (256)
+// IOCs taken by a thread at a time
+#define PARALLEL_DECODE_CHUNK (32)
+
+struct parallel_decode
+{
+  char *data;
+  struct alive_raw_record *records;
+  struct alive_ioc *ioc;
+  int number;
+  int next;    // the first IOC of the next chunk, taken atomically
+  int failed;
+};
+
+static void decode_records( struct parallel_decode *pd)
+{
+  struct buffer_struct bs;
+  struct alive_raw_record *rec;
+  int first, last;
+  int i;
+
+  memset( &bs, 0, sizeof(bs));
+  bs.type = Buffer_External;
+  while( (first = __atomic_fetch_add( &pd->next, PARALLEL_DECODE_CHUNK,
+                                      __ATOMIC_RELAXED)) < pd->number)
+    {
+      last = first + PARALLEL_DECODE_CHUNK;
+      if( last > pd->number)
+        last = pd->number;
+      for( i = first; i < last; i++)
+        {
+          rec = &(pd->records[i]);
+          bs.buffer = pd->data + rec->offset;
+          bs.buffer_size = bs.amount = rec->length;
+          bs.offset = 0;
+          if( decode_ioc( &bs, &(pd->ioc[i])) )
+            __atomic_store_n( &pd->failed, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void *decode_thread( void *arg)
+{
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  decode_records( arg);
+  TRACE_END( Trace_Decode, 0, -1);
+  return NULL;
+}
+
+struct alive_db *alive_decode_db_parallel( char *data, int length,
+                                           int threads)
+{
+  struct parallel_decode pd;
+  struct alive_raw_record *records;
+  struct alive_db *db;
+  pthread_t *tids;
+  struct alive_wire_db_header header;
+  int size;
+  int number;
+  int started;
+  int i;
+
+  if( length >= ALIVE_WIRE_SIZE( db_header))
+    alive_wire_get_db_header( data, &header);
+  else
+    header.version = 0;
+  // the sequential decoder also reports what is wrong with a response
+  if( (threads < 2) || (header.version != CLIENT_PROTOCOL_VERSION) ||
+      (header.number < PARALLEL_DECODE_MIN) )
+    return alive_decode_db( data, length);
+
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  records = NULL;
+  size = 0;
+  number = find_db_records( data, length, &records, &size);
+  if( number < 0)
+    {
+      // a short response is left for it to make what it can of
+      free( records);
+      TRACE_END( Trace_Decode, 0, -1);
+      return alive_decode_db( data, length);
+    }
+
+  db = malloc( sizeof( struct alive_db) );
+  if( db == NULL)
+    {
+      free( records);
+      TRACE_END( Trace_Decode, 0, -1);
+      return NULL;
+    }
+  db->current_time = header.current_time;
+  db->start_time = header.start_time;
+  db->number_ioc = number;
+  db->ioc = calloc( number, sizeof( struct alive_ioc) );
+  if( db->ioc == NULL)
+    {
+      free( db);
+      free( records);
+      TRACE_END( Trace_Decode, 0, -1);
+      return NULL;
+    }
+
+  pd.data = data;
+  pd.records = records;
+  pd.ioc = db->ioc;
+  pd.number = number;
+  pd.next = 0;
+  pd.failed = 0;
+
+  // no more threads than chunks, counting this one
+  if( threads > (number + PARALLEL_DECODE_CHUNK - 1) / PARALLEL_DECODE_CHUNK)
+    threads = (number + PARALLEL_DECODE_CHUNK - 1) / PARALLEL_DECODE_CHUNK;
+  tids = malloc( threads * sizeof( pthread_t));
+  started = 0;
+  if( tids != NULL)
+    // if threads can't be had, fewer do the work
+    while( (started < threads - 1) &&
+           !pthread_create( &tids[started], NULL, decode_thread, &pd) )
+      started++;
+  decode_records( &pd);
+  for( i = 0; i < started; i++)
+    pthread_join( tids[i], NULL);
+  free( tids);
+  free( records);
+
+  if( pd.failed)
+    {
+      printf("Missing data.\n");
+      alive_free_db( db);
+      db = NULL;
+    }
+  TRACE_END( Trace_Decode, 0, length);
+
+  return db;
+}
+
+struct alive_db *alive_get_iocs_parallel( char *server, int port, int number,
+                                          char **names, int threads)
+{
+  struct alive_response *response;
+  struct alive_db *db;
+  char *request, *data;
+  int request_length, length;
+  int opcode;
+
+  if( !number) // all of them
+    opcode = REQUEST_ALL_IOCS;
+  else if( number != 1) // some of them
+    opcode = REQUEST_SOME_IOCS;
+  else // one of them
+    opcode = REQUEST_ONE_IOC;
+
+  TRACE_BEGIN( Trace_GetIocs, 0, opcode, number ? names[0] : NULL);
+  request = build_request( opcode, number, names, &request_length);
+  if( request == NULL)
+    {
+      TRACE_END( Trace_GetIocs, 0, -1);
+      return NULL;
+    }
+
+  // all of the response is needed before the records can be found
+  response = NULL;
+  if( alive_response_cache_ttl() )
+    {
+      response = alive_response_fetch( server, port, request,
+                                       request_length);
+      data = (response != NULL) ?
+        alive_response_data( response, &length) : NULL;
+    }
+  else
+    data = alive_request_raw( server, port, request, request_length,
+                              &length);
+  free( request);
+  if( data == NULL)
+    {
+      TRACE_END( Trace_GetIocs, 0, -1);
+      return NULL;
+    }
+
+  db = alive_decode_db_parallel( data, length, threads);
+  if( response != NULL)
+    alive_response_release( response);
+  else
+    free( data);
+  TRACE_END( Trace_GetIocs, 0, length);
+
+  return db;
+}
+
+
+///////////////////////////////////////////////////////////////////
+
+// The poller keeps the previous response, so an IOC whose record is byte
+// for byte the same is left alone, and one that differs is decoded over
+// its old self.  The IOC array is only rebuilt when IOCs come, go, or
+// move.
+
+struct alive_poller
+{
+  struct sockaddr_storage addr;
+  socklen_t addr_length;
+
+  struct alive_db db;
+  uint8_t *changed;
+  int *match;   // old index of each IOC, or -1 if new
+  int size;     // of changed and match
+
+  // the response being decoded, and the one before
+  char *response;
+  int response_size;
+  struct alive_raw_record *records;
+  int records_size;
+  char *previous;
+  int previous_size;
+  struct alive_raw_record *previous_records;
+  int previous_records_size;
+};
+
+struct alive_poller *alive_poller_create( char *server, int port)
+{
+  struct alive_poller *poller;
+
+  poller = calloc( 1, sizeof( struct alive_poller));
+  if( poller == NULL)
+    return NULL;
+
+  if( server[0] == '/')
+    {
+      struct sockaddr_un *u_addr = (struct sockaddr_un *) &poller->addr;
+
+      if( strlen( server) >= sizeof(u_addr->sun_path) )
+        {
+          printf( "Socket path too long!\n");
+          free( poller);
+          return NULL;
+        }
+      u_addr->sun_family = AF_UNIX;
+      strcpy( u_addr->sun_path, server);
+      poller->addr_length = sizeof(struct sockaddr_un);
+    }
+  else
+    {
+      struct sockaddr_in *r_addr = (struct sockaddr_in *) &poller->addr;
+      struct addrinfo hints;
+      struct addrinfo *servinfo;
+      int status;
+
+      memset(&hints, 0, sizeof hints);
+      hints.ai_family = AF_INET;      
+      hints.ai_socktype = SOCK_STREAM;
+      if( (status = getaddrinfo(server, NULL, &hints, &servinfo)) != 0 )
+        {
+          printf( "getaddrinfo error: %s\n", gai_strerror(status));
+          free( poller);
+          return NULL;
+        }
+      r_addr->sin_family = AF_INET;
+      r_addr->sin_port = htons(port);
+      r_addr->sin_addr = ((struct sockaddr_in *) servinfo->ai_addr)->sin_addr;
+      freeaddrinfo(servinfo);
+      poller->addr_length = sizeof(struct sockaddr_in);
+    }
+
+  return poller;
+}
+
+// reads the whole response into poller->response, returning its length
+static int poller_fetch( struct alive_poller *poller)
+{
+  uint16_t request;
+  char *p;
+  int sockfd;
+  int length;
+  int n;
+
+  sockfd = socket( poller->addr.ss_family, SOCK_STREAM, 0);
+  if( sockfd == -1)
+    {
+      printf( "Can't open socket!\n");
+      return -1;
+    }
+  TRACE_BEGIN( Trace_Connect, 0, 0, NULL);
+  n = connect( sockfd, (struct sockaddr *) &poller->addr, 
+               poller->addr_length);
+  TRACE_END( Trace_Connect, 0, -1);
+  if( n == -1)
+    {
+      printf( "Can't connect to server!\n");
+      close( sockfd);
+      return -1;
+    }
+
+  TRACE_BEGIN( Trace_Write, 0, 0, NULL);
+  request = htons( REQUEST_ALL_IOCS);
+  n = write( sockfd, &request, sizeof(request));
+  TRACE_END( Trace_Write, 0, sizeof(request));
+  shutdown( sockfd, SHUT_WR);
+  if( n != sizeof(request))
+    {
+      close( sockfd);
+      return -1;
+    }
+
+  TRACE_BEGIN( Trace_Read, 0, 0, NULL);
+  length = 0;
+  while( 1)
+    {
+      if( length == poller->response_size)
+        {
+          n = poller->response_size ? 2 * poller->response_size : 65536;
+          p = realloc( poller->response, n);
+          if( p == NULL)
+            {
+              length = -1;
+              break;
+            }
+          poller->response = p;
+          poller->response_size = n;
+        }
+      n = read( sockfd, poller->response + length, 
+                poller->response_size - length);
+      if( n < 0)
+        {
+          if( errno == EINTR)
+            continue;
+          length = -1;
+          break;
+        }
+      if( n == 0)
+        break;
+      if( !length)
+        TRACE_INSTANT( Trace_FirstByte, 0);
+      length += n;
+    }
+  TRACE_END( Trace_Read, 0, length);
+  close( sockfd);
+
+  return length;
+}
+
+static int poller_grow( struct alive_poller *poller, int number)
+{
+  uint8_t *c;
+  int *m;
+
+  if( number <= poller->size)
+    return 0;
+  c = realloc( poller->changed, number * sizeof( uint8_t));
+  if( c == NULL)
+    return 1;
+  poller->changed = c;
+  m = realloc( poller->match, number * sizeof( int));
+  if( m == NULL)
+    return 1;
+  poller->match = m;
+  poller->size = number;
+  return 0;
+}
+
+static uint32_t name_hash( char *name, int length)
+{
+  uint32_t h = 2166136261u;
+  int i;
+
+  for( i = 0; i < length; i++)
+    h = (h ^ (uint8_t) name[i]) * 16777619u;
+  return h;
+}
+
+// Moves the old IOCs to where the new response has them, freeing the ones
+// that are gone.  Returns the number removed, or -1 on error.
+static int poller_rearrange( struct alive_poller *poller, int number)
+{
+  struct alive_raw_record *rec, *old;
+  struct alive_ioc *ioc;
+  int *table;
+  uint8_t *used;
+  int old_number;
+  int table_size, mask;
+  int removed;
+  int i, j;
+  uint32_t h;
+
+  old_number = poller->db.number_ioc;
+  old = poller->previous_records;
+
+  table_size = 2;
+  while( table_size < 2 * old_number)
+    table_size <<= 1;
+  mask = table_size - 1;
+  table = malloc( table_size * sizeof( int));
+  used = calloc( old_number + 1, sizeof( uint8_t));
+  ioc = calloc( number ? number : 1, sizeof( struct alive_ioc));
+  if( (table == NULL) || (used == NULL) || (ioc == NULL) )
+    {
+      free( table);
+      free( used);
+      free( ioc);
+      return -1;
+    }
+
+  for( i = 0; i < table_size; i++)
+    table[i] = -1;
+  for( j = 0; j < old_number; j++)
+    {
+      h = name_hash( old[j].name, old[j].name_length) & mask;
+      while( table[h] != -1)
+        h = (h + 1) & mask;
+      table[h] = j;
+    }
+
+  for( i = 0; i < number; i++)
+    {
+      rec = &(poller->records[i]);
+      poller->match[i] = -1;
+      h = name_hash( rec->name, rec->name_length) & mask;
+      for( ; (j = table[h]) != -1; h = (h + 1) & mask)
+        if( !used[j] && (old[j].name_length == rec->name_length) && 
+            !memcmp( old[j].name, rec->name, rec->name_length) )
+          {
+            ioc[i] = poller->db.ioc[j];
+            used[j] = 1;
+            poller->match[i] = j;
+            break;
+          }
+    }
+
+  removed = 0;
+  for( j = 0; j < old_number; j++)
+    if( !used[j])
+      {
+        alive_free_ioc( &(poller->db.ioc[j]));
+        removed++;
+      }
+  free( poller->db.ioc);
+  poller->db.ioc = ioc;
+
+  free( table);
+  free( used);
+
+  return removed;
+}
+
+int alive_poller_poll( struct alive_poller *poller)
+{
+  struct alive_raw_record *rec, *old;
+  struct alive_ioc *ioc;
+  struct buffer_struct bs;
+  struct alive_wire_db_header header;
+  struct alive_wire_ioc w;
+  int length, number;
+  int count;
+  int i, j;
+  char *p;
+  struct alive_raw_record *r;
+
+  TRACE_BEGIN( Trace_Poll, 0, REQUEST_ALL_IOCS, NULL);
+  length = poller_fetch( poller);
+  if( length < 0)
+    {
+      TRACE_END( Trace_Poll, 0, -1);
+      return -1;
+    }
+
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  number = find_db_records( poller->response, length, &poller->records,
+                            &poller->records_size);
+  if( (number < 0) || poller_grow( poller, number) )
+    {
+      if( number < 0)
+        printf("Missing data.\n");
+      TRACE_END( Trace_Decode, 0, -1);
+      TRACE_END( Trace_Poll, 0, -1);
+      return -1;
+    }
+
+  // same IOCs in the same places is the usual case
+  count = 0;
+  if( number == poller->db.number_ioc)
+    for( i = 0; i < number; i++)
+      {
+        rec = &(poller->records[i]);
+        old = &(poller->previous_records[i]);
+        if( (old->name_length != rec->name_length) || 
+            memcmp( old->name, rec->name, rec->name_length) )
+          break;
+        poller->match[i] = i;
+      }
+  else
+    i = 0;
+  if( (i < number) || (number != poller->db.number_ioc) )
+    {
+      count = poller_rearrange( poller, number);
+      if( count < 0)
+        {
+          TRACE_END( Trace_Decode, 0, -1);
+          TRACE_END( Trace_Poll, 0, -1);
+          return -1;
+        }
+    }
+
+  alive_wire_get_db_header( poller->response, &header);
+  poller->db.current_time = header.current_time;
+  poller->db.start_time = header.start_time;
+  poller->db.number_ioc = number;
+
+  memset( &bs, 0, sizeof(bs));
+  bs.type = Buffer_External;
+  for( i = 0; i < number; i++)
+    {
+      rec = &(poller->records[i]);
+      ioc = &(poller->db.ioc[i]);
+      j = poller->match[i];
+      if( j >= 0)
+        {
+          old = &(poller->previous_records[j]);
+          if( (old->length == rec->length) && 
+              !memcmp( poller->previous + old->offset, 
+                       poller->response + rec->offset, rec->length) )
+            {
+              poller->changed[i] = 0;
+              continue;
+            }
+        }
+
+      bs.buffer = poller->response + rec->offset;
+      bs.amount = rec->length;
+      bs.offset = 0;
+      if( j < 0)
+        ioc->ioc_name = get_buffer_string( &bs, 1);
+      else
+        bs.offset += 1 + rec->name_length;
+      // find_db_records() found the whole record there
+      alive_wire_get_ioc( get_buffer_block( &bs, ALIVE_WIRE_SIZE( ioc)), &w);
+      ioc->status = w.status;
+      ioc->time_value = w.time;
+      ioc->raw_ip_address = w.ip;
+      ioc->user_msg = w.user_msg;
+      refresh_environment( &bs, &ioc->environment);
+
+      poller->changed[i] = 1;
+      count++;
+    }
+  TRACE_END( Trace_Decode, 0, length);
+
+  // this response is the one compared against next time
+  p = poller->previous;
+  poller->previous = poller->response;
+  poller->response = p;
+  i = poller->previous_size;
+  poller->previous_size = poller->response_size;
+  poller->response_size = i;
+  r = poller->previous_records;
+  poller->previous_records = poller->records;
+  poller->records = r;
+  i = poller->previous_records_size;
+  poller->previous_records_size = poller->records_size;
+  poller->records_size = i;
+
+  TRACE_END( Trace_Poll, 0, length);
+
+  return count;
+}
+
+struct alive_db *alive_poller_db( struct alive_poller *poller)
+{
+  return &poller->db;
+}
+
+int alive_poller_changed( struct alive_poller *poller, int index)
+{
+  if( (index < 0) || (index >= poller->db.number_ioc) )
+    return 0;
+  return poller->changed[index];
+}
+
+void alive_poller_free( struct alive_poller *poller)
+{
+  int i;
+
+  if( poller == NULL)
+    return;
+  for( i = 0; i < poller->db.number_ioc; i++)
+    alive_free_ioc( &(poller->db.ioc[i]) );
+  free( poller->db.ioc);
+  free( poller->changed);
+  free( poller->match);
+  free( poller->response);
+  free( poller->records);
+  free( poller->previous);
+  free( poller->previous_records);
+  free( poller);
+}
+
+
+struct alive_db *alive_get_db( char *server, int port)
+{
+  return alive_get_iocs( server, port, 0, NULL);
+}
+
+struct alive_db *alive_get_ioc( char *server, int port, char *name)
+{
+  return alive_get_iocs( server, port, 1, &name);
+}
+
+uint32_t alive_ioc_status_time( struct alive_db *db, struct alive_ioc *ioc)
+{
+  switch( ioc->status)
+    {
+    case STATUS_DOWN_UNKNOWN:
+      return db->current_time - db->start_time;
+    case STATUS_DOWN:
+    case STATUS_UP:
+    case STATUS_CONFLICT:
+      return db->current_time - ioc->time_value;
+    }
+  return 0;
+}
+
+void alive_free_ioc( struct alive_ioc *ioc)
+{
+  free( ioc->ioc_name);
+  alive_free_env( ioc->environment);
+}
+
+static char *copy_string( char *str)
+{
+  return (str == NULL) ? NULL : strdup( str);
+}
+
+static struct alive_env *copy_env( struct alive_env *src)
+{
+  const struct alive_os_schema *schema;
+  struct alive_env *env;
+  char **field, *str;
+  int i;
+
+  env = calloc( 1, sizeof( struct alive_env));
+  if( env == NULL)
+    return NULL;
+  env->extra_type = src->extra_type;
+
+  if( src->number_envvar)
+    {
+      env->envvar_key = calloc( src->number_envvar, sizeof( char *));
+      env->envvar_value = calloc( src->number_envvar, sizeof( char *));
+      if( (env->envvar_key == NULL) || (env->envvar_value == NULL) )
+        {
+          alive_free_env( env);
+          return NULL;
+        }
+      env->number_envvar = src->number_envvar;
+      for( i = 0; i < src->number_envvar; i++)
+        {
+          env->envvar_key[i] = copy_string( src->envvar_key[i]);
+          env->envvar_value[i] = copy_string( src->envvar_value[i]);
+          if( (env->envvar_key[i] == NULL) || (env->envvar_value[i] == NULL) )
+            {
+              alive_free_env( env);
+              return NULL;
+            }
+        }
+    }
+
+  schema = alive_os_schema( src->extra_type);
+  if( (src->extra != NULL) && (schema != NULL) )
+    {
+      env->extra = malloc( schema->size);
+      if( env->extra == NULL)
+        {
+          alive_free_env( env);
+          return NULL;
+        }
+      memcpy( env->extra, src->extra, schema->size);
+      // the strings are the source's until each is copied, so clear
+      // them all first to be able to free a partial copy
+      for( i = 0; i < schema->number; i++)
+        if( schema->params[i].type == PARAM_STRING)
+          *((char **) ((char *) env->extra + schema->params[i].offset)) =
+            NULL;
+      for( i = 0; i < schema->number; i++)
+        if( schema->params[i].type == PARAM_STRING)
+          {
+            field = (char **) ((char *) env->extra + 
+                               schema->params[i].offset);
+            str = *((char **) ((char *) src->extra + 
+                               schema->params[i].offset));
+            *field = copy_string( str);
+            if( (str != NULL) && (*field == NULL) )
+              {
+                alive_free_env( env);
+                return NULL;
+              }
+          }
+    }
+
+  return env;
+}
+
+int alive_copy_ioc( struct alive_ioc *dest, struct alive_ioc *src)
+{
+  *dest = *src;
+  dest->environment = NULL;
+  dest->ioc_name = strdup( src->ioc_name);
+  if( dest->ioc_name == NULL)
+    return 1;
+  if( src->environment != NULL)
+    {
+      dest->environment = copy_env( src->environment);
+      if( dest->environment == NULL)
+        {
+          free( dest->ioc_name);
+          dest->ioc_name = NULL;
+          return 1;
+        }
+    }
+  return 0;
+}
+
+void alive_free_db( struct alive_db *iocs)
+{
+  int i;
+  
+  TRACE_BEGIN( Trace_Free, 0, 0, NULL);
+  for( i = 0; i < iocs->number_ioc; i++)
+    {
+      /* free( iocs->ioc[i].ioc_name); */
+      /* free_alive_env( iocs->ioc[i].environment); */
+      alive_free_ioc( &(iocs->ioc[i]) );
+    }
+  free(iocs->ioc);
+  free(iocs);
+  TRACE_END( Trace_Free, 0, -1);
+}
+
+
+
+/* // TEMPORARY FUNCTION! */
+/* // Will disappear when events added to API */
+/* static struct alive_env *unpack_alive_env( char *data, int length) */
+/* { */
+/*   struct buffer_struct *bs; */
+/*   struct alive_env *env; */
 
 /*   bs = init_buffer_data( data, length, 0); */
 /*   env = get_environment( bs); */
@@ -667,72 +2137,43 @@ void alive_free_db( struct alive_db *iocs)
 
 ///////////////////////////////////////////////////////////////////
 
-struct alive_detailed_ioc *alive_get_detailed( char *server, int port, 
-                                               char *name, int type)
+// decodes a debug or conflict response (opcodes 21 and 22)
+static struct alive_detailed_ioc *decode_detailed( struct buffer_struct *bs)
 {
   struct alive_detailed_ioc *dioc;
   struct alive_instance *inst;
 
-  struct buffer_struct *bs;
-  int sockfd;
-
-  uint16_t version;
-
-  uint32_t o32;
-  uint16_t o16;
-  uint8_t o8;
+  struct alive_wire_header header;
+  struct alive_wire_detailed detailed;
+  struct alive_wire_instance w;
+  const char *p;
 
   int i;
 
-
-  if( get_server_addr( server, port, &sockfd) )
+  if( (p = get_buffer_block( bs, ALIVE_WIRE_SIZE( header))) == NULL)
     return NULL;
-
-  // only works for INCOMING stream
-  bs = init_buffer_stream( sockfd, 1024);
-  if( bs == NULL)
+  alive_wire_get_header( p, &header);
+  if( header.version != CLIENT_PROTOCOL_VERSION)
     {
-      printf("Can't create socket buffer!\n");
+      printf("Unable to handle this protocol version.\n");
       return NULL;
     }
 
-  if( !type)
-    o16 = htons(21);
-  else
-    o16 = htons(22);
-  write( sockfd, &o16, sizeof(o16));
-
-  o8 = strlen( name);
-  write( sockfd, &o8, sizeof(o8));
-  write( sockfd, name, o8);
-
-  shutdown( sockfd, SHUT_WR);
- 
   dioc = calloc( 1, sizeof( struct alive_detailed_ioc) );
-
-
-  if( load_buffer_test(bs, 10) )
+  if( dioc == NULL)
     return NULL;
-  get_buffer_uint16( bs, &version);
-  if( version != CLIENT_PROTOCOL_VERSION)
-    {
-      printf("Unable to handle this protocol version.\n");
-      return NULL;
-    }
-  get_buffer_uint32( bs, &o32);
-  dioc->current_time = o32;
-  get_buffer_uint32( bs, &o32);
-  dioc->start_time = o32;
+  dioc->current_time = header.current_time;
+  dioc->start_time = header.start_time;
 
 
   if( (dioc->ioc_name = get_buffer_string( bs, 1)) == NULL)
-    return NULL;
-  if( load_buffer_test(bs, 9) )
-    return NULL;
-  get_buffer_uint8( bs, &dioc->overall_status);
-  get_buffer_uint32( bs, &o32);
-  dioc->overall_time_value = o32;
-  get_buffer_uint32( bs, &dioc->number_instances);
+    goto Error;
+  if( (p = get_buffer_block( bs, ALIVE_WIRE_SIZE( detailed))) == NULL)
+    goto Error;
+  alive_wire_get_detailed( p, &detailed);
+  dioc->overall_status = detailed.status;
+  dioc->overall_time_value = detailed.time;
+  dioc->number_instances = detailed.number_instances;
 
 
   dioc->instances = calloc( dioc->number_instances,
@@ -740,20 +2181,19 @@ struct alive_detailed_ioc *alive_get_detailed( char *server, int port,
   inst = dioc->instances;
   for( i = 0; i < dioc->number_instances; i++)
     {
-      if( load_buffer_test(bs, 31) )
-        return NULL;
-      get_buffer_uint8( bs, &inst->status);
-      get_buffer_uint32( bs, &inst->raw_ip_address);
-      get_buffer_uint16( bs, &inst->origin_port);
-      get_buffer_uint32( bs, &inst->heartbeat);
-      get_buffer_uint16( bs, &inst->period);
-      get_buffer_uint32( bs, &inst->incarnation);
-      get_buffer_uint32( bs, &o32);
-      inst->boottime = o32;
-      get_buffer_uint32( bs, &o32);
-      inst->timestamp = o32;
-      get_buffer_uint16( bs, &inst->reply_port);
-      get_buffer_uint32( bs, &inst->user_msg);
+      if( (p = get_buffer_block( bs, ALIVE_WIRE_SIZE( instance))) == NULL)
+        goto Error;
+      alive_wire_get_instance( p, &w);
+      inst->status = w.status;
+      inst->raw_ip_address = w.ip;
+      inst->origin_port = w.origin_port;
+      inst->heartbeat = w.heartbeat;
+      inst->period = w.period;
+      inst->incarnation = w.incarnation;
+      inst->boottime = w.boottime;
+      inst->timestamp = w.timestamp;
+      inst->reply_port = w.reply_port;
+      inst->user_msg = w.user_msg;
       
 
       inst->environment = get_environment( bs);
@@ -761,9 +2201,55 @@ struct alive_detailed_ioc *alive_get_detailed( char *server, int port,
       inst++;
     }
 
-  shutdown( sockfd, SHUT_RD);
-  close(sockfd);
-  
+  return dioc;
+
+ Error:
+  alive_free_detailed( dioc);
+
+  return NULL;
+}
+
+struct alive_detailed_ioc *alive_get_detailed( char *server, int port, 
+                                               char *name, int type)
+{
+  struct alive_detailed_ioc *dioc;
+
+  struct buffer_struct *bs;
+  struct alive_response *response;
+  int sockfd;
+  int received;
+  int opcode;
+
+  opcode = type ? REQUEST_CONFLICTS : REQUEST_DEBUG;
+  TRACE_BEGIN( Trace_GetDetailed, 0, opcode, name);
+  bs = start_response( server, port, opcode, 1, &name, &sockfd, &response);
+  if( bs == NULL)
+    {
+      TRACE_END( Trace_GetDetailed, 0, -1);
+      return NULL;
+    }
+
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  dioc = decode_detailed( bs);
+  TRACE_END( Trace_Decode, 0, -1);
+
+  received = finish_response( bs, sockfd, response);
+  TRACE_END( Trace_GetDetailed, 0, received);
+
+  return dioc;
+}
+
+struct alive_detailed_ioc *alive_decode_detailed( char *data, int length)
+{
+  struct buffer_struct *bs;
+  struct alive_detailed_ioc *dioc;
+
+  bs = init_buffer_data( data, length, 0);
+  if( bs == NULL)
+    return NULL;
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  dioc = decode_detailed( bs);
+  TRACE_END( Trace_Decode, 0, length);
   free_buffer( bs);
 
   return dioc;
@@ -787,27 +2273,27 @@ void alive_free_detailed( struct alive_detailed_ioc *ioc)
 {
   int i;
 
+  TRACE_BEGIN( Trace_Free, 0, 0, NULL);
   free( ioc->ioc_name);
 
   for( i = 0; i < ioc->number_instances; i++)
     alive_free_env( ioc->instances[i].environment);
   free( ioc->instances);
   free( ioc);
+  TRACE_END( Trace_Free, 0, -1);
 }
 
 
 ///////////////////////////////////////////////////////////////////
 
 
-struct alive_ioc_event_db *alive_get_ioc_event_db( char *server, int port, char *name)
+// decodes an event response (opcode 15)
+// Reads the response header and gets all the events after it, which are
+// left in the buffer as event blocks.
+static const char *load_events( struct buffer_struct *bs,
+                                time_t *current_time, time_t *start_time,
+                                int *number)
 {
-  struct alive_ioc_event_db *events;
-  struct alive_ioc_event_item *items;
-
-  struct buffer_struct *bs;
-  int sockfd;
-
-  uint32_t *data;
   char *dptr;
   int data_count;
   int chunk_size;
@@ -815,57 +2301,28 @@ struct alive_ioc_event_db *alive_get_ioc_event_db( char *server, int port, char
   int length;
   int ret;
 
-  uint16_t version;
-
-  uint32_t o32;
-  uint16_t o16;
-  uint8_t o8;
-
-  int i;
-
-
-  if( get_server_addr( server, port, &sockfd) )
-    return NULL;
- 
-  // only works for INCOMING stream
-  bs = init_buffer_stream( sockfd, 1024);
-  if( bs == NULL)
-    {
-      printf("Can't create socket buffer!\n");
-      return NULL;
-    }
-
-  events = malloc( sizeof( struct alive_ioc_event_db) );
-
-  o16 = htons(15);
-  write( sockfd, &o16, sizeof(o16));
+  struct alive_wire_header header;
+  const char *p;
 
-  o8 = strlen( name);
-  write( sockfd, &o8, sizeof(o8));
-  write( sockfd, name, o8);
 
-  shutdown( sockfd, SHUT_WR);
-
-  
   // COULD switch this to BUFFER MODE
 
-  if( load_buffer_test(bs, 10) )
+  if( (p = get_buffer_block( bs, ALIVE_WIRE_SIZE( header))) == NULL)
     return NULL;
-  get_buffer_uint16( bs, &version);
-  if( version != CLIENT_PROTOCOL_VERSION)
+  alive_wire_get_header( p, &header);
+  if( header.version != CLIENT_PROTOCOL_VERSION)
     {
       printf("Unable to handle this protocol version.\n");
       return NULL;
     }
-  get_buffer_uint32( bs, &o32);
-  events->current_time = o32;
-  get_buffer_uint32( bs, &o32);
-  events->start_time = o32;
+
+  *current_time = header.current_time;
+  *start_time = header.start_time;
 
 
   data_count = 0;
   data_max = 256;
-  chunk_size = EVENT_SIZE*sizeof(uint32_t);
+  chunk_size = ALIVE_WIRE_SIZE( event);
 
   length = load_buffer( bs, data_max*chunk_size);
   data_count = length/chunk_size;
@@ -878,28 +2335,144 @@ struct alive_ioc_event_db *alive_get_ioc_event_db( char *server, int port, char
 
   get_buffer_dataptr( bs, length, &dptr, &ret);
 
-  shutdown( sockfd, SHUT_RD);
-  close(sockfd);
+  *number = ret/chunk_size;
+  return dptr;
+}
+
+static struct alive_ioc_event_db *decode_events( struct buffer_struct *bs)
+{
+  struct alive_ioc_event_db *events;
+  struct alive_ioc_event_item *items;
+
+  struct alive_wire_event w;
+  const char *data;
+
+  int i;
+
+
+  events = malloc( sizeof( struct alive_ioc_event_db) );
+  if( events == NULL)
+    return NULL;
+  data = load_events( bs, &events->current_time, &events->start_time, 
+                      &events->number);
+  if( data == NULL)
+    {
+      free( events);
+      return NULL;
+    }
 
-  data = (uint32_t *) dptr;
-  events->number = ret/chunk_size;
   events->instances = malloc( events->number * sizeof( struct alive_ioc_event_item) );
   items = events->instances;
 
 
   for( i = 0; i < events->number; i++)
     {
-      items[i].time = *(data++);
-      items[i].raw_ip_address = *(data++);
-      items[i].user_msg = *(data++);
-      items[i].event = *(data++);
+      data = alive_wire_get_event( data, &w);
+      items[i].time = w.time;
+      items[i].raw_ip_address = w.ip;
+      items[i].user_msg = w.user_msg;
+      items[i].event = w.event;
 
       /* if( (items[i].event > 6) || (items[i].event < 0) ) */
       /*   printf("WARNING! %d\n", items[i].event); */
     }
 
+  return events;
+}
+
+// the same, but into a pack, without the array in between
+static struct alive_event_pack *decode_event_pack( struct buffer_struct *bs)
+{
+  struct alive_event_pack *pack;
+  struct alive_ioc_event_item item;
+  time_t current_time, start_time;
+  struct alive_wire_event w;
+  const char *data;
+  int number;
+  int i;
+
+  data = load_events( bs, &current_time, &start_time, &number);
+  if( data == NULL)
+    return NULL;
+  pack = alive_event_pack_new( current_time, start_time);
+  if( pack == NULL)
+    return NULL;
+
+  for( i = 0; i < number; i++)
+    {
+      data = alive_wire_get_event( data, &w);
+      item.time = w.time;
+      item.raw_ip_address = w.ip;
+      item.user_msg = w.user_msg;
+      item.event = w.event;
+      if( alive_event_pack_add( pack, &item) )
+        {
+          alive_free_event_pack( pack);
+          return NULL;
+        }
+    }
+  alive_event_pack_trim( pack);
+
+  return pack;
+}
+
+// fetches an IOC's events, as a pack if pack_flag is set
+static void *get_events( char *server, int port, char *name, int pack_flag)
+{
+  void *events;
+
+  struct buffer_struct *bs;
+  struct alive_response *response;
+  int sockfd;
+  int received;
+
+
+  TRACE_BEGIN( Trace_GetEvents, 0, REQUEST_EVENTS, name);
+  bs = start_response( server, port, REQUEST_EVENTS, 1, &name, &sockfd,
+                       &response);
+  if( bs == NULL)
+    {
+      TRACE_END( Trace_GetEvents, 0, -1);
+      return NULL;
+    }
+
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  if( pack_flag)
+    events = decode_event_pack( bs);
+  else
+    events = decode_events( bs);
+  TRACE_END( Trace_Decode, 0, -1);
+
   fflush(stdout);
 
+  received = finish_response( bs, sockfd, response);
+  TRACE_END( Trace_GetEvents, 0, received);
+
+  return events;
+}
+
+struct alive_ioc_event_db *alive_get_ioc_event_db( char *server, int port, char *name)
+{
+  return get_events( server, port, name, 0);
+}
+
+struct alive_event_pack *alive_get_ioc_event_pack( char *server, int port,
+                                                   char *name)
+{
+  return get_events( server, port, name, 1);
+}
+
+struct alive_ioc_event_db *alive_decode_ioc_event_db( char *data, int length)
+{
+  struct buffer_struct *bs;
+  struct alive_ioc_event_db *events;
+
+  bs = init_buffer_data( data, length, 0);
+  if( bs == NULL)
+    return NULL;
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  events = decode_events( bs);
+  TRACE_END( Trace_Decode, 0, length);
   free_buffer( bs);
 
   return events;
@@ -910,9 +2483,130 @@ void alive_free_ioc_event_db( struct alive_ioc_event_db *events)
 {
   if (events!= NULL)
     {
+      TRACE_BEGIN( Trace_Free, 0, 0, NULL);
       free( events->instances);
       free( events);
+      TRACE_END( Trace_Free, 0, -1);
+    }
+}
+
+
+struct alive_event_follower
+{
+  int backlog;
+  int started;
+  int seen;  // events in the last response
+  char last[ALIVE_WIRE_SIZE( event)];  // the last of them, as sent
+  struct alive_ioc_event_item *events;
+  int size;
+};
+
+struct alive_event_follower *alive_event_follower_create( int backlog)
+{
+  struct alive_event_follower *follower;
+
+  follower = calloc( 1, sizeof( struct alive_event_follower));
+  if( follower == NULL)
+    return NULL;
+  follower->backlog = backlog;
+  return follower;
+}
+
+int alive_event_follower_update( struct alive_event_follower *follower,
+                                 char *data, int length,
+                                 struct alive_ioc_event_item **events)
+{
+  struct alive_ioc_event_item *items;
+  struct alive_wire_header header;
+  struct alive_wire_event record, last;
+  char *records;
+  int chunk_size;
+  int number, first;
+  int i;
+
+  chunk_size = ALIVE_WIRE_SIZE( event);
+  if( length < ALIVE_WIRE_SIZE( header))
+    return -1;
+  alive_wire_get_header( data, &header);
+  if( header.version != CLIENT_PROTOCOL_VERSION)
+    return -1;
+  records = data + ALIVE_WIRE_SIZE( header);
+  number = (length - ALIVE_WIRE_SIZE( header)) / chunk_size;
+
+  TRACE_BEGIN( Trace_Decode, 0, 0, NULL);
+  if( !follower->started)
+    {
+      first = 0;
+      if( (follower->backlog >= 0) && (number > follower->backlog) )
+        first = number - follower->backlog;
+    }
+  else if( !follower->seen)
+    first = 0;
+  else if( (number >= follower->seen) &&
+           !memcmp( records + (follower->seen - 1) * chunk_size,
+                    follower->last, chunk_size) )
+    // the usual case, where the list only grew
+    first = follower->seen;
+  else
+    {
+      // cut from the front, so the last event seen moved back
+      for( first = number; first > 0; first--)
+        if( !memcmp( records + (first - 1) * chunk_size, follower->last,
+                     chunk_size) )
+          break;
+      // or started over, so go by time
+      if( !first)
+        {
+          alive_wire_get_event( follower->last, &last);
+          for( ; first < number; first++)
+            {
+              alive_wire_get_event( records + first * chunk_size, &record);
+              if( record.time > last.time)
+                break;
+            }
+        }
+    }
+
+  if( number - first > follower->size)
+    {
+      items = realloc( follower->events, (number - first) *
+                       sizeof( struct alive_ioc_event_item));
+      if( items == NULL)
+        {
+          TRACE_END( Trace_Decode, 0, -1);
+          return -1;
+        }
+      follower->events = items;
+      follower->size = number - first;
+    }
+
+  items = follower->events;
+  for( i = first; i < number; i++)
+    {
+      alive_wire_get_event( records + i * chunk_size, &record);
+      items->time = record.time;
+      items->raw_ip_address = record.ip;
+      items->user_msg = record.user_msg;
+      items->event = record.event;
+      items++;
     }
+
+  follower->started = 1;
+  follower->seen = number;
+  if( number)
+    memcpy( follower->last, records + (number - 1) * chunk_size, chunk_size);
+  TRACE_END( Trace_Decode, 0, (number - first) * chunk_size);
+
+  *events = follower->events;
+  return number - first;
+}
+
+void alive_event_follower_free( struct alive_event_follower *follower)
+{
+  if( follower == NULL)
+    return;
+  free( follower->events);
+  free( follower);
 }
 
 /*
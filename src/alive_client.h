@@ -16,6 +16,10 @@
 #include <time.h>
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 enum alive_os_type { GENERIC, VXWORKS, LINUX, DARWIN, WINDOWS};
 
 struct alive_iocinfo_extra_vxworks
@@ -66,6 +70,34 @@ struct alive_env
   void *extra;
 };
 
+// Each OS type's parameters are described by one table, in wire order,
+// which the decoder, freer, and printers all work from.  Strings are
+// sent with a one byte length.
+enum alive_param_types { PARAM_STRING, PARAM_UINT32 };
+
+struct alive_os_param
+{
+  char *name;     // as given to "alivedb -p", like "boot_device"
+  char *label;    // as printed, like "boot device"
+  uint8_t type;
+  uint8_t optional;  // only printed when present
+  uint16_t offset;   // in the extra structure
+};
+
+struct alive_os_schema
+{
+  char *name;     // as given to "alivedb -p", like "vxworks"
+  char *title;    // heading for printing
+  int size;       // of the extra structure
+  int number;
+  const struct alive_os_param *params;
+};
+
+const struct alive_os_schema *alive_os_schema( int os_type);
+// returns the OS type, or -1 if there is no such OS or parameter
+int alive_find_os_param( char *os, char *name, 
+                         const struct alive_os_param **param);
+
 enum alive_statuses { STATUS_UNKNOWN, STATUS_DOWN_UNKNOWN, STATUS_DOWN,
                       STATUS_UP, STATUS_CONFLICT };
 
@@ -170,9 +202,17 @@ struct alive_db *alive_get_iocs( char *server, int port, int number,
 struct alive_db *alive_get_ioc( char *server, int port, char *name);
 void alive_free_db( struct alive_db *iocs);
 
+// Seconds the IOC has been in its current status, as seen by the daemon.
+// For STATUS_DOWN_UNKNOWN this is the daemon's uptime (a lower bound),
+// and for STATUS_UNKNOWN it is zero.
+uint32_t alive_ioc_status_time( struct alive_db *db, struct alive_ioc *ioc);
+
 // Does not remove 'ioc', only it's allocated parts, so that a pointer 
 // to a statically allocated structure can be passed to it.
 void alive_free_ioc( struct alive_ioc *ioc);
+// Copies an IOC and everything it points to into *dest, which is later
+// freed with alive_free_ioc().  Returns 0, or 1 if out of memory.
+int alive_copy_ioc( struct alive_ioc *dest, struct alive_ioc *src);
 
 struct alive_detailed_ioc *alive_get_debug( char *server, int port, 
                                             char *name);
@@ -185,4 +225,750 @@ struct alive_ioc_event_db *alive_get_ioc_event_db( char *server, int port,
                                              char *name);
 void alive_free_ioc_event_db( struct alive_ioc_event_db *events);
 
+/////////////////////////////////////////////
+
+// Request types (opcodes) of the client protocol
+enum alive_request_types { REQUEST_ALL_IOCS = 1, REQUEST_SOME_IOCS = 2,
+                           REQUEST_ONE_IOC = 3, REQUEST_EVENTS = 15,
+                           REQUEST_DEBUG = 21, REQUEST_CONFLICTS = 22 };
+
+// Raw protocol access, for proxies and caches.  A server name starting
+// with '/' is taken to be the path of a local UNIX socket.
+
+// Sends the request and returns the server's whole response, allocated.
+char *alive_request_raw( char *server, int port, char *request, 
+                         int request_length, int *response_length);
+
+// decodes a raw database response (opcodes 1, 2, and 3)
+struct alive_db *alive_decode_db( char *data, int length);
+
+// The same, with threads decoding the IOCs at once once the records have
+// been found; worth it for large responses, and the result is no
+// different.  Small ones are decoded by the calling thread alone.
+struct alive_db *alive_decode_db_parallel( char *data, int length,
+                                           int threads);
+// alive_get_iocs(), receiving the whole response and then decoding it
+// with alive_decode_db_parallel()
+struct alive_db *alive_get_iocs_parallel( char *server, int port, int number,
+                                          char **names, int threads);
+
+// Location of each IOC record inside a raw database response, found
+// without decoding it.  Returns the number of records, or -1 on error.
+struct alive_raw_record
+{
+  char *name;  // points into the response, not NUL terminated
+  int name_length;
+  int offset;  // from the start of the response
+  int length;
+};
+int alive_raw_db_records( char *data, int length, 
+                          struct alive_raw_record **records);
+
+// A poller owns one database and refreshes it in place each poll,
+// reusing the receive buffer, the IOC slots, and any strings that didn't
+// change, so a poll where little changed allocates next to nothing.  The
+// server's address is looked up once, when the poller is made.
+struct alive_poller;
+
+struct alive_poller *alive_poller_create( char *server, int port);
+// Returns the number of IOCs changed, added, or removed, or -1 on error,
+// which leaves the database as it was.
+int alive_poller_poll( struct alive_poller *poller);
+// the poller's database, which is only changed by polling; don't free it
+struct alive_db *alive_poller_db( struct alive_poller *poller);
+// whether the IOC at index changed or was added in the last poll
+int alive_poller_changed( struct alive_poller *poller, int index);
+void alive_poller_free( struct alive_poller *poller);
+
+// decode raw responses for the other request types
+struct alive_detailed_ioc *alive_decode_detailed( char *data, int length);
+struct alive_ioc_event_db *alive_decode_ioc_event_db( char *data, 
+                                                      int length);
+
+// Non-blocking requests for use with an event loop.  Start one, then
+// call alive_request_process() whenever its descriptor is ready for the
+// poll() events asked for; that returns 0 while there's more to do, 1
+// once the whole response is in, and -1 on error.  The response is then
+// decoded with one of the alive_decode functions.  Only a server given
+// by name (rather than a numeric address) is looked up with blocking.
+struct alive_request;
+struct alive_request *alive_request_start( char *server, int port, 
+                                           int type, int number, 
+                                           char **names);
+int alive_request_fd( struct alive_request *req);
+int alive_request_poll_events( struct alive_request *req);
+int alive_request_process( struct alive_request *req);
+// points into the request, so valid until it is freed
+char *alive_request_response( struct alive_request *req, int *length);
+void alive_request_free( struct alive_request *req);
+
+// Responses shared between threads.  With a TTL set, alive_get_db(),
+// alive_get_iocs(), alive_get_ioc(), the debug, conflict, and event
+// functions all take their responses from here: one fetched less than
+// the TTL ago for the same server, port, and request is used again, and
+// threads asking while one is being fetched wait for it rather than
+// asking the daemon too.  Each caller still gets its own decoded copy.
+// The TTL starts from the ALIVE_RESPONSE_TTL environment variable, or
+// zero (off).  Needs linking with -pthread.
+void alive_response_cache_set_ttl( int milliseconds);
+int alive_response_cache_ttl( void);
+
+// Responses can also be taken directly.  They are shared, so don't
+// change the data, and release each one when done with it.
+struct alive_response;
+struct alive_response *alive_response_fetch( char *server, int port,
+                                             char *request,
+                                             int request_length);
+char *alive_response_data( struct alive_response *response, int *length);
+void alive_response_release( struct alive_response *response);
+
+/////////////////////////////////////////////
+
+// IP address index over an alive_db, for exact and subnet lookups.
+// Addresses are kept in host order (first octet most significant).
+
+struct alive_ip_entry
+{
+  uint32_t address;
+  int ioc_index;  // index into db->ioc
+};
+
+struct alive_ip_index
+{
+  struct alive_db *db;  // not owned by index
+  int number;
+  struct alive_ip_entry *entries;  // sorted by address
+};
+
+struct alive_subnet_rollup
+{
+  uint32_t network;
+  int prefix_length;
+  int total;
+  int status_count[STATUS_CONFLICT+1];  // indexed by alive_statuses
+};
+
+uint32_t alive_ip_host_order( unsigned char *ip_address);
+// returns 0 on success; a bare address is treated as a /32
+int alive_parse_cidr( char *str, uint32_t *network, int *prefix_length);
+
+struct alive_ip_index *alive_ip_index_create( struct alive_db *db);
+void alive_ip_index_free( struct alive_ip_index *index);
+
+// These return the number of matching entries, with *first set to the
+// position in index->entries of the first match.
+int alive_ip_index_find( struct alive_ip_index *index, uint32_t address,
+                         int *first);
+int alive_ip_index_find_prefix( struct alive_ip_index *index, 
+                                uint32_t network, int prefix_length, 
+                                int *first);
+
+int alive_ip_index_rollup( struct alive_ip_index *index, uint32_t network,
+                           int prefix_length, 
+                           struct alive_subnet_rollup *rollup);
+// Rolls up every subnet of the given prefix length that has IOCs in it,
+// returning the number of subnets and an allocated array in *rollups.
+int alive_ip_index_subnets( struct alive_ip_index *index, int prefix_length,
+                            struct alive_subnet_rollup **rollups);
+
+/////////////////////////////////////////////
+
+// Views of an alive_db in some order, as arrays of indices into db->ioc,
+// so any number of views can share one database without copying it.
+// Sorting by time puts the oldest time_value first, which is the IOC
+// that has been in its status the longest.  Ties go by name.
+
+enum alive_sort_keys { SORT_NAME, SORT_STATUS, SORT_TIME, SORT_IP, 
+                       SORT_USER_MSG, SORT_REVERSE = 0x100 };
+
+void alive_sort_iocs( struct alive_db *db, int *order, int number, int key);
+// Moves the first k of order by key to the front, sorted, and returns how
+// many there are; the rest are left after them, unsorted.  Takes time
+// proportional to number times log k.
+int alive_top_iocs( struct alive_db *db, int *order, int number, int key,
+                    int k);
+// Groups order by status (indexed by alive_statuses), keeping the order
+// within each group, and fills in counts[STATUS_CONFLICT+1].  Returns 0
+// on success.
+int alive_group_iocs_by_status( struct alive_db *db, int *order, int number,
+                                int *counts);
+
+/////////////////////////////////////////////
+
+// Filters for picking out IOCs, compiled once from expressions like
+//   status==DOWN && env.EPICS_HOST_ARCH~"linux" && age>1h && ip in 10.2.0.0/16
+// Fields are name, status (by name), age (seconds in its status, which
+// can end in m, h, d, or w), time, user_msg, ip (== an address, or in a
+// subnet), os (generic, vxworks, linux, darwin, or windows), env.(var),
+// and (os).(param) like linux.user.  Comparisons are ==, !=, <, <=, >,
+// >=, and ~ and !~ for extended regular expressions; a variable or
+// parameter alone is true if it is set.  Tests join with &&, ||, !, and
+// parentheses.  Strings compare as numbers when both are numbers.  An
+// unset variable or parameter is only != or !~ anything.
+
+struct alive_filter;
+
+// prints what's wrong and returns NULL if the expression is bad
+struct alive_filter *alive_filter_compile( char *expression);
+void alive_filter_free( struct alive_filter *filter);
+
+int alive_filter_match( struct alive_filter *filter, struct alive_db *db,
+                        struct alive_ioc *ioc);
+// keeps the IOCs of order that match, in order, returning how many
+int alive_filter_iocs( struct alive_filter *filter, struct alive_db *db,
+                       int *order, int number);
+// The same on an IOC's record in a raw database response, found with
+// alive_raw_db_records(), without decoding it.
+int alive_filter_match_raw( struct alive_filter *filter, char *data,
+                            struct alive_raw_record *record);
+// decodes only the IOCs of a raw database response that match
+struct alive_db *alive_filter_decode_db( struct alive_filter *filter,
+                                         char *data, int length);
+// all the IOCs of the database that match, decoding only those
+struct alive_db *alive_get_filtered_db( char *server, int port,
+                                        struct alive_filter *filter);
+
+/////////////////////////////////////////////
+
+// Differences between two database snapshots, with IOCs matched by name.
+
+enum alive_change_flags { CHANGE_ADDED = 0x01, CHANGE_REMOVED = 0x02,
+                          CHANGE_STATUS = 0x04, CHANGE_TIME = 0x08, 
+                          CHANGE_IP = 0x10, CHANGE_USER_MSG = 0x20,
+                          CHANGE_ENV = 0x40, CHANGE_OS_PARAMS = 0x80 };
+
+struct alive_ioc_change
+{
+  int flags;
+  struct alive_ioc *old_ioc;  // NULL if added
+  struct alive_ioc *new_ioc;  // NULL if removed
+
+  // environment variable names that were added, removed, or changed
+  int number_keys;
+  char **keys;
+};
+
+struct alive_db_diff
+{
+  int number;
+  struct alive_ioc_change *changes;
+};
+
+// The diff points into both databases, so free it before either of them.
+struct alive_db_diff *alive_db_diff( struct alive_db *old_db, 
+                                     struct alive_db *new_db);
+void alive_free_db_diff( struct alive_db_diff *diff);
+
+/////////////////////////////////////////////
+
+// Environment drift: for every environment variable and OS parameter,
+// the IOCs grouped by value, in one pass with the keys and values hashed
+// rather than compared IOC against IOC.
+
+struct alive_drift_value
+{
+  char *value;  // NULL for the IOCs that don't have it
+  uint32_t number_value;  // for a PARAM_UINT32 parameter
+  int number;   // of IOCs
+  int *iocs;    // indices into the database, in the order given
+};
+
+struct alive_drift_key
+{
+  char *name;   // of the variable, NULL for an OS parameter
+  const struct alive_os_schema *schema;  // for an OS parameter
+  const struct alive_os_param *param;
+  int number_iocs;  // that could have it: with an environment, or that OS
+  int number_values;
+  struct alive_drift_value *values;  // most IOCs (the majority) first
+};
+
+struct alive_drift
+{
+  int number_iocs;  // with an environment
+  int number_keys;
+  struct alive_drift_key *keys;  // variables by name, then OS parameters
+
+  struct alive_drift_value *value_list;
+  int *ioc_list;
+};
+
+// For the IOCs in order (all of them if NULL).  The values point into
+// the database, so free the drift before it.
+struct alive_drift *alive_db_drift( struct alive_db *db, int *order,
+                                    int number);
+void alive_free_drift( struct alive_drift *drift);
+
+/////////////////////////////////////////////
+
+// Snapshot of a database published in POSIX shared memory, for local
+// readers that can't afford a socket round trip.  The layout has no
+// pointers, only offsets from the start of the snapshot, and there are
+// two snapshot slots so the publisher never writes the one being read.
+// Readers check a sequence count (seqlock) to know their view was
+// consistent.  A database that outgrows the slots is published in a new,
+// larger segment under the same name, and readers move over to it on
+// their next read.  Only the environment variables are published, not
+// the operating system parameters.
+
+struct alive_shm_envvar
+{
+  uint32_t key_offset;  // strings are NUL terminated
+  uint32_t value_offset;
+};
+
+struct alive_shm_record
+{
+  uint32_t name_offset;
+  uint16_t name_length;
+  uint8_t status;
+  uint8_t unused;
+  union 
+  {
+    uint32_t raw_ip_address;
+    unsigned char ip_address[4];
+  };
+  uint32_t time_value;
+  uint32_t user_msg;
+  uint32_t envvar_offset;  // array of struct alive_shm_envvar
+  uint32_t number_envvar;
+};
+
+struct alive_shm_snapshot
+{
+  uint32_t current_time;
+  uint32_t start_time;
+  uint32_t number_ioc;
+  uint32_t table_size;      // power of two
+  uint32_t record_offset;   // array of struct alive_shm_record
+  uint32_t table_offset;    // uint32_t record index + 1, 0 for empty
+  uint32_t used;
+  uint32_t size;  // capacity of the slot, never changes
+};
+
+struct alive_shm;
+
+struct alive_shm_read
+{
+  struct alive_shm_snapshot *snapshot;
+  int slot;
+  uint64_t sequence;
+};
+
+// publisher side; slot_size is the most one snapshot can take
+struct alive_shm *alive_shm_create( char *name, uint32_t slot_size);
+int alive_shm_publish( struct alive_shm *shm, struct alive_db *db);
+// size a database will take when published
+uint32_t alive_shm_db_size( struct alive_db *db);
+
+// reader side
+struct alive_shm *alive_shm_open( char *name);
+void alive_shm_close( struct alive_shm *shm);
+
+// Anything found between begin and retry is only valid if retry returns
+// zero; otherwise start over.  Begin returns 1 if nothing is published.
+int alive_shm_read_begin( struct alive_shm *shm, struct alive_shm_read *rd);
+int alive_shm_read_retry( struct alive_shm *shm, struct alive_shm_read *rd);
+struct alive_shm_record *alive_shm_find( struct alive_shm_snapshot *snapshot,
+                                         char *name);
+char *alive_shm_string( struct alive_shm_snapshot *snapshot, 
+                        uint32_t offset);
+// When the snapshot was last published (0 if never), and in *failed
+// whether the publishing since has failed, leaving it stale.
+time_t alive_shm_published( struct alive_shm *shm, int *failed);
+
+// Consistent copy of one IOC's record, retrying as needed.  Returns 0 if
+// found, 1 if not, and -1 if nothing is published.
+int alive_shm_get_ioc( struct alive_shm *shm, char *name, 
+                       struct alive_shm_record *record);
+
+/////////////////////////////////////////////
+
+// Status history kept in a directory: an append-only log of the changes
+// between successive snapshots, a full keyframe now and then so a reader
+// can start part way in, an index of the keyframes by time, and the IOC
+// names.  Only status, time, IP address, and user message are kept.
+
+struct alive_history_writer;
+struct alive_history;
+
+// change between two points in a history; the IOCs have no environment,
+// and their names are only valid until the history is closed
+struct alive_history_change
+{
+  time_t time;
+  int flags;  // alive_change_flags, without CHANGE_ENV or CHANGE_OS_PARAMS
+  struct alive_ioc old_ioc;  // not valid if added
+  struct alive_ioc new_ioc;  // last known values if removed
+};
+
+// directory is created if needed, and an existing history is appended to
+struct alive_history_writer *alive_history_create( char *dir);
+// appends what changed since the last database recorded
+int alive_history_record( struct alive_history_writer *hw,
+                          struct alive_db *db);
+void alive_history_writer_close( struct alive_history_writer *hw);
+
+// Readers see the history as it was when opened.
+struct alive_history *alive_history_open( char *dir);
+void alive_history_close( struct alive_history *hist);
+// IOCs as they were at time t, with current_time set to t
+struct alive_db *alive_history_db_at( struct alive_history *hist, time_t t);
+// Changes made from t0 through t1: seek to t0, then call next until it
+// returns 0.
+int alive_history_seek( struct alive_history *hist, time_t t0);
+int alive_history_next( struct alive_history *hist, time_t t1,
+                        struct alive_history_change *change);
+
+/////////////////////////////////////////////
+
+// Event lists kept in a directory, one append-only file for each IOC,
+// with a small header and then the events in the alive_ioc_event_item
+// layout, so they are read straight from a mapping of the file.  A
+// refresh still gets each IOC's whole list from the daemon, but only
+// checks the events the cache has against it and appends the new ones.
+// The cache also keeps events the daemon has since dropped.  Only one
+// process should refresh a cache at a time; any number can read it.
+
+struct alive_event_cache;
+
+// An IOC's cached events, as of when it was mapped.  The events are in
+// the read-only mapping: don't change them or free them.
+struct alive_event_cache_view
+{
+  struct alive_ioc_event_db events;  // current_time is the last refresh's
+
+  void *map;
+  size_t length;
+};
+
+// directory is created if needed
+struct alive_event_cache *alive_event_cache_open( char *dir);
+void alive_event_cache_close( struct alive_event_cache *cache);
+
+// Brings an IOC's file up to date with a raw event response (opcode 15).
+// Returns the number of events added, or -1 on error.  If the file
+// doesn't match the response, it is replaced with it.
+int alive_event_cache_update( struct alive_event_cache *cache, char *name,
+                              char *data, int length);
+// For all IOCs (number of zero) or the ones named, fetching up to
+// concurrency at once.  Returns the number of IOCs brought up to date,
+// or -1 if the IOCs couldn't be got, and adds the events added to
+// *added if it isn't NULL.
+int alive_event_cache_refresh( struct alive_event_cache *cache,
+                               char *server, int port, int number,
+                               char **names, int concurrency, int *added);
+
+// NULL if the IOC isn't cached
+struct alive_event_cache_view *alive_event_cache_map(
+                                            struct alive_event_cache *cache,
+                                            char *name);
+void alive_event_cache_unmap( struct alive_event_cache_view *view);
+// the cached IOCs, sorted, in an allocated array of allocated names
+char **alive_event_cache_names( struct alive_event_cache *cache,
+                                int *number);
+void alive_event_cache_free_names( char **names, int number);
+
+/////////////////////////////////////////////
+
+// Availability worked out from an IOC's events over a time window.  Time
+// before the first event is unknown, and counts toward neither up nor
+// down.  Conflicts don't count as down.
+
+struct alive_availability
+{
+  char *ioc_name;
+  int valid;  // zero if the events couldn't be fetched
+
+  uint32_t up_time;
+  uint32_t down_time;
+  uint32_t unknown_time;
+  uint32_t conflict_time;
+  int failures;
+  int boots;
+  int recoveries;
+
+  double availability;  // fraction of the known time up
+  double mtbf;  // up time per failure, zero if none
+  double mttr;  // down time per down period, zero if none
+};
+
+struct alive_availability_report
+{
+  time_t start;
+  time_t end;
+  int number;
+  struct alive_availability *iocs;
+};
+
+// for one IOC; ioc_name and valid are left alone
+void alive_ioc_availability( struct alive_ioc_event_db *events,
+                             time_t start, time_t end,
+                             struct alive_availability *avail);
+// For all IOCs (number of zero) or the ones named, fetching their events
+// with the given number of threads.  Needs linking with -pthread.
+struct alive_availability_report *alive_get_availability( char *server,
+                                                          int port,
+                                                          int number,
+                                                          char **names,
+                                                          time_t start,
+                                                          time_t end,
+                                                          int threads);
+// the same from an event cache, for all cached IOCs (number of zero) or
+// the ones named, up to the last refresh
+struct alive_availability_report *alive_cache_availability(
+                                            struct alive_event_cache *cache,
+                                            int number, char **names,
+                                            time_t start, time_t end);
+void alive_free_availability_report( struct alive_availability_report *report);
+
+/////////////////////////////////////////////
+
+// Health of an IOC's instances, worked out from its debug information.
+// Live instances are those up or maybe up, and one is stale when the
+// daemon hasn't heard from it in more than the given number of its
+// periods.  An instance (address and port) that was seen in a previous
+// scan with another incarnation has restarted.
+
+enum alive_health_flags { HEALTH_MULTIPLE_LIVE = 1, HEALTH_MAYBE = 2, 
+                          HEALTH_STALE = 4, HEALTH_RESTARTED = 8 };
+
+struct alive_ioc_health
+{
+  char *ioc_name;
+  int valid;      // zero if the debug information couldn't be fetched
+  int flags;
+
+  int live;       // instances up or maybe up
+  int maybe;      // instances maybe up or maybe down
+  int stale;      // live instances not heard from lately
+  int restarted;  // instances with a new incarnation
+  double lag;     // most periods since a live instance was heard from
+
+  struct alive_detailed_ioc *detail;
+};
+
+struct alive_health_report
+{
+  time_t current_time;
+  int number;
+  struct alive_ioc_health *iocs;  // sorted by name
+};
+
+// for one IOC, with previous NULL if there was no earlier scan; ioc_name,
+// valid, and detail are left alone
+void alive_ioc_health( struct alive_detailed_ioc *detail,
+                       struct alive_detailed_ioc *previous,
+                       double lag_periods, struct alive_ioc_health *health);
+// For all IOCs (number of zero) or the ones named, fetching them with the
+// given number of threads.  Passing the last report finds restarts.
+// Needs linking with -pthread.
+struct alive_health_report *alive_get_health( char *server, int port,
+                                              int number, char **names,
+                                              double lag_periods,
+                                              int threads,
+                                              struct alive_health_report *previous);
+void alive_free_health_report( struct alive_health_report *report);
+
+/////////////////////////////////////////////
+
+// A compact copy of an IOC's events, for holding many of them.  Each
+// event takes a header byte (event and user message when they are small,
+// and whether the address changed), the time as the varint difference
+// from the event before, and an index into the IOC's address dictionary
+// only when the address changed, which is usually 2 to 4 bytes in all
+// instead of 16.  Events are in blocks of ALIVE_EVENT_BLOCK that each
+// decode on their own, so seeking to a time skips whole blocks.
+
+#define ALIVE_EVENT_BLOCK (64)
+
+struct alive_event_block
+{
+  uint32_t first_time;  // of its first event
+  uint32_t max_time;    // latest time of this and all earlier blocks
+  uint32_t offset;      // into data
+};
+
+struct alive_event_pack
+{
+  time_t current_time;
+  time_t start_time;
+  int number;
+
+  int number_blocks;
+  struct alive_event_block *blocks;
+  int number_addresses;
+  uint32_t *addresses;  // raw, as in raw_ip_address
+  uint32_t length;      // bytes used in data
+  uint8_t *data;
+
+  // for adding events: room allocated, and the last event's time and
+  // dictionary index
+  int size_blocks;
+  int size_addresses;
+  uint32_t size_data;
+  uint32_t last_time;
+  int last_address;
+};
+
+// position in a pack; it is only read, so any number can share one
+struct alive_event_cursor
+{
+  const struct alive_event_pack *pack;
+  int index;        // of the next event
+  uint32_t offset;  // of the next event in data
+  uint32_t time;    // of the event before
+  int address;      // dictionary index of the event before
+};
+
+struct alive_event_pack *alive_event_pack_create( 
+                                         struct alive_ioc_event_db *events);
+// An empty pack, to add events to in time order.  Adding returns 0 on
+// success.
+struct alive_event_pack *alive_event_pack_new( time_t current_time, 
+                                               time_t start_time);
+int alive_event_pack_add( struct alive_event_pack *pack,
+                          struct alive_ioc_event_item *item);
+// gives back the room kept for adding more
+void alive_event_pack_trim( struct alive_event_pack *pack);
+// bytes used by the pack in all
+size_t alive_event_pack_bytes( struct alive_event_pack *pack);
+void alive_free_event_pack( struct alive_event_pack *pack);
+
+// the plain array form, for code that wants it
+struct alive_ioc_event_db *alive_event_pack_unpack( 
+                                          struct alive_event_pack *pack);
+
+// Sets the cursor at the first event, or at the first with a time at or
+// past t.  Next fills in the next event and returns 1, or returns 0 at
+// the end.
+void alive_event_pack_begin( struct alive_event_pack *pack, 
+                             struct alive_event_cursor *cursor);
+void alive_event_pack_seek( struct alive_event_pack *pack, 
+                            struct alive_event_cursor *cursor, time_t t);
+int alive_event_pack_next( struct alive_event_cursor *cursor,
+                           struct alive_ioc_event_item *item);
+
+// like alive_get_ioc_event_db(), but packing straight from the response
+struct alive_event_pack *alive_get_ioc_event_pack( char *server, int port,
+                                                   char *name);
+
+/////////////////////////////////////////////
+
+// The event lists of many IOCs merged into one stream in time order,
+// taking the earliest next event of all the IOCs from a heap rather than
+// sorting them together.
+
+struct alive_timeline_event
+{
+  int ioc;  // index into ioc_names
+  struct alive_ioc_event_item item;
+};
+
+struct alive_timeline
+{
+  time_t current_time;
+  int number;
+  char **ioc_names;
+  struct alive_event_pack **packs;  // NULL where the fetch failed
+
+  // merge state
+  struct alive_event_cursor *cursors;
+  struct alive_ioc_event_item *heads;  // each IOC's next event
+  int *heap;
+  int heap_size;
+  time_t end;
+};
+
+// For all IOCs (number of zero) or the ones named, fetching their events
+// with the given number of threads, and ready to give all the events.
+// Needs linking with -pthread.
+struct alive_timeline *alive_get_timeline( char *server, int port, 
+                                           int number, char **names,
+                                           int threads);
+// the same from an event cache, for all cached IOCs (number of zero) or
+// the ones named
+struct alive_timeline *alive_cache_timeline( struct alive_event_cache *cache,
+                                             int number, char **names);
+// starts over with the first events at or past start, and up to end
+void alive_timeline_seek( struct alive_timeline *tl, time_t start, 
+                          time_t end);
+// fills in the next event and returns 1, or returns 0 at the end
+int alive_timeline_next( struct alive_timeline *tl,
+                         struct alive_timeline_event *event);
+void alive_free_timeline( struct alive_timeline *tl);
+
+// A burst is a run of events of one type where each one has at least
+// threshold of that type (itself included) in the window seconds up to
+// it, like a power blip making many IOCs fail and then boot.  A burst
+// after another of the same type starts only with events after it, so
+// no event is in two bursts.
+
+struct alive_burst_subnet
+{
+  uint32_t network;  // host order
+  int prefix_length;
+  int number;  // of the burst's IOCs in it
+};
+
+struct alive_burst
+{
+  uint32_t event;
+  time_t start;  // first and last event times
+  time_t end;
+  int number;  // of events
+  int number_iocs;
+  int *iocs;   // indices into the timeline's ioc_names, each once
+  int number_subnets;
+  struct alive_burst_subnet *subnets;  // those with the most IOCs first
+};
+
+// Finds the bursts between start and end, grouping the IOCs by subnets of
+// the given prefix length (24 if out of range).  Returns the number of
+// bursts, in order of start, with an allocated array in *bursts, or -1
+// on error.  This moves the timeline's place.
+int alive_timeline_bursts( struct alive_timeline *tl, time_t start,
+                           time_t end, int window, int threshold,
+                           int prefix_length, struct alive_burst **bursts);
+void alive_free_bursts( struct alive_burst *bursts, int number);
+
+/////////////////////////////////////////////
+
+// Following an IOC's event list as it grows, like tail -f.  A follower
+// remembers how many events it has seen and the last of them, so of each
+// new event response it decodes only the events after that one, into an
+// array it reuses.  If the list was cut from the front, it picks up
+// after the last event seen, and if that's gone, after its time.
+struct alive_event_follower;
+
+// The first response gives at most backlog of its latest events (all of
+// them if negative).
+struct alive_event_follower *alive_event_follower_create( int backlog);
+// Takes a raw event response (opcode 15), and returns the number of new
+// events, with them in *events, or -1 on error.  The events belong to
+// the follower, and are good until the next update.
+int alive_event_follower_update( struct alive_event_follower *follower,
+                                 char *data, int length,
+                                 struct alive_ioc_event_item **events);
+void alive_event_follower_free( struct alive_event_follower *follower);
+
+/////////////////////////////////////////////
+
+// Tracing of the client calls and their phases (name lookup, connect,
+// request write, first byte, each read, decode, and free), kept in a ring
+// for each thread and written as Chrome trace JSON, which chrome://tracing
+// and Perfetto can load.  The records argument sets the size of the rings
+// (default 4096), and only counts the first time; the oldest records are
+// overwritten when a ring fills.  Needs linking with -pthread.
+int alive_trace_start( int records);
+void alive_trace_stop( void);
+// forget what has been recorded so far
+void alive_trace_clear( void);
+// returns 0 on success
+int alive_trace_write( char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
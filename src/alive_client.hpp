@@ -0,0 +1,482 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Header-only C++17 wrapper for the alive client library.  The owner
+// classes (Db, DetailedIoc, EventDb) are move-only and free the C
+// structures when destroyed; everything else is a view into them and
+// must not outlive its owner.  Strings are returned as string_view
+// pointing at the library's own memory, so nothing is copied.
+
+#ifndef ALIVE_CLIENT_HPP
+#define ALIVE_CLIENT_HPP 1
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "alive_client.h"
+
+
+namespace alive
+{
+
+namespace detail
+{
+  inline std::string_view view( const char *s)
+  {
+    return (s == nullptr) ? std::string_view() : std::string_view( s);
+  }
+
+  // Iterator over a C array, handing out View objects made from each
+  // element's address.
+  template <class View, class Item>
+  class array_iterator
+  {
+  public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = View;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = View;
+
+    array_iterator() = default;
+    explicit array_iterator( Item *p) : p_(p) {}
+
+    View operator*() const { return View( p_); }
+    View operator[]( difference_type n) const { return View( p_ + n); }
+    array_iterator &operator++() { ++p_; return *this; }
+    array_iterator operator++(int) { array_iterator t = *this; ++p_; return t; }
+    array_iterator &operator--() { --p_; return *this; }
+    array_iterator operator--(int) { array_iterator t = *this; --p_; return t; }
+    array_iterator &operator+=( difference_type n) { p_ += n; return *this; }
+    array_iterator &operator-=( difference_type n) { p_ -= n; return *this; }
+    array_iterator operator+( difference_type n) const { return array_iterator( p_ + n); }
+    array_iterator operator-( difference_type n) const { return array_iterator( p_ - n); }
+    difference_type operator-( const array_iterator &o) const { return p_ - o.p_; }
+    bool operator==( const array_iterator &o) const { return p_ == o.p_; }
+    bool operator!=( const array_iterator &o) const { return p_ != o.p_; }
+    bool operator<( const array_iterator &o) const { return p_ < o.p_; }
+
+  private:
+    Item *p_ = nullptr;
+  };
+
+  template <class Iterator>
+  class range
+  {
+  public:
+    range( Iterator b, Iterator e) : begin_(b), end_(e) {}
+    Iterator begin() const { return begin_; }
+    Iterator end() const { return end_; }
+    std::size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    auto operator[]( std::size_t n) const { return begin_[n]; }
+
+  private:
+    Iterator begin_, end_;
+  };
+
+  // Converts a list of names to the char * array the C API wants.  The
+  // names must be NUL terminated, so std::string or const char *.
+  template <class Names>
+  std::vector<char *> name_array( const Names &names)
+  {
+    std::vector<char *> v;
+
+    for( const auto &n : names)
+      {
+        if constexpr (std::is_convertible_v<decltype(n), const char *>)
+          v.push_back( const_cast<char *>( static_cast<const char *>( n)));
+        else
+          v.push_back( const_cast<char *>( n.c_str()));
+      }
+    return v;
+  }
+}
+
+
+/////////////////////////////////////////////
+// Operating system parameters
+
+class VxWorksParams
+{
+public:
+  explicit VxWorksParams( const alive_iocinfo_extra_vxworks *p) : p_(p) {}
+
+  std::string_view boot_device() const { return detail::view( p_->bootdev); }
+  uint32_t unit_number() const { return p_->unitnum; }
+  uint32_t processor_number() const { return p_->procnum; }
+  std::string_view boot_host_name() const { return detail::view( p_->boothost_name); }
+  std::string_view boot_file() const { return detail::view( p_->bootfile); }
+  std::string_view address() const { return detail::view( p_->address); }
+  std::string_view backplane_address() const { return detail::view( p_->backplane_address); }
+  std::string_view boot_host_address() const { return detail::view( p_->boothost_address); }
+  std::string_view gateway_address() const { return detail::view( p_->gateway_address); }
+  uint32_t flags() const { return p_->flags; }
+  std::string_view target_name() const { return detail::view( p_->target_name); }
+  std::string_view startup_script() const { return detail::view( p_->startup_script); }
+  std::string_view other() const { return detail::view( p_->other); }
+
+  const alive_iocinfo_extra_vxworks *get() const { return p_; }
+
+private:
+  const alive_iocinfo_extra_vxworks *p_;
+};
+
+class LinuxParams
+{
+public:
+  explicit LinuxParams( const alive_iocinfo_extra_linux *p) : p_(p) {}
+
+  std::string_view user() const { return detail::view( p_->user); }
+  std::string_view group() const { return detail::view( p_->group); }
+  std::string_view hostname() const { return detail::view( p_->hostname); }
+
+  const alive_iocinfo_extra_linux *get() const { return p_; }
+
+private:
+  const alive_iocinfo_extra_linux *p_;
+};
+
+class DarwinParams
+{
+public:
+  explicit DarwinParams( const alive_iocinfo_extra_darwin *p) : p_(p) {}
+
+  std::string_view user() const { return detail::view( p_->user); }
+  std::string_view group() const { return detail::view( p_->group); }
+  std::string_view hostname() const { return detail::view( p_->hostname); }
+
+  const alive_iocinfo_extra_darwin *get() const { return p_; }
+
+private:
+  const alive_iocinfo_extra_darwin *p_;
+};
+
+class WindowsParams
+{
+public:
+  explicit WindowsParams( const alive_iocinfo_extra_windows *p) : p_(p) {}
+
+  std::string_view user() const { return detail::view( p_->user); }
+  std::string_view machine() const { return detail::view( p_->machine); }
+
+  const alive_iocinfo_extra_windows *get() const { return p_; }
+
+private:
+  const alive_iocinfo_extra_windows *p_;
+};
+
+// std::monostate for GENERIC or unknown types
+using OsParams = std::variant<std::monostate, VxWorksParams, LinuxParams,
+                              DarwinParams, WindowsParams>;
+
+
+/////////////////////////////////////////////
+// Environment
+
+class EnvVar
+{
+public:
+  EnvVar( const alive_env *env, int i) : env_(env), i_(i) {}
+
+  std::string_view key() const { return detail::view( env_->envvar_key[i_]); }
+  std::string_view value() const { return detail::view( env_->envvar_value[i_]); }
+
+private:
+  const alive_env *env_;
+  int i_;
+};
+
+class Env
+{
+public:
+  class iterator
+  {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = EnvVar;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = EnvVar;
+
+    iterator( const alive_env *env, int i) : env_(env), i_(i) {}
+    EnvVar operator*() const { return EnvVar( env_, i_); }
+    iterator &operator++() { ++i_; return *this; }
+    iterator operator++(int) { iterator t = *this; ++i_; return t; }
+    bool operator==( const iterator &o) const { return i_ == o.i_; }
+    bool operator!=( const iterator &o) const { return i_ != o.i_; }
+
+  private:
+    const alive_env *env_;
+    int i_;
+  };
+
+  explicit Env( const alive_env *env) : env_(env) {}
+
+  // an IOC may have no environment recorded
+  explicit operator bool() const { return env_ != nullptr; }
+
+  std::size_t size() const { return (env_ == nullptr) ? 0 : env_->number_envvar; }
+  iterator begin() const { return iterator( env_, 0); }
+  iterator end() const { return iterator( env_, size()); }
+
+  std::optional<std::string_view> find( std::string_view key) const
+  {
+    for( std::size_t i = 0; i < size(); i++)
+      if( detail::view( env_->envvar_key[i]) == key)
+        return detail::view( env_->envvar_value[i]);
+    return std::nullopt;
+  }
+
+  alive_os_type os_type() const
+  {
+    return (env_ == nullptr) ? GENERIC : (alive_os_type) env_->extra_type;
+  }
+
+  OsParams os_params() const
+  {
+    if( (env_ == nullptr) || (env_->extra == nullptr) )
+      return std::monostate();
+    switch( env_->extra_type)
+      {
+      case VXWORKS:
+        return VxWorksParams( static_cast<const alive_iocinfo_extra_vxworks *>( env_->extra));
+      case LINUX:
+        return LinuxParams( static_cast<const alive_iocinfo_extra_linux *>( env_->extra));
+      case DARWIN:
+        return DarwinParams( static_cast<const alive_iocinfo_extra_darwin *>( env_->extra));
+      case WINDOWS:
+        return WindowsParams( static_cast<const alive_iocinfo_extra_windows *>( env_->extra));
+      }
+    return std::monostate();
+  }
+
+  const alive_env *get() const { return env_; }
+
+private:
+  const alive_env *env_;
+};
+
+
+/////////////////////////////////////////////
+// Database
+
+class Ioc
+{
+public:
+  explicit Ioc( const alive_ioc *p) : p_(p) {}
+
+  std::string_view name() const { return detail::view( p_->ioc_name); }
+  alive_statuses status() const { return (alive_statuses) p_->status; }
+  const unsigned char *ip_address() const { return p_->ip_address; }
+  uint32_t raw_ip_address() const { return p_->raw_ip_address; }
+  time_t time_value() const { return p_->time_value; }
+  uint32_t user_msg() const { return p_->user_msg; }
+  Env environment() const { return Env( p_->environment); }
+
+  const alive_ioc *get() const { return p_; }
+
+private:
+  const alive_ioc *p_;
+};
+
+class Db
+{
+public:
+  using iterator = detail::array_iterator<Ioc, const alive_ioc>;
+
+  Db() = default;
+  explicit Db( alive_db *db) : db_(db) {}
+
+  explicit operator bool() const { return db_ != nullptr; }
+
+  time_t current_time() const { return db_->current_time; }
+  time_t start_time() const { return db_->start_time; }
+
+  std::size_t size() const { return (db_ == nullptr) ? 0 : db_->number_ioc; }
+  bool empty() const { return size() == 0; }
+  iterator begin() const { return iterator( (db_ == nullptr) ? nullptr : db_->ioc); }
+  iterator end() const { return begin() + size(); }
+  Ioc operator[]( std::size_t i) const { return Ioc( &db_->ioc[i]); }
+
+  // Seconds the IOC has been in its current status.
+  uint32_t status_time( const Ioc &ioc) const
+  {
+    return alive_ioc_status_time( db_.get(), const_cast<alive_ioc *>( ioc.get()));
+  }
+
+  alive_db *get() const { return db_.get(); }
+  alive_db *release() { return db_.release(); }
+
+private:
+  struct deleter
+  {
+    void operator()( alive_db *p) const { alive_free_db( p); }
+  };
+  std::unique_ptr<alive_db, deleter> db_;
+};
+
+
+/////////////////////////////////////////////
+// Debug and conflict information
+
+class Instance
+{
+public:
+  explicit Instance( const alive_instance *p) : p_(p) {}
+
+  alive_instance_statuses status() const { return (alive_instance_statuses) p_->status; }
+  const unsigned char *ip_address() const { return p_->ip_address; }
+  uint32_t raw_ip_address() const { return p_->raw_ip_address; }
+  uint16_t origin_port() const { return p_->origin_port; }
+  uint32_t heartbeat() const { return p_->heartbeat; }
+  uint16_t period() const { return p_->period; }
+  uint32_t incarnation() const { return p_->incarnation; }
+  uint32_t boottime() const { return p_->boottime; }
+  uint32_t timestamp() const { return p_->timestamp; }
+  uint16_t reply_port() const { return p_->reply_port; }
+  uint32_t user_msg() const { return p_->user_msg; }
+  Env environment() const { return Env( p_->environment); }
+
+  const alive_instance *get() const { return p_; }
+
+private:
+  const alive_instance *p_;
+};
+
+class DetailedIoc
+{
+public:
+  using iterator = detail::array_iterator<Instance, const alive_instance>;
+
+  DetailedIoc() = default;
+  explicit DetailedIoc( alive_detailed_ioc *p) : p_(p) {}
+
+  explicit operator bool() const { return p_ != nullptr; }
+
+  time_t current_time() const { return p_->current_time; }
+  time_t start_time() const { return p_->start_time; }
+  std::string_view name() const { return detail::view( p_->ioc_name); }
+  alive_statuses overall_status() const { return (alive_statuses) p_->overall_status; }
+  time_t overall_time_value() const { return p_->overall_time_value; }
+
+  detail::range<iterator> instances() const
+  {
+    if( p_ == nullptr)
+      return detail::range<iterator>( iterator(), iterator());
+    return detail::range<iterator>( iterator( p_->instances),
+                                    iterator( p_->instances + p_->number_instances));
+  }
+
+  alive_detailed_ioc *get() const { return p_.get(); }
+  alive_detailed_ioc *release() { return p_.release(); }
+
+private:
+  struct deleter
+  {
+    void operator()( alive_detailed_ioc *p) const { alive_free_detailed( p); }
+  };
+  std::unique_ptr<alive_detailed_ioc, deleter> p_;
+};
+
+
+/////////////////////////////////////////////
+// Events
+
+class EventDb
+{
+public:
+  using iterator = const alive_ioc_event_item *;
+
+  EventDb() = default;
+  explicit EventDb( alive_ioc_event_db *p) : p_(p) {}
+
+  explicit operator bool() const { return p_ != nullptr; }
+
+  time_t current_time() const { return p_->current_time; }
+  time_t start_time() const { return p_->start_time; }
+
+  std::size_t size() const { return (p_ == nullptr) ? 0 : p_->number; }
+  bool empty() const { return size() == 0; }
+  iterator begin() const { return (p_ == nullptr) ? nullptr : p_->instances; }
+  iterator end() const { return begin() + size(); }
+  const alive_ioc_event_item &operator[]( std::size_t i) const { return p_->instances[i]; }
+
+  alive_ioc_event_db *get() const { return p_.get(); }
+  alive_ioc_event_db *release() { return p_.release(); }
+
+private:
+  struct deleter
+  {
+    void operator()( alive_ioc_event_db *p) const { alive_free_ioc_event_db( p); }
+  };
+  std::unique_ptr<alive_ioc_event_db, deleter> p_;
+};
+
+
+/////////////////////////////////////////////
+// Fetching.  These return an empty (false) owner on failure, the same
+// as the C functions returning NULL.
+
+inline Db get_db( const std::string &server, int port)
+{
+  return Db( alive_get_db( const_cast<char *>( server.c_str()), port));
+}
+
+template <class Names>
+inline Db get_iocs( const std::string &server, int port, const Names &names)
+{
+  std::vector<char *> v = detail::name_array( names);
+
+  if( v.empty())
+    return Db();
+  return Db( alive_get_iocs( const_cast<char *>( server.c_str()), port,
+                             v.size(), v.data()));
+}
+
+inline Db get_ioc( const std::string &server, int port, const std::string &name)
+{
+  return Db( alive_get_ioc( const_cast<char *>( server.c_str()), port,
+                            const_cast<char *>( name.c_str())));
+}
+
+inline DetailedIoc get_debug( const std::string &server, int port,
+                              const std::string &name)
+{
+  return DetailedIoc( alive_get_debug( const_cast<char *>( server.c_str()), port,
+                                       const_cast<char *>( name.c_str())));
+}
+
+inline DetailedIoc get_conflicts( const std::string &server, int port,
+                                  const std::string &name)
+{
+  return DetailedIoc( alive_get_conflicts( const_cast<char *>( server.c_str()), port,
+                                           const_cast<char *>( name.c_str())));
+}
+
+inline EventDb get_events( const std::string &server, int port,
+                           const std::string &name)
+{
+  return EventDb( alive_get_ioc_event_db( const_cast<char *>( server.c_str()), port,
+                                          const_cast<char *>( name.c_str())));
+}
+
+}  // namespace alive
+
+#endif
@@ -0,0 +1,604 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// C++20 coroutine interface to the alive client library, built on the
+// non-blocking request functions and the owner classes from
+// alive_client.hpp.  Everything runs on one thread in an alive::Loop:
+//
+//   alive::Loop loop;
+//   alive::Client client( loop, "alive-host", 5679);
+//
+//   alive::Task<void> check( alive::Client &client)
+//   {
+//     alive::Db db = co_await client.db();
+//     std::vector<alive::Task<alive::EventDb>> tasks;
+//     for( alive::Ioc ioc : db)
+//       tasks.push_back( client.events( std::string( ioc.name())));
+//     std::vector<alive::EventDb> events = co_await alive::when_all( std::move( tasks));
+//   }
+//
+//   loop.run( check( client));
+//
+// A failed, timed out, or cancelled call gives an empty (false) owner.
+// Calls take a deadline and a std::stop_token; passing the caller's
+// Options down to the calls it makes propagates both.
+
+#ifndef ALIVE_CORO_HPP
+#define ALIVE_CORO_HPP 1
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <stop_token>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "alive_client.hpp"
+
+
+namespace alive
+{
+
+using Clock = std::chrono::steady_clock;
+
+
+/////////////////////////////////////////////
+// Lazily started task, resumed by whoever awaits it
+
+template <class T>
+class Task;
+
+namespace detail
+{
+  template <class T>
+  struct task_promise_base
+  {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter
+    {
+      bool await_ready() noexcept { return false; }
+      template <class P>
+      std::coroutine_handle<> await_suspend( std::coroutine_handle<P> h) noexcept
+      {
+        if( h.promise().continuation)
+          return h.promise().continuation;
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { exception = std::current_exception(); }
+  };
+
+  template <class T>
+  struct task_promise : task_promise_base<T>
+  {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value( T v) { value.emplace( std::move( v)); }
+    T result()
+    {
+      if( this->exception)
+        std::rethrow_exception( this->exception);
+      return std::move( *value);
+    }
+  };
+
+  template <>
+  struct task_promise<void> : task_promise_base<void>
+  {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result()
+    {
+      if( this->exception)
+        std::rethrow_exception( this->exception);
+    }
+  };
+}
+
+template <class T = void>
+class Task
+{
+public:
+  using promise_type = detail::task_promise<T>;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  Task() = default;
+  explicit Task( handle_type h) : h_(h) {}
+  Task( Task &&o) noexcept : h_( std::exchange( o.h_, nullptr)) {}
+  Task &operator=( Task &&o) noexcept
+  {
+    if( this != &o)
+      {
+        if( h_)
+          h_.destroy();
+        h_ = std::exchange( o.h_, nullptr);
+      }
+    return *this;
+  }
+  Task( const Task &) = delete;
+  Task &operator=( const Task &) = delete;
+  ~Task()
+  {
+    if( h_)
+      h_.destroy();
+  }
+
+  bool await_ready() const noexcept { return !h_ || h_.done(); }
+  std::coroutine_handle<> await_suspend( std::coroutine_handle<> waiter) noexcept
+  {
+    h_.promise().continuation = waiter;
+    return h_;
+  }
+  T await_resume() { return h_.promise().result(); }
+
+  handle_type handle() const { return h_; }
+
+private:
+  handle_type h_;
+};
+
+namespace detail
+{
+  template <class T>
+  Task<T> task_promise<T>::get_return_object()
+  {
+    return Task<T>( std::coroutine_handle<task_promise<T>>::from_promise( *this));
+  }
+
+  inline Task<void> task_promise<void>::get_return_object()
+  {
+    return Task<void>( std::coroutine_handle<task_promise<void>>::from_promise( *this));
+  }
+
+  // started immediately and destroys itself when finished
+  struct detached
+  {
+    struct promise_type
+    {
+      detached get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+}
+
+
+/////////////////////////////////////////////
+// Event loop
+
+struct Options
+{
+  Clock::time_point deadline = Clock::time_point::max();
+  std::stop_token stop;
+};
+
+class Loop
+{
+public:
+  // A pending call, living in the awaiting coroutine's frame.  If the
+  // frame is destroyed first, the call is withdrawn from the loop.
+  struct Operation
+  {
+    enum Result { Pending, Done, Failed, TimedOut, Cancelled };
+
+    int type = 0;
+    std::string server;
+    int port = 0;
+    std::vector<std::string> names;
+    Clock::time_point deadline;
+
+    alive_request *request = nullptr;
+    Result result = Pending;
+    std::coroutine_handle<> waiter;
+    Loop *loop = nullptr;  // from being submitted until resumed
+
+    std::atomic<bool> cancel_requested{ false };
+    struct waker
+    {
+      Operation *op;
+      Loop *loop;
+      void operator()() noexcept
+      {
+        op->cancel_requested.store( true);
+        loop->wake();
+      }
+    };
+    std::optional<std::stop_callback<waker>> stop_callback;
+
+    Operation() = default;
+    Operation( const Operation &) = delete;
+    ~Operation()
+    {
+      if( loop != nullptr)
+        loop->withdraw( this);
+      alive_request_free( request);
+    }
+  };
+
+  // at most max_in_flight connections are open at once
+  explicit Loop( std::size_t max_in_flight = 256)
+    : max_in_flight_( max_in_flight)
+  {
+    if( pipe( wake_pipe_) == 0)
+      {
+        fcntl( wake_pipe_[0], F_SETFL, O_NONBLOCK);
+        fcntl( wake_pipe_[1], F_SETFL, O_NONBLOCK);
+      }
+  }
+  Loop( const Loop &) = delete;
+  ~Loop()
+  {
+    for( Operation *op : queued_)
+      op->loop = nullptr;
+    for( Operation *op : active_)
+      op->loop = nullptr;
+    close( wake_pipe_[0]);
+    close( wake_pipe_[1]);
+  }
+
+  // Runs the loop until the task finishes, returning its result.
+  template <class T>
+  T run( Task<T> task)
+  {
+    auto h = task.handle();
+
+    h.resume();
+    while( !h.done() && (!queued_.empty() || !active_.empty()) )
+      run_once();
+    return task.await_resume();
+  }
+
+  void submit( Operation *op, Options &opt)
+  {
+    if( opt.stop.stop_possible())
+      op->stop_callback.emplace( opt.stop, Operation::waker{ op, this});
+    op->loop = this;
+    queued_.push_back( op);
+  }
+
+  // drops an operation whose coroutine was destroyed before it finished
+  void withdraw( Operation *op)
+  {
+    queued_.erase( std::remove( queued_.begin(), queued_.end(), op),
+                   queued_.end());
+    active_.erase( std::remove( active_.begin(), active_.end(), op),
+                   active_.end());
+    std::replace( finished_.begin(), finished_.end(), op,
+                  (Operation *) nullptr);
+    op->loop = nullptr;
+  }
+
+  // safe to call from another thread
+  void wake()
+  {
+    char c = 0;
+    (void) !write( wake_pipe_[1], &c, 1);
+  }
+
+private:
+  void run_once()
+  {
+    std::vector<Operation *> &finished = finished_;
+    std::vector<pollfd> fds;
+    Clock::time_point now, nearest;
+    int timeout;
+
+    // start what we have room for
+    while( !queued_.empty() && (active_.size() < max_in_flight_) )
+      {
+        Operation *op = queued_.front();
+        std::vector<char *> names;
+
+        queued_.pop_front();
+        for( auto &n : op->names)
+          names.push_back( n.data());
+        op->request = alive_request_start( op->server.data(), op->port,
+                                           op->type, names.size(),
+                                           names.data());
+        if( op->request == nullptr)
+          {
+            op->result = Operation::Failed;
+            finished.push_back( op);
+          }
+        else
+          active_.push_back( op);
+      }
+
+    now = Clock::now();
+    nearest = Clock::time_point::max();
+    fds.push_back( pollfd{ wake_pipe_[0], POLLIN, 0});
+    for( Operation *op : active_)
+      {
+        fds.push_back( pollfd{ alive_request_fd( op->request),
+              (short) alive_request_poll_events( op->request), 0});
+        nearest = std::min( nearest, op->deadline);
+      }
+
+    if( !finished.empty())
+      timeout = 0;
+    else if( nearest == Clock::time_point::max())
+      timeout = -1;
+    else if( nearest <= now)
+      timeout = 0;
+    else
+      timeout = std::chrono::ceil<std::chrono::milliseconds>( nearest - now).count();
+
+    if( poll( fds.data(), fds.size(), timeout) > 0 && (fds[0].revents & POLLIN))
+      {
+        char buf[64];
+        while( read( wake_pipe_[0], buf, sizeof(buf)) > 0)
+          ;
+      }
+
+    now = Clock::now();
+    for( std::size_t i = 0; i < active_.size(); i++)
+      {
+        Operation *op = active_[i];
+        int ret = 0;
+
+        if( fds[i+1].revents)
+          ret = alive_request_process( op->request);
+        if( ret > 0)
+          op->result = Operation::Done;
+        else if( ret < 0)
+          op->result = Operation::Failed;
+        else if( op->cancel_requested.load())
+          op->result = Operation::Cancelled;
+        else if( op->deadline <= now)
+          op->result = Operation::TimedOut;
+        else
+          continue;
+        finished.push_back( op);
+      }
+    // queued ones can be cancelled or time out before starting
+    for( auto it = queued_.begin(); it != queued_.end(); )
+      {
+        Operation *op = *it;
+        if( op->cancel_requested.load())
+          op->result = Operation::Cancelled;
+        else if( op->deadline <= now)
+          op->result = Operation::TimedOut;
+        else
+          {
+            ++it;
+            continue;
+          }
+        finished.push_back( op);
+        it = queued_.erase( it);
+      }
+
+    active_.erase( std::remove_if( active_.begin(), active_.end(),
+                                   [](Operation *op)
+                                   { return op->result != Operation::Pending; }),
+                   active_.end());
+
+    // Resumed last, since they may submit more.  Resuming one can
+    // destroy others still to come, which withdraw() leaves as null.
+    for( std::size_t i = 0; i < finished.size(); i++)
+      {
+        Operation *op = finished[i];
+        if( op == nullptr)
+          continue;
+        op->loop = nullptr;
+        op->stop_callback.reset();
+        op->waiter.resume();
+      }
+    finished.clear();
+  }
+
+  std::size_t max_in_flight_;
+  std::deque<Operation *> queued_;
+  std::vector<Operation *> active_;
+  std::vector<Operation *> finished_;  // in run_once(), to be resumed
+  int wake_pipe_[2] = { -1, -1 };
+};
+
+
+/////////////////////////////////////////////
+// Client
+
+class Client
+{
+public:
+  // timeout applies to each call unless the Options deadline is sooner
+  Client( Loop &loop, std::string server, int port,
+          Clock::duration timeout = std::chrono::seconds( 30))
+    : loop_( loop), server_( std::move( server)), port_( port),
+      timeout_( timeout)
+  {
+  }
+
+  Task<Db> db( Options opt = {})
+  {
+    Loop::Operation op;
+    co_await request( op, REQUEST_ALL_IOCS, {}, opt);
+    co_return Db( decode( op, alive_decode_db));
+  }
+
+  Task<Db> iocs( std::vector<std::string> names, Options opt = {})
+  {
+    Loop::Operation op;
+    int type = (names.size() == 1) ? REQUEST_ONE_IOC : REQUEST_SOME_IOCS;
+    if( names.empty())
+      co_return Db();
+    co_await request( op, type, std::move( names), opt);
+    co_return Db( decode( op, alive_decode_db));
+  }
+
+  Task<Db> ioc( std::string name, Options opt = {})
+  {
+    Loop::Operation op;
+    co_await request( op, REQUEST_ONE_IOC, std::vector<std::string>( 1, std::move( name)), opt);
+    co_return Db( decode( op, alive_decode_db));
+  }
+
+  Task<EventDb> events( std::string name, Options opt = {})
+  {
+    Loop::Operation op;
+    co_await request( op, REQUEST_EVENTS, std::vector<std::string>( 1, std::move( name)), opt);
+    co_return EventDb( decode( op, alive_decode_ioc_event_db));
+  }
+
+  Task<DetailedIoc> debug( std::string name, Options opt = {})
+  {
+    Loop::Operation op;
+    co_await request( op, REQUEST_DEBUG, std::vector<std::string>( 1, std::move( name)), opt);
+    co_return DetailedIoc( decode( op, alive_decode_detailed));
+  }
+
+  Task<DetailedIoc> conflicts( std::string name, Options opt = {})
+  {
+    Loop::Operation op;
+    co_await request( op, REQUEST_CONFLICTS, std::vector<std::string>( 1, std::move( name)), opt);
+    co_return DetailedIoc( decode( op, alive_decode_detailed));
+  }
+
+private:
+  struct request_awaiter
+  {
+    Loop &loop;
+    Loop::Operation &op;
+    Options &opt;
+
+    bool await_ready() const noexcept
+    {
+      if( opt.stop.stop_requested())
+        {
+          op.result = Loop::Operation::Cancelled;
+          return true;
+        }
+      return false;
+    }
+    void await_suspend( std::coroutine_handle<> h)
+    {
+      op.waiter = h;
+      loop.submit( &op, opt);
+    }
+    void await_resume() const noexcept {}
+  };
+
+  request_awaiter request( Loop::Operation &op, int type,
+                           std::vector<std::string> names, Options &opt)
+  {
+    op.type = type;
+    op.server = server_;
+    op.port = port_;
+    op.names = std::move( names);
+    op.deadline = std::min( opt.deadline, Clock::now() + timeout_);
+    return request_awaiter{ loop_, op, opt};
+  }
+
+  template <class R>
+  static R *decode( Loop::Operation &op, R *(*decoder)( char *, int))
+  {
+    char *data;
+    int length;
+
+    if( op.result != Loop::Operation::Done)
+      return nullptr;
+    data = alive_request_response( op.request, &length);
+    return (data == nullptr) ? nullptr : decoder( data, length);
+  }
+
+  Loop &loop_;
+  std::string server_;
+  int port_;
+  Clock::duration timeout_;
+};
+
+
+/////////////////////////////////////////////
+// Waiting on many tasks at once
+
+namespace detail
+{
+  struct when_all_state
+  {
+    std::size_t remaining;
+    std::coroutine_handle<> parent;
+  };
+
+  template <class T>
+  detached when_all_run( Task<T> &task, std::optional<T> &slot,
+                         std::exception_ptr &error, when_all_state &state)
+  {
+    try
+      {
+        slot.emplace( co_await task);
+      }
+    catch( ...)
+      {
+        error = std::current_exception();
+      }
+    if( --state.remaining == 0)
+      state.parent.resume();
+  }
+}
+
+// Runs the tasks concurrently, giving back their results in order.
+template <class T>
+Task<std::vector<T>> when_all( std::vector<Task<T>> tasks)
+{
+  std::vector<std::optional<T>> slots( tasks.size());
+  std::exception_ptr error;
+  detail::when_all_state state{ tasks.size() + 1, nullptr };
+
+  struct awaiter
+  {
+    std::vector<Task<T>> &tasks;
+    std::vector<std::optional<T>> &slots;
+    std::exception_ptr &error;
+    detail::when_all_state &state;
+
+    bool await_ready() const noexcept { return tasks.empty(); }
+    bool await_suspend( std::coroutine_handle<> h)
+    {
+      state.parent = h;
+      for( std::size_t i = 0; i < tasks.size(); i++)
+        detail::when_all_run( tasks[i], slots[i], error, state);
+      // the extra count keeps a child from resuming us before now
+      return --state.remaining != 0;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  co_await awaiter{ tasks, slots, error, state};
+  if( error)
+    std::rethrow_exception( error);
+
+  std::vector<T> results;
+  results.reserve( slots.size());
+  for( auto &s : slots)
+    results.push_back( std::move( *s));
+  co_return results;
+}
+
+}  // namespace alive
+
+#endif
@@ -0,0 +1,276 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "alive_client.h"
+
+
+// hash table of IOC indices, keyed by name, open addressing
+struct name_table
+{
+  int size;  // power of two
+  int *slots;  // -1 for empty
+};
+
+static uint32_t name_hash( char *name)
+{
+  uint32_t h = 2166136261u;
+
+  while( *name)
+    {
+      h ^= (unsigned char) *name++;
+      h *= 16777619u;
+    }
+  return h;
+}
+
+static int name_table_init( struct name_table *nt, struct alive_db *db)
+{
+  uint32_t h;
+  int i;
+
+  nt->size = 16;
+  while( nt->size < 2 * db->number_ioc)
+    nt->size <<= 1;
+  nt->slots = malloc( nt->size * sizeof( int));
+  if( nt->slots == NULL)
+    return 1;
+  memset( nt->slots, 0xff, nt->size * sizeof( int));
+
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      h = name_hash( db->ioc[i].ioc_name) & (nt->size - 1);
+      while( nt->slots[h] >= 0)
+        h = (h + 1) & (nt->size - 1);
+      nt->slots[h] = i;
+    }
+  return 0;
+}
+
+static int name_table_find( struct name_table *nt, struct alive_db *db,
+                            char *name)
+{
+  uint32_t h;
+
+  h = name_hash( name) & (nt->size - 1);
+  while( nt->slots[h] >= 0)
+    {
+      if( !strcmp( db->ioc[nt->slots[h]].ioc_name, name) )
+        return nt->slots[h];
+      h = (h + 1) & (nt->size - 1);
+    }
+  return -1;
+}
+
+
+static int string_differs( char *a, char *b)
+{
+  if( (a == NULL) || (b == NULL) )
+    return a != b;
+  return strcmp( a, b) != 0;
+}
+
+static int extra_differs( struct alive_env *a, struct alive_env *b)
+{
+  const struct alive_os_schema *schema;
+  char *fa, *fb;
+  int i;
+
+  if( a->extra_type != b->extra_type)
+    return 1;
+  if( (a->extra == NULL) || (b->extra == NULL) )
+    return a->extra != b->extra;
+
+  schema = alive_os_schema( a->extra_type);
+  if( schema == NULL)
+    return 0;
+  for( i = 0; i < schema->number; i++)
+    {
+      fa = (char *) a->extra + schema->params[i].offset;
+      fb = (char *) b->extra + schema->params[i].offset;
+      if( schema->params[i].type == PARAM_UINT32)
+        {
+          if( *((uint32_t *) fa) != *((uint32_t *) fb) )
+            return 1;
+        }
+      else if( string_differs( *((char **) fa), *((char **) fb)) )
+        return 1;
+    }
+  return 0;
+}
+
+
+static int env_find_key( struct alive_env *env, char *key, int hint)
+{
+  int i;
+
+  // environments usually come in the same order each time
+  if( (hint < env->number_envvar) &&
+      !string_differs( env->envvar_key[hint], key) )
+    return hint;
+  for( i = 0; i < env->number_envvar; i++)
+    if( !string_differs( env->envvar_key[i], key) )
+      return i;
+  return -1;
+}
+
+// fills in change->keys and the env flags
+static int diff_env( struct alive_env *a, struct alive_env *b,
+                     struct alive_ioc_change *change)
+{
+  int i, j;
+  int max;
+
+  if( (a == NULL) && (b == NULL) )
+    return 0;
+
+  if( (a == NULL) || (b == NULL) )
+    {
+      // environment appeared or went away, all keys changed
+      struct alive_env *e;
+
+      e = (a == NULL) ? b : a;
+      change->flags |= CHANGE_ENV;
+      if( e->extra_type != GENERIC)
+        change->flags |= CHANGE_OS_PARAMS;
+      if( !e->number_envvar)
+        return 0;
+      change->keys = malloc( e->number_envvar * sizeof( char *));
+      if( change->keys == NULL)
+        return 1;
+      for( i = 0; i < e->number_envvar; i++)
+        change->keys[i] = e->envvar_key[i];
+      change->number_keys = e->number_envvar;
+      return 0;
+    }
+
+  if( extra_differs( a, b) )
+    change->flags |= CHANGE_OS_PARAMS;
+
+  max = a->number_envvar + b->number_envvar;
+  if( !max)
+    return 0;
+  change->keys = malloc( max * sizeof( char *));
+  if( change->keys == NULL)
+    return 1;
+
+  for( i = 0; i < b->number_envvar; i++)
+    {
+      j = env_find_key( a, b->envvar_key[i], i);
+      if( (j < 0) || string_differs( a->envvar_value[j], b->envvar_value[i]))
+        change->keys[change->number_keys++] = b->envvar_key[i];
+    }
+  // removed keys
+  for( i = 0; i < a->number_envvar; i++)
+    if( env_find_key( b, a->envvar_key[i], i) < 0)
+      change->keys[change->number_keys++] = a->envvar_key[i];
+
+  if( change->number_keys)
+    change->flags |= CHANGE_ENV;
+  else
+    {
+      free( change->keys);
+      change->keys = NULL;
+    }
+
+  return 0;
+}
+
+
+struct alive_db_diff *alive_db_diff( struct alive_db *old_db,
+                                     struct alive_db *new_db)
+{
+  struct alive_db_diff *diff;
+  struct alive_ioc_change *change;
+  struct alive_ioc *oi, *ni;
+  struct name_table nt;
+  char *matched;
+  int i, j;
+
+  diff = calloc( 1, sizeof( struct alive_db_diff));
+  if( diff == NULL)
+    return NULL;
+  // at most every new IOC changed, and every old one was removed
+  diff->changes = calloc( old_db->number_ioc + new_db->number_ioc + 1,
+                          sizeof( struct alive_ioc_change));
+  matched = calloc( old_db->number_ioc + 1, sizeof( char));
+  if( (diff->changes == NULL) || (matched == NULL) ||
+      name_table_init( &nt, old_db) )
+    {
+      free( matched);
+      alive_free_db_diff( diff);
+      return NULL;
+    }
+
+  for( i = 0; i < new_db->number_ioc; i++)
+    {
+      ni = &(new_db->ioc[i]);
+      change = &(diff->changes[diff->number]);
+
+      j = name_table_find( &nt, old_db, ni->ioc_name);
+      if( j < 0)
+        {
+          change->flags = CHANGE_ADDED;
+          change->new_ioc = ni;
+          diff->number++;
+          continue;
+        }
+      matched[j] = 1;
+      oi = &(old_db->ioc[j]);
+
+      if( oi->status != ni->status)
+        change->flags |= CHANGE_STATUS;
+      if( oi->time_value != ni->time_value)
+        change->flags |= CHANGE_TIME;
+      if( oi->raw_ip_address != ni->raw_ip_address)
+        change->flags |= CHANGE_IP;
+      if( oi->user_msg != ni->user_msg)
+        change->flags |= CHANGE_USER_MSG;
+      diff_env( oi->environment, ni->environment, change);
+
+      if( change->flags)
+        {
+          change->old_ioc = oi;
+          change->new_ioc = ni;
+          diff->number++;
+        }
+    }
+
+  for( j = 0; j < old_db->number_ioc; j++)
+    if( !matched[j])
+      {
+        change = &(diff->changes[diff->number++]);
+        change->flags = CHANGE_REMOVED;
+        change->old_ioc = &(old_db->ioc[j]);
+      }
+
+  free( nt.slots);
+  free( matched);
+
+  return diff;
+}
+
+void alive_free_db_diff( struct alive_db_diff *diff)
+{
+  int i;
+
+  if( diff == NULL)
+    return;
+  if( diff->changes != NULL)
+    for( i = 0; i < diff->number; i++)
+      free( diff->changes[i].keys);
+  free( diff->changes);
+  free( diff);
+}
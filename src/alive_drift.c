@@ -0,0 +1,544 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Each environment variable name and each OS parameter is a key, and each
+// different value of a key is looked up in one hash table by its hash
+// with the key's number mixed in.  One pass over the IOCs gives every
+// (value, IOC) pair, which are then laid out by value with a counting
+// sort, so nothing is ever compared IOC against IOC.  IOCs that could
+// have a key but don't are gathered afterwards, only for the keys that
+// have any.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alive_client.h"
+
+
+struct build_key
+{
+  int id;        // from before sorting, which the values refer to
+  char *name;
+  const struct alive_os_schema *schema;
+  const struct alive_os_param *param;
+  int os_type;
+  int number_iocs;
+  int number_values;
+  int present;   // IOCs with a value
+  int last_ioc;  // so a variable given twice counts once
+  int first;     // place of its values in value_list
+  int next;
+};
+
+struct build_value
+{
+  int key;
+  char *value;
+  uint32_t number_value;
+  uint32_t hash;
+  int place;     // in value_list
+};
+
+struct pair
+{
+  int value;
+  int ioc;
+};
+
+struct os_keys
+{
+  int os_type;
+  int first;
+};
+
+struct builder
+{
+  struct build_key *keys;
+  int number_keys, size_keys;
+  int *key_slots;  // by name, -1 for empty
+  int key_slots_size;
+
+  struct build_value *values;
+  int number_values, size_values;
+  int *value_slots;
+  int value_slots_size;
+
+  struct pair *pairs;
+  int number_pairs, size_pairs;
+
+  struct os_keys *os;
+  int number_os;
+};
+
+
+static uint32_t string_hash( char *s, uint32_t h)
+{
+  while( *s)
+    {
+      h ^= (unsigned char) *s++;
+      h *= 16777619u;
+    }
+  return h;
+}
+
+// makes room for one more, returns 0 on success
+static int grow( void **p, int *size, int number, size_t item)
+{
+  void *q;
+  int n;
+
+  if( number < *size)
+    return 0;
+  n = *size ? 2 * *size : 64;
+  q = realloc( *p, n * item);
+  if( q == NULL)
+    return 1;
+  *p = q;
+  *size = n;
+  return 0;
+}
+
+// doubles an open addressing table, where hash gives each entry's hash,
+// or returns 0 for one not in the table
+static int rehash( int **slots, int *size, int number,
+                   int (*hash)( struct builder *, int, uint32_t *),
+                   struct builder *b)
+{
+  int *s;
+  uint32_t h;
+  int n, i;
+
+  n = *size ? 2 * *size : 64;
+  s = malloc( n * sizeof( int));
+  if( s == NULL)
+    return 1;
+  memset( s, 0xff, n * sizeof( int));
+  for( i = 0; i < number; i++)
+    {
+      if( !hash( b, i, &h) )
+        continue;
+      h &= n - 1;
+      while( s[h] >= 0)
+        h = (h + 1) & (n - 1);
+      s[h] = i;
+    }
+  free( *slots);
+  *slots = s;
+  *size = n;
+  return 0;
+}
+
+// OS parameters aren't looked up by name
+static int key_hash( struct builder *b, int i, uint32_t *h)
+{
+  if( b->keys[i].name == NULL)
+    return 0;
+  *h = string_hash( b->keys[i].name, 2166136261u);
+  return 1;
+}
+
+static int value_hash( struct builder *b, int i, uint32_t *h)
+{
+  *h = b->values[i].hash;
+  return 1;
+}
+
+static int new_key( struct builder *b)
+{
+  struct build_key *key;
+
+  if( grow( (void **) &b->keys, &b->size_keys, b->number_keys,
+            sizeof( struct build_key)) )
+    return -1;
+  key = &(b->keys[b->number_keys]);
+  memset( key, 0, sizeof( struct build_key));
+  key->id = b->number_keys;
+  key->os_type = -1;
+  key->last_ioc = -1;
+  return b->number_keys++;
+}
+
+static int find_variable( struct builder *b, char *name)
+{
+  uint32_t h;
+  int k;
+
+  if( (2 * (b->number_keys + 1) > b->key_slots_size) &&
+      rehash( &b->key_slots, &b->key_slots_size, b->number_keys, key_hash,
+              b) )
+    return -1;
+
+  h = string_hash( name, 2166136261u) & (b->key_slots_size - 1);
+  while( (k = b->key_slots[h]) >= 0)
+    {
+      if( (b->keys[k].name != NULL) && !strcmp( b->keys[k].name, name) )
+        return k;
+      h = (h + 1) & (b->key_slots_size - 1);
+    }
+
+  k = new_key( b);
+  if( k < 0)
+    return -1;
+  b->keys[k].name = name;
+  b->key_slots[h] = k;
+  return k;
+}
+
+// the first of the keys for the parameters of an OS type, made together
+static int find_os_keys( struct builder *b, int os_type,
+                         const struct alive_os_schema *schema)
+{
+  struct os_keys *o;
+  int first, i, k;
+
+  for( i = 0; i < b->number_os; i++)
+    if( b->os[i].os_type == os_type)
+      return b->os[i].first;
+
+  o = realloc( b->os, (b->number_os + 1) * sizeof( struct os_keys));
+  if( o == NULL)
+    return -1;
+  b->os = o;
+
+  first = b->number_keys;
+  for( i = 0; i < schema->number; i++)
+    {
+      k = new_key( b);
+      if( k < 0)
+        return -1;
+      b->keys[k].schema = schema;
+      b->keys[k].param = &(schema->params[i]);
+      b->keys[k].os_type = os_type;
+    }
+  b->os[b->number_os].os_type = os_type;
+  b->os[b->number_os].first = first;
+  b->number_os++;
+  return first;
+}
+
+// adds the (value, IOC) pair, with value NULL for a number
+static int add_value( struct builder *b, int key, char *value,
+                      uint32_t number_value, int ioc)
+{
+  struct build_value *v;
+  uint32_t hash, h;
+  int i;
+
+  if( value != NULL)
+    hash = string_hash( value, 2166136261u ^ (key * 0x9e3779b1u));
+  else
+    hash = (number_value ^ (key * 0x9e3779b1u)) * 0x85ebca6bu;
+  hash ^= hash >> 15;
+
+  if( (2 * (b->number_values + 1) > b->value_slots_size) &&
+      rehash( &b->value_slots, &b->value_slots_size, b->number_values,
+              value_hash, b) )
+    return 1;
+
+  h = hash & (b->value_slots_size - 1);
+  while( (i = b->value_slots[h]) >= 0)
+    {
+      v = &(b->values[i]);
+      if( (v->hash == hash) && (v->key == key) &&
+          ((value != NULL) ? !strcmp( v->value, value) :
+           (v->number_value == number_value)) )
+        break;
+      h = (h + 1) & (b->value_slots_size - 1);
+    }
+  if( i < 0)
+    {
+      if( grow( (void **) &b->values, &b->size_values, b->number_values,
+                sizeof( struct build_value)) )
+        return 1;
+      i = b->number_values++;
+      v = &(b->values[i]);
+      v->key = key;
+      v->value = value;
+      v->number_value = number_value;
+      v->hash = hash;
+      b->value_slots[h] = i;
+      b->keys[key].number_values++;
+    }
+
+  if( grow( (void **) &b->pairs, &b->size_pairs, b->number_pairs,
+            sizeof( struct pair)) )
+    return 1;
+  b->pairs[b->number_pairs].value = i;
+  b->pairs[b->number_pairs].ioc = ioc;
+  b->number_pairs++;
+  b->keys[key].present++;
+  return 0;
+}
+
+static int scan_ioc( struct builder *b, struct alive_env *env, int ioc)
+{
+  const struct alive_os_schema *schema;
+  const struct alive_os_param *param;
+  char *field;
+  int first;
+  int i, k;
+
+  for( i = 0; i < env->number_envvar; i++)
+    {
+      if( env->envvar_value[i] == NULL)
+        continue;
+      k = find_variable( b, env->envvar_key[i]);
+      if( k < 0)
+        return 1;
+      if( b->keys[k].last_ioc == ioc)
+        continue;
+      b->keys[k].last_ioc = ioc;
+      if( add_value( b, k, env->envvar_value[i], 0, ioc) )
+        return 1;
+    }
+
+  if( (env->extra == NULL) ||
+      ((schema = alive_os_schema( env->extra_type)) == NULL) )
+    return 0;
+  first = find_os_keys( b, env->extra_type, schema);
+  if( first < 0)
+    return 1;
+  for( i = 0; i < schema->number; i++)
+    {
+      param = &(schema->params[i]);
+      field = (char *) env->extra + param->offset;
+      b->keys[first + i].number_iocs++;
+      if( param->type == PARAM_UINT32)
+        {
+          if( add_value( b, first + i, NULL, *((uint32_t *) field), ioc) )
+            return 1;
+        }
+      else if( *((char **) field) != NULL)
+        {
+          if( add_value( b, first + i, *((char **) field), 0, ioc) )
+            return 1;
+        }
+    }
+  return 0;
+}
+
+
+static void free_builder( struct builder *b)
+{
+  free( b->keys);
+  free( b->key_slots);
+  free( b->values);
+  free( b->value_slots);
+  free( b->pairs);
+  free( b->os);
+}
+
+
+static int compare_key( const void *a, const void *b)
+{
+  const struct build_key *x = a;
+  const struct build_key *y = b;
+
+  if( (x->name != NULL) && (y->name != NULL) )
+    return strcmp( x->name, y->name);
+  if( x->name != NULL)
+    return -1;
+  if( y->name != NULL)
+    return 1;
+  if( x->os_type != y->os_type)
+    return (x->os_type > y->os_type) - (x->os_type < y->os_type);
+  return (x->param > y->param) - (x->param < y->param);
+}
+
+static int compare_value( const void *a, const void *b)
+{
+  const struct alive_drift_value *x = a;
+  const struct alive_drift_value *y = b;
+
+  if( x->number != y->number)
+    return (x->number < y->number) - (x->number > y->number);
+  // only strings are ever unset, and that comes last among equals
+  if( (x->value != NULL) && (y->value != NULL) )
+    return strcmp( x->value, y->value);
+  if( x->value != NULL)
+    return -1;
+  if( y->value != NULL)
+    return 1;
+  return (x->number_value > y->number_value) -
+    (x->number_value < y->number_value);
+}
+
+static int could_have( struct alive_env *env, struct alive_drift_key *key,
+                       int os_type)
+{
+  if( env == NULL)
+    return 0;
+  if( key->name != NULL)
+    return 1;
+  return (env->extra != NULL) && (env->extra_type == os_type);
+}
+
+struct alive_drift *alive_db_drift( struct alive_db *db, int *order,
+                                    int number)
+{
+  struct builder b;
+  struct alive_drift *drift;
+  struct alive_drift_key *out;
+  struct alive_drift_value *value;
+  struct alive_env *env;
+  int *key_place;
+  char *marked;
+  int number_iocs;
+  int number_slots, number_list;
+  int unset, place, offset;
+  int i, j, k, n;
+
+  if( order == NULL)
+    number = db->number_ioc;
+
+  memset( &b, 0, sizeof( struct builder));
+  drift = NULL;
+  key_place = NULL;
+  marked = NULL;
+
+  // the one pass over the IOCs
+  number_iocs = 0;
+  for( k = 0; k < number; k++)
+    {
+      i = (order == NULL) ? k : order[k];
+      env = db->ioc[i].environment;
+      if( env == NULL)
+        continue;
+      number_iocs++;
+      if( scan_ioc( &b, env, i) )
+        goto Error;
+    }
+  for( k = 0; k < b.number_keys; k++)
+    if( b.keys[k].name != NULL)
+      b.keys[k].number_iocs = number_iocs;
+
+  drift = calloc( 1, sizeof( struct alive_drift));
+  if( drift == NULL)
+    goto Error;
+  drift->number_iocs = number_iocs;
+
+  // keys in order, each with its values and maybe an unset one together
+  qsort( b.keys, b.number_keys, sizeof( struct build_key), compare_key);
+  key_place = malloc( (b.number_keys ? b.number_keys : 1) * sizeof( int));
+  drift->keys = malloc( (b.number_keys ? b.number_keys : 1) *
+                        sizeof( struct alive_drift_key));
+  if( (key_place == NULL) || (drift->keys == NULL) )
+    goto Error;
+  drift->number_keys = b.number_keys;
+  number_slots = 0;
+  number_list = b.number_pairs;
+  for( k = 0; k < b.number_keys; k++)
+    {
+      key_place[ b.keys[k].id] = k;
+      out = &(drift->keys[k]);
+      out->name = b.keys[k].name;
+      out->schema = b.keys[k].schema;
+      out->param = b.keys[k].param;
+      out->number_iocs = b.keys[k].number_iocs;
+      unset = b.keys[k].number_iocs - b.keys[k].present;
+      out->number_values = b.keys[k].number_values + (unset > 0);
+      b.keys[k].first = b.keys[k].next = number_slots;
+      number_slots += out->number_values;
+      number_list += unset;
+    }
+
+  drift->value_list = calloc( number_slots ? number_slots : 1,
+                              sizeof( struct alive_drift_value));
+  drift->ioc_list = malloc( (number_list ? number_list : 1) * sizeof( int));
+  if( (drift->value_list == NULL) || (drift->ioc_list == NULL) )
+    goto Error;
+  for( i = 0; i < b.number_values; i++)
+    {
+      k = key_place[ b.values[i].key];
+      place = b.keys[k].next++;
+      b.values[i].place = place;
+      drift->value_list[place].value = b.values[i].value;
+      drift->value_list[place].number_value = b.values[i].number_value;
+    }
+  for( i = 0; i < b.number_pairs; i++)
+    drift->value_list[ b.values[ b.pairs[i].value].place].number++;
+
+  // then the IOCs, kept in the order given
+  offset = 0;
+  for( k = 0; k < b.number_keys; k++)
+    {
+      out = &(drift->keys[k]);
+      out->values = &(drift->value_list[ b.keys[k].first]);
+      // the unset one is after the others
+      unset = b.keys[k].number_iocs - b.keys[k].present;
+      if( unset > 0)
+        out->values[out->number_values - 1].number = unset;
+      for( j = 0; j < out->number_values; j++)
+        {
+          value = &(out->values[j]);
+          value->iocs = &(drift->ioc_list[offset]);
+          offset += value->number;
+          value->number = 0;
+        }
+    }
+  for( i = 0; i < b.number_pairs; i++)
+    {
+      value = &(drift->value_list[ b.values[ b.pairs[i].value].place]);
+      value->iocs[ value->number++] = b.pairs[i].ioc;
+    }
+
+  marked = calloc( db->number_ioc ? db->number_ioc : 1, sizeof( char));
+  if( marked == NULL)
+    goto Error;
+  for( k = 0; k < b.number_keys; k++)
+    {
+      out = &(drift->keys[k]);
+      if( b.keys[k].number_iocs == b.keys[k].present)
+        continue;
+      value = &(out->values[out->number_values - 1]);
+      for( j = 0; j < out->number_values - 1; j++)
+        for( i = 0; i < out->values[j].number; i++)
+          marked[ out->values[j].iocs[i]] = 1;
+      for( n = 0; n < number; n++)
+        {
+          i = (order == NULL) ? n : order[n];
+          if( !marked[i] && could_have( db->ioc[i].environment, out,
+                                        b.keys[k].os_type) )
+            value->iocs[ value->number++] = i;
+        }
+      for( j = 0; j < out->number_values - 1; j++)
+        for( i = 0; i < out->values[j].number; i++)
+          marked[ out->values[j].iocs[i]] = 0;
+    }
+
+  for( k = 0; k < drift->number_keys; k++)
+    qsort( drift->keys[k].values, drift->keys[k].number_values,
+           sizeof( struct alive_drift_value), compare_value);
+
+  free( marked);
+  free( key_place);
+  free_builder( &b);
+  return drift;
+
+ Error:
+  printf("Error: out of memory finding the drift.\n");
+  free( marked);
+  free( key_place);
+  free_builder( &b);
+  alive_free_drift( drift);
+  return NULL;
+}
+
+void alive_free_drift( struct alive_drift *drift)
+{
+  if( drift == NULL)
+    return;
+  free( drift->keys);
+  free( drift->value_list);
+  free( drift->ioc_list);
+  free( drift);
+}
@@ -0,0 +1,562 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Each IOC's events are in (dir)/(ioc).events: a header, then the events
+// as struct alive_ioc_event_item, oldest first.  The header's count is
+// only raised after the events it covers are written, so a reader that
+// maps the count it read never sees a partial event.  When the file
+// doesn't match the daemon's list at all (the daemon lost its events),
+// a new file is written beside it and renamed over it, so readers with
+// the old one mapped keep seeing it whole.
+//
+// A refresh compares the cached events with the start of the response;
+// if the daemon has dropped old events, the cache's last event is found
+// further up the response instead, and the events before it compared.
+// Either way, only the events past it are decoded and appended.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "alive_client.h"
+#include "alive_wire.h"
+
+
+#define CACHE_MAGIC "ALVE"
+#define CACHE_VERSION (1)
+#define CACHE_SUFFIX ".events"
+
+// in host byte order, as the files are only for local use
+struct cache_header
+{
+  char magic[4];
+  uint32_t version;
+  uint32_t number;        // of events after the header
+  uint32_t last_time;     // of the last event
+  uint32_t start_time;    // the daemon's, at the last refresh
+  uint32_t refresh_time;  // the daemon's current time then
+  uint32_t unused[2];
+};
+
+struct alive_event_cache
+{
+  char *dir;
+};
+
+
+struct alive_event_cache *alive_event_cache_open( char *dir)
+{
+  struct alive_event_cache *cache;
+
+  if( mkdir( dir, 0755) && (errno != EEXIST) )
+    {
+      printf( "Can't create event cache directory \"%s\"!\n", dir);
+      return NULL;
+    }
+  cache = calloc( 1, sizeof( struct alive_event_cache));
+  if( cache == NULL)
+    return NULL;
+  cache->dir = strdup( dir);
+  if( cache->dir == NULL)
+    {
+      free( cache);
+      return NULL;
+    }
+  return cache;
+}
+
+void alive_event_cache_close( struct alive_event_cache *cache)
+{
+  if( cache == NULL)
+    return;
+  free( cache->dir);
+  free( cache);
+}
+
+// NULL for names that can't be file names
+static char *cache_path( struct alive_event_cache *cache, char *name,
+                         char *suffix)
+{
+  char *path;
+
+  if( (name[0] == '\0') || (name[0] == '.') || (strchr( name, '/') != NULL))
+    return NULL;
+  path = malloc( strlen( cache->dir) + strlen( name) + strlen( suffix) + 2);
+  if( path != NULL)
+    sprintf( path, "%s/%s%s", cache->dir, name, suffix);
+  return path;
+}
+
+static void wire_event( char *data, int i, struct alive_ioc_event_item *item)
+{
+  struct alive_wire_event w;
+
+  alive_wire_get_event( data + ALIVE_WIRE_SIZE( header) +
+                        i * ALIVE_WIRE_SIZE( event), &w);
+  item->time = w.time;
+  item->raw_ip_address = w.ip;
+  item->user_msg = w.user_msg;
+  item->event = w.event;
+}
+
+static int same_event( struct alive_ioc_event_item *a, char *data, int i)
+{
+  struct alive_ioc_event_item b;
+
+  wire_event( data, i, &b);
+  return (a->time == b.time) && (a->raw_ip_address == b.raw_ip_address) &&
+    (a->user_msg == b.user_msg) && (a->event == b.event);
+}
+
+// Where the response's events past the cached ones start, or -1 if the
+// cache doesn't match it.
+static int match_events( struct alive_ioc_event_item *cached, int number,
+                         char *data, int number_wire)
+{
+  int i, j;
+
+  if( !number)
+    return 0;
+
+  // the usual case, where the list only grew
+  if( number_wire >= number)
+    {
+      for( i = 0; i < number; i++)
+        if( !same_event( &cached[i], data, i) )
+          break;
+      if( i == number)
+        return number;
+    }
+
+  // the daemon dropped old events, so the last cached one moved up
+  j = (number_wire < number) ? number_wire : number;
+  for( j--; j >= 0; j--)
+    {
+      if( !same_event( &cached[number - 1], data, j) )
+        continue;
+      for( i = 0; i < j; i++)
+        if( !same_event( &cached[number - 1 - j + i], data, i) )
+          break;
+      if( i == j)
+        return j + 1;
+    }
+  return -1;
+}
+
+static int write_all( int fd, void *buffer, size_t length, off_t offset)
+{
+  ssize_t n;
+
+  while( length)
+    {
+      n = pwrite( fd, buffer, length, offset);
+      if( n <= 0)
+        return 1;
+      buffer = (char *) buffer + n;
+      length -= n;
+      offset += n;
+    }
+  return 0;
+}
+
+// the response's events from first on, as the file keeps them
+static struct alive_ioc_event_item *convert_events( char *data, int first,
+                                                    int number_wire)
+{
+  struct alive_ioc_event_item *items;
+  int i;
+
+  items = malloc( ((number_wire > first) ? number_wire - first : 1) *
+                  sizeof( struct alive_ioc_event_item));
+  if( items == NULL)
+    return NULL;
+  for( i = first; i < number_wire; i++)
+    wire_event( data, i, &items[i - first]);
+  return items;
+}
+
+static int replace_file( struct alive_event_cache *cache, char *name,
+                         char *path, struct cache_header *header,
+                         char *data, int number_wire)
+{
+  struct alive_ioc_event_item *items;
+  char *temp;
+  int fd, ret;
+
+  temp = cache_path( cache, name, CACHE_SUFFIX ".new");
+  items = convert_events( data, 0, number_wire);
+  if( (temp == NULL) || (items == NULL) )
+    {
+      free( temp);
+      free( items);
+      return 1;
+    }
+
+  ret = 1;
+  fd = open( temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if( fd != -1)
+    {
+      header->number = number_wire;
+      ret = write_all( fd, header, sizeof( struct cache_header), 0) ||
+        write_all( fd, items, number_wire *
+                   sizeof( struct alive_ioc_event_item),
+                   sizeof( struct cache_header));
+      close( fd);
+      if( !ret)
+        ret = rename( temp, path) != 0;
+      if( ret)
+        unlink( temp);
+    }
+
+  free( items);
+  free( temp);
+  return ret;
+}
+
+int alive_event_cache_update( struct alive_event_cache *cache, char *name,
+                              char *data, int length)
+{
+  struct cache_header header;
+  struct alive_ioc_event_item *items, last;
+  struct stat st;
+  void *map;
+  size_t map_length;
+  char *path;
+  struct alive_wire_header response;
+  int number_wire, first;
+  int fd;
+  int ret;
+
+  if( length < ALIVE_WIRE_SIZE( header))
+    return -1;
+  alive_wire_get_header( data, &response);
+  if( response.version != CLIENT_PROTOCOL_VERSION)
+    return -1;
+  number_wire = (length - ALIVE_WIRE_SIZE( header)) / ALIVE_WIRE_SIZE( event);
+
+  path = cache_path( cache, name, CACHE_SUFFIX);
+  if( path == NULL)
+    {
+      printf( "Can't cache the events of \"%s\".\n", name);
+      return -1;
+    }
+  fd = open( path, O_RDWR | O_CREAT, 0644);
+  if( fd == -1)
+    {
+      printf( "Can't open the event cache of \"%s\"!\n", name);
+      free( path);
+      return -1;
+    }
+
+  // a new file, or one that's not usable, is started over
+  if( (pread( fd, &header, sizeof( header), 0) != sizeof( header)) ||
+      memcmp( header.magic, CACHE_MAGIC, 4) ||
+      (header.version != CACHE_VERSION) || fstat( fd, &st) ||
+      ((size_t) st.st_size < sizeof( header) + (size_t) header.number *
+       sizeof( struct alive_ioc_event_item)) )
+    {
+      memset( &header, 0, sizeof( header));
+      memcpy( header.magic, CACHE_MAGIC, 4);
+      header.version = CACHE_VERSION;
+    }
+
+  first = 0;
+  if( header.number)
+    {
+      map_length = sizeof( header) + (size_t) header.number *
+        sizeof( struct alive_ioc_event_item);
+      map = mmap( NULL, map_length, PROT_READ, MAP_SHARED, fd, 0);
+      if( map == MAP_FAILED)
+        first = -1;
+      else
+        {
+          first = match_events( (struct alive_ioc_event_item *)
+                                ((char *) map + sizeof( header)),
+                                header.number, data, number_wire);
+          munmap( map, map_length);
+        }
+    }
+
+  header.start_time = response.start_time;
+  header.refresh_time = response.current_time;
+  if( number_wire)
+    {
+      wire_event( data, number_wire - 1, &last);
+      header.last_time = last.time;
+    }
+
+  if( first < 0)
+    {
+      close( fd);
+      ret = replace_file( cache, name, path, &header, data, number_wire) ?
+        -1 : number_wire;
+      free( path);
+      if( ret < 0)
+        printf( "Can't write the event cache of \"%s\"!\n", name);
+      return ret;
+    }
+  free( path);
+
+  // the new events, then the count that covers them
+  items = convert_events( data, first, number_wire);
+  if( (items == NULL) ||
+      write_all( fd, items, (number_wire - first) *
+                 sizeof( struct alive_ioc_event_item),
+                 sizeof( header) + (size_t) header.number *
+                 sizeof( struct alive_ioc_event_item)) )
+    ret = -1;
+  else
+    {
+      header.number += number_wire - first;
+      // anything past that was a partial write
+      if( ftruncate( fd, sizeof( header) + (size_t) header.number *
+                     sizeof( struct alive_ioc_event_item)) ||
+          write_all( fd, &header, sizeof( header), 0) )
+        ret = -1;
+      else
+        ret = number_wire - first;
+    }
+  free( items);
+  close( fd);
+  if( ret < 0)
+    printf( "Can't write the event cache of \"%s\"!\n", name);
+  return ret;
+}
+
+
+struct refresh_ioc
+{
+  char *name;
+  struct alive_request *req;
+};
+
+int alive_event_cache_refresh( struct alive_event_cache *cache,
+                               char *server, int port, int number,
+                               char **names, int concurrency, int *added)
+{
+  struct refresh_ioc *iocs;
+  struct alive_db *db;
+  struct pollfd *fds;
+  int *polled;
+  char *data;
+  int number_fds;
+  int started, in_flight, done, updated;
+  int length, n;
+  int i;
+
+  // the IOCs are whatever the daemon knows of
+  db = alive_get_iocs( server, port, number, names);
+  if( db == NULL)
+    return -1;
+
+  if( concurrency > db->number_ioc)
+    concurrency = db->number_ioc;
+  if( concurrency < 1)
+    concurrency = 1;
+  iocs = calloc( db->number_ioc + 1, sizeof( struct refresh_ioc));
+  fds = malloc( concurrency * sizeof( struct pollfd));
+  polled = malloc( concurrency * sizeof( int));
+  if( (iocs == NULL) || (fds == NULL) || (polled == NULL) )
+    {
+      free( iocs);
+      free( fds);
+      free( polled);
+      alive_free_db( db);
+      return -1;
+    }
+  for( i = 0; i < db->number_ioc; i++)
+    iocs[i].name = db->ioc[i].ioc_name;
+
+  started = in_flight = done = updated = 0;
+  while( done < db->number_ioc)
+    {
+      while( (started < db->number_ioc) && (in_flight < concurrency) )
+        {
+          i = started++;
+          iocs[i].req = alive_request_start( server, port, REQUEST_EVENTS, 1,
+                                             &iocs[i].name);
+          if( iocs[i].req != NULL)
+            in_flight++;
+          else
+            {
+              printf( "Can't get the events of \"%s\".\n", iocs[i].name);
+              done++;
+            }
+        }
+      if( !in_flight)
+        continue;
+
+      number_fds = 0;
+      for( i = 0; i < db->number_ioc; i++)
+        if( iocs[i].req != NULL)
+          {
+            fds[number_fds].fd = alive_request_fd( iocs[i].req);
+            fds[number_fds].events = alive_request_poll_events( iocs[i].req);
+            polled[number_fds++] = i;
+          }
+      if( poll( fds, number_fds, -1) < 0)
+        continue;
+
+      for( i = 0; i < number_fds; i++)
+        {
+          struct refresh_ioc *r = &(iocs[polled[i]]);
+
+          if( !fds[i].revents)
+            continue;
+          n = alive_request_process( r->req);
+          if( !n)
+            continue;
+          if( n > 0)
+            {
+              data = alive_request_response( r->req, &length);
+              n = alive_event_cache_update( cache, r->name, data, length);
+              if( n >= 0)
+                {
+                  updated++;
+                  if( added != NULL)
+                    *added += n;
+                }
+            }
+          else
+            printf( "Can't get the events of \"%s\".\n", r->name);
+          alive_request_free( r->req);
+          r->req = NULL;
+          in_flight--;
+          done++;
+        }
+    }
+
+  free( iocs);
+  free( fds);
+  free( polled);
+  alive_free_db( db);
+  return updated;
+}
+
+
+struct alive_event_cache_view *alive_event_cache_map(
+                                            struct alive_event_cache *cache,
+                                            char *name)
+{
+  struct alive_event_cache_view *view;
+  struct cache_header header;
+  struct stat st;
+  char *path;
+  int fd;
+
+  path = cache_path( cache, name, CACHE_SUFFIX);
+  if( path == NULL)
+    return NULL;
+  fd = open( path, O_RDONLY);
+  free( path);
+  if( fd == -1)
+    return NULL;
+  if( (pread( fd, &header, sizeof( header), 0) != sizeof( header)) ||
+      memcmp( header.magic, CACHE_MAGIC, 4) ||
+      (header.version != CACHE_VERSION) || fstat( fd, &st) ||
+      ((size_t) st.st_size < sizeof( header) + (size_t) header.number *
+       sizeof( struct alive_ioc_event_item)) ||
+      ((view = calloc( 1, sizeof( struct alive_event_cache_view))) == NULL) )
+    {
+      close( fd);
+      return NULL;
+    }
+
+  view->length = sizeof( header) + (size_t) header.number *
+    sizeof( struct alive_ioc_event_item);
+  view->map = mmap( NULL, view->length, PROT_READ, MAP_SHARED, fd, 0);
+  close( fd);
+  if( view->map == MAP_FAILED)
+    {
+      free( view);
+      return NULL;
+    }
+  view->events.current_time = header.refresh_time;
+  view->events.start_time = header.start_time;
+  view->events.number = header.number;
+  view->events.instances = (struct alive_ioc_event_item *)
+    ((char *) view->map + sizeof( header));
+  return view;
+}
+
+void alive_event_cache_unmap( struct alive_event_cache_view *view)
+{
+  if( view == NULL)
+    return;
+  munmap( view->map, view->length);
+  free( view);
+}
+
+static int compare_name( const void *a, const void *b)
+{
+  return strcmp( *(char **) a, *(char **) b);
+}
+
+char **alive_event_cache_names( struct alive_event_cache *cache,
+                                int *number)
+{
+  DIR *dir;
+  struct dirent *entry;
+  char **names, **p;
+  int size;
+  size_t length, suffix;
+
+  *number = 0;
+  dir = opendir( cache->dir);
+  if( dir == NULL)
+    return NULL;
+  size = 64;
+  names = malloc( size * sizeof( char *));
+  suffix = strlen( CACHE_SUFFIX);
+  while( (names != NULL) && ((entry = readdir( dir)) != NULL) )
+    {
+      length = strlen( entry->d_name);
+      if( (entry->d_name[0] == '.') || (length <= suffix) ||
+          strcmp( entry->d_name + length - suffix, CACHE_SUFFIX) )
+        continue;
+      if( *number == size)
+        {
+          p = realloc( names, 2 * size * sizeof( char *));
+          if( p == NULL)
+            break;
+          names = p;
+          size *= 2;
+        }
+      names[*number] = strndup( entry->d_name, length - suffix);
+      if( names[*number] == NULL)
+        break;
+      (*number)++;
+    }
+  closedir( dir);
+  if( names != NULL)
+    qsort( names, *number, sizeof( char *), compare_name);
+  return names;
+}
+
+void alive_event_cache_free_names( char **names, int number)
+{
+  int i;
+
+  if( names == NULL)
+    return;
+  for( i = 0; i < number; i++)
+    free( names[i]);
+  free( names);
+}
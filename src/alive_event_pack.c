@@ -0,0 +1,363 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Each event is a header byte, then varints: the time difference from
+// the event before (zigzag, in case the times go backwards), then the
+// address index if it changed, then the user message and the event if
+// they didn't fit in the header.  The first event of a block takes its
+// time from the block and always gives its address, so a block decodes
+// without the ones before it.  Each block also keeps the latest time up
+// to its end, which never goes down, so finding the first event at or
+// past a time is a binary search of the blocks and a short walk.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alive_client.h"
+
+
+// header byte: event in bits 0-2, user message in bits 3-5, with 7
+// meaning the value follows; bit 6 means an address index follows
+#define PACK_ESCAPE (7)
+#define PACK_ADDRESS (0x40)
+
+// most bytes one event can take: the header, and four varints of at
+// most 5 bytes, as the time difference fits in 33 bits
+#define PACK_MAX_EVENT (21)
+
+
+static uint8_t *put_varint( uint8_t *p, uint64_t v)
+{
+  while( v >= 0x80)
+    {
+      *p++ = (v & 0x7f) | 0x80;
+      v >>= 7;
+    }
+  *p++ = v;
+  return p;
+}
+
+static const uint8_t *get_varint( const uint8_t *p, uint64_t *v)
+{
+  uint64_t x;
+  int shift;
+
+  x = 0;
+  for( shift = 0; *p & 0x80; shift += 7)
+    x |= (uint64_t) (*p++ & 0x7f) << shift;
+  x |= (uint64_t) *p++ << shift;
+  *v = x;
+  return p;
+}
+
+
+struct alive_event_pack *alive_event_pack_new( time_t current_time,
+                                               time_t start_time)
+{
+  struct alive_event_pack *pack;
+
+  pack = calloc( 1, sizeof( struct alive_event_pack));
+  if( pack == NULL)
+    return NULL;
+  pack->current_time = current_time;
+  pack->start_time = start_time;
+  return pack;
+}
+
+static int find_address( struct alive_event_pack *pack, uint32_t address)
+{
+  uint32_t *p;
+  int i;
+
+  // an IOC only ever has a few
+  for( i = 0; i < pack->number_addresses; i++)
+    if( pack->addresses[i] == address)
+      return i;
+
+  if( pack->number_addresses == pack->size_addresses)
+    {
+      p = realloc( pack->addresses,
+                   (pack->size_addresses + 4) * sizeof( uint32_t));
+      if( p == NULL)
+        return -1;
+      pack->addresses = p;
+      pack->size_addresses += 4;
+    }
+  pack->addresses[pack->number_addresses] = address;
+  return pack->number_addresses++;
+}
+
+int alive_event_pack_add( struct alive_event_pack *pack,
+                          struct alive_ioc_event_item *item)
+{
+  struct alive_event_block *block;
+  uint8_t *p, *start;
+  uint8_t header;
+  int64_t delta;
+  int address;
+  int n;
+
+  if( pack->length + PACK_MAX_EVENT > pack->size_data)
+    {
+      n = pack->size_data ? 2 * pack->size_data : 256;
+      p = realloc( pack->data, n);
+      if( p == NULL)
+        return 1;
+      pack->data = p;
+      pack->size_data = n;
+    }
+  if( (pack->number % ALIVE_EVENT_BLOCK == 0) &&
+      (pack->number_blocks == pack->size_blocks) )
+    {
+      n = pack->size_blocks ? 2 * pack->size_blocks : 4;
+      block = realloc( pack->blocks, n * sizeof( struct alive_event_block));
+      if( block == NULL)
+        return 1;
+      pack->blocks = block;
+      pack->size_blocks = n;
+    }
+  address = find_address( pack, item->raw_ip_address);
+  if( address < 0)
+    return 1;
+
+  // a block starts over without the event before
+  if( pack->number % ALIVE_EVENT_BLOCK == 0)
+    {
+      block = &(pack->blocks[pack->number_blocks++]);
+      block->first_time = item->time;
+      block->max_time = item->time;
+      if( (pack->number_blocks > 1) && (block[-1].max_time > item->time) )
+        block->max_time = block[-1].max_time;
+      block->offset = pack->length;
+      pack->last_time = item->time;
+      pack->last_address = -1;
+    }
+  else
+    {
+      block = &(pack->blocks[pack->number_blocks - 1]);
+      if( item->time > block->max_time)
+        block->max_time = item->time;
+    }
+
+  header = (item->event < PACK_ESCAPE) ? item->event : PACK_ESCAPE;
+  header |= ((item->user_msg < PACK_ESCAPE) ? item->user_msg : PACK_ESCAPE)
+    << 3;
+  if( address != pack->last_address)
+    header |= PACK_ADDRESS;
+
+  start = p = pack->data + pack->length;
+  *p++ = header;
+  delta = (int64_t) item->time - (int64_t) pack->last_time;
+  p = put_varint( p, ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63));
+  if( header & PACK_ADDRESS)
+    p = put_varint( p, address);
+  if( item->user_msg >= PACK_ESCAPE)
+    p = put_varint( p, item->user_msg);
+  if( item->event >= PACK_ESCAPE)
+    p = put_varint( p, item->event);
+
+  pack->length += p - start;
+  pack->number++;
+  pack->last_time = item->time;
+  pack->last_address = address;
+  return 0;
+}
+
+struct alive_event_pack *alive_event_pack_create(
+                                          struct alive_ioc_event_db *events)
+{
+  struct alive_event_pack *pack;
+  int i;
+
+  pack = alive_event_pack_new( events->current_time, events->start_time);
+  if( pack == NULL)
+    return NULL;
+  for( i = 0; i < events->number; i++)
+    if( alive_event_pack_add( pack, &(events->instances[i])) )
+      {
+        alive_free_event_pack( pack);
+        return NULL;
+      }
+  alive_event_pack_trim( pack);
+  return pack;
+}
+
+void alive_event_pack_trim( struct alive_event_pack *pack)
+{
+  void *p;
+
+  if( pack->length && (pack->length < pack->size_data) &&
+      ((p = realloc( pack->data, pack->length)) != NULL) )
+    {
+      pack->data = p;
+      pack->size_data = pack->length;
+    }
+  if( pack->number_blocks && (pack->number_blocks < pack->size_blocks) &&
+      ((p = realloc( pack->blocks, pack->number_blocks *
+                     sizeof( struct alive_event_block))) != NULL) )
+    {
+      pack->blocks = p;
+      pack->size_blocks = pack->number_blocks;
+    }
+  if( pack->number_addresses &&
+      (pack->number_addresses < pack->size_addresses) &&
+      ((p = realloc( pack->addresses, pack->number_addresses *
+                     sizeof( uint32_t))) != NULL) )
+    {
+      pack->addresses = p;
+      pack->size_addresses = pack->number_addresses;
+    }
+}
+
+size_t alive_event_pack_bytes( struct alive_event_pack *pack)
+{
+  return sizeof( struct alive_event_pack) + pack->size_data +
+    pack->size_blocks * sizeof( struct alive_event_block) +
+    pack->size_addresses * sizeof( uint32_t);
+}
+
+void alive_free_event_pack( struct alive_event_pack *pack)
+{
+  if( pack == NULL)
+    return;
+  free( pack->data);
+  free( pack->blocks);
+  free( pack->addresses);
+  free( pack);
+}
+
+
+void alive_event_pack_begin( struct alive_event_pack *pack,
+                             struct alive_event_cursor *cursor)
+{
+  cursor->pack = pack;
+  cursor->index = 0;
+  cursor->offset = 0;
+  cursor->time = 0;
+  cursor->address = -1;
+}
+
+void alive_event_pack_seek( struct alive_event_pack *pack,
+                            struct alive_event_cursor *cursor, time_t t)
+{
+  struct alive_event_cursor look;
+  int lo, hi, mid;
+
+  alive_event_pack_begin( pack, cursor);
+  if( t <= 0)
+    return;
+
+  // first block that reaches t
+  lo = 0;
+  hi = pack->number_blocks;
+  while( lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if( pack->blocks[mid].max_time < t)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if( lo == pack->number_blocks)
+    {
+      cursor->index = pack->number;
+      cursor->offset = pack->length;
+      return;
+    }
+  cursor->index = lo * ALIVE_EVENT_BLOCK;
+  cursor->offset = pack->blocks[lo].offset;
+
+  // then the event in it
+  look = *cursor;
+  while( alive_event_pack_next( &look, NULL) && (look.time < t) )
+    *cursor = look;
+}
+
+int alive_event_pack_next( struct alive_event_cursor *cursor,
+                           struct alive_ioc_event_item *item)
+{
+  const struct alive_event_pack *pack = cursor->pack;
+  const uint8_t *p;
+  uint8_t header;
+  uint64_t v;
+  uint32_t user_msg, event;
+
+  if( cursor->index >= pack->number)
+    return 0;
+
+  if( cursor->index % ALIVE_EVENT_BLOCK == 0)
+    {
+      cursor->time = pack->blocks[cursor->index / ALIVE_EVENT_BLOCK].first_time;
+      cursor->address = -1;
+    }
+
+  p = pack->data + cursor->offset;
+  header = *p++;
+  p = get_varint( p, &v);
+  cursor->time += (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+  if( header & PACK_ADDRESS)
+    {
+      p = get_varint( p, &v);
+      cursor->address = v;
+    }
+  user_msg = (header >> 3) & 7;
+  if( user_msg == PACK_ESCAPE)
+    {
+      p = get_varint( p, &v);
+      user_msg = v;
+    }
+  event = header & 7;
+  if( event == PACK_ESCAPE)
+    {
+      p = get_varint( p, &v);
+      event = v;
+    }
+
+  cursor->offset = p - pack->data;
+  cursor->index++;
+
+  if( item != NULL)
+    {
+      item->event = event;
+      item->user_msg = user_msg;
+      item->time = cursor->time;
+      item->raw_ip_address = pack->addresses[cursor->address];
+    }
+  return 1;
+}
+
+struct alive_ioc_event_db *alive_event_pack_unpack(
+                                          struct alive_event_pack *pack)
+{
+  struct alive_ioc_event_db *events;
+  struct alive_event_cursor cursor;
+  int i;
+
+  events = malloc( sizeof( struct alive_ioc_event_db));
+  if( events == NULL)
+    return NULL;
+  events->current_time = pack->current_time;
+  events->start_time = pack->start_time;
+  events->number = pack->number;
+  events->instances = malloc( (pack->number ? pack->number : 1) *
+                              sizeof( struct alive_ioc_event_item));
+  if( events->instances == NULL)
+    {
+      free( events);
+      return NULL;
+    }
+
+  alive_event_pack_begin( pack, &cursor);
+  for( i = 0; i < pack->number; i++)
+    alive_event_pack_next( &cursor, &(events->instances[i]));
+  return events;
+}
@@ -0,0 +1,978 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Filters are parsed once into a flat list of operations: tests, which
+// set one result, and NOT and jumps, which work on it.  "a && b" is a,
+// then a jump past b if the result is false, then b, so the evaluation
+// short-circuits with no stack.  Everything that can be worked out from
+// the expression alone is done when compiling: OS parameters are looked
+// up, status and OS names turned into numbers, subnets into masks, and
+// patterns compiled.
+//
+// A test sees an IOC through a subject, filled in either from a decoded
+// IOC or straight from its record in a raw response, so a whole database
+// response can be filtered and only the IOCs that match decoded.  The
+// raw environment is only walked when a test needs it.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#include <regex.h>
+#include <arpa/inet.h>
+
+#include "alive_client.h"
+#include "alive_wire.h"
+
+
+enum filter_codes { OP_TEST, OP_NOT, OP_JUMP_FALSE, OP_JUMP_TRUE };
+
+enum filter_fields { FIELD_NAME, FIELD_STATUS, FIELD_AGE, FIELD_TIME,
+                     FIELD_USER_MSG, FIELD_IP, FIELD_OS, FIELD_ENV,
+                     FIELD_PARAM };
+
+enum filter_compares { CMP_EQ, CMP_NE, CMP_LT, CMP_LE, CMP_GT, CMP_GE,
+                       CMP_MATCH, CMP_NOT_MATCH, CMP_IN, CMP_SET };
+
+struct filter_op
+{
+  uint8_t code;
+  uint8_t field;
+  uint8_t compare;
+  int jump;  // where jumps go
+
+  // what the field is compared to
+  char *key;  // of FIELD_ENV
+  const struct alive_os_param *param;  // of FIELD_PARAM
+  int index;  // of param in its schema
+  int os_type;  // of FIELD_PARAM and FIELD_OS
+  char *string;
+  double number;
+  int number_flag;  // whether string is also a number
+  uint32_t network;
+  uint32_t mask;
+  regex_t *regex;
+};
+
+struct alive_filter
+{
+  int number;
+  int size;
+  struct filter_op *ops;
+};
+
+
+// An IOC as the tests see it.  Strings are given by length, as raw ones
+// aren't NUL terminated.
+struct filter_subject
+{
+  char *name;
+  int name_length;
+  uint8_t status;
+  uint32_t age;
+  uint32_t time_value;
+  uint32_t address;  // host order
+  uint32_t user_msg;
+
+  // decoded, or else raw
+  struct alive_env *env;
+  char *raw_env;  // just past the flag, NULL if there is no environment
+  char *raw_extra;  // at the OS type, found when first needed
+};
+
+
+/////////////////////////////////////////////
+
+static char *status_names[] =
+  { "UNKNOWN", "DOWN_UNKNOWN", "DOWN", "UP", "CONFLICT" };
+
+struct parser
+{
+  struct alive_filter *filter;
+  char *expression;
+  char *p;
+
+  // the token just read
+  int token;
+  char *start;  // in the expression, for errors
+  char *text;   // allocated, for words and strings
+};
+
+enum filter_tokens { TOKEN_END, TOKEN_WORD, TOKEN_STRING, TOKEN_AND,
+                     TOKEN_OR, TOKEN_NOT, TOKEN_OPEN, TOKEN_CLOSE,
+                     TOKEN_COMPARE, TOKEN_ERROR };
+
+static int parse_or( struct parser *ps);
+
+
+static void parse_error( struct parser *ps, char *what)
+{
+  printf("Filter error: %s at column %d.\n", what,
+         (int) (ps->start - ps->expression) + 1);
+}
+
+static int is_word( int c)
+{
+  return isalnum( c) || (c == '_') || (c == '.') || (c == ':') ||
+    (c == '/') || (c == '-') || (c == '+');
+}
+
+// reads the next token, with the compare in *compare
+static int next_token( struct parser *ps, int *compare)
+{
+  char *p, *q;
+
+  free( ps->text);
+  ps->text = NULL;
+
+  while( isspace( (unsigned char) *ps->p) )
+    ps->p++;
+  p = ps->start = ps->p;
+
+  if( *p == '\0')
+    return ps->token = TOKEN_END;
+  if( is_word( (unsigned char) *p) )
+    {
+      while( is_word( (unsigned char) *ps->p) )
+        ps->p++;
+      ps->text = strndup( p, ps->p - p);
+      if( !strcmp( ps->text, "in") )
+        {
+          *compare = CMP_IN;
+          return ps->token = TOKEN_COMPARE;
+        }
+      return ps->token = TOKEN_WORD;
+    }
+  if( *p == '"')
+    {
+      // backslash escapes the next character
+      ps->text = malloc( strlen( p));
+      if( ps->text == NULL)
+        return ps->token = TOKEN_ERROR;
+      q = ps->text;
+      for( p++; (*p != '"') && (*p != '\0'); p++)
+        {
+          if( (*p == '\\') && (p[1] != '\0') )
+            p++;
+          *q++ = *p;
+        }
+      *q = '\0';
+      if( *p != '"')
+        {
+          parse_error( ps, "unterminated string");
+          return ps->token = TOKEN_ERROR;
+        }
+      ps->p = p + 1;
+      return ps->token = TOKEN_STRING;
+    }
+
+  ps->p += 2;
+  if( !strncmp( p, "&&", 2) )
+    return ps->token = TOKEN_AND;
+  if( !strncmp( p, "||", 2) )
+    return ps->token = TOKEN_OR;
+  *compare = -1;
+  if( !strncmp( p, "==", 2) )
+    *compare = CMP_EQ;
+  else if( !strncmp( p, "!=", 2) )
+    *compare = CMP_NE;
+  else if( !strncmp( p, "<=", 2) )
+    *compare = CMP_LE;
+  else if( !strncmp( p, ">=", 2) )
+    *compare = CMP_GE;
+  else if( !strncmp( p, "!~", 2) )
+    *compare = CMP_NOT_MATCH;
+  if( *compare >= 0)
+    return ps->token = TOKEN_COMPARE;
+
+  ps->p--;
+  switch( *p)
+    {
+    case '!':
+      return ps->token = TOKEN_NOT;
+    case '(':
+      return ps->token = TOKEN_OPEN;
+    case ')':
+      return ps->token = TOKEN_CLOSE;
+    case '<':
+      *compare = CMP_LT;
+      return ps->token = TOKEN_COMPARE;
+    case '>':
+      *compare = CMP_GT;
+      return ps->token = TOKEN_COMPARE;
+    case '~':
+      *compare = CMP_MATCH;
+      return ps->token = TOKEN_COMPARE;
+    case '=':
+      *compare = CMP_EQ;
+      return ps->token = TOKEN_COMPARE;
+    }
+  parse_error( ps, "unexpected character");
+  return ps->token = TOKEN_ERROR;
+}
+
+static struct filter_op *add_op( struct parser *ps, int code)
+{
+  struct alive_filter *filter = ps->filter;
+  struct filter_op *ops;
+  int n;
+
+  if( filter->number == filter->size)
+    {
+      n = filter->size ? 2 * filter->size : 16;
+      ops = realloc( filter->ops, n * sizeof( struct filter_op));
+      if( ops == NULL)
+        return NULL;
+      filter->ops = ops;
+      filter->size = n;
+    }
+  ops = &(filter->ops[filter->number++]);
+  memset( ops, 0, sizeof( struct filter_op));
+  ops->code = code;
+  return ops;
+}
+
+// a number with an optional s, m, h, d, or w for times
+static int parse_number( char *str, double *number)
+{
+  char *end;
+
+  *number = strtod( str, &end);
+  if( end == str)
+    return 1;
+  switch( *end)
+    {
+    case '\0':
+    case 's':
+      break;
+    case 'm':
+      *number *= 60;
+      break;
+    case 'h':
+      *number *= 60*60;
+      break;
+    case 'd':
+      *number *= 24*60*60;
+      break;
+    case 'w':
+      *number *= 7*24*60*60;
+      break;
+    default:
+      return 1;
+    }
+  return (*end != '\0') && (end[1] != '\0');
+}
+
+// the field named by the word, with its key or parameter
+static int parse_field( struct parser *ps, struct filter_op *op)
+{
+  static const struct { char *name; int field; } fields[] =
+    { { "name", FIELD_NAME }, { "status", FIELD_STATUS },
+      { "age", FIELD_AGE }, { "time", FIELD_TIME },
+      { "user_msg", FIELD_USER_MSG }, { "ip", FIELD_IP },
+      { "os", FIELD_OS } };
+  char *word = ps->text;
+  char *dot;
+  int i;
+
+  for( i = 0; i < (int) (sizeof( fields) / sizeof( fields[0])); i++)
+    if( !strcmp( word, fields[i].name) )
+      {
+        op->field = fields[i].field;
+        return 0;
+      }
+
+  dot = strchr( word, '.');
+  if( (dot == NULL) || (dot[1] == '\0') )
+    {
+      parse_error( ps, "unknown field");
+      return 1;
+    }
+  *dot = '\0';
+  if( !strcmp( word, "env") )
+    {
+      op->field = FIELD_ENV;
+      op->key = strdup( dot + 1);
+      return op->key == NULL;
+    }
+  // OS parameters are of form os.parameter, like linux.user
+  op->field = FIELD_PARAM;
+  op->os_type = alive_find_os_param( word, dot + 1, &op->param);
+  if( op->os_type < 0)
+    {
+      *dot = '.';
+      parse_error( ps, "unknown field");
+      return 1;
+    }
+  op->index = op->param - alive_os_schema( op->os_type)->params;
+  return 0;
+}
+
+// the value compared to, checked against the field
+static int parse_value( struct parser *ps, struct filter_op *op)
+{
+  const struct alive_os_schema *schema;
+  int prefix_length;
+  int i, bad;
+
+  bad = 0;
+  op->string = ps->text;
+  ps->text = NULL;
+  op->number_flag = !parse_number( op->string, &op->number);
+  switch( op->field)
+    {
+    case FIELD_NAME:
+    case FIELD_ENV:
+      bad = (op->compare == CMP_IN);
+      break;
+    case FIELD_STATUS:
+      bad = (op->compare != CMP_EQ) && (op->compare != CMP_NE);
+      for( i = 0; !bad && (i <= STATUS_CONFLICT); i++)
+        if( !strcasecmp( op->string, status_names[i]) )
+          break;
+      if( !bad && (i > STATUS_CONFLICT) )
+        {
+          parse_error( ps, "unknown status");
+          return 1;
+        }
+      op->number = i;
+      break;
+    case FIELD_AGE:
+    case FIELD_TIME:
+    case FIELD_USER_MSG:
+      bad = (op->compare >= CMP_MATCH) || !op->number_flag;
+      break;
+    case FIELD_IP:
+      if( (op->compare != CMP_EQ) && (op->compare != CMP_NE) &&
+          (op->compare != CMP_IN) )
+        bad = 1;
+      else if( alive_parse_cidr( op->string, &op->network, &prefix_length))
+        {
+          parse_error( ps, "bad address");
+          return 1;
+        }
+      else
+        {
+          op->mask = prefix_length ?
+            (0xffffffffu << (32 - prefix_length)) : 0;
+          op->network &= op->mask;
+          // an address alone is a /32, so this is the same
+          if( op->compare == CMP_EQ)
+            op->compare = CMP_IN;
+        }
+      break;
+    case FIELD_OS:
+      bad = (op->compare != CMP_EQ) && (op->compare != CMP_NE);
+      op->os_type = -1;
+      for( i = 0; !bad && (i <= WINDOWS); i++)
+        if( ((schema = alive_os_schema( i)) != NULL) &&
+            !strcasecmp( op->string, schema->name) )
+          op->os_type = i;
+      if( !strcasecmp( op->string, "generic") )
+        op->os_type = GENERIC;
+      if( !bad && (op->os_type < 0) )
+        {
+          parse_error( ps, "unknown OS");
+          return 1;
+        }
+      break;
+    case FIELD_PARAM:
+      bad = (op->compare == CMP_IN) ||
+        ((op->param->type == PARAM_UINT32) &&
+         ((op->compare >= CMP_MATCH) || !op->number_flag));
+      break;
+    }
+  if( bad)
+    {
+      parse_error( ps, "comparison doesn't fit the field");
+      return 1;
+    }
+
+  if( (op->compare == CMP_MATCH) || (op->compare == CMP_NOT_MATCH) )
+    {
+      op->regex = malloc( sizeof( regex_t));
+      if( (op->regex == NULL) ||
+          regcomp( op->regex, op->string, REG_EXTENDED | REG_NOSUB) )
+        {
+          free( op->regex);
+          op->regex = NULL;
+          parse_error( ps, "bad pattern");
+          return 1;
+        }
+    }
+  return 0;
+}
+
+// field compare value, or an environment variable or OS parameter alone
+// for whether it is set
+static int parse_test( struct parser *ps)
+{
+  struct filter_op *op;
+  int compare;
+
+  // errors in tokens are already written
+  if( ps->token == TOKEN_ERROR)
+    return 1;
+  if( ps->token != TOKEN_WORD)
+    {
+      parse_error( ps, "expected a field");
+      return 1;
+    }
+  op = add_op( ps, OP_TEST);
+  if( (op == NULL) || parse_field( ps, op) )
+    return 1;
+
+  if( next_token( ps, &compare) != TOKEN_COMPARE)
+    {
+      if( ps->token == TOKEN_ERROR)
+        return 1;
+      if( (op->field != FIELD_ENV) && (op->field != FIELD_PARAM) )
+        {
+          parse_error( ps, "expected a comparison");
+          return 1;
+        }
+      op->compare = CMP_SET;
+      return ps->token == TOKEN_ERROR;
+    }
+  op->compare = compare;
+
+  if( (next_token( ps, &compare) != TOKEN_WORD) &&
+      (ps->token != TOKEN_STRING) )
+    {
+      if( ps->token == TOKEN_ERROR)
+        return 1;
+      parse_error( ps, "expected a value");
+      return 1;
+    }
+  if( parse_value( ps, op) )
+    return 1;
+  next_token( ps, &compare);
+  return ps->token == TOKEN_ERROR;
+}
+
+static int parse_not( struct parser *ps)
+{
+  int compare;
+
+  if( ps->token == TOKEN_NOT)
+    {
+      next_token( ps, &compare);
+      if( parse_not( ps) )
+        return 1;
+      return add_op( ps, OP_NOT) == NULL;
+    }
+  if( ps->token == TOKEN_OPEN)
+    {
+      next_token( ps, &compare);
+      if( parse_or( ps) )
+        return 1;
+      if( ps->token != TOKEN_CLOSE)
+        {
+          parse_error( ps, "expected \")\"");
+          return 1;
+        }
+      next_token( ps, &compare);
+      return ps->token == TOKEN_ERROR;
+    }
+  return parse_test( ps);
+}
+
+// a run of operands joined by token, each jumping past the rest when the
+// result is settled
+static int parse_run( struct parser *ps, int token, int code,
+                      int (*operand)( struct parser *))
+{
+  struct filter_op *op;
+  int jump;
+  int compare;
+
+  if( operand( ps) )
+    return 1;
+  while( ps->token == token)
+    {
+      op = add_op( ps, code);
+      if( op == NULL)
+        return 1;
+      jump = ps->filter->number - 1;
+      next_token( ps, &compare);
+      if( operand( ps) )
+        return 1;
+      ps->filter->ops[jump].jump = ps->filter->number;
+    }
+  return 0;
+}
+
+static int parse_and( struct parser *ps)
+{
+  return parse_run( ps, TOKEN_AND, OP_JUMP_FALSE, parse_not);
+}
+
+static int parse_or( struct parser *ps)
+{
+  return parse_run( ps, TOKEN_OR, OP_JUMP_TRUE, parse_and);
+}
+
+struct alive_filter *alive_filter_compile( char *expression)
+{
+  struct parser ps;
+  int compare;
+
+  memset( &ps, 0, sizeof( struct parser));
+  ps.filter = calloc( 1, sizeof( struct alive_filter));
+  if( ps.filter == NULL)
+    return NULL;
+  ps.expression = ps.p = expression;
+
+  next_token( &ps, &compare);
+  if( (ps.token == TOKEN_ERROR) || parse_or( &ps) )
+    {
+      free( ps.text);
+      alive_filter_free( ps.filter);
+      return NULL;
+    }
+  if( ps.token != TOKEN_END)
+    {
+      parse_error( &ps, "unexpected text");
+      free( ps.text);
+      alive_filter_free( ps.filter);
+      return NULL;
+    }
+  return ps.filter;
+}
+
+void alive_filter_free( struct alive_filter *filter)
+{
+  int i;
+
+  if( filter == NULL)
+    return;
+  for( i = 0; i < filter->number; i++)
+    {
+      free( filter->ops[i].key);
+      free( filter->ops[i].string);
+      if( filter->ops[i].regex != NULL)
+        {
+          regfree( filter->ops[i].regex);
+          free( filter->ops[i].regex);
+        }
+    }
+  free( filter->ops);
+  free( filter);
+}
+
+
+/////////////////////////////////////////////
+
+static uint16_t raw_uint16( char *p)
+{
+  uint16_t val;
+
+  memcpy( &val, p, 2);
+  return ntohs( val);
+}
+
+static uint32_t raw_uint32( char *p)
+{
+  uint32_t val;
+
+  memcpy( &val, p, 4);
+  return ntohl( val);
+}
+
+// the raw OS type, or -1 for none
+static int raw_os_type( struct filter_subject *s)
+{
+  struct alive_wire_env_count count;
+  struct alive_wire_env_extra extra;
+  char *p;
+  int i;
+
+  if( s->raw_env == NULL)
+    return -1;
+  if( s->raw_extra == NULL)
+    {
+      // the record was checked when it was found, so this stays inside
+      p = s->raw_env;
+      alive_wire_get_env_count( p, &count);
+      p += ALIVE_WIRE_SIZE( env_count);
+      for( i = 0; i < count.number; i++)
+        {
+          p += 1 + *((uint8_t *) p);
+          p += 2 + raw_uint16( p);
+        }
+      s->raw_extra = p;
+    }
+  alive_wire_get_env_extra( s->raw_extra, &extra);
+  return extra.extra_type;
+}
+
+static int subject_os_type( struct filter_subject *s)
+{
+  if( s->env != NULL)
+    return s->env->extra_type;
+  return raw_os_type( s);
+}
+
+// Finds a string field, returning 0 if it is unset.  Numeric parameters
+// are given in *number instead, with a NULL string.
+static int subject_string( struct filter_subject *s, struct filter_op *op,
+                           char **str, int *length, uint32_t *number)
+{
+  const struct alive_os_param *params;
+  char *p, *field;
+  int n, len;
+  int i;
+
+  *str = NULL;
+  *number = 0;
+  switch( op->field)
+    {
+    case FIELD_NAME:
+      *str = s->name;
+      *length = s->name_length;
+      return 1;
+
+    case FIELD_ENV:
+      if( s->env != NULL)
+        {
+          for( i = 0; i < s->env->number_envvar; i++)
+            if( !strcmp( op->key, s->env->envvar_key[i]) )
+              {
+                *str = s->env->envvar_value[i];
+                *length = strlen( *str);
+                return 1;
+              }
+          return 0;
+        }
+      if( s->raw_env == NULL)
+        return 0;
+      len = strlen( op->key);
+      p = s->raw_env;
+      n = raw_uint16( p);
+      p += ALIVE_WIRE_SIZE( env_count);
+      for( i = 0; i < n; i++)
+        {
+          if( (*((uint8_t *) p) == len) && !memcmp( p + 1, op->key, len) )
+            {
+              p += 1 + len;
+              *str = p + 2;
+              *length = raw_uint16( p);
+              return 1;
+            }
+          p += 1 + *((uint8_t *) p);
+          p += 2 + raw_uint16( p);
+        }
+      return 0;
+
+    case FIELD_PARAM:
+      if( subject_os_type( s) != op->os_type)
+        return 0;
+      if( s->env != NULL)
+        {
+          if( s->env->extra == NULL)
+            return 0;
+          field = (char *) s->env->extra + op->param->offset;
+          if( op->param->type == PARAM_UINT32)
+            {
+              *number = *((uint32_t *) field);
+              return 1;
+            }
+          *str = *((char **) field);
+          if( *str == NULL)
+            return 0;
+          *length = strlen( *str);
+          return 1;
+        }
+      // past the parameters before it
+      p = s->raw_extra + ALIVE_WIRE_SIZE( env_extra);
+      params = alive_os_schema( op->os_type)->params;
+      for( i = 0; i < op->index; i++)
+        if( params[i].type == PARAM_STRING)
+          p += 1 + *((uint8_t *) p);
+        else
+          p += sizeof(uint32_t);
+      if( op->param->type == PARAM_UINT32)
+        {
+          *number = raw_uint32( p);
+          return 1;
+        }
+      *str = p + 1;
+      *length = *((uint8_t *) p);
+      return 1;
+    }
+  return 0;
+}
+
+static int compare_number( int compare, double x, double y)
+{
+  switch( compare)
+    {
+    case CMP_EQ:
+      return x == y;
+    case CMP_NE:
+      return x != y;
+    case CMP_LT:
+      return x < y;
+    case CMP_LE:
+      return x <= y;
+    case CMP_GT:
+      return x > y;
+    case CMP_GE:
+      return x >= y;
+    }
+  return 0;
+}
+
+static int test_string( struct filter_op *op, char *str, int length)
+{
+  char buffer[256];
+  char *copy, *end;
+  double value;
+  int ret, cmp;
+
+  switch( op->compare)
+    {
+    case CMP_EQ:
+    case CMP_NE:
+      ret = (length == (int) strlen( op->string)) &&
+        !memcmp( str, op->string, length);
+      return (op->compare == CMP_EQ) ? ret : !ret;
+    case CMP_MATCH:
+    case CMP_NOT_MATCH:
+      break;
+    default:
+      // numerically if both are numbers, otherwise by the characters
+      copy = (length < (int) sizeof( buffer)) ? buffer : malloc( length + 1);
+      if( copy == NULL)
+        return 0;
+      memcpy( copy, str, length);
+      copy[length] = '\0';
+      value = strtod( copy, &end);
+      if( op->number_flag && (end != copy) && (*end == '\0') )
+        ret = compare_number( op->compare, value, op->number);
+      else
+        {
+          cmp = strcmp( copy, op->string);
+          ret = compare_number( op->compare, cmp, 0);
+        }
+      if( copy != buffer)
+        free( copy);
+      return ret;
+    }
+
+  // patterns need a terminated string
+  copy = (length < (int) sizeof( buffer)) ? buffer : malloc( length + 1);
+  if( copy == NULL)
+    return 0;
+  memcpy( copy, str, length);
+  copy[length] = '\0';
+  ret = !regexec( op->regex, copy, 0, NULL, 0);
+  if( copy != buffer)
+    free( copy);
+  return (op->compare == CMP_MATCH) ? ret : !ret;
+}
+
+static int test( struct filter_op *op, struct filter_subject *s)
+{
+  char *str;
+  int length;
+  uint32_t number;
+  int ret;
+
+  switch( op->field)
+    {
+    case FIELD_STATUS:
+      ret = (s->status == op->number);
+      return (op->compare == CMP_EQ) ? ret : !ret;
+    case FIELD_AGE:
+      return compare_number( op->compare, s->age, op->number);
+    case FIELD_TIME:
+      return compare_number( op->compare, s->time_value, op->number);
+    case FIELD_USER_MSG:
+      return compare_number( op->compare, s->user_msg, op->number);
+    case FIELD_IP:
+      ret = ((s->address & op->mask) == op->network);
+      return (op->compare == CMP_IN) ? ret : !ret;
+    case FIELD_OS:
+      ret = (subject_os_type( s) == op->os_type);
+      return (op->compare == CMP_EQ) ? ret : !ret;
+    }
+
+  // the rest may be unset, which only != and !~ are true of
+  if( !subject_string( s, op, &str, &length, &number) )
+    return (op->compare == CMP_NE) || (op->compare == CMP_NOT_MATCH);
+  if( op->compare == CMP_SET)
+    return 1;
+  if( str == NULL)
+    return compare_number( op->compare, number, op->number);
+  return test_string( op, str, length);
+}
+
+static int run( struct alive_filter *filter, struct filter_subject *s)
+{
+  struct filter_op *op;
+  int result;
+  int pc;
+
+  result = 1;
+  for( pc = 0; pc < filter->number; pc++)
+    {
+      op = &(filter->ops[pc]);
+      switch( op->code)
+        {
+        case OP_TEST:
+          result = test( op, s);
+          break;
+        case OP_NOT:
+          result = !result;
+          break;
+        case OP_JUMP_FALSE:
+          if( !result)
+            pc = op->jump - 1;
+          break;
+        case OP_JUMP_TRUE:
+          if( result)
+            pc = op->jump - 1;
+          break;
+        }
+    }
+  return result;
+}
+
+
+/////////////////////////////////////////////
+
+int alive_filter_match( struct alive_filter *filter, struct alive_db *db,
+                        struct alive_ioc *ioc)
+{
+  struct filter_subject s;
+
+  memset( &s, 0, sizeof( struct filter_subject));
+  s.name = ioc->ioc_name;
+  s.name_length = strlen( ioc->ioc_name);
+  s.status = ioc->status;
+  s.age = alive_ioc_status_time( db, ioc);
+  s.time_value = ioc->time_value;
+  s.address = alive_ip_host_order( ioc->ip_address);
+  s.user_msg = ioc->user_msg;
+  s.env = ioc->environment;
+  return run( filter, &s);
+}
+
+int alive_filter_iocs( struct alive_filter *filter, struct alive_db *db,
+                       int *order, int number)
+{
+  int i, kept;
+
+  kept = 0;
+  for( i = 0; i < number; i++)
+    if( alive_filter_match( filter, db, &(db->ioc[order[i]])) )
+      order[kept++] = order[i];
+  return kept;
+}
+
+int alive_filter_match_raw( struct alive_filter *filter, char *data,
+                            struct alive_raw_record *record)
+{
+  struct filter_subject s;
+  struct alive_wire_db_header header;
+  struct alive_wire_ioc w;
+  struct alive_wire_env_flag flag;
+  struct alive_db db;
+  struct alive_ioc ioc;
+  const char *p;
+
+  memset( &s, 0, sizeof( struct filter_subject));
+  s.name = record->name;
+  s.name_length = record->name_length;
+
+  // as decode_db() does
+  p = alive_wire_get_ioc( record->name + record->name_length, &w);
+  s.status = w.status;
+  s.time_value = w.time;
+  ioc.raw_ip_address = w.ip;
+  s.address = alive_ip_host_order( ioc.ip_address);
+  s.user_msg = w.user_msg;
+  p = alive_wire_get_env_flag( p, &flag);
+  if( flag.present)
+    s.raw_env = (char *) p;
+
+  alive_wire_get_db_header( data, &header);
+  db.current_time = header.current_time;
+  db.start_time = header.start_time;
+  ioc.status = s.status;
+  ioc.time_value = s.time_value;
+  s.age = alive_ioc_status_time( &db, &ioc);
+
+  return run( filter, &s);
+}
+
+struct alive_db *alive_filter_decode_db( struct alive_filter *filter,
+                                         char *data, int length)
+{
+  struct alive_raw_record *records;
+  struct alive_wire_db_header header;
+  struct alive_db *db;
+  char *subset, *p;
+  int number, kept;
+  int i;
+
+  number = alive_raw_db_records( data, length, &records);
+  if( number < 0)
+    {
+      printf("Unable to handle this response.\n");
+      return NULL;
+    }
+
+  // a response of just the IOCs that match, in their order
+  subset = malloc( length);
+  if( subset == NULL)
+    {
+      free( records);
+      return NULL;
+    }
+  alive_wire_get_db_header( data, &header);
+  p = subset + ALIVE_WIRE_SIZE( db_header);
+  kept = 0;
+  for( i = 0; i < number; i++)
+    if( alive_filter_match_raw( filter, data, &records[i]) )
+      {
+        memcpy( p, data + records[i].offset, records[i].length);
+        p += records[i].length;
+        kept++;
+      }
+  header.number = kept;
+  alive_wire_put_db_header( subset, &header);
+
+  db = alive_decode_db( subset, p - subset);
+  free( subset);
+  free( records);
+  return db;
+}
+
+struct alive_db *alive_get_filtered_db( char *server, int port,
+                                        struct alive_filter *filter)
+{
+  struct alive_db *db;
+  char *data;
+  uint16_t request;
+  int length;
+
+  request = htons( REQUEST_ALL_IOCS);
+  data = alive_request_raw( server, port, (char *) &request, 2, &length);
+  if( data == NULL)
+    return NULL;
+  db = alive_filter_decode_db( filter, data, length);
+  free( data);
+  return db;
+}
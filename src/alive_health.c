@@ -0,0 +1,229 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Health of the IOC instances, from the debug information of every IOC.
+// As with the availability report, a pool of threads each take the next
+// IOC and fetch it, so the scan takes about as long as the slowest few
+// fetches rather than all of them in a row.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "alive_client.h"
+
+
+void alive_ioc_health( struct alive_detailed_ioc *detail,
+                       struct alive_detailed_ioc *previous,
+                       double lag_periods, struct alive_ioc_health *health)
+{
+  struct alive_instance *inst, *old;
+  double lag;
+  int live;
+  int i, j;
+
+  health->flags = 0;
+  health->live = health->maybe = health->stale = health->restarted = 0;
+  health->lag = 0.0;
+
+  for( i = 0; i < detail->number_instances; i++)
+    {
+      inst = &(detail->instances[i]);
+
+      live = (inst->status == INSTANCE_STATUS_UP) ||
+        (inst->status == INSTANCE_STATUS_MAYBE_UP);
+      if( live)
+        health->live++;
+      if( (inst->status == INSTANCE_STATUS_MAYBE_UP) ||
+          (inst->status == INSTANCE_STATUS_MAYBE_DOWN) )
+        health->maybe++;
+
+      // a down instance is expected to have gone quiet
+      if( live && inst->period && (detail->current_time > inst->timestamp) )
+        {
+          lag = (double) (detail->current_time - inst->timestamp) /
+            inst->period;
+          if( lag > health->lag)
+            health->lag = lag;
+          if( lag > lag_periods)
+            health->stale++;
+        }
+
+      // the same instance is the same address and port
+      if( previous != NULL)
+        for( j = 0; j < previous->number_instances; j++)
+          {
+            old = &(previous->instances[j]);
+            if( (old->raw_ip_address == inst->raw_ip_address) &&
+                (old->origin_port == inst->origin_port) )
+              {
+                if( old->incarnation != inst->incarnation)
+                  health->restarted++;
+                break;
+              }
+          }
+    }
+
+  if( health->live > 1)
+    health->flags |= HEALTH_MULTIPLE_LIVE;
+  if( health->maybe)
+    health->flags |= HEALTH_MAYBE;
+  if( health->stale)
+    health->flags |= HEALTH_STALE;
+  if( health->restarted)
+    health->flags |= HEALTH_RESTARTED;
+}
+
+
+struct health_work
+{
+  char *server;
+  int port;
+  double lag_periods;
+  struct alive_health_report *report;
+  struct alive_health_report *previous;
+
+  pthread_mutex_t lock;
+  int next;
+};
+
+static int compare_health_name( const void *a, const void *b)
+{
+  return strcmp( ((const struct alive_ioc_health *) a)->ioc_name,
+                 ((const struct alive_ioc_health *) b)->ioc_name);
+}
+
+static void *health_worker( void *arg)
+{
+  struct health_work *work = arg;
+  struct alive_ioc_health *health, *old;
+  struct alive_detailed_ioc *detail;
+  int i;
+
+  while( 1)
+    {
+      pthread_mutex_lock( &work->lock);
+      i = work->next++;
+      pthread_mutex_unlock( &work->lock);
+      if( i >= work->report->number)
+        break;
+
+      health = &(work->report->iocs[i]);
+      detail = alive_get_debug( work->server, work->port, health->ioc_name);
+      if( detail == NULL)
+        continue;
+
+      old = NULL;
+      if( work->previous != NULL)
+        old = bsearch( health, work->previous->iocs,
+                       work->previous->number,
+                       sizeof( struct alive_ioc_health), compare_health_name);
+      alive_ioc_health( detail, (old != NULL) ? old->detail : NULL,
+                        work->lag_periods, health);
+      health->detail = detail;
+      health->valid = 1;
+    }
+
+  return NULL;
+}
+
+struct alive_health_report *alive_get_health( char *server, int port,
+                                              int number, char **names,
+                                              double lag_periods,
+                                              int threads,
+                                              struct alive_health_report *previous)
+{
+  struct alive_health_report *report;
+  struct health_work work;
+  struct alive_db *db;
+  pthread_t *tids;
+  int started;
+  int i;
+
+  // the IOCs are whatever the daemon knows of
+  db = alive_get_iocs( server, port, number, names);
+  if( db == NULL)
+    return NULL;
+
+  report = calloc( 1, sizeof( struct alive_health_report));
+  if( report == NULL)
+    {
+      alive_free_db( db);
+      return NULL;
+    }
+  report->current_time = db->current_time;
+  report->number = db->number_ioc;
+  report->iocs = calloc( db->number_ioc + 1,
+                         sizeof( struct alive_ioc_health));
+  if( report->iocs == NULL)
+    {
+      free( report);
+      alive_free_db( db);
+      return NULL;
+    }
+  // names are taken over from the database
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      report->iocs[i].ioc_name = db->ioc[i].ioc_name;
+      db->ioc[i].ioc_name = NULL;
+    }
+  alive_free_db( db);
+  // sorted so the next scan can find these
+  qsort( report->iocs, report->number, sizeof( struct alive_ioc_health),
+         compare_health_name);
+
+  if( threads < 1)
+    threads = 1;
+  if( threads > report->number)
+    threads = report->number;
+
+  work.server = server;
+  work.port = port;
+  work.lag_periods = lag_periods;
+  work.report = report;
+  work.previous = previous;
+  work.next = 0;
+  pthread_mutex_init( &work.lock, NULL);
+
+  tids = malloc( (threads ? threads : 1) * sizeof( pthread_t));
+  started = 0;
+  if( tids != NULL)
+    for( ; started < threads; started++)
+      if( pthread_create( &tids[started], NULL, health_worker, &work))
+        break;
+  if( !started)
+    // do it all here instead
+    health_worker( &work);
+  for( i = 0; i < started; i++)
+    pthread_join( tids[i], NULL);
+  free( tids);
+  pthread_mutex_destroy( &work.lock);
+
+  return report;
+}
+
+void alive_free_health_report( struct alive_health_report *report)
+{
+  int i;
+
+  if( report == NULL)
+    return;
+  for( i = 0; i < report->number; i++)
+    {
+      free( report->iocs[i].ioc_name);
+      if( report->iocs[i].detail != NULL)
+        alive_free_detailed( report->iocs[i].detail);
+    }
+  free( report->iocs);
+  free( report);
+}
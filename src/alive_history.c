@@ -0,0 +1,1209 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// A history directory holds three files:
+//
+//   history.log    "ALVH", u32 version, then records
+//   history.idx    struct history_index_entry for each keyframe
+//   history.names  IOC names, one per line; the line number is the ID
+//
+// A record is a tag byte, its time, and a count of entries.  Keyframes
+// give the absolute time and the daemon's start time, then every IOC
+// present in ID order, with all its fields.  Change records give the
+// time since the record before, then only the IOCs that changed, each
+// with a flag byte saying which fields follow.  Numbers are varints,
+// signed ones zigzag encoded, and times of IOCs are relative to the
+// record's time, so most entries take a few bytes.  Polls with no
+// changes write nothing.
+//
+// Names are written before the records that use them, and each record is
+// written at once, so a reader opening the files while they're being
+// appended to at most sees a partial record at the end, which it ignores.
+// The writer truncates such a record away when it reopens the history.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "alive_client.h"
+
+
+#define HISTORY_MAGIC "ALVH"
+#define HISTORY_VERSION (1)
+#define HISTORY_HEADER_SIZE (8)
+// a reader never has to replay more than this much of the log
+#define HISTORY_KEYFRAME_SECONDS (3600)
+
+enum history_record_tags { Record_Keyframe = 1, Record_Changes = 2 };
+
+// fields a change record can carry
+#define HISTORY_FIELDS (CHANGE_ADDED | CHANGE_REMOVED | CHANGE_STATUS | \
+                        CHANGE_TIME | CHANGE_IP | CHANGE_USER_MSG)
+
+// in host byte order, as the file is only for local use
+struct history_index_entry
+{
+  uint64_t offset;
+  uint32_t time;
+  uint32_t unused;
+};
+
+// last known values of an IOC, by ID
+struct history_state
+{
+  uint8_t present;
+  uint8_t status;
+  uint32_t ip;  // host order
+  uint32_t user_msg;
+  time_t time_value;
+  uint32_t mark;  // last record or poll it was seen in
+};
+
+// one decoded entry of a record; a keyframe's have CHANGE_ADDED set
+struct history_entry
+{
+  uint32_t id;
+  uint8_t flags;
+  uint8_t status;
+  uint32_t ip;
+  uint32_t user_msg;
+  time_t time_value;
+};
+
+struct history_record
+{
+  int tag;
+  time_t time;
+  time_t start_time;  // keyframes only
+  uint32_t number;
+};
+
+
+struct byte_buffer
+{
+  unsigned char *data;
+  size_t length;
+  size_t size;
+  int failed;
+};
+
+static void put_byte( struct byte_buffer *bb, uint8_t byte)
+{
+  unsigned char *p;
+  size_t size;
+
+  if( bb->length == bb->size)
+    {
+      size = bb->size ? 2 * bb->size : 4096;
+      p = realloc( bb->data, size);
+      if( p == NULL)
+        {
+          bb->failed = 1;
+          return;
+        }
+      bb->data = p;
+      bb->size = size;
+    }
+  bb->data[bb->length++] = byte;
+}
+
+static void put_varint( struct byte_buffer *bb, uint64_t v)
+{
+  while( v >= 0x80)
+    {
+      put_byte( bb, (v & 0x7f) | 0x80);
+      v >>= 7;
+    }
+  put_byte( bb, v);
+}
+
+static void put_signed( struct byte_buffer *bb, int64_t v)
+{
+  put_varint( bb, ((uint64_t) v << 1) ^ (uint64_t) (v >> 63));
+}
+
+static void put_bytes( struct byte_buffer *bb, void *data, size_t length)
+{
+  unsigned char *p = data;
+
+  while( length--)
+    put_byte( bb, *p++);
+}
+
+// these return NULL if the value runs past the end
+static unsigned char *get_varint( unsigned char *p, unsigned char *end,
+                                  uint64_t *v)
+{
+  int shift;
+
+  *v = 0;
+  for( shift = 0; shift < 64; shift += 7)
+    {
+      if( p >= end)
+        return NULL;
+      *v |= (uint64_t) (*p & 0x7f) << shift;
+      if( !(*p++ & 0x80) )
+        return p;
+    }
+  return NULL;
+}
+
+static unsigned char *get_signed( unsigned char *p, unsigned char *end,
+                                  int64_t *v)
+{
+  uint64_t u;
+
+  p = get_varint( p, end, &u);
+  *v = (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+  return p;
+}
+
+
+// Decodes the record at p into rec and entries, returning the position
+// after it, or NULL if it is incomplete or damaged.  IDs must be below
+// number_names, so there are never more entries than that.
+static unsigned char *decode_record( unsigned char *p, unsigned char *end,
+                                     time_t prev_time, uint32_t number_names,
+                                     struct history_record *rec,
+                                     struct history_entry *entries)
+{
+  struct history_entry *e;
+  uint64_t u;
+  int64_t s;
+  int64_t id;
+  uint32_t i;
+
+  if( p >= end)
+    return NULL;
+  rec->tag = *p++;
+  if( rec->tag == Record_Keyframe)
+    {
+      if( ((p = get_varint( p, end, &u)) == NULL) ||
+          ((p = get_signed( p, end, &s)) == NULL) )
+        return NULL;
+      rec->time = u;
+      rec->start_time = rec->time + s;
+    }
+  else if( rec->tag == Record_Changes)
+    {
+      if( (p = get_signed( p, end, &s)) == NULL)
+        return NULL;
+      rec->time = prev_time + s;
+      rec->start_time = 0;
+    }
+  else
+    return NULL;
+  if( ((p = get_varint( p, end, &u)) == NULL) || (u > number_names) )
+    return NULL;
+  rec->number = u;
+
+  id = 0;
+  for( i = 0; i < rec->number; i++)
+    {
+      e = &entries[i];
+      if( rec->tag == Record_Keyframe)
+        {
+          // in order, so the first is relative to zero and the rest to
+          // the one before
+          if( (p = get_varint( p, end, &u)) == NULL)
+            return NULL;
+          id += u;
+          e->flags = CHANGE_ADDED;
+        }
+      else
+        {
+          if( ((p = get_signed( p, end, &s)) == NULL) || (p >= end) )
+            return NULL;
+          id += s;
+          e->flags = *p++;
+          if( !(e->flags & HISTORY_FIELDS) || (e->flags & ~HISTORY_FIELDS) )
+            return NULL;
+        }
+      if( (id < 0) || (id >= number_names) )
+        return NULL;
+      e->id = id;
+
+      if( e->flags & (CHANGE_ADDED | CHANGE_STATUS) )
+        {
+          if( p >= end)
+            return NULL;
+          e->status = *p++;
+        }
+      if( e->flags & (CHANGE_ADDED | CHANGE_TIME) )
+        {
+          if( (p = get_signed( p, end, &s)) == NULL)
+            return NULL;
+          e->time_value = rec->time + s;
+        }
+      if( e->flags & (CHANGE_ADDED | CHANGE_IP) )
+        {
+          if( (p = get_varint( p, end, &u)) == NULL)
+            return NULL;
+          e->ip = u;
+        }
+      if( e->flags & (CHANGE_ADDED | CHANGE_USER_MSG) )
+        {
+          if( (p = get_varint( p, end, &u)) == NULL)
+            return NULL;
+          e->user_msg = u;
+        }
+    }
+
+  return p;
+}
+
+
+static char *history_path( char *dir, char *file)
+{
+  char *path;
+
+  path = malloc( strlen( dir) + strlen( file) + 2);
+  if( path != NULL)
+    sprintf( path, "%s/%s", dir, file);
+  return path;
+}
+
+// whole file, with a NUL added at the end
+static char *read_file( char *dir, char *file, size_t *length)
+{
+  struct stat st;
+  char *path, *data;
+  ssize_t n;
+  size_t got;
+  int fd;
+
+  path = history_path( dir, file);
+  if( path == NULL)
+    return NULL;
+  fd = open( path, O_RDONLY);
+  free( path);
+  if( fd == -1)
+    return NULL;
+  if( fstat( fd, &st) || ((data = malloc( st.st_size + 1)) == NULL) )
+    {
+      close( fd);
+      return NULL;
+    }
+  got = 0;
+  while( got < (size_t) st.st_size)
+    {
+      n = read( fd, data + got, st.st_size - got);
+      if( n <= 0)
+        break;
+      got += n;
+    }
+  close( fd);
+  data[got] = '\0';
+  *length = got;
+  return data;
+}
+
+// Splits the names file in place.  A last line without its newline is
+// still being written, so it is left out.
+static char **split_names( char *text, size_t length, uint32_t *number)
+{
+  char **names;
+  uint32_t count;
+  size_t i;
+
+  count = 0;
+  for( i = 0; i < length; i++)
+    if( text[i] == '\n')
+      count++;
+  names = malloc( (count ? count : 1) * sizeof( char *));
+  if( names == NULL)
+    return NULL;
+
+  *number = 0;
+  names[0] = text;
+  for( i = 0; (i < length) && (*number < count); i++)
+    if( text[i] == '\n')
+      {
+        text[i] = '\0';
+        (*number)++;
+        if( *number < count)
+          names[*number] = text + i + 1;
+      }
+  return names;
+}
+
+static int write_all( int fd, void *data, size_t length)
+{
+  char *p = data;
+  ssize_t n;
+
+  while( length)
+    {
+      n = write( fd, p, length);
+      if( n == -1)
+        {
+          if( errno == EINTR)
+            continue;
+          return 1;
+        }
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/////////////////////////////////////////////
+// Writer
+
+struct alive_history_writer
+{
+  int log_fd;
+  int index_fd;
+  int names_fd;
+
+  char **names;
+  uint32_t number_names;
+  uint32_t names_size;
+  uint32_t names_written;  // to the names file
+  off_t names_length;
+  struct history_state *state;
+
+  // name to ID + 1, open addressing
+  uint32_t *table;
+  uint32_t table_size;
+
+  uint32_t mark;
+  int have_keyframe;
+  time_t keyframe_time;
+  time_t last_time;
+  time_t start_time;
+
+  uint64_t *keys;  // ID and index of each IOC being recorded
+  struct byte_buffer record;
+  struct byte_buffer body;
+  struct byte_buffer new_names;  // names not written yet
+};
+
+static uint32_t name_hash( char *name)
+{
+  uint32_t h = 2166136261u;
+
+  while( *name)
+    {
+      h ^= (unsigned char) *name++;
+      h *= 16777619u;
+    }
+  return h;
+}
+
+static int table_insert( struct alive_history_writer *hw, uint32_t id)
+{
+  uint32_t *table;
+  uint32_t size, h, i;
+
+  if( 2 * (hw->number_names + 1) > hw->table_size)
+    {
+      size = hw->table_size ? 2 * hw->table_size : 1024;
+      table = calloc( size, sizeof( uint32_t));
+      if( table == NULL)
+        return 1;
+      for( i = 0; i < hw->table_size; i++)
+        if( hw->table[i])
+          {
+            h = name_hash( hw->names[hw->table[i] - 1]) & (size - 1);
+            while( table[h])
+              h = (h + 1) & (size - 1);
+            table[h] = hw->table[i];
+          }
+      free( hw->table);
+      hw->table = table;
+      hw->table_size = size;
+    }
+
+  h = name_hash( hw->names[id]) & (hw->table_size - 1);
+  while( hw->table[h])
+    h = (h + 1) & (hw->table_size - 1);
+  hw->table[h] = id + 1;
+  return 0;
+}
+
+// existing ID of the name, or a new one; -1 on error
+static int64_t name_id( struct alive_history_writer *hw, char *name)
+{
+  struct history_state *state;
+  uint32_t h, size;
+  char **names;
+
+  if( hw->table_size)
+    {
+      h = name_hash( name) & (hw->table_size - 1);
+      while( hw->table[h])
+        {
+          if( !strcmp( hw->names[hw->table[h] - 1], name) )
+            return hw->table[h] - 1;
+          h = (h + 1) & (hw->table_size - 1);
+        }
+    }
+
+  // a newline would throw off the names file
+  if( strchr( name, '\n') != NULL)
+    return -1;
+
+  if( hw->number_names == hw->names_size)
+    {
+      size = hw->names_size ? 2 * hw->names_size : 1024;
+      names = realloc( hw->names, size * sizeof( char *));
+      if( names == NULL)
+        return -1;
+      hw->names = names;
+      state = realloc( hw->state, size * sizeof( struct history_state));
+      if( state == NULL)
+        return -1;
+      hw->state = state;
+      hw->names_size = size;
+    }
+  hw->names[hw->number_names] = strdup( name);
+  if( hw->names[hw->number_names] == NULL)
+    return -1;
+  memset( &hw->state[hw->number_names], 0, sizeof( struct history_state));
+  if( table_insert( hw, hw->number_names) )
+    {
+      free( hw->names[hw->number_names]);
+      return -1;
+    }
+  return hw->number_names++;
+}
+
+// Drops anything after the last complete record, along with index
+// entries pointing there.
+static int recover_log( struct alive_history_writer *hw, char *dir)
+{
+  struct history_index_entry *index;
+  struct history_entry *entries;
+  struct history_record rec;
+  unsigned char *log, *p, *next, *end;
+  size_t log_length, index_length;
+  uint32_t number_index;
+  time_t prev_time;
+  char header[HISTORY_HEADER_SIZE];
+  uint32_t version;
+
+  memcpy( header, HISTORY_MAGIC, 4);
+  version = HISTORY_VERSION;
+  memcpy( header + 4, &version, 4);
+
+  log_length = lseek( hw->log_fd, 0, SEEK_END);
+  if( log_length < HISTORY_HEADER_SIZE)
+    {
+      if( ftruncate( hw->log_fd, 0) || ftruncate( hw->index_fd, 0) ||
+          (lseek( hw->log_fd, 0, SEEK_SET) != 0) ||
+          write_all( hw->log_fd, header, HISTORY_HEADER_SIZE) )
+        return 1;
+      return 0;
+    }
+
+  log = mmap( NULL, log_length, PROT_READ, MAP_SHARED, hw->log_fd, 0);
+  if( log == MAP_FAILED)
+    return 1;
+  if( memcmp( log, header, HISTORY_HEADER_SIZE) )
+    {
+      printf( "History in \"%s\" is not usable.\n", dir);
+      munmap( log, log_length);
+      return 1;
+    }
+
+  index = (struct history_index_entry *)
+    read_file( dir, "history.idx", &index_length);
+  number_index = (index == NULL) ? 0 :
+    index_length / sizeof( struct history_index_entry);
+  while( number_index && (index[number_index-1].offset >= log_length) )
+    number_index--;
+
+  entries = malloc( (hw->number_names ? hw->number_names : 1) *
+                    sizeof( struct history_entry));
+  if( entries == NULL)
+    {
+      free( index);
+      munmap( log, log_length);
+      return 1;
+    }
+  p = log + (number_index ? index[number_index-1].offset :
+             HISTORY_HEADER_SIZE);
+  end = log + log_length;
+  prev_time = 0;
+  while( (next = decode_record( p, end, prev_time, hw->number_names,
+                                &rec, entries)) != NULL)
+    {
+      prev_time = rec.time;
+      p = next;
+    }
+
+  if( ftruncate( hw->log_fd, p - log) ||
+      ftruncate( hw->index_fd,
+                 number_index * sizeof( struct history_index_entry)) )
+    {
+      free( entries);
+      free( index);
+      munmap( log, log_length);
+      return 1;
+    }
+
+  free( entries);
+  free( index);
+  munmap( log, log_length);
+  lseek( hw->log_fd, 0, SEEK_END);
+  lseek( hw->index_fd, 0, SEEK_END);
+  return 0;
+}
+
+struct alive_history_writer *alive_history_create( char *dir)
+{
+  struct alive_history_writer *hw;
+  char *text, **names, *path;
+  size_t length;
+  uint32_t number, i;
+
+  if( mkdir( dir, 0755) && (errno != EEXIST) )
+    {
+      printf( "Can't create history directory \"%s\"!\n", dir);
+      return NULL;
+    }
+
+  hw = calloc( 1, sizeof( struct alive_history_writer));
+  if( hw == NULL)
+    return NULL;
+  hw->log_fd = hw->index_fd = hw->names_fd = -1;
+
+  // the IDs already given out
+  text = read_file( dir, "history.names", &length);
+  if( text != NULL)
+    {
+      names = split_names( text, length, &number);
+      for( i = 0; (names != NULL) && (i < number); i++)
+        if( name_id( hw, names[i]) != i)
+          break;
+      free( names);
+      free( text);
+      if( (names == NULL) || (i < number) )
+        {
+          printf( "History names in \"%s\" are not usable.\n", dir);
+          alive_history_writer_close( hw);
+          return NULL;
+        }
+    }
+  hw->names_written = hw->number_names;
+  hw->names_length = 0;
+  for( i = 0; i < hw->number_names; i++)
+    hw->names_length += strlen( hw->names[i]) + 1;
+
+  path = history_path( dir, "history.names");
+  if( path != NULL)
+    {
+      hw->names_fd = open( path, O_WRONLY | O_CREAT, 0644);
+      free( path);
+    }
+  path = history_path( dir, "history.log");
+  if( path != NULL)
+    {
+      hw->log_fd = open( path, O_RDWR | O_CREAT, 0644);
+      free( path);
+    }
+  path = history_path( dir, "history.idx");
+  if( path != NULL)
+    {
+      hw->index_fd = open( path, O_RDWR | O_CREAT, 0644);
+      free( path);
+    }
+  if( (hw->names_fd == -1) || (hw->log_fd == -1) || (hw->index_fd == -1) )
+    {
+      printf( "Can't open history files in \"%s\"!\n", dir);
+      alive_history_writer_close( hw);
+      return NULL;
+    }
+
+  // a partial last name gets written again
+  if( ftruncate( hw->names_fd, hw->names_length) ||
+      (lseek( hw->names_fd, 0, SEEK_END) == -1) || recover_log( hw, dir) )
+    {
+      printf( "Can't open history files in \"%s\"!\n", dir);
+      alive_history_writer_close( hw);
+      return NULL;
+    }
+
+  return hw;
+}
+
+void alive_history_writer_close( struct alive_history_writer *hw)
+{
+  uint32_t i;
+
+  if( hw == NULL)
+    return;
+  if( hw->log_fd != -1)
+    close( hw->log_fd);
+  if( hw->index_fd != -1)
+    close( hw->index_fd);
+  if( hw->names_fd != -1)
+    close( hw->names_fd);
+  for( i = 0; i < hw->number_names; i++)
+    free( hw->names[i]);
+  free( hw->names);
+  free( hw->state);
+  free( hw->table);
+  free( hw->keys);
+  free( hw->record.data);
+  free( hw->body.data);
+  free( hw->new_names.data);
+  free( hw);
+}
+
+static int compare_keys( const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void put_fields( struct byte_buffer *bb, int flags,
+                        struct alive_ioc *ioc, time_t time)
+{
+  if( flags & (CHANGE_ADDED | CHANGE_STATUS) )
+    put_byte( bb, ioc->status);
+  if( flags & (CHANGE_ADDED | CHANGE_TIME) )
+    put_signed( bb, (int64_t) ioc->time_value - time);
+  if( flags & (CHANGE_ADDED | CHANGE_IP) )
+    put_varint( bb, ntohl( ioc->raw_ip_address));
+  if( flags & (CHANGE_ADDED | CHANGE_USER_MSG) )
+    put_varint( bb, ioc->user_msg);
+}
+
+static int state_changes( struct history_state *s, struct alive_ioc *ioc)
+{
+  int flags = 0;
+
+  if( !s->present)
+    return CHANGE_ADDED;
+  if( s->status != ioc->status)
+    flags |= CHANGE_STATUS;
+  if( s->time_value != ioc->time_value)
+    flags |= CHANGE_TIME;
+  if( s->ip != ntohl( ioc->raw_ip_address) )
+    flags |= CHANGE_IP;
+  if( s->user_msg != ioc->user_msg)
+    flags |= CHANGE_USER_MSG;
+  return flags;
+}
+
+static void set_state( struct history_state *s, struct alive_ioc *ioc)
+{
+  s->present = 1;
+  s->status = ioc->status;
+  s->ip = ntohl( ioc->raw_ip_address);
+  s->user_msg = ioc->user_msg;
+  s->time_value = ioc->time_value;
+}
+
+int alive_history_record( struct alive_history_writer *hw,
+                          struct alive_db *db)
+{
+  struct history_index_entry entry;
+  struct history_state *s;
+  struct alive_ioc *ioc;
+  uint64_t *keys;
+  uint32_t number, entries, i, id, prev_id;
+  int64_t new_id;
+  time_t now;
+  off_t offset;
+  int keyframe, flags, failed;
+
+  now = db->current_time;
+  keyframe = !hw->have_keyframe || (db->start_time != hw->start_time) ||
+    (now < hw->last_time) ||
+    (now - hw->keyframe_time >= HISTORY_KEYFRAME_SECONDS);
+
+  keys = realloc( hw->keys, (db->number_ioc + 1) * sizeof( uint64_t));
+  if( keys == NULL)
+    return 1;
+  hw->keys = keys;
+
+  hw->new_names.length = 0;
+  hw->record.length = 0;
+  hw->body.length = 0;
+  hw->mark++;
+
+  // ID in the high half and index in the low, ignoring any name given
+  // twice
+  number = 0;
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      new_id = name_id( hw, db->ioc[i].ioc_name);
+      if( new_id < 0)
+        {
+          printf( "Can't add IOC \"%s\" to history.\n", db->ioc[i].ioc_name);
+          continue;
+        }
+      if( hw->state[new_id].mark == hw->mark)
+        continue;
+      hw->state[new_id].mark = hw->mark;
+      keys[number++] = ((uint64_t) new_id << 32) | i;
+    }
+
+  prev_id = 0;
+  if( keyframe)
+    {
+      // in ID order, so IDs can be stored as differences
+      qsort( keys, number, sizeof( uint64_t), compare_keys);
+      for( i = 0; i < number; i++)
+        {
+          id = keys[i] >> 32;
+          ioc = &db->ioc[(uint32_t) keys[i]];
+          put_varint( &hw->body, id - prev_id);
+          put_fields( &hw->body, CHANGE_ADDED, ioc, now);
+          set_state( &hw->state[id], ioc);
+          prev_id = id;
+        }
+      for( id = 0; id < hw->number_names; id++)
+        if( hw->state[id].mark != hw->mark)
+          hw->state[id].present = 0;
+      put_byte( &hw->record, Record_Keyframe);
+      put_varint( &hw->record, now);
+      put_signed( &hw->record, (int64_t) db->start_time - now);
+    }
+  else
+    {
+      // in database order, which is usually close to ID order anyway
+      entries = 0;
+      for( i = 0; i < number; i++)
+        {
+          id = keys[i] >> 32;
+          ioc = &db->ioc[(uint32_t) keys[i]];
+          s = &hw->state[id];
+          flags = state_changes( s, ioc);
+          if( !flags)
+            continue;
+          put_signed( &hw->body, (int64_t) id - prev_id);
+          put_byte( &hw->body, flags);
+          put_fields( &hw->body, flags, ioc, now);
+          set_state( s, ioc);
+          prev_id = id;
+          entries++;
+        }
+      for( id = 0; id < hw->number_names; id++)
+        {
+          s = &hw->state[id];
+          if( s->present && (s->mark != hw->mark) )
+            {
+              put_signed( &hw->body, (int64_t) id - prev_id);
+              put_byte( &hw->body, CHANGE_REMOVED);
+              s->present = 0;
+              prev_id = id;
+              entries++;
+            }
+        }
+      number = entries;
+      if( !number)
+        return 0;
+      put_byte( &hw->record, Record_Changes);
+      put_signed( &hw->record, (int64_t) now - hw->last_time);
+    }
+  put_varint( &hw->record, number);
+  put_bytes( &hw->record, hw->body.data, hw->body.length);
+
+  for( id = hw->names_written; id < hw->number_names; id++)
+    {
+      put_bytes( &hw->new_names, hw->names[id], strlen( hw->names[id]));
+      put_byte( &hw->new_names, '\n');
+    }
+
+  offset = lseek( hw->log_fd, 0, SEEK_END);
+  failed = hw->record.failed || hw->body.failed || hw->new_names.failed ||
+    (offset == -1);
+  if( !failed)
+    {
+      failed = write_all( hw->names_fd, hw->new_names.data,
+                          hw->new_names.length);
+      if( failed)
+        // don't leave a partial name to be written after
+        ftruncate( hw->names_fd, hw->names_length);
+      else
+        {
+          hw->names_written = hw->number_names;
+          hw->names_length += hw->new_names.length;
+          failed = write_all( hw->log_fd, hw->record.data, hw->record.length);
+        }
+    }
+  if( failed)
+    {
+      printf( "Can't write history!\n");
+      // what the log holds is no longer known, so start over from a keyframe
+      hw->record.failed = hw->body.failed = hw->new_names.failed = 0;
+      hw->have_keyframe = 0;
+      return 1;
+    }
+  if( keyframe)
+    {
+      memset( &entry, 0, sizeof( entry));
+      entry.offset = offset;
+      entry.time = now;
+      write_all( hw->index_fd, &entry, sizeof( entry));
+      hw->have_keyframe = 1;
+      hw->keyframe_time = now;
+      hw->start_time = db->start_time;
+    }
+  hw->last_time = now;
+
+  return 0;
+}
+
+
+/////////////////////////////////////////////
+// Reader
+
+struct alive_history
+{
+  unsigned char *log;
+  size_t log_length;
+  struct history_index_entry *index;
+  uint32_t number_index;
+
+  char *names_text;
+  char **names;
+  uint32_t number_names;
+
+  struct history_state *state;
+  struct history_entry *entries;
+  uint32_t mark;
+
+  // replay position
+  unsigned char *position;
+  time_t time;  // of the last record applied
+  time_t start_time;  // daemon's, from the last keyframe
+
+  // changes from the last record applied, handed out by next
+  struct alive_history_change *pending;
+  uint32_t number_pending;
+  uint32_t next_pending;
+};
+
+struct alive_history *alive_history_open( char *dir)
+{
+  struct alive_history *hist;
+  struct stat st;
+  size_t length;
+  char *path;
+  int fd;
+
+  hist = calloc( 1, sizeof( struct alive_history));
+  if( hist == NULL)
+    return NULL;
+
+  path = history_path( dir, "history.log");
+  if( path == NULL)
+    {
+      free( hist);
+      return NULL;
+    }
+  fd = open( path, O_RDONLY);
+  free( path);
+  if( fd == -1)
+    {
+      printf( "Can't open history in \"%s\"!\n", dir);
+      free( hist);
+      return NULL;
+    }
+  if( fstat( fd, &st) || (st.st_size < HISTORY_HEADER_SIZE) )
+    {
+      printf( "History in \"%s\" is not usable.\n", dir);
+      close( fd);
+      free( hist);
+      return NULL;
+    }
+  hist->log_length = st.st_size;
+  hist->log = mmap( NULL, hist->log_length, PROT_READ, MAP_SHARED, fd, 0);
+  close( fd);
+  if( hist->log == MAP_FAILED)
+    {
+      printf( "Can't map history in \"%s\"!\n", dir);
+      free( hist);
+      return NULL;
+    }
+  if( memcmp( hist->log, HISTORY_MAGIC, 4) ||
+      (*(uint32_t *) (hist->log + 4) != HISTORY_VERSION) )
+    {
+      printf( "History in \"%s\" is not usable.\n", dir);
+      munmap( hist->log, hist->log_length);
+      free( hist);
+      return NULL;
+    }
+
+  // the index and names are read after the log, so they cover it
+  hist->index = (struct history_index_entry *)
+    read_file( dir, "history.idx", &length);
+  if( hist->index != NULL)
+    hist->number_index = length / sizeof( struct history_index_entry);
+  while( hist->number_index &&
+         (hist->index[hist->number_index-1].offset >= hist->log_length) )
+    hist->number_index--;
+
+  hist->names_text = read_file( dir, "history.names", &length);
+  if( hist->names_text != NULL)
+    hist->names = split_names( hist->names_text, length,
+                               &hist->number_names);
+
+  hist->state = calloc( hist->number_names + 1,
+                        sizeof( struct history_state));
+  hist->entries = malloc( (hist->number_names + 1) *
+                          sizeof( struct history_entry));
+  // a keyframe can change every IOC
+  hist->pending = malloc( (hist->number_names + 1) *
+                          sizeof( struct alive_history_change));
+  if( (hist->names == NULL) || (hist->state == NULL) ||
+      (hist->entries == NULL) || (hist->pending == NULL) )
+    {
+      alive_history_close( hist);
+      return NULL;
+    }
+  hist->position = hist->log + HISTORY_HEADER_SIZE;
+
+  return hist;
+}
+
+void alive_history_close( struct alive_history *hist)
+{
+  if( hist == NULL)
+    return;
+  munmap( hist->log, hist->log_length);
+  free( hist->index);
+  free( hist->names);
+  free( hist->names_text);
+  free( hist->state);
+  free( hist->entries);
+  free( hist->pending);
+  free( hist);
+}
+
+
+static void state_ioc( struct alive_history *hist, uint32_t id,
+                       struct alive_ioc *ioc)
+{
+  struct history_state *s;
+
+  s = &hist->state[id];
+  memset( ioc, 0, sizeof( struct alive_ioc));
+  ioc->ioc_name = hist->names[id];
+  ioc->raw_ip_address = htonl( s->ip);
+  ioc->status = s->status;
+  ioc->time_value = s->time_value;
+  ioc->user_msg = s->user_msg;
+}
+
+// Applies the next record if it is before the limit, queuing the
+// changes it makes if asked.  Returns 1 if applied, otherwise 0.
+static int apply_record( struct alive_history *hist, time_t limit,
+                         int queue)
+{
+  struct alive_history_change *change;
+  struct history_record rec;
+  struct history_entry *e;
+  struct history_state *s;
+  unsigned char *next;
+  uint32_t i, id;
+  int flags;
+
+  next = decode_record( hist->position, hist->log + hist->log_length,
+                        hist->time, hist->number_names, &rec,
+                        hist->entries);
+  if( (next == NULL) || (rec.time >= limit) )
+    return 0;
+
+  hist->position = next;
+  hist->time = rec.time;
+  if( rec.tag == Record_Keyframe)
+    hist->start_time = rec.start_time;
+  hist->mark++;
+  hist->number_pending = 0;
+  hist->next_pending = 0;
+
+  for( i = 0; i < rec.number; i++)
+    {
+      e = &hist->entries[i];
+      s = &hist->state[e->id];
+      s->mark = hist->mark;
+
+      if( e->flags & CHANGE_REMOVED)
+        flags = s->present ? CHANGE_REMOVED : 0;
+      else if( !s->present)
+        flags = CHANGE_ADDED;
+      else if( rec.tag == Record_Keyframe)
+        {
+          // keyframes have everything, so only report what differs
+          flags = 0;
+          if( s->status != e->status)
+            flags |= CHANGE_STATUS;
+          if( s->time_value != e->time_value)
+            flags |= CHANGE_TIME;
+          if( s->ip != e->ip)
+            flags |= CHANGE_IP;
+          if( s->user_msg != e->user_msg)
+            flags |= CHANGE_USER_MSG;
+        }
+      else
+        flags = e->flags & ~CHANGE_ADDED;
+      if( !flags)
+        continue;
+
+      change = NULL;
+      if( queue)
+        {
+          change = &hist->pending[hist->number_pending++];
+          change->time = rec.time;
+          change->flags = flags;
+          state_ioc( hist, e->id, &change->old_ioc);
+        }
+      if( flags & CHANGE_REMOVED)
+        s->present = 0;
+      else
+        {
+          s->present = 1;
+          if( (flags & (CHANGE_ADDED | CHANGE_STATUS)) )
+            s->status = e->status;
+          if( (flags & (CHANGE_ADDED | CHANGE_TIME)) )
+            s->time_value = e->time_value;
+          if( (flags & (CHANGE_ADDED | CHANGE_IP)) )
+            s->ip = e->ip;
+          if( (flags & (CHANGE_ADDED | CHANGE_USER_MSG)) )
+            s->user_msg = e->user_msg;
+        }
+      if( change != NULL)
+        state_ioc( hist, e->id, &change->new_ioc);
+    }
+
+  // a keyframe lists every IOC there is
+  if( rec.tag == Record_Keyframe)
+    for( id = 0; id < hist->number_names; id++)
+      {
+        s = &hist->state[id];
+        if( !s->present || (s->mark == hist->mark) )
+          continue;
+        if( queue && (hist->number_pending < hist->number_names + 1) )
+          {
+            change = &hist->pending[hist->number_pending++];
+            change->time = rec.time;
+            change->flags = CHANGE_REMOVED;
+            state_ioc( hist, id, &change->old_ioc);
+            change->new_ioc = change->old_ioc;
+          }
+        s->present = 0;
+      }
+
+  return 1;
+}
+
+int alive_history_seek( struct alive_history *hist, time_t t0)
+{
+  uint32_t low, high, mid;
+
+  // last keyframe before t0
+  low = 0;
+  high = hist->number_index;
+  while( low < high)
+    {
+      mid = low + (high - low) / 2;
+      if( hist->index[mid].time < t0)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  memset( hist->state, 0, hist->number_names * sizeof( struct history_state));
+  hist->mark = 0;
+  hist->time = 0;
+  hist->start_time = 0;
+  hist->number_pending = 0;
+  hist->next_pending = 0;
+  hist->position = hist->log + (low ? hist->index[low-1].offset :
+                                HISTORY_HEADER_SIZE);
+
+  while( apply_record( hist, t0, 0))
+    ;
+
+  return 0;
+}
+
+int alive_history_next( struct alive_history *hist, time_t t1,
+                        struct alive_history_change *change)
+{
+  while( hist->next_pending == hist->number_pending)
+    if( !apply_record( hist, t1 + 1, 1) )
+      return 0;
+
+  *change = hist->pending[hist->next_pending++];
+  return 1;
+}
+
+static int compare_names( const void *a, const void *b)
+{
+  return strcmp( ((const struct alive_ioc *) a)->ioc_name,
+                 ((const struct alive_ioc *) b)->ioc_name);
+}
+
+struct alive_db *alive_history_db_at( struct alive_history *hist, time_t t)
+{
+  struct alive_db *db;
+  struct alive_ioc *ioc;
+  uint32_t id, number;
+
+  alive_history_seek( hist, t + 1);
+
+  number = 0;
+  for( id = 0; id < hist->number_names; id++)
+    if( hist->state[id].present)
+      number++;
+  // the database can't hold more than this
+  if( number > UINT16_MAX)
+    number = UINT16_MAX;
+
+  db = calloc( 1, sizeof( struct alive_db));
+  if( db == NULL)
+    return NULL;
+  db->ioc = calloc( number + 1, sizeof( struct alive_ioc));
+  if( db->ioc == NULL)
+    {
+      free( db);
+      return NULL;
+    }
+  db->current_time = t;
+  db->start_time = hist->start_time;
+
+  for( id = 0; (id < hist->number_names) && (db->number_ioc < number); id++)
+    {
+      if( !hist->state[id].present)
+        continue;
+      ioc = &db->ioc[db->number_ioc];
+      state_ioc( hist, id, ioc);
+      ioc->ioc_name = strdup( ioc->ioc_name);
+      if( ioc->ioc_name == NULL)
+        {
+          alive_free_db( db);
+          return NULL;
+        }
+      db->number_ioc++;
+    }
+  // the order the daemon gives them in
+  qsort( db->ioc, db->number_ioc, sizeof( struct alive_ioc), compare_names);
+
+  return db;
+}
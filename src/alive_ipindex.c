@@ -0,0 +1,231 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <arpa/inet.h>
+
+#include "alive_client.h"
+
+
+static uint32_t prefix_mask( int prefix_length)
+{
+  if( prefix_length <= 0)
+    return 0;
+  if( prefix_length >= 32)
+    return 0xffffffff;
+  return 0xffffffff << (32 - prefix_length);
+}
+
+
+uint32_t alive_ip_host_order( unsigned char *ip_address)
+{
+  return ((uint32_t) ip_address[0] << 24) | ((uint32_t) ip_address[1] << 16)
+    | ((uint32_t) ip_address[2] << 8) | (uint32_t) ip_address[3];
+}
+
+
+int alive_parse_cidr( char *str, uint32_t *network, int *prefix_length)
+{
+  char addr_str[INET_ADDRSTRLEN];
+  struct in_addr addr;
+  char *p, *end;
+  int len;
+  long plen;
+
+  p = strchr( str, '/');
+  if( p == NULL)
+    {
+      len = strlen( str);
+      plen = 32;
+    }
+  else
+    {
+      len = p - str;
+      plen = strtol( p+1, &end, 10);
+      if( (p[1] == '\0') || (*end != '\0') || (plen < 0) || (plen > 32) )
+        return 1;
+    }
+  if( len >= INET_ADDRSTRLEN)
+    return 1;
+  memcpy( addr_str, str, len);
+  addr_str[len] = '\0';
+
+  if( inet_pton( AF_INET, addr_str, &addr) != 1)
+    return 1;
+
+  *network = ntohl( addr.s_addr) & prefix_mask( plen);
+  *prefix_length = plen;
+
+  return 0;
+}
+
+
+static int entry_compare( const void *a, const void *b)
+{
+  const struct alive_ip_entry *ea = a;
+  const struct alive_ip_entry *eb = b;
+
+  if( ea->address != eb->address)
+    return (ea->address < eb->address) ? -1 : 1;
+  // keep database order for equal addresses (conflicts)
+  return ea->ioc_index - eb->ioc_index;
+}
+
+struct alive_ip_index *alive_ip_index_create( struct alive_db *db)
+{
+  struct alive_ip_index *index;
+  int i;
+
+  index = calloc( 1, sizeof( struct alive_ip_index));
+  if( index == NULL)
+    return NULL;
+
+  index->db = db;
+  index->number = db->number_ioc;
+  index->entries = malloc( (index->number ? index->number : 1) *
+                           sizeof( struct alive_ip_entry));
+  if( index->entries == NULL)
+    {
+      free( index);
+      return NULL;
+    }
+
+  for( i = 0; i < index->number; i++)
+    {
+      index->entries[i].address =
+        alive_ip_host_order( db->ioc[i].ip_address);
+      index->entries[i].ioc_index = i;
+    }
+  qsort( index->entries, index->number, sizeof( struct alive_ip_entry),
+         entry_compare);
+
+  return index;
+}
+
+void alive_ip_index_free( struct alive_ip_index *index)
+{
+  if( index == NULL)
+    return;
+  free( index->entries);
+  free( index);
+}
+
+
+// first position with address >= value
+static int lower_bound( struct alive_ip_index *index, uint32_t value)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = index->number;
+  while( lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if( index->entries[mid].address < value)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+int alive_ip_index_find_prefix( struct alive_ip_index *index,
+                                uint32_t network, int prefix_length,
+                                int *first)
+{
+  uint32_t mask;
+  int lo, hi;
+
+  mask = prefix_mask( prefix_length);
+  network &= mask;
+
+  lo = lower_bound( index, network);
+  if( (network | ~mask) == 0xffffffff)
+    hi = index->number;
+  else
+    hi = lower_bound( index, (network | ~mask) + 1);
+
+  *first = lo;
+  return hi - lo;
+}
+
+int alive_ip_index_find( struct alive_ip_index *index, uint32_t address,
+                         int *first)
+{
+  return alive_ip_index_find_prefix( index, address, 32, first);
+}
+
+
+int alive_ip_index_rollup( struct alive_ip_index *index, uint32_t network,
+                           int prefix_length,
+                           struct alive_subnet_rollup *rollup)
+{
+  struct alive_ioc *ioc;
+  int first, count;
+  int i;
+
+  memset( rollup, 0, sizeof( struct alive_subnet_rollup));
+  rollup->network = network & prefix_mask( prefix_length);
+  rollup->prefix_length = prefix_length;
+
+  count = alive_ip_index_find_prefix( index, network, prefix_length, &first);
+  for( i = first; i < first + count; i++)
+    {
+      ioc = &(index->db->ioc[index->entries[i].ioc_index]);
+      if( ioc->status <= STATUS_CONFLICT)
+        rollup->status_count[ioc->status]++;
+      rollup->total++;
+    }
+
+  return count;
+}
+
+int alive_ip_index_subnets( struct alive_ip_index *index, int prefix_length,
+                            struct alive_subnet_rollup **rollups)
+{
+  struct alive_subnet_rollup *r;
+  uint32_t mask, network;
+  int number;
+  int i;
+
+  *rollups = NULL;
+  if( !index->number)
+    return 0;
+
+  mask = prefix_mask( prefix_length);
+
+  // sorted, so subnets are contiguous; count them first
+  number = 1;
+  for( i = 1; i < index->number; i++)
+    if( (index->entries[i].address & mask) !=
+        (index->entries[i-1].address & mask) )
+      number++;
+
+  r = malloc( number * sizeof( struct alive_subnet_rollup));
+  if( r == NULL)
+    return -1;
+
+  i = 0;
+  number = 0;
+  while( i < index->number)
+    {
+      network = index->entries[i].address & mask;
+      i += alive_ip_index_rollup( index, network, prefix_length, &r[number]);
+      number++;
+    }
+
+  *rollups = r;
+  return number;
+}
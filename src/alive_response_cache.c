@@ -0,0 +1,284 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Raw responses shared between the threads of a process.  Each request
+// (server, port, and the request's bytes) has an entry in a hash table,
+// holding the last response for it until it is older than the TTL.  A
+// thread that finds the entry being fetched waits for that fetch rather
+// than making its own, so however many threads ask at once, the daemon
+// sees one request.  Responses are reference counted and never changed,
+// so every caller decodes from the same bytes without copying them, and
+// an expired one lives on until the last caller lets go of it.
+//
+// One lock covers the table.  It is only held to look up and update
+// entries, never while fetching.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "alive_client.h"
+#include "alive_trace.h"
+
+
+#define CACHE_BUCKETS (256)
+// expired entries are swept when this many more have been added
+#define CACHE_SWEEP (256)
+
+struct alive_response
+{
+  int references;  // under the table's lock
+  int length;
+  char *data;
+};
+
+struct cache_entry
+{
+  struct cache_entry *next;
+  uint32_t hash;
+
+  char *server;
+  int port;
+  char *request;
+  int request_length;
+
+  struct alive_response *response;  // NULL until fetched, or if it failed
+  uint64_t expires;  // in milliseconds
+
+  int fetching;
+  int generation;  // of fetches, so waiters know theirs is done
+  int waiters;     // keeps the entry from being swept
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cache_fetched = PTHREAD_COND_INITIALIZER;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static struct cache_entry *buckets[CACHE_BUCKETS];
+static int cache_ttl = 0;
+static int added = 0;
+
+
+static uint64_t now_ms( void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// the TTL can be set by the environment, so programs needn't be changed
+static void read_environment( void)
+{
+  char *str;
+
+  str = getenv( "ALIVE_RESPONSE_TTL");
+  if( (str != NULL) && (atoi( str) > 0) )
+    cache_ttl = atoi( str);
+}
+
+static uint32_t hash_request( char *server, int port, char *request,
+                              int request_length)
+{
+  uint32_t hash = 2166136261u;
+  int i;
+
+  for( ; *server != '\0'; server++)
+    hash = (hash ^ (uint8_t) *server) * 16777619u;
+  hash = (hash ^ (uint32_t) port) * 16777619u;
+  for( i = 0; i < request_length; i++)
+    hash = (hash ^ (uint8_t) request[i]) * 16777619u;
+  return hash;
+}
+
+// with the lock held
+static void release( struct alive_response *response)
+{
+  if( (response != NULL) && !--response->references)
+    {
+      free( response->data);
+      free( response);
+    }
+}
+
+// Drops the entries that are expired and unused, or with all set, every
+// entry not in use.  With the lock held.
+static void sweep( uint64_t now, int all)
+{
+  struct cache_entry **p, *e;
+  int i;
+
+  for( i = 0; i < CACHE_BUCKETS; i++)
+    {
+      p = &buckets[i];
+      while( (e = *p) != NULL)
+        {
+          if( e->fetching || e->waiters || (!all && (e->expires > now)) )
+            {
+              p = &e->next;
+              continue;
+            }
+          *p = e->next;
+          release( e->response);
+          free( e->server);
+          free( e->request);
+          free( e);
+        }
+    }
+  added = 0;
+}
+
+int alive_response_cache_ttl( void)
+{
+  int ttl;
+
+  pthread_once( &cache_once, read_environment);
+  pthread_mutex_lock( &cache_lock);
+  ttl = cache_ttl;
+  pthread_mutex_unlock( &cache_lock);
+  return ttl;
+}
+
+void alive_response_cache_set_ttl( int milliseconds)
+{
+  pthread_once( &cache_once, read_environment);
+  pthread_mutex_lock( &cache_lock);
+  cache_ttl = (milliseconds > 0) ? milliseconds : 0;
+  // what was kept may be older than the new TTL allows
+  sweep( 0, 1);
+  pthread_mutex_unlock( &cache_lock);
+}
+
+struct alive_response *alive_response_fetch( char *server, int port,
+                                             char *request,
+                                             int request_length)
+{
+  struct alive_response *response;
+  struct cache_entry *e;
+  uint32_t hash;
+  uint64_t now;
+  char *data;
+  int length;
+  int generation;
+
+  hash = hash_request( server, port, request, request_length);
+  pthread_mutex_lock( &cache_lock);
+  now = now_ms();
+  for( e = buckets[hash % CACHE_BUCKETS]; e != NULL; e = e->next)
+    if( (e->hash == hash) && (e->port == port) &&
+        (e->request_length == request_length) &&
+        !memcmp( e->request, request, request_length) &&
+        !strcmp( e->server, server) )
+      break;
+
+  if( (e != NULL) && e->fetching)
+    {
+      // share the fetch already going, even if it fails
+      TRACE_BEGIN( Trace_CacheWait, 0, 0, NULL);
+      generation = e->generation;
+      e->waiters++;
+      while( e->fetching && (e->generation == generation) )
+        pthread_cond_wait( &cache_fetched, &cache_lock);
+      e->waiters--;
+      response = e->response;
+      if( response != NULL)
+        response->references++;
+      pthread_mutex_unlock( &cache_lock);
+      TRACE_END( Trace_CacheWait, 0, response ? response->length : -1);
+      return response;
+    }
+  if( (e != NULL) && (e->response != NULL) && (e->expires > now) )
+    {
+      TRACE_INSTANT( Trace_CacheHit, 0);
+      response = e->response;
+      response->references++;
+      pthread_mutex_unlock( &cache_lock);
+      return response;
+    }
+
+  if( e == NULL)
+    {
+      if( added >= CACHE_SWEEP)
+        sweep( now, 0);
+      e = calloc( 1, sizeof( struct cache_entry));
+      if( e != NULL)
+        {
+          e->server = strdup( server);
+          e->request = malloc( request_length ? request_length : 1);
+        }
+      if( (e == NULL) || (e->server == NULL) || (e->request == NULL) )
+        {
+          if( e != NULL)
+            {
+              free( e->server);
+              free( e->request);
+              free( e);
+            }
+          pthread_mutex_unlock( &cache_lock);
+          return NULL;
+        }
+      e->hash = hash;
+      e->port = port;
+      memcpy( e->request, request, request_length);
+      e->request_length = request_length;
+      e->next = buckets[hash % CACHE_BUCKETS];
+      buckets[hash % CACHE_BUCKETS] = e;
+      added++;
+    }
+  // the old response stays with whoever still has it
+  release( e->response);
+  e->response = NULL;
+  e->fetching = 1;
+  pthread_mutex_unlock( &cache_lock);
+
+  data = alive_request_raw( server, port, request, request_length, &length);
+  response = NULL;
+  if( (data != NULL) && (length > 0) )
+    {
+      response = malloc( sizeof( struct alive_response));
+      if( response != NULL)
+        {
+          response->data = data;
+          response->length = length;
+          // one for the cache, one for the caller
+          response->references = 2;
+        }
+    }
+  if( response == NULL)
+    free( data);
+
+  pthread_mutex_lock( &cache_lock);
+  e->response = response;
+  // failures are shared with the waiters, but not kept
+  e->expires = (response != NULL) ? now_ms() + cache_ttl : 0;
+  e->fetching = 0;
+  e->generation++;
+  pthread_cond_broadcast( &cache_fetched);
+  pthread_mutex_unlock( &cache_lock);
+
+  return response;
+}
+
+char *alive_response_data( struct alive_response *response, int *length)
+{
+  *length = response->length;
+  return response->data;
+}
+
+void alive_response_release( struct alive_response *response)
+{
+  pthread_mutex_lock( &cache_lock);
+  release( response);
+  pthread_mutex_unlock( &cache_lock);
+}
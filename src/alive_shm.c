@@ -0,0 +1,497 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "alive_client.h"
+
+
+#define SHM_MAGIC (0x414c5653)  // "ALVS"
+#define SHM_LAYOUT_VERSION (2)
+#define SHM_HEADER_SIZE (64)
+#define SHM_NO_SLOT (0xffffffff)
+
+
+struct shm_header
+{
+  uint32_t magic;
+  uint32_t layout_version;
+  uint32_t slot_size;
+  uint32_t active;  // slot readers should use, or SHM_NO_SLOT
+  uint64_t sequence[2];  // odd while the slot is being written
+  uint32_t generation;  // changes when the segment is replaced
+  uint32_t failed;      // the last publish failed, so the slot is stale
+  uint64_t published;   // time of the last publish that worked
+};
+
+struct alive_shm
+{
+  char *name;
+  int fd;
+  int writable;
+  size_t length;
+  char *base;
+  struct shm_header *header;
+  uint32_t generation;  // of the segment mapped
+};
+
+
+static uint32_t name_hash( char *name, int length)
+{
+  uint32_t h = 2166136261u;
+
+  while( length--)
+    {
+      h ^= (unsigned char) *name++;
+      h *= 16777619u;
+    }
+  return h;
+}
+
+static uint32_t table_size_for( uint32_t number)
+{
+  uint32_t size;
+
+  size = 16;
+  while( size < 2 * number)
+    size <<= 1;
+  return size;
+}
+
+static uint32_t align8( uint32_t n)
+{
+  return (n + 7) & ~7u;
+}
+
+
+uint32_t alive_shm_db_size( struct alive_db *db)
+{
+  struct alive_env *env;
+  uint32_t size;
+  int i, j;
+
+  size = align8( sizeof( struct alive_shm_snapshot));
+  size += db->number_ioc * sizeof( struct alive_shm_record);
+  size += table_size_for( db->number_ioc) * sizeof( uint32_t);
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      size += strlen( db->ioc[i].ioc_name) + 1;
+      env = db->ioc[i].environment;
+      if( env == NULL)
+        continue;
+      size = align8( size);
+      size += env->number_envvar * sizeof( struct alive_shm_envvar);
+      for( j = 0; j < env->number_envvar; j++)
+        size += strlen( env->envvar_key[j] ? env->envvar_key[j] : "") +
+          strlen( env->envvar_value[j] ? env->envvar_value[j] : "") + 2;
+    }
+  return size;
+}
+
+
+// makes and maps a new segment, which readers can't use until published
+static int make_segment( struct alive_shm *shm, char *name, 
+                         uint32_t slot_size, uint32_t generation)
+{
+  slot_size = (slot_size + 63) & ~63u;
+  shm->writable = 1;
+  shm->length = SHM_HEADER_SIZE + 2 * (size_t) slot_size;
+
+  shm->fd = shm_open( name, O_CREAT | O_RDWR, 0644);
+  if( shm->fd == -1)
+    {
+      printf( "Can't open shared memory \"%s\"!\n", name);
+      return 1;
+    }
+  if( ftruncate( shm->fd, shm->length) )
+    {
+      printf( "Can't size shared memory \"%s\"!\n", name);
+      close( shm->fd);
+      return 1;
+    }
+  shm->base = mmap( NULL, shm->length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    shm->fd, 0);
+  if( shm->base == MAP_FAILED)
+    {
+      printf( "Can't map shared memory \"%s\"!\n", name);
+      close( shm->fd);
+      return 1;
+    }
+
+  // readers see nothing until the first publish
+  shm->header = (struct shm_header *) shm->base;
+  __atomic_store_n( &shm->header->active, SHM_NO_SLOT, __ATOMIC_RELEASE);
+  shm->header->slot_size = slot_size;
+  shm->header->layout_version = SHM_LAYOUT_VERSION;
+  shm->header->generation = generation;
+  shm->header->failed = 0;
+  shm->header->published = 0;
+  shm->generation = generation;
+  __atomic_store_n( &shm->header->magic, SHM_MAGIC, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+struct alive_shm *alive_shm_create( char *name, uint32_t slot_size)
+{
+  struct alive_shm *shm;
+
+  shm = calloc( 1, sizeof( struct alive_shm));
+  if( shm == NULL)
+    return NULL;
+  shm->name = strdup( name);
+  if( (shm->name == NULL) || make_segment( shm, name, slot_size, 0) )
+    {
+      free( shm->name);
+      free( shm);
+      return NULL;
+    }
+
+  return shm;
+}
+
+static void copy_string( char *base, uint32_t *used, char *str,
+                         uint32_t *offset)
+{
+  int len;
+
+  if( str == NULL)
+    str = "";
+  len = strlen( str) + 1;
+  memcpy( base + *used, str, len);
+  *offset = *used;
+  *used += len;
+}
+
+int alive_shm_publish( struct alive_shm *shm, struct alive_db *db)
+{
+  struct shm_header *header;
+  struct alive_shm_snapshot *snap;
+  struct alive_shm_record *rec;
+  struct alive_shm_envvar *ev;
+  struct alive_env *env;
+  struct alive_ioc *ioc;
+  struct alive_shm old;
+  uint32_t *table;
+  uint32_t size, used, h;
+  uint64_t sequence;
+  char *base;
+  int slot;
+  int i, j;
+
+  // Readers have the segment mapped at its size, so one the database
+  // outgrew is replaced by a larger one under the same name.  The old
+  // one's generation is only changed once the new one is published,
+  // telling readers to open it; until then they read the old.
+  old.base = NULL;
+  size = alive_shm_db_size( db);
+  if( size > shm->header->slot_size)
+    {
+      old = *shm;
+      shm_unlink( shm->name);
+      if( make_segment( shm, shm->name, 2 * size, old.generation + 1) )
+        {
+          *shm = old;
+          __atomic_store_n( &shm->header->failed, 1, __ATOMIC_RELEASE);
+          printf( "Database too large for shared memory slot.\n");
+          return 1;
+        }
+    }
+
+  header = shm->header;
+
+  // always write the slot readers are not being pointed at
+  slot = (header->active == 0) ? 1 : 0;
+  base = shm->base + SHM_HEADER_SIZE + (size_t) slot * header->slot_size;
+
+  sequence = header->sequence[slot];
+  __atomic_store_n( &header->sequence[slot], sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence( __ATOMIC_RELEASE);
+
+  snap = (struct alive_shm_snapshot *) base;
+  snap->current_time = db->current_time;
+  snap->start_time = db->start_time;
+  snap->number_ioc = db->number_ioc;
+  snap->table_size = table_size_for( db->number_ioc);
+  snap->size = header->slot_size;
+
+  used = align8( sizeof( struct alive_shm_snapshot));
+  snap->record_offset = used;
+  used += db->number_ioc * sizeof( struct alive_shm_record);
+  snap->table_offset = used;
+  used += snap->table_size * sizeof( uint32_t);
+
+  table = (uint32_t *) (base + snap->table_offset);
+  memset( table, 0, snap->table_size * sizeof( uint32_t));
+
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      ioc = &(db->ioc[i]);
+      rec = (struct alive_shm_record *) (base + snap->record_offset) + i;
+
+      rec->name_length = strlen( ioc->ioc_name);
+      copy_string( base, &used, ioc->ioc_name, &rec->name_offset);
+      rec->status = ioc->status;
+      rec->unused = 0;
+      rec->raw_ip_address = ioc->raw_ip_address;
+      rec->time_value = ioc->time_value;
+      rec->user_msg = ioc->user_msg;
+
+      env = ioc->environment;
+      if( env == NULL)
+        {
+          rec->envvar_offset = 0;
+          rec->number_envvar = 0;
+        }
+      else
+        {
+          used = align8( used);
+          rec->envvar_offset = used;
+          rec->number_envvar = env->number_envvar;
+          ev = (struct alive_shm_envvar *) (base + used);
+          used += env->number_envvar * sizeof( struct alive_shm_envvar);
+          for( j = 0; j < env->number_envvar; j++)
+            {
+              copy_string( base, &used, env->envvar_key[j],
+                           &ev[j].key_offset);
+              copy_string( base, &used, env->envvar_value[j],
+                           &ev[j].value_offset);
+            }
+        }
+
+      h = name_hash( ioc->ioc_name, rec->name_length) &
+        (snap->table_size - 1);
+      while( table[h])
+        h = (h + 1) & (snap->table_size - 1);
+      table[h] = i + 1;
+    }
+  snap->used = used;
+
+  __atomic_store_n( &header->sequence[slot], sequence + 2, __ATOMIC_RELEASE);
+  __atomic_store_n( &header->active, slot, __ATOMIC_RELEASE);
+  __atomic_store_n( &header->published, (uint64_t) time( NULL), 
+                    __ATOMIC_RELEASE);
+  __atomic_store_n( &header->failed, 0, __ATOMIC_RELEASE);
+
+  if( old.base != NULL)
+    {
+      __atomic_store_n( &old.header->generation, shm->generation, 
+                        __ATOMIC_RELEASE);
+      munmap( old.base, old.length);
+      close( old.fd);
+    }
+
+  return 0;
+}
+
+
+struct alive_shm *alive_shm_open( char *name)
+{
+  struct alive_shm *shm;
+  struct stat st;
+
+  shm = calloc( 1, sizeof( struct alive_shm));
+  if( shm == NULL)
+    return NULL;
+  shm->name = strdup( name);
+  if( shm->name == NULL)
+    {
+      free( shm);
+      return NULL;
+    }
+
+  shm->fd = shm_open( name, O_RDONLY, 0);
+  if( shm->fd == -1)
+    {
+      free( shm->name);
+      free( shm);
+      return NULL;
+    }
+  if( fstat( shm->fd, &st) || (st.st_size < SHM_HEADER_SIZE) )
+    {
+      close( shm->fd);
+      free( shm->name);
+      free( shm);
+      return NULL;
+    }
+  shm->length = st.st_size;
+  shm->base = mmap( NULL, shm->length, PROT_READ, MAP_SHARED, shm->fd, 0);
+  if( shm->base == MAP_FAILED)
+    {
+      close( shm->fd);
+      free( shm->name);
+      free( shm);
+      return NULL;
+    }
+  shm->header = (struct shm_header *) shm->base;
+  shm->generation = __atomic_load_n( &shm->header->generation, 
+                                     __ATOMIC_ACQUIRE);
+
+  if( (__atomic_load_n( &shm->header->magic, __ATOMIC_ACQUIRE) != SHM_MAGIC)
+      || (shm->header->layout_version != SHM_LAYOUT_VERSION) ||
+      (SHM_HEADER_SIZE + 2 * (size_t) shm->header->slot_size > shm->length) )
+    {
+      alive_shm_close( shm);
+      return NULL;
+    }
+
+  return shm;
+}
+
+void alive_shm_close( struct alive_shm *shm)
+{
+  if( shm == NULL)
+    return;
+  munmap( shm->base, shm->length);
+  close( shm->fd);
+  free( shm->name);
+  free( shm);
+}
+
+// moves a reader over to the segment that replaced its own
+static int reopen( struct alive_shm *shm)
+{
+  struct alive_shm *next;
+
+  next = alive_shm_open( shm->name);
+  if( next == NULL)
+    return 1;
+  munmap( shm->base, shm->length);
+  close( shm->fd);
+  free( shm->name);
+  *shm = *next;
+  free( next);
+  return 0;
+}
+
+time_t alive_shm_published( struct alive_shm *shm, int *failed)
+{
+  if( failed != NULL)
+    *failed = __atomic_load_n( &shm->header->failed, __ATOMIC_ACQUIRE);
+  return (time_t) __atomic_load_n( &shm->header->published, 
+                                   __ATOMIC_ACQUIRE);
+}
+
+
+int alive_shm_read_begin( struct alive_shm *shm, struct alive_shm_read *rd)
+{
+  uint32_t slot;
+
+  if( !shm->writable &&
+      (__atomic_load_n( &shm->header->generation, __ATOMIC_ACQUIRE) !=
+       shm->generation) && reopen( shm) )
+    return 1;
+
+  while( 1)
+    {
+      slot = __atomic_load_n( &shm->header->active, __ATOMIC_ACQUIRE);
+      if( slot > 1)
+        return 1;
+      rd->sequence = __atomic_load_n( &shm->header->sequence[slot],
+                                      __ATOMIC_ACQUIRE);
+      // only odd if the publisher lapped us, so just look again
+      if( !(rd->sequence & 1) )
+        break;
+    }
+  rd->slot = slot;
+  rd->snapshot = (struct alive_shm_snapshot *)
+    (shm->base + SHM_HEADER_SIZE + (size_t) slot * shm->header->slot_size);
+
+  return 0;
+}
+
+int alive_shm_read_retry( struct alive_shm *shm, struct alive_shm_read *rd)
+{
+  __atomic_thread_fence( __ATOMIC_ACQUIRE);
+  // a replaced segment is read again from its replacement
+  return (__atomic_load_n( &shm->header->sequence[rd->slot],
+                           __ATOMIC_RELAXED) != rd->sequence) ||
+    (__atomic_load_n( &shm->header->generation, __ATOMIC_RELAXED) !=
+     shm->generation);
+}
+
+
+// Offsets are checked against the slot size, since a reader that gets
+// lapped by the publisher can see a half written snapshot.
+struct alive_shm_record *alive_shm_find( struct alive_shm_snapshot *snapshot,
+                                         char *name)
+{
+  struct alive_shm_record *rec;
+  uint32_t *table;
+  uint32_t size, mask, h, index, probes;
+  char *base;
+  int len;
+
+  base = (char *) snapshot;
+  size = snapshot->size;
+  mask = snapshot->table_size - 1;
+  if( (snapshot->table_size & mask) ||
+      (snapshot->table_offset > size) ||
+      (snapshot->table_size > (size - snapshot->table_offset) / 4) ||
+      (snapshot->record_offset > size) ||
+      (snapshot->number_ioc > (size - snapshot->record_offset) /
+       sizeof( struct alive_shm_record)) )
+    return NULL;
+
+  table = (uint32_t *) (base + snapshot->table_offset);
+  len = strlen( name);
+  h = name_hash( name, len) & mask;
+  for( probes = 0; probes <= mask; probes++)
+    {
+      index = table[h];
+      if( !index || (index > snapshot->number_ioc) )
+        return NULL;
+      rec = (struct alive_shm_record *) (base + snapshot->record_offset) +
+        (index - 1);
+      if( (rec->name_length == len) && (rec->name_offset < size) &&
+          (len < size - rec->name_offset) &&
+          !memcmp( base + rec->name_offset, name, len) )
+        return rec;
+      h = (h + 1) & mask;
+    }
+  return NULL;
+}
+
+char *alive_shm_string( struct alive_shm_snapshot *snapshot, uint32_t offset)
+{
+  if( offset >= snapshot->size)
+    return "";
+  return (char *) snapshot + offset;
+}
+
+
+int alive_shm_get_ioc( struct alive_shm *shm, char *name,
+                       struct alive_shm_record *record)
+{
+  struct alive_shm_read rd;
+  struct alive_shm_record *rec;
+
+  do
+    {
+      if( alive_shm_read_begin( shm, &rd) )
+        return -1;
+      rec = alive_shm_find( rd.snapshot, name);
+      if( rec != NULL)
+        *record = *rec;
+    }
+  while( alive_shm_read_retry( shm, &rd) );
+
+  return (rec == NULL) ? 1 : 0;
+}
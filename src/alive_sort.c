@@ -0,0 +1,153 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Orderings of a database are kept as arrays of IOC indices, so the IOCs
+// themselves are never moved or copied.  Picking the top k uses a heap of
+// k entries, so it costs n log k rather than a full sort, and the full
+// sort is just the top n.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alive_client.h"
+
+
+// whether IOC a comes before IOC b
+static int before( struct alive_db *db, int key, int a, int b)
+{
+  struct alive_ioc *x = &(db->ioc[a]);
+  struct alive_ioc *y = &(db->ioc[b]);
+  uint32_t xv, yv;
+  int ret;
+
+  ret = 0;
+  switch( key & ~SORT_REVERSE)
+    {
+    case SORT_STATUS:
+      ret = (int) x->status - (int) y->status;
+      break;
+    case SORT_TIME:
+      ret = (x->time_value > y->time_value) - (x->time_value < y->time_value);
+      break;
+    case SORT_IP:
+      xv = alive_ip_host_order( x->ip_address);
+      yv = alive_ip_host_order( y->ip_address);
+      ret = (xv > yv) - (xv < yv);
+      break;
+    case SORT_USER_MSG:
+      ret = (x->user_msg > y->user_msg) - (x->user_msg < y->user_msg);
+      break;
+    }
+  if( key & SORT_REVERSE)
+    ret = -ret;
+
+  // ties go by name, then by where they are in the database
+  if( !ret)
+    ret = strcmp( x->ioc_name, y->ioc_name);
+  if( !ret)
+    ret = a - b;
+  return ret < 0;
+}
+
+// heap with the IOC that comes last on top
+static void sift_down( struct alive_db *db, int key, int *heap, int number,
+                       int i)
+{
+  int child, t;
+
+  while( (child = 2 * i + 1) < number)
+    {
+      if( (child + 1 < number) &&
+          before( db, key, heap[child], heap[child + 1]) )
+        child++;
+      if( !before( db, key, heap[i], heap[child]) )
+        break;
+      t = heap[i];
+      heap[i] = heap[child];
+      heap[child] = t;
+      i = child;
+    }
+}
+
+int alive_top_iocs( struct alive_db *db, int *order, int number, int key,
+                    int k)
+{
+  int i, t;
+
+  if( (k < 0) || (k > number) )
+    k = number;
+  if( k == 0)
+    return 0;
+
+  // the best k so far, with the worst of them on top to be replaced
+  for( i = k/2 - 1; i >= 0; i--)
+    sift_down( db, key, order, k, i);
+  for( i = k; i < number; i++)
+    if( before( db, key, order[i], order[0]) )
+      {
+        t = order[0];
+        order[0] = order[i];
+        order[i] = t;
+        sift_down( db, key, order, k, 0);
+      }
+
+  // then sort them in place
+  for( i = k - 1; i > 0; i--)
+    {
+      t = order[0];
+      order[0] = order[i];
+      order[i] = t;
+      sift_down( db, key, order, i, 0);
+    }
+
+  return k;
+}
+
+void alive_sort_iocs( struct alive_db *db, int *order, int number, int key)
+{
+  alive_top_iocs( db, order, number, key, number);
+}
+
+int alive_group_iocs_by_status( struct alive_db *db, int *order, int number,
+                                int *counts)
+{
+  int start[STATUS_CONFLICT+1];
+  int *copy;
+  int status;
+  int i;
+
+  copy = malloc( (number ? number : 1) * sizeof( int));
+  if( copy == NULL)
+    return 1;
+  memcpy( copy, order, number * sizeof( int));
+
+  // counting sort, which keeps the order within each status
+  memset( counts, 0, (STATUS_CONFLICT+1) * sizeof( int));
+  for( i = 0; i < number; i++)
+    {
+      status = db->ioc[copy[i]].status;
+      counts[ (status > STATUS_CONFLICT) ? STATUS_UNKNOWN : status]++;
+    }
+  start[0] = 0;
+  for( i = 1; i <= STATUS_CONFLICT; i++)
+    start[i] = start[i-1] + counts[i-1];
+  for( i = 0; i < number; i++)
+    {
+      status = db->ioc[copy[i]].status;
+      if( status > STATUS_CONFLICT)
+        status = STATUS_UNKNOWN;
+      order[ start[status]++] = copy[i];
+    }
+
+  free( copy);
+  return 0;
+}
@@ -0,0 +1,559 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// The event lists of many IOCs, merged into one stream in time order.
+// Each IOC's events are kept packed with a cursor into them, and a heap
+// holds the IOCs by the time of their next event, so taking the next
+// event of all is a log of the number of IOCs, and nothing is ever
+// concatenated or sorted.  Burst detection runs over that stream, keeping
+// for each event type the events of the last window.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "alive_client.h"
+
+
+// the event types bursts are looked for in
+#define TIMELINE_EVENT_TYPES (CONFLICT_STOP + 1)
+
+
+// whether IOC a's next event comes before IOC b's
+static int before( struct alive_timeline *tl, int a, int b)
+{
+  if( tl->heads[a].time != tl->heads[b].time)
+    return tl->heads[a].time < tl->heads[b].time;
+  return a < b;
+}
+
+static void sift_down( struct alive_timeline *tl, int i)
+{
+  int child, t;
+
+  while( (child = 2 * i + 1) < tl->heap_size)
+    {
+      if( (child + 1 < tl->heap_size) &&
+          before( tl, tl->heap[child + 1], tl->heap[child]) )
+        child++;
+      if( !before( tl, tl->heap[child], tl->heap[i]) )
+        break;
+      t = tl->heap[i];
+      tl->heap[i] = tl->heap[child];
+      tl->heap[child] = t;
+      i = child;
+    }
+}
+
+void alive_timeline_seek( struct alive_timeline *tl, time_t start,
+                          time_t end)
+{
+  int i;
+
+  tl->end = end;
+  tl->heap_size = 0;
+  for( i = 0; i < tl->number; i++)
+    {
+      if( tl->packs[i] == NULL)
+        continue;
+      alive_event_pack_seek( tl->packs[i], &(tl->cursors[i]), start);
+      if( alive_event_pack_next( &(tl->cursors[i]), &(tl->heads[i])) )
+        tl->heap[tl->heap_size++] = i;
+    }
+  for( i = tl->heap_size/2 - 1; i >= 0; i--)
+    sift_down( tl, i);
+}
+
+int alive_timeline_next( struct alive_timeline *tl,
+                         struct alive_timeline_event *event)
+{
+  int i;
+
+  if( !tl->heap_size)
+    return 0;
+  i = tl->heap[0];
+  if( tl->heads[i].time > tl->end)
+    return 0;
+
+  event->ioc = i;
+  event->item = tl->heads[i];
+  if( !alive_event_pack_next( &(tl->cursors[i]), &(tl->heads[i])) )
+    tl->heap[0] = tl->heap[--tl->heap_size];
+  sift_down( tl, 0);
+  return 1;
+}
+
+
+struct timeline_work
+{
+  char *server;
+  int port;
+  struct alive_timeline *tl;
+
+  pthread_mutex_t lock;
+  int next;
+};
+
+static void *timeline_worker( void *arg)
+{
+  struct timeline_work *work = arg;
+  int i;
+
+  while( 1)
+    {
+      pthread_mutex_lock( &work->lock);
+      i = work->next++;
+      pthread_mutex_unlock( &work->lock);
+      if( i >= work->tl->number)
+        break;
+
+      work->tl->packs[i] = alive_get_ioc_event_pack( work->server, work->port,
+                                                     work->tl->ioc_names[i]);
+    }
+
+  return NULL;
+}
+
+struct alive_timeline *alive_get_timeline( char *server, int port,
+                                           int number, char **names,
+                                           int threads)
+{
+  struct alive_timeline *tl;
+  struct timeline_work work;
+  struct alive_db *db;
+  pthread_t *tids;
+  int started;
+  int i;
+
+  // the IOCs are whatever the daemon knows of
+  db = alive_get_iocs( server, port, number, names);
+  if( db == NULL)
+    return NULL;
+
+  tl = calloc( 1, sizeof( struct alive_timeline));
+  if( tl == NULL)
+    {
+      alive_free_db( db);
+      return NULL;
+    }
+  tl->current_time = db->current_time;
+  tl->number = db->number_ioc;
+  tl->ioc_names = calloc( tl->number + 1, sizeof( char *));
+  tl->packs = calloc( tl->number + 1, sizeof( struct alive_event_pack *));
+  tl->cursors = calloc( tl->number + 1, sizeof( struct alive_event_cursor));
+  tl->heads = calloc( tl->number + 1, sizeof( struct alive_ioc_event_item));
+  tl->heap = calloc( tl->number + 1, sizeof( int));
+  if( (tl->ioc_names == NULL) || (tl->packs == NULL) ||
+      (tl->cursors == NULL) || (tl->heads == NULL) || (tl->heap == NULL) )
+    {
+      alive_free_db( db);
+      alive_free_timeline( tl);
+      return NULL;
+    }
+  // names are taken over from the database
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      tl->ioc_names[i] = db->ioc[i].ioc_name;
+      db->ioc[i].ioc_name = NULL;
+    }
+  alive_free_db( db);
+
+  if( threads < 1)
+    threads = 1;
+  if( threads > tl->number)
+    threads = tl->number;
+
+  work.server = server;
+  work.port = port;
+  work.tl = tl;
+  work.next = 0;
+  pthread_mutex_init( &work.lock, NULL);
+
+  tids = malloc( (threads ? threads : 1) * sizeof( pthread_t));
+  started = 0;
+  if( tids != NULL)
+    for( ; started < threads; started++)
+      if( pthread_create( &tids[started], NULL, timeline_worker, &work))
+        break;
+  if( !started)
+    // do it all here instead
+    timeline_worker( &work);
+  for( i = 0; i < started; i++)
+    pthread_join( tids[i], NULL);
+  free( tids);
+  pthread_mutex_destroy( &work.lock);
+
+  alive_timeline_seek( tl, 0, tl->current_time);
+  return tl;
+}
+
+struct alive_timeline *alive_cache_timeline( struct alive_event_cache *cache,
+                                             int number, char **names)
+{
+  struct alive_timeline *tl;
+  struct alive_event_cache_view *view;
+  char **cached;
+  int number_cached;
+  int i;
+
+  cached = NULL;
+  number_cached = 0;
+  if( !number)
+    {
+      cached = alive_event_cache_names( cache, &number_cached);
+      if( cached == NULL)
+        return NULL;
+      number = number_cached;
+      names = cached;
+    }
+
+  tl = calloc( 1, sizeof( struct alive_timeline));
+  if( tl == NULL)
+    {
+      alive_event_cache_free_names( cached, number_cached);
+      return NULL;
+    }
+  tl->number = number;
+  tl->ioc_names = calloc( tl->number + 1, sizeof( char *));
+  tl->packs = calloc( tl->number + 1, sizeof( struct alive_event_pack *));
+  tl->cursors = calloc( tl->number + 1, sizeof( struct alive_event_cursor));
+  tl->heads = calloc( tl->number + 1, sizeof( struct alive_ioc_event_item));
+  tl->heap = calloc( tl->number + 1, sizeof( int));
+  if( (tl->ioc_names == NULL) || (tl->packs == NULL) ||
+      (tl->cursors == NULL) || (tl->heads == NULL) || (tl->heap == NULL) )
+    {
+      alive_event_cache_free_names( cached, number_cached);
+      alive_free_timeline( tl);
+      return NULL;
+    }
+
+  // packed from the mapping, which isn't kept
+  for( i = 0; i < number; i++)
+    {
+      tl->ioc_names[i] = strdup( names[i]);
+      view = alive_event_cache_map( cache, names[i]);
+      if( view == NULL)
+        continue;
+      if( view->events.current_time > tl->current_time)
+        tl->current_time = view->events.current_time;
+      tl->packs[i] = alive_event_pack_create( &view->events);
+      alive_event_cache_unmap( view);
+    }
+  alive_event_cache_free_names( cached, number_cached);
+
+  alive_timeline_seek( tl, 0, tl->current_time);
+  return tl;
+}
+
+void alive_free_timeline( struct alive_timeline *tl)
+{
+  int i;
+
+  if( tl == NULL)
+    return;
+  for( i = 0; i < tl->number; i++)
+    {
+      if( tl->ioc_names != NULL)
+        free( tl->ioc_names[i]);
+      if( tl->packs != NULL)
+        alive_free_event_pack( tl->packs[i]);
+    }
+  free( tl->ioc_names);
+  free( tl->packs);
+  free( tl->cursors);
+  free( tl->heads);
+  free( tl->heap);
+  free( tl);
+}
+
+
+/////////////////////////////////////////////
+
+struct burst_entry
+{
+  uint32_t time;
+  int ioc;
+  uint32_t address;  // raw
+};
+
+// events of one type, the ones in the window and those of an open burst
+struct burst_track
+{
+  struct burst_entry *window;
+  int first, last, size;   // window[first..last-1]
+  // events ever added to the window, and how many of those went into
+  // bursts, which are always the earliest ones
+  int added, counted;
+
+  int open;
+  struct alive_burst burst;
+  struct burst_entry *members;
+  int number_members, size_members;
+};
+
+struct burst_list
+{
+  struct alive_burst *bursts;
+  int number, size;
+};
+
+static int append_entry( struct burst_entry **entries, int *number,
+                         int *size, struct burst_entry *e)
+{
+  struct burst_entry *p;
+  int n;
+
+  if( *number == *size)
+    {
+      n = *size ? 2 * *size : 64;
+      p = realloc( *entries, n * sizeof( struct burst_entry));
+      if( p == NULL)
+        return 1;
+      *entries = p;
+      *size = n;
+    }
+  (*entries)[ (*number)++] = *e;
+  return 0;
+}
+
+static int compare_entry_ioc( const void *a, const void *b)
+{
+  const struct burst_entry *x = a, *y = b;
+
+  if( x->ioc != y->ioc)
+    return x->ioc - y->ioc;
+  return (x->time > y->time) - (x->time < y->time);
+}
+
+static int compare_uint32( const void *a, const void *b)
+{
+  uint32_t x = *((const uint32_t *) a), y = *((const uint32_t *) b);
+
+  return (x > y) - (x < y);
+}
+
+static int compare_subnet( const void *a, const void *b)
+{
+  const struct alive_burst_subnet *x = a, *y = b;
+
+  if( x->number != y->number)
+    return y->number - x->number;
+  return (x->network > y->network) - (x->network < y->network);
+}
+
+static int compare_burst( const void *a, const void *b)
+{
+  const struct alive_burst *x = a, *y = b;
+
+  if( x->start != y->start)
+    return (x->start > y->start) - (x->start < y->start);
+  return (x->event > y->event) - (x->event < y->event);
+}
+
+// works out the IOCs and subnets of a finished burst, and keeps it
+static int close_burst( struct burst_track *track, int prefix_length,
+                        struct burst_list *list)
+{
+  struct alive_burst *b = &track->burst;
+  struct burst_entry *m = track->members;
+  uint32_t *networks;
+  uint32_t mask;
+  void *p;
+  int i, n;
+
+  track->open = 0;
+  b->iocs = malloc( (track->number_members + 1) * sizeof( int));
+  networks = malloc( (track->number_members + 1) * sizeof( uint32_t));
+  b->subnets = malloc( (track->number_members + 1) *
+                       sizeof( struct alive_burst_subnet));
+  if( (b->iocs == NULL) || (networks == NULL) || (b->subnets == NULL) )
+    goto Error;
+
+  // each IOC once, with the address of its first event in the burst
+  qsort( m, track->number_members, sizeof( struct burst_entry),
+         compare_entry_ioc);
+  mask = prefix_length ? 0xffffffff << (32 - prefix_length) : 0;
+  b->number_iocs = 0;
+  for( i = 0; i < track->number_members; i++)
+    if( !i || (m[i].ioc != m[i-1].ioc) )
+      {
+        networks[b->number_iocs] =
+          alive_ip_host_order( (unsigned char *) &m[i].address) & mask;
+        b->iocs[b->number_iocs++] = m[i].ioc;
+      }
+
+  qsort( networks, b->number_iocs, sizeof( uint32_t), compare_uint32);
+  b->number_subnets = 0;
+  for( i = 0; i < b->number_iocs; i += n)
+    {
+      for( n = 1; (i + n < b->number_iocs) &&
+             (networks[i + n] == networks[i]); n++)
+        ;
+      b->subnets[b->number_subnets].network = networks[i];
+      b->subnets[b->number_subnets].prefix_length = prefix_length;
+      b->subnets[b->number_subnets++].number = n;
+    }
+  qsort( b->subnets, b->number_subnets, sizeof( struct alive_burst_subnet),
+         compare_subnet);
+  free( networks);
+
+  if( list->number == list->size)
+    {
+      n = list->size ? 2 * list->size : 16;
+      p = realloc( list->bursts, n * sizeof( struct alive_burst));
+      if( p == NULL)
+        goto Error;
+      list->bursts = p;
+      list->size = n;
+    }
+  list->bursts[ list->number++] = *b;
+  return 0;
+
+ Error:
+  free( b->iocs);
+  free( b->subnets);
+  free( networks);
+  return 1;
+}
+
+int alive_timeline_bursts( struct alive_timeline *tl, time_t start,
+                           time_t end, int window, int threshold,
+                           int prefix_length, struct alive_burst **bursts)
+{
+  struct burst_track tracks[TIMELINE_EVENT_TYPES];
+  struct burst_track *track;
+  struct burst_list list;
+  struct alive_timeline_event event;
+  struct burst_entry e;
+  int count;
+  int fresh;
+  int ret;
+  int i;
+
+  memset( tracks, 0, sizeof( tracks));
+  memset( &list, 0, sizeof( list));
+  if( threshold < 1)
+    threshold = 1;
+  if( (prefix_length < 0) || (prefix_length > 32) )
+    prefix_length = 24;
+
+  ret = 0;
+  alive_timeline_seek( tl, start, end);
+  while( alive_timeline_next( tl, &event) )
+    {
+      if( event.item.event >= TIMELINE_EVENT_TYPES)
+        continue;
+      track = &tracks[event.item.event];
+      e.time = event.item.time;
+      e.ioc = event.ioc;
+      e.address = event.item.raw_ip_address;
+
+      // the window is the events no more than window seconds before this
+      while( (track->first < track->last) &&
+             ((int64_t) e.time - track->window[track->first].time > window) )
+        track->first++;
+      if( track->first == track->last)
+        track->first = track->last = 0;
+      else if( track->first > track->size / 2)
+        {
+          memmove( track->window, track->window + track->first,
+                   (track->last - track->first) * sizeof( struct burst_entry));
+          track->last -= track->first;
+          track->first = 0;
+        }
+      if( append_entry( &track->window, &track->last, &track->size, &e) )
+        {
+          ret = 1;
+          break;
+        }
+      track->added++;
+      count = track->last - track->first;
+      // those in the window that are in no burst yet
+      fresh = track->added - track->counted;
+      if( fresh > count)
+        fresh = count;
+
+      if( track->open && (count < threshold) )
+        {
+          if( close_burst( track, prefix_length, &list) )
+            {
+              ret = 1;
+              break;
+            }
+        }
+      else if( track->open)
+        {
+          track->burst.end = e.time;
+          track->burst.number++;
+          track->counted = track->added;
+          if( append_entry( &track->members, &track->number_members,
+                            &track->size_members, &e) )
+            {
+              ret = 1;
+              break;
+            }
+        }
+      else if( fresh >= threshold)
+        {
+          // Starts with all in the window that came after the last
+          // burst, so bursts never share events.
+          memset( &track->burst, 0, sizeof( struct alive_burst));
+          track->open = 1;
+          track->burst.event = event.item.event;
+          track->burst.start = track->window[track->last - fresh].time;
+          track->burst.end = e.time;
+          track->burst.number = fresh;
+          track->counted = track->added;
+          track->number_members = 0;
+          for( i = track->last - fresh; i < track->last; i++)
+            if( append_entry( &track->members, &track->number_members,
+                              &track->size_members, &track->window[i]) )
+              ret = 1;
+          if( ret)
+            break;
+        }
+    }
+
+  for( i = 0; i < TIMELINE_EVENT_TYPES; i++)
+    {
+      if( !ret && tracks[i].open &&
+          close_burst( &tracks[i], prefix_length, &list) )
+        ret = 1;
+      free( tracks[i].window);
+      free( tracks[i].members);
+    }
+  if( ret)
+    {
+      alive_free_bursts( list.bursts, list.number);
+      return -1;
+    }
+
+  qsort( list.bursts, list.number, sizeof( struct alive_burst),
+         compare_burst);
+  *bursts = list.bursts;
+  return list.number;
+}
+
+void alive_free_bursts( struct alive_burst *bursts, int number)
+{
+  int i;
+
+  if( bursts == NULL)
+    return;
+  for( i = 0; i < number; i++)
+    {
+      free( bursts[i].iocs);
+      free( bursts[i].subnets);
+    }
+  free( bursts);
+}
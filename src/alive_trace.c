@@ -0,0 +1,349 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Each thread records into its own ring, so recording takes no lock: the
+// owner fills a slot and then publishes it by advancing the head.  Rings
+// are kept on a list that is only ever pushed onto, and a ring is handed
+// to a new thread once its old one exits.  The writer of the trace
+// copies the rings out, and drops anything that may have been overwritten
+// while it was copying.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "alive_client.h"
+#include "alive_trace.h"
+
+
+#define TRACE_DEFAULT_CAPACITY (4096)
+#define TRACE_IOC_LENGTH (40)
+
+struct trace_record
+{
+  uint64_t time;  // nanoseconds, monotonic
+  uint64_t id;
+  int32_t bytes;
+  uint16_t type;
+  uint8_t span;
+  uint8_t phase;
+  char ioc[TRACE_IOC_LENGTH];
+};
+
+struct trace_ring
+{
+  struct trace_ring *next;
+  int tid;
+  int in_use;
+
+  uint64_t head;   // records ever made, only changed by the owner
+  uint64_t floor;  // records before this were cleared
+  uint64_t mask;
+  struct trace_record *records;
+};
+
+
+int alive_tracing = 0;
+
+static struct trace_ring *rings = NULL;
+static int ring_count = 0;
+static int capacity = TRACE_DEFAULT_CAPACITY;
+static uint64_t next_id = 0;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static __thread struct trace_ring *thread_ring = NULL;
+
+
+static char *span_names[Trace_Number] =
+  { "alive_get_iocs", "alive_get_detailed", "alive_get_ioc_event_db",
+    "alive_request_raw", "request", "alive_poller_poll", "getaddrinfo", "connect", "write",
+    "first byte", "read", "decode", "free", "cache hit", "cache wait" };
+
+
+static void release_ring( void *arg)
+{
+  struct trace_ring *ring = arg;
+
+  __atomic_store_n( &ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void make_key( void)
+{
+  pthread_key_create( &ring_key, release_ring);
+}
+
+static struct trace_ring *get_ring( void)
+{
+  struct trace_ring *ring;
+  int unused;
+
+  if( thread_ring != NULL)
+    return thread_ring;
+
+  pthread_once( &key_once, make_key);
+
+  // one left behind by a thread that has exited
+  for( ring = __atomic_load_n( &rings, __ATOMIC_ACQUIRE); ring != NULL;
+       ring = ring->next)
+    {
+      unused = 0;
+      if( __atomic_compare_exchange_n( &ring->in_use, &unused, 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) )
+        break;
+    }
+
+  if( ring == NULL)
+    {
+      ring = calloc( 1, sizeof( struct trace_ring));
+      if( ring == NULL)
+        return NULL;
+      ring->records = malloc( capacity * sizeof( struct trace_record));
+      if( ring->records == NULL)
+        {
+          free( ring);
+          return NULL;
+        }
+      ring->mask = capacity - 1;
+      ring->in_use = 1;
+      ring->tid = __atomic_add_fetch( &ring_count, 1, __ATOMIC_RELAXED);
+
+      ring->next = __atomic_load_n( &rings, __ATOMIC_RELAXED);
+      while( !__atomic_compare_exchange_n( &rings, &ring->next, ring, 1,
+                                           __ATOMIC_RELEASE,
+                                           __ATOMIC_RELAXED) )
+        ;
+    }
+
+  thread_ring = ring;
+  pthread_setspecific( ring_key, ring);
+
+  return ring;
+}
+
+void alive_trace_record( int phase, int span, uint64_t id, int type,
+                         const char *ioc, int bytes)
+{
+  struct trace_ring *ring;
+  struct trace_record *rec;
+  struct timespec ts;
+  uint64_t head;
+
+  ring = get_ring();
+  if( ring == NULL)
+    return;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+  head = ring->head;
+  rec = &(ring->records[head & ring->mask]);
+  rec->time = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  rec->id = id;
+  rec->bytes = bytes;
+  rec->type = type;
+  rec->span = span;
+  rec->phase = phase;
+  if( ioc != NULL)
+    strncpy( rec->ioc, ioc, TRACE_IOC_LENGTH - 1);
+  rec->ioc[ (ioc != NULL) ? TRACE_IOC_LENGTH - 1 : 0] = '\0';
+  __atomic_store_n( &ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t alive_trace_new_id( void)
+{
+  return __atomic_add_fetch( &next_id, 1, __ATOMIC_RELAXED);
+}
+
+
+int alive_trace_start( int records)
+{
+  int n;
+
+  // the first start fixes the ring size
+  if( (records > 0) && (__atomic_load_n( &rings, __ATOMIC_ACQUIRE) == NULL) )
+    {
+      n = 2;
+      while( n < records)
+        n <<= 1;
+      capacity = n;
+    }
+
+  __atomic_store_n( &alive_tracing, 1, __ATOMIC_RELEASE);
+  return 0;
+}
+
+void alive_trace_stop( void)
+{
+  __atomic_store_n( &alive_tracing, 0, __ATOMIC_RELEASE);
+}
+
+void alive_trace_clear( void)
+{
+  struct trace_ring *ring;
+
+  for( ring = __atomic_load_n( &rings, __ATOMIC_ACQUIRE); ring != NULL;
+       ring = ring->next)
+    ring->floor = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE);
+}
+
+
+static char *type_name( int type)
+{
+  switch( type)
+    {
+    case REQUEST_ALL_IOCS:
+      return "all";
+    case REQUEST_SOME_IOCS:
+      return "some";
+    case REQUEST_ONE_IOC:
+      return "one";
+    case REQUEST_EVENTS:
+      return "events";
+    case REQUEST_DEBUG:
+      return "debug";
+    case REQUEST_CONFLICTS:
+      return "conflicts";
+    }
+  return NULL;
+}
+
+static void write_json_string( FILE *fp, char *s)
+{
+  fputc( '"', fp);
+  for( ; *s; s++)
+    {
+      if( (*s == '"') || (*s == '\\') )
+        fprintf( fp, "\\%c", *s);
+      else if( (unsigned char) *s < 0x20)
+        fprintf( fp, "\\u%04x", (unsigned char) *s);
+      else
+        fputc( *s, fp);
+    }
+  fputc( '"', fp);
+}
+
+static void write_record( FILE *fp, struct trace_record *rec, int pid,
+                          int tid)
+{
+  char phase;
+  char *name;
+  int args;
+
+  if( rec->phase == 'I')
+    phase = rec->id ? 'n' : 'i';
+  else if( rec->id)
+    phase = (rec->phase == 'B') ? 'b' : 'e';
+  else
+    phase = rec->phase;
+
+  fprintf( fp, ",\n{\"name\":\"%s\",\"cat\":\"alive\",\"ph\":\"%c\","
+           "\"ts\":%llu.%03u,\"pid\":%d,\"tid\":%d", span_names[rec->span], phase,
+           (unsigned long long) (rec->time / 1000),
+           (unsigned) (rec->time % 1000), pid, tid);
+  if( rec->id)
+    fprintf( fp, ",\"id\":\"0x%llx\"", (unsigned long long) rec->id);
+  if( phase == 'i')
+    fprintf( fp, ",\"s\":\"t\"");
+
+  args = 0;
+  if( rec->type)
+    {
+      fprintf( fp, ",\"args\":{\"type\":");
+      name = type_name( rec->type);
+      if( name != NULL)
+        fprintf( fp, "\"%s\"", name);
+      else
+        fprintf( fp, "%d", rec->type);
+      args = 1;
+    }
+  if( rec->ioc[0])
+    {
+      fprintf( fp, args ? ",\"ioc\":" : ",\"args\":{\"ioc\":");
+      write_json_string( fp, rec->ioc);
+      args = 1;
+    }
+  if( rec->bytes >= 0)
+    {
+      fprintf( fp, args ? ",\"bytes\":%d" : ",\"args\":{\"bytes\":%d",
+               rec->bytes);
+      args = 1;
+    }
+  fprintf( fp, args ? "}}" : "}");
+}
+
+int alive_trace_write( char *filename)
+{
+  FILE *fp;
+  struct trace_ring *ring;
+  struct trace_record *copy;
+  uint64_t base, from, to, safe, i;
+  int pid;
+  int first;
+  int ret;
+
+  fp = fopen( filename, "w");
+  if( fp == NULL)
+    {
+      printf( "Can't open trace file \"%s\"!\n", filename);
+      return 1;
+    }
+  copy = malloc( capacity * sizeof( struct trace_record));
+  if( copy == NULL)
+    {
+      fclose( fp);
+      return 1;
+    }
+
+  pid = getpid();
+  first = 1;
+  fprintf( fp, "{\"traceEvents\":[");
+  for( ring = __atomic_load_n( &rings, __ATOMIC_ACQUIRE); ring != NULL;
+       ring = ring->next)
+    {
+      to = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE);
+      from = ring->floor;
+      if( to - from > ring->mask + 1)
+        from = to - (ring->mask + 1);
+      for( i = from; i < to; i++)
+        copy[i - from] = ring->records[i & ring->mask];
+      base = from;
+
+      // the owner may have lapped the copy, and be filling one slot more
+      __atomic_thread_fence( __ATOMIC_ACQUIRE);
+      safe = __atomic_load_n( &ring->head, __ATOMIC_RELAXED) + 1;
+      if( safe > ring->mask + 1)
+        {
+          safe -= ring->mask + 1;
+          if( from < safe)
+            from = safe;
+        }
+
+      fprintf( fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+               "\"tid\":%d,\"args\":{\"name\":\"alive thread %d\"}}",
+               first ? "" : ",", pid, ring->tid, ring->tid);
+      first = 0;
+      for( i = from; i < to; i++)
+        write_record( fp, &copy[i - base], pid, ring->tid);
+    }
+  fprintf( fp, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+  free( copy);
+  ret = ferror( fp);
+  if( fclose( fp) || ret)
+    {
+      printf( "Can't write trace file \"%s\"!\n", filename);
+      return 1;
+    }
+  return 0;
+}
@@ -0,0 +1,48 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Library-internal tracing hooks; the public calls are in alive_client.h.
+// When tracing is off each hook is a test of one flag.
+
+
+#ifndef ALIVE_TRACE_H
+#define ALIVE_TRACE_H 1
+
+
+#include <stdint.h>
+
+
+enum TraceSpan { Trace_GetIocs, Trace_GetDetailed, Trace_GetEvents,
+                 Trace_RequestRaw, Trace_Request, Trace_Poll, Trace_Getaddrinfo,
+                 Trace_Connect, Trace_Write, Trace_FirstByte, Trace_Read,
+                 Trace_Decode, Trace_Free, Trace_CacheHit, Trace_CacheWait,
+                 Trace_Number };
+
+extern int alive_tracing;
+
+void alive_trace_record( int phase, int span, uint64_t id, int type,
+                         const char *ioc, int bytes);
+uint64_t alive_trace_new_id( void);
+
+// A span with an id of zero nests on the calling thread; otherwise it
+// belongs to a non-blocking request and can overlap others.  Type and IOC
+// go on the beginning, and the byte count on the end.
+#define TRACE_BEGIN( span, id, type, ioc) \
+  do { if( __builtin_expect( alive_tracing, 0) ) \
+      alive_trace_record( 'B', span, id, type, ioc, -1); } while(0)
+#define TRACE_END( span, id, bytes) \
+  do { if( __builtin_expect( alive_tracing, 0) ) \
+      alive_trace_record( 'E', span, id, 0, NULL, bytes); } while(0)
+#define TRACE_INSTANT( span, id) \
+  do { if( __builtin_expect( alive_tracing, 0) ) \
+      alive_trace_record( 'I', span, id, 0, NULL, -1); } while(0)
+
+
+#endif
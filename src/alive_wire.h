@@ -0,0 +1,198 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// The fixed blocks of the daemon's responses, each described by one
+// table of its fields in wire order.  Everything else is made from the
+// tables: a struct for each block, its size on the wire, and inline
+// functions to get it from and put it into a buffer.  The library's
+// decoders and skippers use these, as can proxies, caches, and mock
+// servers that build responses, so none of them can disagree about a
+// layout.
+//
+// Getting and putting don't test lengths; test once that the whole
+// block is there with ALIVE_WIRE_SIZE().  Fields are big endian, except
+// the events, which the daemon sends in its own byte order.  Strings,
+// between the blocks, have a one or two byte length in front.  The OS
+// parameters after an environment are described by alive_os_schema().
+
+
+#ifndef ALIVE_WIRE_H
+#define ALIVE_WIRE_H 1
+
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+
+// the version of the protocol in every response's header
+#define CLIENT_PROTOCOL_VERSION (4)
+
+// the start of every response
+#define ALIVE_WIRE_HEADER( FIELD) \
+  FIELD( u16, version) \
+  FIELD( u32, current_time) \
+  FIELD( u32, start_time)
+
+// the start of a database response, with the count of IOCs
+#define ALIVE_WIRE_DB_HEADER( FIELD) \
+  ALIVE_WIRE_HEADER( FIELD) \
+  FIELD( u16, number)
+
+// an IOC of a database response, after its name
+#define ALIVE_WIRE_IOC( FIELD) \
+  FIELD( u8, status) \
+  FIELD( u32, time) \
+  FIELD( u32, ip) \
+  FIELD( u32, user_msg)
+
+// the IOC of a debug or conflict response, after its name
+#define ALIVE_WIRE_DETAILED( FIELD) \
+  FIELD( u8, status) \
+  FIELD( u32, time) \
+  FIELD( u32, number_instances)
+
+// each instance of the IOC, followed by its environment
+#define ALIVE_WIRE_INSTANCE( FIELD) \
+  FIELD( u8, status) \
+  FIELD( u32, ip) \
+  FIELD( u16, origin_port) \
+  FIELD( u32, heartbeat) \
+  FIELD( u16, period) \
+  FIELD( u32, incarnation) \
+  FIELD( u32, boottime) \
+  FIELD( u32, timestamp) \
+  FIELD( u16, reply_port) \
+  FIELD( u32, user_msg)
+
+// An environment is its flag, and only if it is set, the count of
+// variables, the key and value strings of each, the OS type, and the OS
+// parameters.
+#define ALIVE_WIRE_ENV_FLAG( FIELD) \
+  FIELD( u8, present)
+#define ALIVE_WIRE_ENV_COUNT( FIELD) \
+  FIELD( u16, number)
+#define ALIVE_WIRE_ENV_EXTRA( FIELD) \
+  FIELD( u16, extra_type)
+
+// each event of an event response, after its header
+#define ALIVE_WIRE_EVENT( FIELD) \
+  FIELD( raw32, time) \
+  FIELD( raw32, ip) \
+  FIELD( raw32, user_msg) \
+  FIELD( raw32, event)
+
+
+typedef uint8_t alive_wire_u8;
+typedef uint16_t alive_wire_u16;
+typedef uint32_t alive_wire_u32;
+typedef uint32_t alive_wire_raw32;
+
+static inline const char *alive_wire_get_u8( const char *p, uint8_t *val)
+{
+  *val = *((const uint8_t *) p);
+  return p + sizeof(uint8_t);
+}
+
+static inline const char *alive_wire_get_u16( const char *p, uint16_t *val)
+{
+  memcpy( val, p, sizeof(uint16_t));
+  *val = ntohs( *val);
+  return p + sizeof(uint16_t);
+}
+
+static inline const char *alive_wire_get_u32( const char *p, uint32_t *val)
+{
+  memcpy( val, p, sizeof(uint32_t));
+  *val = ntohl( *val);
+  return p + sizeof(uint32_t);
+}
+
+static inline const char *alive_wire_get_raw32( const char *p, uint32_t *val)
+{
+  memcpy( val, p, sizeof(uint32_t));
+  return p + sizeof(uint32_t);
+}
+
+static inline char *alive_wire_put_u8( char *p, uint8_t val)
+{
+  *((uint8_t *) p) = val;
+  return p + sizeof(uint8_t);
+}
+
+static inline char *alive_wire_put_u16( char *p, uint16_t val)
+{
+  val = htons( val);
+  memcpy( p, &val, sizeof(uint16_t));
+  return p + sizeof(uint16_t);
+}
+
+static inline char *alive_wire_put_u32( char *p, uint32_t val)
+{
+  val = htonl( val);
+  memcpy( p, &val, sizeof(uint32_t));
+  return p + sizeof(uint32_t);
+}
+
+static inline char *alive_wire_put_raw32( char *p, uint32_t val)
+{
+  memcpy( p, &val, sizeof(uint32_t));
+  return p + sizeof(uint32_t);
+}
+
+// Puts a string with a length of bytes (1 or 2) in front, cutting it to
+// what fits.  Needs ALIVE_WIRE_STRING_SIZE() bytes.
+static inline char *alive_wire_put_string( char *p, const char *str,
+                                           int bytes)
+{
+  size_t len;
+
+  len = strnlen( str, (bytes == 1) ? 0xff : 0xffff);
+  if( bytes == 1)
+    p = alive_wire_put_u8( p, len);
+  else
+    p = alive_wire_put_u16( p, len);
+  memcpy( p, str, len);
+  return p + len;
+}
+#define ALIVE_WIRE_STRING_SIZE( str, bytes) \
+  ((bytes) + strnlen( (str), ((bytes) == 1) ? 0xff : 0xffff))
+
+
+#define ALIVE_WIRE_MEMBER( type, name) alive_wire_##type name;
+#define ALIVE_WIRE_FIELD_SIZE( type, name) + (int) sizeof(alive_wire_##type)
+#define ALIVE_WIRE_GET( type, name) p = alive_wire_get_##type( p, &block->name);
+#define ALIVE_WIRE_PUT( type, name) p = alive_wire_put_##type( p, block->name);
+
+#define ALIVE_WIRE_BLOCK( kind, LAYOUT) \
+  struct alive_wire_##kind { LAYOUT( ALIVE_WIRE_MEMBER) }; \
+  enum { alive_wire_##kind##_size = 0 LAYOUT( ALIVE_WIRE_FIELD_SIZE) }; \
+  static inline const char *alive_wire_get_##kind( \
+    const char *p, struct alive_wire_##kind *block) \
+  { LAYOUT( ALIVE_WIRE_GET) return p; } \
+  static inline char *alive_wire_put_##kind( \
+    char *p, const struct alive_wire_##kind *block) \
+  { LAYOUT( ALIVE_WIRE_PUT) return p; }
+
+ALIVE_WIRE_BLOCK( header, ALIVE_WIRE_HEADER)
+ALIVE_WIRE_BLOCK( db_header, ALIVE_WIRE_DB_HEADER)
+ALIVE_WIRE_BLOCK( ioc, ALIVE_WIRE_IOC)
+ALIVE_WIRE_BLOCK( detailed, ALIVE_WIRE_DETAILED)
+ALIVE_WIRE_BLOCK( instance, ALIVE_WIRE_INSTANCE)
+ALIVE_WIRE_BLOCK( env_flag, ALIVE_WIRE_ENV_FLAG)
+ALIVE_WIRE_BLOCK( env_count, ALIVE_WIRE_ENV_COUNT)
+ALIVE_WIRE_BLOCK( env_extra, ALIVE_WIRE_ENV_EXTRA)
+ALIVE_WIRE_BLOCK( event, ALIVE_WIRE_EVENT)
+
+// bytes of a block on the wire, like ALIVE_WIRE_SIZE( ioc)
+#define ALIVE_WIRE_SIZE( kind) (alive_wire_##kind##_size)
+
+
+#endif
@@ -14,8 +14,44 @@
 #include <time.h>
 
 #include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
 
 #include "alive_client.h"
+#include "alivedb.h"
+
+
+// long-only options
+enum { OPT_WATCH = 256, OPT_HOOK, OPT_INTERVAL, OPT_SERVE_METRICS,
+       OPT_PUBLISH_SHM, OPT_RECORD_HISTORY, OPT_HISTORY, OPT_AT, OPT_SINCE,
+       OPT_UNTIL, OPT_AVAILABILITY, OPT_THREADS, OPT_TRACE, OPT_HEALTH,
+       OPT_LAG, OPT_SORT, OPT_REVERSE, OPT_TOP, OPT_GROUP_BY, OPT_BATCH,
+       OPT_TIMELINE, OPT_BURSTS, OPT_WINDOW, OPT_DRIFT,
+       OPT_FOLLOW, OPT_EVENT_CACHE, OPT_WHERE };
+
+static char *status_strings[] = 
+  { "UNKNOWN", "DOWN_UNKNOWN", "DOWN", "UP", "CONFLICT" };
+
+static char *event_strings[] = 
+  { "NONE", "FAIL", "BOOT", "RECOVER", "MESSAGE", "CONFLICT_START", 
+    "CONFLICT_STOP" };
+
+static char *event_string( uint32_t event)
+{
+  if( event > CONFLICT_STOP)
+    return "INVALID";
+  return event_strings[event];
+}
+
+char *status_string( uint8_t status)
+{
+  if( status > STATUS_CONFLICT)
+    return "INVALID";
+  return status_strings[status];
+}
 
 void time_string( uint32_t timeval, char *buffer)
 {
@@ -44,9 +80,10 @@ void time_string( uint32_t timeval, char *buffer)
 void helper( void)
 {
   printf("Usage: alivedb [-h] [-r (server)[:(port)] ] [-s | -e (var) | -p (param)]\n"
-         "       ( . | (ioc1) [ioc2] [...] | (-l|-d|-c) (ioc) )\n");
+         "       [-n (bits)] ( . | (ioc1|ip|cidr) [...] | (-l|-d|-c) (ioc) )\n");
   printf("Prints out information from alive database.\n"
-         "To print entire database, give \'.\' as an argument.\n");
+         "To print entire database, give \'.\' as an argument.\n"
+         "IOCs can also be selected by IP address or subnet (10.1.2.0/24).\n");
   printf("  -h  Show this help screen.\n");
   printf("  -v  Show version.\n");
   printf("  -r  Set the remote host and optionally the port.\n");
@@ -55,6 +92,7 @@ void helper( void)
   printf("  -c  Print out conflict information for the specified IOC.\n");
   printf("  -s  Print out only status information.\n");
   printf("  -e  Print out only the environment variable specified.\n");
+  printf("  -n  Print out status counts for each subnet of the given prefix length.\n");
   printf("  -p  Print out only the operating system specific parameter specified.\n"
          "      Parameter is of form os:parameter\n"
          "        vxworks: boot_device, unit_number, processor_number, boot_host_name,\n"
@@ -63,10 +101,91 @@ void helper( void)
          "        linux: user, group, hostname\n"
          "        darwin: user, group, hostname\n"
          "        windows: user, machine\n");
+  printf("  --follow         With -l, keep printing the new events of the IOCs\n"
+         "      given (\".\" for all), polling them every interval.\n");
+  printf("  --event-cache (dir)  Refresh the event lists of the IOCs given into a\n"
+         "      cache directory, or with -l, --availability, or --timeline, read\n"
+         "      them from it instead of the server.\n");
+  printf("  --where (filter)  Select only the IOCs matching the filter, like\n"
+         "      'status==DOWN && env.EPICS_HOST_ARCH~\"linux\" && age>1h'; the IOC\n"
+         "      arguments can then be left out.  Fields are name, status, age,\n"
+         "      time, user_msg, ip (== or in a subnet), os, env.(var), and\n"
+         "      (os).(param); comparisons are ==, !=, <, <=, >, >=, ~, and !~\n"
+         "      (regular expressions), joined with &&, ||, !, and parentheses.\n");
+  printf("  --sort (key)     Print IOCs sorted by name, status, time (longest in its\n"
+         "      status first), ip, or user_msg.\n");
+  printf("  --reverse        Reverse the sort.\n");
+  printf("  --top (number)   Print only the first number of IOCs (of each status\n"
+         "      with --group-by).\n");
+  printf("  --group-by status  Print IOCs grouped by status.\n");
+  printf("  --watch (seconds)  Poll the database and print only the changes.\n");
+  printf("  --hook (command)   Run a shell command for each change while watching,\n"
+         "      with ALIVE_IOC, ALIVE_CHANGE, ALIVE_OLD_STATUS, and ALIVE_NEW_STATUS set.\n");
+  printf("  --serve-metrics (port)  Serve Prometheus-style metrics over HTTP,\n"
+         "      polling the database every interval.\n");
+  printf("  --publish-shm (name)  Publish the database in POSIX shared memory,\n"
+         "      polling every interval.\n");
+  printf("  --record-history (dir)  Record status changes into a history directory,\n"
+         "      polling every interval.\n");
+  printf("  --history (dir)  Read IOCs from a recorded history instead of the server.\n");
+  printf("  --at (time)      Time to show the history at (default now).\n");
+  printf("  --since (time)   Print the changes in the history from this time on.\n");
+  printf("  --until (time)   End time for --since (default now).\n"
+         "      Times are seconds since 1970, or of form \"YYYY-MM-DD HH:MM:SS\".\n");
+  printf("  --availability   Print availability, failures, MTBF, and MTTR from the\n"
+         "      event lists, between --since (default 30 days ago) and --until.\n");
+  printf("  --health         Print IOCs with more than one live instance, instances\n"
+         "      that are maybe up or down, or are late, or restarted between scans\n"
+         "      (with --watch).\n");
+  printf("  --lag (periods)  Heartbeat periods before a live instance is late for\n"
+         "      --health (default 3).\n");
+  printf("  --timeline       Print the events of all the IOCs merged in time order,\n"
+         "      between --since (default a day ago) and --until.\n");
+  printf("  --bursts (number)  Print instead the bursts of at least number events of\n"
+         "      one type within the window, with their IOCs and subnets (-n sets the\n"
+         "      prefix length, default 24).\n");
+  printf("  --window (seconds)  Window for --bursts (default 10).\n");
+  printf("  --drift          Print for each environment variable and OS parameter\n"
+         "      with more than one value the majority value and the IOCs with\n"
+         "      others (only the one given with -e or -p).\n");
+  printf("  --batch (file)   Answer the queries in the file (\"-\" for standard\n"
+         "      input), one per line, each of form\n"
+         "      [-s | -e (var) | -p (param) | -l | -d | -c] (ioc).\n");
+  printf("  --threads (number)  IOCs fetched at once for --availability,\n"
+         "      --health, --timeline, --follow, --event-cache, and --batch,\n"
+         "      and threads decoding the whole database (default 16).\n");
+  printf("  --interval (seconds)  Polling interval for server modes (default 10).\n");
+  printf("  --trace (file)   Trace the client calls, and write them as Chrome trace\n"
+         "      JSON when finished.\n");
+}
+
+// With a prefix, prints the labeled line for the parameter, otherwise just
+// the value.  Missing optional parameters print nothing.
+void print_os_param( struct alive_env *env, const struct alive_os_param *param,
+                     char *prefix)
+{
+  char *field;
+
+  field = (char *) env->extra + param->offset;
+  if( param->type == PARAM_UINT32)
+    {
+      if( prefix != NULL)
+        printf("%s  %s = ", prefix, param->label);
+      printf("%d\n", *((uint32_t *) field) );
+    }
+  else
+    {
+      if( param->optional && (*((char **) field) == NULL) )
+        return;
+      if( prefix != NULL)
+        printf("%s  %s = ", prefix, param->label);
+      printf("%s\n", *((char **) field) );
+    }
 }
 
 void print_env( struct alive_env *env, int style)
 {
+  const struct alive_os_schema *schema;
   int i;
 
   char prefix[3] = "  ";
@@ -85,245 +204,1255 @@ void print_env( struct alive_env *env, int style)
         printf( "%s  %s = %s\n", prefix, env->envvar_key[i], 
                 env->envvar_value[i]);
               
-      switch(env->extra_type)
+      schema = alive_os_schema( env->extra_type);
+      if( (schema != NULL) && (env->extra != NULL) )
         {
-        case VXWORKS:
-          {
-            struct alive_iocinfo_extra_vxworks *vw;
+          if(!style)
+            printf("\n");
+          printf("%s%s\n", prefix, schema->title);
+          for( i = 0; i < schema->number; i++)
+            print_os_param( env, &schema->params[i], prefix);
+        }
+    }
+}
+
+
+void print_ioc_line( struct alive_db *db, struct alive_ioc *ioc)
+{
+  char timestring_prefix[32], timestring[256];
+
+  switch( ioc->status)
+    {
+    case STATUS_UNKNOWN:
+      strcpy( timestring_prefix, "Uncertain");
+      timestring[0] = '\0';
+      break;
+    case STATUS_DOWN_UNKNOWN:
+      strcpy( timestring_prefix, "Down time: > ");
+      time_string( alive_ioc_status_time( db, ioc), timestring);
+      break;
+    case STATUS_DOWN:
+      strcpy( timestring_prefix, "Down time: ");
+      time_string( alive_ioc_status_time( db, ioc), timestring);
+      break;
+    case STATUS_UP:
+      strcpy( timestring_prefix, "Up time: ");
+      time_string( alive_ioc_status_time( db, ioc), timestring);
+      break;
+    case STATUS_CONFLICT:
+      strcpy( timestring_prefix, "Conflict time: ~ ");
+      time_string( alive_ioc_status_time( db, ioc), timestring);
+      break;
+    }
+
+  printf("%s (%d.%d.%d.%d) %d - %s%s\n",
+         ioc->ioc_name, ioc->ip_address[0], ioc->ip_address[1], 
+         ioc->ip_address[2], ioc->ip_address[3], ioc->user_msg,
+         timestring_prefix, timestring );
+}
+
+void print_event_db( struct alive_ioc_event_db *events, char *iocname)
+{
+  struct alive_ioc_event_item *item;
+
+  time_t current_time;
+  struct tm *ct;
+  char timestring[256];
+
+  int i;
+
+  char *event_strings[] = 
+    { "None          ", "Fail          ", "Boot          ", 
+      "Recover       ", "Message       ", "Conflict_Start", 
+      "Conflict_Stop "};
+  
+  if( (events != NULL) && (events->number) )
+    {
+      printf("\n%s Events\n", iocname);
+
+      item = events->instances;
+      for( i = 0; i < events->number; i++)
+        {
+          current_time = (time_t) item->time;
+          ct = localtime( &current_time);
+          strftime( timestring, 255, "%Y-%m-%d %H:%M:%S", ct);
           
-            vw = env->extra;
-
-            if(!style)
-              printf("\n");
-            printf("%svxWorks Boot Parameters\n", prefix);
-
-            printf("%s  boot device = %s\n", prefix, vw->bootdev);
-            printf("%s  unit number = %d\n", prefix, vw->unitnum);
-            printf("%s  processor number = %d\n", prefix, vw->procnum);
-            printf("%s  boot host name = %s\n", prefix, vw->boothost_name);
-            printf("%s  boot file = %s\n", prefix, vw->bootfile);
-            if( vw->address != NULL)
-              printf("%s  IP address = %s\n", prefix, vw->address);
-            if( vw->backplane_address != NULL)
-              printf("%s  backplane IP address = %s\n", prefix, 
-                     vw->backplane_address );
-            if( vw->boothost_address != NULL)
-              printf("%s  boot host IP address = %s\n", prefix, 
-                     vw->boothost_address);
-            if( vw->gateway_address != NULL)
-              printf("%s  gateway IP address = %s\n", prefix, 
-                     vw->gateway_address);
-            printf("%s  flags = %d\n", prefix, vw->flags );
-            if( vw->target_name != NULL)
-              printf("%s  target name = %s\n", prefix, vw->target_name);
-            if( vw->startup_script != NULL)
-              printf("%s  startup script = %s\n", prefix, vw->startup_script);
-            if( vw->other != NULL)
-              printf("%s  other = %s\n", prefix, vw->other);
-          }
-          break;
-        case LINUX:
-          {
-            struct alive_iocinfo_extra_linux *lnx;
+          printf("  %s [%d] %s (%d.%d.%d.%d) - ", 
+                 event_strings[item->event], item->user_msg,
+                 timestring, item->ip_address[0], item->ip_address[1],
+                 item->ip_address[2], item->ip_address[3] );
 
-            lnx = env->extra;
+          time_string( events->current_time - item->time, timestring);
+          printf("%s ago\n", timestring);
 
-            if(!style)
-              printf("\n");
-            printf("%sLinux Parameters\n", prefix);
+          item++;
+        }
+    }
+}
 
-            printf("%s  user = %s\n", prefix, lnx->user);
-            printf("%s  group = %s\n", prefix, lnx->group);
-            printf("%s  hostname = %s\n", prefix, lnx->hostname);
-          }
+void print_events( char *server, int port, char *iocname)
+{
+  struct alive_ioc_event_db *events;
+
+  events = alive_get_ioc_event_db( server, port, iocname);
+  print_event_db( events, iocname);
+  alive_free_ioc_event_db( events);
+}
+
+void print_cached_events( struct alive_event_cache *cache, char *iocname)
+{
+  struct alive_event_cache_view *view;
+
+  view = alive_event_cache_map( cache, iocname);
+  if( view == NULL)
+    {
+      printf("Error: %s isn't in the event cache.\n", iocname);
+      return;
+    }
+  print_event_db( &view->events, iocname);
+  alive_event_cache_unmap( view);
+}
+
+// hash table of IOC indices, keyed by name, open addressing
+struct name_table
+{
+  int size;  // power of two
+  int *slots;  // -1 for empty
+};
+
+static uint32_t name_hash( char *name)
+{
+  uint32_t h = 2166136261u;
+
+  while( *name)
+    {
+      h ^= (unsigned char) *name++;
+      h *= 16777619u;
+    }
+  return h;
+}
+
+static int name_table_init( struct name_table *nt, struct alive_db *db)
+{
+  uint32_t h;
+  int i;
+
+  nt->size = 16;
+  while( nt->size < 2 * db->number_ioc)
+    nt->size <<= 1;
+  nt->slots = malloc( nt->size * sizeof( int));
+  if( nt->slots == NULL)
+    return 1;
+  memset( nt->slots, 0xff, nt->size * sizeof( int));
+
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      h = name_hash( db->ioc[i].ioc_name) & (nt->size - 1);
+      while( nt->slots[h] >= 0)
+        h = (h + 1) & (nt->size - 1);
+      nt->slots[h] = i;
+    }
+  return 0;
+}
+
+static int name_table_find( struct name_table *nt, struct alive_db *db,
+                            char *name)
+{
+  uint32_t h;
+
+  h = name_hash( name) & (nt->size - 1);
+  while( nt->slots[h] >= 0)
+    {
+      if( !strcmp( db->ioc[nt->slots[h]].ioc_name, name) )
+        return nt->slots[h];
+      h = (h + 1) & (nt->size - 1);
+    }
+  return -1;
+}
+
+// marks the IOCs of db that the names and addresses select, or all of
+// them with none
+static int select_iocs( struct alive_db *db, int number, char **names,
+                        char *selected)
+{
+  struct alive_ip_index *index = NULL;
+  struct name_table nt;
+  uint32_t network;
+  int plen, first, count;
+  int i, j;
+
+  nt.slots = NULL;
+  memset( selected, !number, db->number_ioc);
+  for( i = 0; i < number; i++)
+    {
+      if( !alive_parse_cidr( names[i], &network, &plen) )
+        {
+          if( (index == NULL) && ((index = alive_ip_index_create( db)) == NULL) )
+            break;
+          count = alive_ip_index_find_prefix( index, network, plen, &first);
+          for( j = first; j < first + count; j++)
+            selected[index->entries[j].ioc_index] = 1;
+        }
+      else
+        {
+          if( (nt.slots == NULL) && name_table_init( &nt, db) )
+            break;
+          j = name_table_find( &nt, db, names[i]);
+          if( j >= 0)
+            selected[j] = 1;
+        }
+    }
+  alive_ip_index_free( index);
+  free( nt.slots);
+  return i < number;
+}
+
+// The names of the IOCs matching the filter, of those given (names,
+// addresses, or subnets) or all with none or ".", pointing into *db.
+static char **where_names( char *server, int port, struct alive_filter *filter,
+                           int number, char **names, int *number_matched,
+                           struct alive_db **db)
+{
+  char **matched;
+  char *selected;
+  int i;
+
+  *db = alive_get_filtered_db( server, port, filter);
+  if( *db == NULL)
+    return NULL;
+  matched = malloc( ((*db)->number_ioc + 1) * sizeof( char *));
+  selected = malloc( ((*db)->number_ioc + 1) * sizeof( char));
+  if( (number == 1) && !strcmp( names[0], ".") )
+    number = 0;
+  if( (matched == NULL) || (selected == NULL) ||
+      select_iocs( *db, number, names, selected) )
+    {
+      free( matched);
+      free( selected);
+      alive_free_db( *db);
+      return NULL;
+    }
+  *number_matched = 0;
+  for( i = 0; i < (*db)->number_ioc; i++)
+    if( selected[i])
+      matched[(*number_matched)++] = (*db)->ioc[i].ioc_name;
+  free( selected);
+  return matched;
+}
+
+// brings the cache up to date with the daemon
+int refresh_event_cache( struct alive_event_cache *cache, char *server,
+                         int port, int number, char **names, int threads)
+{
+  char address[INET_ADDRSTRLEN];
+  int updated, added;
+
+  added = 0;
+  updated = alive_event_cache_refresh( cache, lookup_server( server, address),
+                                       port, number, names, threads, &added);
+  if( updated < 0)
+    // error written in library
+    return 1;
+  printf("Refreshed %d IOC%s, adding %d event%s.\n", updated,
+         (updated == 1) ? "" : "s", added, (added == 1) ? "" : "s");
+  return 0;
+}
+
+// the debug (or conflict) instances of an IOC, which can be NULL if the
+// IOC isn't known
+void print_detailed( struct alive_detailed_ioc *dioc, char *iocname,
+                     int conflict_flag)
+{
+  struct alive_instance *inst;
+
+  time_t t;
+  struct tm *ct;
+  char timestring[256];
+
+  int i;
+
+  if( dioc == NULL)
+    {
+      printf("No IOC known as \"%s\".\n", iocname);
+      return;
+    }
+
+  if( dioc->number_instances == 0)
+    {
+      if( !conflict_flag)
+        printf("No known IOC instances for \"%s\".\n", iocname);
+      else
+        printf("No known IOC conflict for \"%s\".\n", iocname);
+    }
+      
+  inst = dioc->instances;
+  for( i = 0; i < dioc->number_instances; i++)
+    {
+      if( !conflict_flag)
+        printf("%s Instance #%d\n", dioc->ioc_name, i+1);
+      else
+        printf("%s Conflict #%d\n", dioc->ioc_name, i+1);
+
+      switch( inst->status)
+        {
+        case INSTANCE_STATUS_UP:
+          printf("  Status = UP\n");
           break;
-        case DARWIN:
-          {
-            struct alive_iocinfo_extra_darwin *dwn;
+        case INSTANCE_STATUS_DOWN:
+          printf("  Status = DOWN\n");
+          break;
+        case INSTANCE_STATUS_UNTIMED_DOWN:
+          printf("  Status = UNTIMED_DOWN\n");
+          break;
+        case INSTANCE_STATUS_MAYBE_UP:
+          printf("  Status = MAYBE_UP\n");
+          break;
+        case INSTANCE_STATUS_MAYBE_DOWN:
+          printf("  Status = MAYBE_DOWN\n");
+          break;
+        }
+      printf("  Address and Port = %d.%d.%d.%d:%d\n",
+             inst->ip_address[0], inst->ip_address[1], 
+             inst->ip_address[2], inst->ip_address[3], 
+             inst->origin_port);
+      printf("  Incarnation = %d, Period = %d, Heartbeat = %d\n", 
+             inst->incarnation, inst->period, inst->heartbeat);
+
+      t = (time_t) inst->boottime;
+      ct = localtime( &t);
+      strftime( timestring, 255, "%Y-%m-%d %H:%M:%S", ct);
+      printf("  Boot Time = %s\n", timestring);
+  
+      t = (time_t) inst->timestamp;
+      ct = localtime( &t);
+      strftime( timestring, 255, "%Y-%m-%d %H:%M:%S", ct);
+      printf("  Ping Timestamp = %s\n", timestring);
+  
+      printf("  Reply Port = %d, User Message = %d\n", 
+             inst->reply_port, inst->user_msg);
 
-            dwn = env->extra;
+      print_env( inst->environment, 1);
+      printf("\n");
+              
+      inst++;
+    }
+}
 
-            if(!style)
-              printf("\n");
-            printf("%sDarwin Parameters\n", prefix);
 
-            printf("%s  user = %s\n", prefix, dwn->user);
-            printf("%s  group = %s\n", prefix, dwn->group);
-            printf("%s  hostname = %s\n", prefix, dwn->hostname);
-          }
+void print_subnets( struct alive_db *db, int bits, int number_cidr,
+                    uint32_t *networks, int *prefixes)
+{
+  struct alive_ip_index *index;
+  struct alive_subnet_rollup *r;
+  int number;
+  int i, j;
+
+  index = alive_ip_index_create( db);
+  if( index == NULL)
+    return;
+  number = alive_ip_index_subnets( index, bits, &r);
+  for( i = 0; i < number; i++)
+    {
+      if( number_cidr)
+        {
+          // only subnets that lie inside one of the selectors
+          for( j = 0; j < number_cidr; j++)
+            if( (bits >= prefixes[j]) && (!prefixes[j] ||
+                 ((r[i].network >> (32 - prefixes[j])) ==
+                  (networks[j] >> (32 - prefixes[j])))) )
+              break;
+          if( j == number_cidr)
+            continue;
+        }
+      printf("%d.%d.%d.%d/%d  %d IOC%s - up %d, down %d, conflict %d, "
+             "unknown %d\n", r[i].network >> 24, (r[i].network >> 16) & 0xff,
+             (r[i].network >> 8) & 0xff, r[i].network & 0xff, bits,
+             r[i].total, (r[i].total == 1) ? "" : "s",
+             r[i].status_count[STATUS_UP],
+             r[i].status_count[STATUS_DOWN] +
+             r[i].status_count[STATUS_DOWN_UNKNOWN],
+             r[i].status_count[STATUS_CONFLICT],
+             r[i].status_count[STATUS_UNKNOWN]);
+    }
+  free( r);
+  alive_ip_index_free( index);
+}
+
+
+static void run_hook( char *hook, char *ioc_name, char *change_name,
+                      struct alive_ioc *old_ioc, struct alive_ioc *new_ioc)
+{
+  pid_t pid;
+
+  fflush(stdout);
+  pid = fork();
+  if( pid == 0)
+    {
+      setenv( "ALIVE_IOC", ioc_name, 1);
+      setenv( "ALIVE_CHANGE", change_name, 1);
+      setenv( "ALIVE_OLD_STATUS", 
+              (old_ioc == NULL) ? "" : status_string( old_ioc->status), 1);
+      setenv( "ALIVE_NEW_STATUS", 
+              (new_ioc == NULL) ? "" : status_string( new_ioc->status), 1);
+      execl( "/bin/sh", "sh", "-c", hook, (char *) NULL);
+      _exit(127);
+    }
+  else if( pid > 0)
+    waitpid( pid, NULL, 0);
+}
+
+void print_changes( struct alive_db_diff *diff, time_t now, char *hook)
+{
+  struct alive_ioc_change *change;
+  struct alive_ioc *oi, *ni;
+  char timestring[64];
+  struct tm *ct;
+  char *name;
+  int i, j;
+
+  ct = localtime( &now);
+  strftime( timestring, 63, "%Y-%m-%d %H:%M:%S", ct);
+
+  for( i = 0; i < diff->number; i++)
+    {
+      change = &(diff->changes[i]);
+      oi = change->old_ioc;
+      ni = change->new_ioc;
+      name = (ni != NULL) ? ni->ioc_name : oi->ioc_name;
+
+      if( change->flags & CHANGE_ADDED)
+        {
+          printf("%s %s added (%d.%d.%d.%d) %s\n", timestring, name,
+                 ni->ip_address[0], ni->ip_address[1], ni->ip_address[2],
+                 ni->ip_address[3], status_string( ni->status));
+          if( hook != NULL)
+            run_hook( hook, name, "added", oi, ni);
+          continue;
+        }
+      if( change->flags & CHANGE_REMOVED)
+        {
+          printf("%s %s removed\n", timestring, name);
+          if( hook != NULL)
+            run_hook( hook, name, "removed", oi, ni);
+          continue;
+        }
+
+      if( change->flags & CHANGE_STATUS)
+        {
+          printf("%s %s status %s -> %s\n", timestring, name,
+                 status_string( oi->status), status_string( ni->status));
+          if( hook != NULL)
+            run_hook( hook, name, "status", oi, ni);
+        }
+      else if( change->flags & CHANGE_TIME)
+        {
+          printf("%s %s %s time changed\n", timestring, name,
+                 status_string( ni->status));
+          if( hook != NULL)
+            run_hook( hook, name, "time", oi, ni);
+        }
+      if( change->flags & CHANGE_IP)
+        {
+          printf("%s %s address %d.%d.%d.%d -> %d.%d.%d.%d\n", timestring, 
+                 name, oi->ip_address[0], oi->ip_address[1], 
+                 oi->ip_address[2], oi->ip_address[3], ni->ip_address[0], 
+                 ni->ip_address[1], ni->ip_address[2], ni->ip_address[3]);
+          if( hook != NULL)
+            run_hook( hook, name, "address", oi, ni);
+        }
+      if( change->flags & CHANGE_USER_MSG)
+        {
+          printf("%s %s user message %d -> %d\n", timestring, name, 
+                 oi->user_msg, ni->user_msg);
+          if( hook != NULL)
+            run_hook( hook, name, "user_msg", oi, ni);
+        }
+      if( change->flags & (CHANGE_ENV | CHANGE_OS_PARAMS) )
+        {
+          printf("%s %s environment changed:", timestring, name);
+          for( j = 0; j < change->number_keys; j++)
+            printf(" %s", change->keys[j]);
+          if( change->flags & CHANGE_OS_PARAMS)
+            printf(" (os parameters)");
+          printf("\n");
+          if( hook != NULL)
+            run_hook( hook, name, "environment", oi, ni);
+        }
+    }
+  fflush(stdout);
+}
+
+// Brings the copies of the watched IOCs up to date with the changes,
+// copying only the IOCs that changed.  Returns 1 if out of memory.
+static int apply_changes( struct alive_db *copy, struct alive_db_diff *diff)
+{
+  struct alive_ioc_change *change;
+  struct alive_ioc *ioc;
+  int added;
+  int i, j;
+
+  // the changes point into the copies, so replace before growing
+  added = 0;
+  for( i = 0; i < diff->number; i++)
+    {
+      change = &(diff->changes[i]);
+      if( change->flags & CHANGE_ADDED)
+        {
+          added++;
+          continue;
+        }
+      alive_free_ioc( change->old_ioc);
+      change->old_ioc->ioc_name = NULL;
+      if( !(change->flags & CHANGE_REMOVED) &&
+          alive_copy_ioc( change->old_ioc, change->new_ioc) )
+        return 1;
+    }
+
+  ioc = realloc( copy->ioc, (copy->number_ioc + added + 1) * 
+                 sizeof( struct alive_ioc));
+  if( ioc == NULL)
+    return 1;
+  copy->ioc = ioc;
+  for( i = 0; i < diff->number; i++)
+    if( diff->changes[i].flags & CHANGE_ADDED)
+      {
+        if( alive_copy_ioc( &(copy->ioc[copy->number_ioc]), 
+                            diff->changes[i].new_ioc) )
+          return 1;
+        copy->number_ioc++;
+      }
+
+  // removed ones were left without names
+  for( i = j = 0; i < copy->number_ioc; i++)
+    if( copy->ioc[i].ioc_name != NULL)
+      copy->ioc[j++] = copy->ioc[i];
+  copy->number_ioc = j;
+
+  return 0;
+}
+
+// The poller refreshes the whole database in place, and the IOCs watched
+// are picked out of it after each poll.  The filter is tried every time,
+// as ages change even when nothing else does, and IOCs that come to
+// match or stop matching are added or removed.  Between polls only
+// copies of the watched IOCs are kept, to be diffed against.
+int watch_database( char *server, int port, int number, char **names,
+                    struct alive_filter *filter, int interval, char *hook)
+{
+  struct alive_poller *poller;
+  struct alive_db *db;
+  struct alive_db old_db, new_db;
+  struct alive_db_diff *diff;
+  char *selected = NULL;
+  char *watched = NULL;
+  int size = 0;
+  int changed, same, match;
+  int started = 0;
+  void *p;
+  int i;
+
+  poller = alive_poller_create( server, port);
+  if( poller == NULL)
+    return 1;
+  memset( &old_db, 0, sizeof( struct alive_db));
+  memset( &new_db, 0, sizeof( struct alive_db));
+
+  while( 1)
+    {
+      changed = alive_poller_poll( poller);
+      if( changed < 0)
+        {
+          // error written in library, try again next time
+          sleep( interval);
+          continue;
+        }
+      db = alive_poller_db( poller);
+
+      if( db->number_ioc >= size)
+        {
+          size = db->number_ioc + 1;
+          p = realloc( selected, size * sizeof( char));
+          if( p == NULL)
+            return 1;
+          selected = p;
+          p = realloc( watched, size * sizeof( char));
+          if( p == NULL)
+            return 1;
+          watched = p;
+          p = realloc( new_db.ioc, size * sizeof( struct alive_ioc));
+          if( p == NULL)
+            return 1;
+          new_db.ioc = p;
+        }
+      // names and addresses pick the same IOCs until some change
+      if( (changed || !started) && select_iocs( db, number, names, selected) )
+        return 1;
+      // the IOCs watched, still the poller's
+      new_db.current_time = db->current_time;
+      new_db.start_time = db->start_time;
+      new_db.number_ioc = 0;
+      same = started && !changed;
+      for( i = 0; i < db->number_ioc; i++)
+        {
+          match = selected[i] && 
+            ((filter == NULL) || alive_filter_match( filter, db, &db->ioc[i]));
+          if( same && (match != watched[i]) )
+            same = 0;
+          watched[i] = match;
+          if( match)
+            new_db.ioc[new_db.number_ioc++] = db->ioc[i];
+        }
+      if( same)
+        {
+          sleep( interval);
+          continue;
+        }
+
+      if( !started)
+        {
+          old_db.ioc = malloc( (new_db.number_ioc + 1) * 
+                               sizeof( struct alive_ioc));
+          if( old_db.ioc == NULL)
+            return 1;
+          for( i = 0; i < new_db.number_ioc; i++)
+            {
+              if( alive_copy_ioc( &(old_db.ioc[i]), &(new_db.ioc[i])) )
+                return 1;
+              old_db.number_ioc++;
+            }
+          printf("Watching %d IOC%s.\n", old_db.number_ioc, 
+                 (old_db.number_ioc == 1) ? "" : "s");
+          fflush(stdout);
+          started = 1;
+        }
+      else
+        {
+          diff = alive_db_diff( &old_db, &new_db);
+          if( diff != NULL)
+            {
+              print_changes( diff, new_db.current_time, hook);
+              if( apply_changes( &old_db, diff) )
+                return 1;
+              alive_free_db_diff( diff);
+            }
+        }
+      sleep( interval);
+    }
+
+  return 0;
+}
+
+
+int publish_shm( char *server, int port, char *name, int interval)
+{
+  struct alive_shm *shm = NULL;
+  struct alive_poller *poller;
+  struct alive_db *db;
+  uint32_t size;
+
+  poller = alive_poller_create( server, port);
+  if( poller == NULL)
+    return 1;
+
+  while( 1)
+    {
+      if( alive_poller_poll( poller) >= 0)
+        {
+          db = alive_poller_db( poller);
+          if( shm == NULL)
+            {
+              // readers map a fixed size, so leave room to grow
+              size = 4 * alive_shm_db_size( db);
+              if( size < (1 << 20))
+                size = 1 << 20;
+              shm = alive_shm_create( name, size);
+              if( shm == NULL)
+                return 1;
+            }
+          alive_shm_publish( shm, db);
+        }
+      sleep( interval);
+    }
+
+  return 0;
+}
+
+
+int record_history( char *server, int port, char *dir, int interval)
+{
+  struct alive_history_writer *hw;
+  struct alive_poller *poller;
+
+  hw = alive_history_create( dir);
+  if( hw == NULL)
+    return 1;
+  poller = alive_poller_create( server, port);
+  if( poller == NULL)
+    return 1;
+
+  while( 1)
+    {
+      if( alive_poller_poll( poller) >= 0)
+        alive_history_record( hw, alive_poller_db( poller));
+      sleep( interval);
+    }
+
+  return 0;
+}
+
+static int parse_time( char *str, time_t *t)
+{
+  struct tm tm;
+  char *p;
+  char sep;
+  int n;
+
+  if( !*str)
+    return 1;
+  *t = strtol( str, &p, 10);
+  if( !*p)
+    return 0;
+
+  // local time, with or without the time of day
+  memset( &tm, 0, sizeof(tm));
+  n = sscanf( str, "%d-%d-%d%c%d:%d:%d", &tm.tm_year, &tm.tm_mon, 
+              &tm.tm_mday, &sep, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+  if( (n != 3) && ((n != 7) || ((sep != ' ') && (sep != 'T'))) )
+    return 1;
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  tm.tm_isdst = -1;
+  *t = mktime( &tm);
+  return 0;
+}
+
+void print_history_changes( struct alive_history *hist, time_t t0, 
+                            time_t t1, int number, char **names)
+{
+  struct alive_history_change hc;
+  struct alive_ioc_change change;
+  struct alive_db_diff diff;
+  int i;
+
+  // printed the same way as --watch, one at a time
+  memset( &change, 0, sizeof( change));
+  diff.number = 1;
+  diff.changes = &change;
+
+  alive_history_seek( hist, t0);
+  while( alive_history_next( hist, t1, &hc) )
+    {
+      for( i = 0; i < number; i++)
+        if( !strcmp( names[i], hc.new_ioc.ioc_name) )
           break;
-        case WINDOWS:
-          {
-            struct alive_iocinfo_extra_windows *win;
+      if( number && (i == number) )
+        continue;
+
+      change.flags = hc.flags;
+      change.old_ioc = (hc.flags & CHANGE_ADDED) ? NULL : &hc.old_ioc;
+      change.new_ioc = (hc.flags & CHANGE_REMOVED) ? NULL : &hc.new_ioc;
+      print_changes( &diff, hc.time, NULL);
+    }
+}
+
+
+static int compare_availability( const void *a, const void *b)
+{
+  const struct alive_availability *x = a;
+  const struct alive_availability *y = b;
+  int x_known, y_known;
+
+  // worst first, and ones with nothing to say last
+  x_known = x->valid && (x->up_time + x->down_time);
+  y_known = y->valid && (y->up_time + y->down_time);
+  if( x_known != y_known)
+    return y_known - x_known;
+  if( x->availability != y->availability)
+    return (x->availability < y->availability) ? -1 : 1;
+  if( x->failures != y->failures)
+    return y->failures - x->failures;
+  return strcmp( x->ioc_name, y->ioc_name);
+}
+
+// from the daemon, or the event cache if there is one
+int print_availability( char *server, int port, int number, char **names,
+                        time_t start, time_t end, int threads,
+                        struct alive_event_cache *cache)
+{
+  struct alive_availability_report *report;
+  struct alive_availability *avail;
+  char mtbf[64], mttr[64], down[64];
+  char start_string[64], end_string[64];
+  int i;
+
+  if( cache != NULL)
+    report = alive_cache_availability( cache, number, names, start, end);
+  else
+    report = alive_get_availability( server, port, number, names, start, 
+                                     end, threads);
+  if( report == NULL)
+    // error written in library
+    return 1;
+  qsort( report->iocs, report->number, sizeof( struct alive_availability),
+         compare_availability);
+
+  strftime( start_string, 63, "%Y-%m-%d %H:%M:%S", localtime( &start));
+  strftime( end_string, 63, "%Y-%m-%d %H:%M:%S", localtime( &report->end));
+  printf("Availability from %s to %s\n\n", start_string, end_string);
+  printf("%-24s %8s %8s  %-18s %-18s %s\n", "IOC", "Avail", "Failures",
+         "MTBF", "MTTR", "Down time");
+  for( i = 0; i < report->number; i++)
+    {
+      avail = &(report->iocs[i]);
+      if( !avail->valid)
+        {
+          printf("%-24s %8s\n", avail->ioc_name, "no events");
+          continue;
+        }
+      strcpy( mtbf, "-");
+      strcpy( mttr, "-");
+      if( avail->failures)
+        time_string( (uint32_t) avail->mtbf, mtbf);
+      if( avail->down_time)
+        time_string( (uint32_t) avail->mttr, mttr);
+      time_string( avail->down_time, down);
+      if( avail->up_time + avail->down_time)
+        printf("%-24s %7.3f%% %8d  %-18s %-18s %s\n", avail->ioc_name,
+               100.0 * avail->availability, avail->failures, mtbf, mttr, down);
+      else
+        printf("%-24s %8s %8d\n", avail->ioc_name, "unknown", 
+               avail->failures);
+    }
+
+  alive_free_availability_report( report);
+  return 0;
+}
+
+
+static int parse_sort_key( char *str)
+{
+  static char *keys[] = { "name", "status", "time", "ip", "user_msg" };
+  int i;
+
+  for( i = 0; i < sizeof(keys)/sizeof(keys[0]); i++)
+    if( !strcmp( str, keys[i]) )
+      return SORT_NAME + i;
+  return -1;
+}
+
+// Puts order into the view asked for, returning how many IOCs are left
+// in it.  A key of -1 keeps the order given.  When grouping, groups gets
+// the number of each status, and top applies to each group.
+static int arrange_view( struct alive_db *db, int *order, int number, 
+                         int key, int top, int *groups)
+{
+  int counts[STATUS_CONFLICT+1];
+  int start, kept, n;
+  int i;
+
+  if( groups == NULL)
+    {
+      if( key < 0)
+        return (top && (top < number)) ? top : number;
+      return alive_top_iocs( db, order, number, key, top ? top : number);
+    }
+
+  if( alive_group_iocs_by_status( db, order, number, counts) )
+    return number;
+  start = kept = 0;
+  for( i = 0; i <= STATUS_CONFLICT; i++)
+    {
+      if( key < 0)
+        n = (top && (top < counts[i])) ? top : counts[i];
+      else
+        n = alive_top_iocs( db, order + start, counts[i], key, 
+                            top ? top : counts[i]);
+      memmove( order + kept, order + start, n * sizeof( int));
+      groups[i] = n;
+      kept += n;
+      start += counts[i];
+    }
+  return kept;
+}
+
+// worst first: more than one live instance is an address conflict
+static int health_rank( struct alive_ioc_health *health)
+{
+  return ((health->flags & HEALTH_MULTIPLE_LIVE) ? 8 : 0) +
+    ((health->flags & HEALTH_STALE) ? 4 : 0) +
+    ((health->flags & HEALTH_RESTARTED) ? 2 : 0) +
+    ((health->flags & HEALTH_MAYBE) ? 1 : 0);
+}
 
-            win = env->extra;
+static int compare_health( const void *a, const void *b)
+{
+  struct alive_ioc_health *x = *((struct alive_ioc_health **) a);
+  struct alive_ioc_health *y = *((struct alive_ioc_health **) b);
+
+  if( x->valid != y->valid)
+    return y->valid - x->valid;
+  if( health_rank( x) != health_rank( y))
+    return health_rank( y) - health_rank( x);
+  if( x->lag != y->lag)
+    return (x->lag > y->lag) ? -1 : 1;
+  return strcmp( x->ioc_name, y->ioc_name);
+}
 
-            if(!style)
-              printf("\n");
-            printf("%sWindows Parameters\n", prefix);
+static void print_health_report( struct alive_health_report *report)
+{
+  struct alive_ioc_health **order;
+  struct alive_ioc_health *health;
+  struct alive_instance *inst;
+  char problems[128];
+  char timestring[64];
+  int flagged, missing;
+  int i, j;
 
-            printf("%s  user = %s\n", prefix, win->user);
-            printf("%s  machine = %s\n", prefix, win->machine);
+  // the report itself stays sorted by name for the next scan
+  order = malloc( (report->number + 1) * sizeof( struct alive_ioc_health *));
+  if( order == NULL)
+    return;
+  flagged = missing = 0;
+  for( i = 0; i < report->number; i++)
+    {
+      order[i] = &(report->iocs[i]);
+      if( !order[i]->valid)
+        missing++;
+      else if( order[i]->flags)
+        flagged++;
+    }
+  qsort( order, report->number, sizeof( struct alive_ioc_health *),
+         compare_health);
+
+  strftime( timestring, 63, "%Y-%m-%d %H:%M:%S", 
+            localtime( &report->current_time));
+  printf("Instance health at %s: %d IOC%s, %d with problems", timestring,
+         report->number, (report->number == 1) ? "" : "s", flagged);
+  if( missing)
+    printf(", %d not fetched", missing);
+  printf("\n");
+  if( flagged + missing)
+    printf("\n%-24s %5s %5s %5s %8s  %s\n", "IOC", "Live", "Maybe", "Late",
+           "Lag", "Problems");
+
+  for( i = 0; i < report->number; i++)
+    {
+      health = order[i];
+      if( !health->valid)
+        {
+          printf("%-24s %5s %5s %5s %8s  %s\n", health->ioc_name, "-", "-", 
+                 "-", "-", "not fetched");
+          continue;
+        }
+      if( !health->flags)
+        break;
+
+      problems[0] = '\0';
+      if( health->flags & HEALTH_MULTIPLE_LIVE)
+        strcat( problems, ", multiple live");
+      if( health->flags & HEALTH_STALE)
+        strcat( problems, ", late");
+      if( health->flags & HEALTH_RESTARTED)
+        strcat( problems, ", restarted");
+      if( health->flags & HEALTH_MAYBE)
+        strcat( problems, ", maybe");
+      printf("%-24s %5d %5d %5d %8.1f  %s\n", health->ioc_name, health->live,
+             health->maybe, health->stale, health->lag, problems + 2);
+
+      if( health->flags & HEALTH_MULTIPLE_LIVE)
+        for( j = 0; j < health->detail->number_instances; j++)
+          {
+            inst = &(health->detail->instances[j]);
+            if( (inst->status == INSTANCE_STATUS_UP) || 
+                (inst->status == INSTANCE_STATUS_MAYBE_UP) )
+              printf("    %d.%d.%d.%d:%d\n", inst->ip_address[0], 
+                     inst->ip_address[1], inst->ip_address[2], 
+                     inst->ip_address[3], inst->origin_port);
           }
-          break;
+    }
+
+  free( order);
+}
+
+int print_health( char *server, int port, int number, char **names,
+                  struct alive_filter *filter, double lag, int threads,
+                  int interval)
+{
+  struct alive_health_report *report, *previous = NULL;
+  struct alive_db *where_db;
+  char **matched;
+  int number_matched;
+
+  while( 1)
+    {
+      number_matched = -1;
+      if( filter == NULL)
+        report = alive_get_health( server, port, number, names, lag, 
+                                   threads, previous);
+      else
+        {
+          // the filter picks the IOCs again for each scan
+          report = NULL;
+          matched = where_names( server, port, filter, number, names,
+                                 &number_matched, &where_db);
+          if( matched != NULL)
+            {
+              if( number_matched)
+                report = alive_get_health( server, port, number_matched,
+                                           matched, lag, threads, previous);
+              else
+                printf("No IOCs match.\n");
+              free( matched);
+              alive_free_db( where_db);
+            }
         }
+      if( report != NULL)
+        {
+          if( previous != NULL)
+            printf("\n");
+          print_health_report( report);
+          alive_free_health_report( previous);
+          previous = report;
+        }
+      else if( !interval && number_matched)
+        // error written in library
+        return 1;
+
+      if( !interval)
+        break;
+      fflush(stdout);
+      sleep( interval);
     }
+
+  alive_free_health_report( previous);
+  return 0;
 }
 
 
-void print_events( char *server, int port, char *iocname)
+// For modes making many requests, the server's numeric address, put in
+// address (INET_ADDRSTRLEN long), or the server as given if it is a
+// socket path or can't be looked up.
+char *lookup_server( char *server, char *address)
 {
-  struct alive_ioc_event_db *events;
-  struct alive_ioc_event_item *item;
+  struct addrinfo hints, *servinfo;
 
-  time_t current_time;
-  struct tm *ct;
-  char timestring[256];
+  memset( &hints, 0, sizeof( hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if( (server[0] != '/') && !getaddrinfo( server, NULL, &hints, &servinfo) )
+    {
+      if( inet_ntop( AF_INET,
+                     &((struct sockaddr_in *) servinfo->ai_addr)->sin_addr,
+                     address, INET_ADDRSTRLEN) != NULL)
+        server = address;
+      freeaddrinfo( servinfo);
+    }
+  return server;
+}
+
+// one event on one line, for lists of events of many IOCs
+void print_event_line( char *iocname, struct alive_ioc_event_item *item)
+{
+  time_t t;
+  char timestring[64];
+
+  t = item->time;
+  strftime( timestring, sizeof( timestring), "%Y-%m-%d %H:%M:%S",
+            localtime( &t));
+  printf("%s %-14s %s (%d.%d.%d.%d) %d\n", timestring, 
+         event_string( item->event), iocname, item->ip_address[0], 
+         item->ip_address[1], item->ip_address[2], item->ip_address[3],
+         item->user_msg);
+}
+
+// Prints a name after a space, going to a new line indented by indent
+// when the line would pass 78 columns.  Returns the new column.
+static int print_wrapped( int column, char *name, int indent)
+{
+  if( column + 1 + (int) strlen( name) > 78)
+    column = printf("\n%*s", indent, "") - 1;
+  return column + printf(" %s", name);
+}
 
-  int i;
+// All the events in time order, or with a threshold, just the bursts,
+// from the daemon or the event cache if there is one.
+int print_timeline( char *server, int port, int number, char **names,
+                    time_t start, time_t end, int threads, int threshold,
+                    int window, int prefix_length,
+                    struct alive_event_cache *cache)
+{
+  struct alive_timeline *tl;
+  struct alive_timeline_event event;
+  struct alive_burst *bursts, *b;
+  unsigned char *ip;
+  uint32_t network;
+  char timestring[64];
+  int number_bursts;
+  int column;
+  int i, j;
 
-  char *event_strings[] = 
-    { "None          ", "Fail          ", "Boot          ", 
-      "Recover       ", "Message       ", "Conflict_Start", 
-      "Conflict_Stop "};
-  
-  events = alive_get_ioc_event_db( server, port, iocname);
-  if( (events != NULL) && (events->number) )
+  if( cache != NULL)
+    tl = alive_cache_timeline( cache, number, names);
+  else
+    tl = alive_get_timeline( server, port, number, names, threads);
+  if( tl == NULL)
+    // error written in library
+    return 1;
+
+  if( !threshold)
     {
-      printf("\n%s Events\n", iocname);
+      alive_timeline_seek( tl, start, end);
+      while( alive_timeline_next( tl, &event) )
+        print_event_line( tl->ioc_names[event.ioc], &event.item);
+      alive_free_timeline( tl);
+      return 0;
+    }
 
-      item = events->instances;
-      for( i = 0; i < events->number; i++)
+  number_bursts = alive_timeline_bursts( tl, start, end, window, threshold,
+                                         prefix_length, &bursts);
+  if( number_bursts < 0)
+    {
+      printf("Error: can't find the bursts.\n");
+      alive_free_timeline( tl);
+      return 1;
+    }
+  if( !number_bursts)
+    printf("No bursts found.\n");
+  for( i = 0; i < number_bursts; i++)
+    {
+      b = &bursts[i];
+      strftime( timestring, sizeof( timestring), "%Y-%m-%d %H:%M:%S",
+                localtime( &b->start));
+      printf("%s%s %s burst over %d sec: %d event%s from %d IOC%s\n",
+             i ? "\n" : "", timestring, event_string( b->event), 
+             (int) (b->end - b->start), b->number, 
+             (b->number == 1) ? "" : "s", b->number_iocs,
+             (b->number_iocs == 1) ? "" : "s");
+      for( j = 0; j < b->number_subnets; j++)
         {
-          current_time = (time_t) item->time;
-          ct = localtime( &current_time);
-          strftime( timestring, 255, "%Y-%m-%d %H:%M:%S", ct);
-          
-          printf("  %s [%d] %s (%d.%d.%d.%d) - ", 
-                 event_strings[item->event], item->user_msg,
-                 timestring, item->ip_address[0], item->ip_address[1],
-                 item->ip_address[2], item->ip_address[3] );
-
-          time_string( events->current_time - item->time, timestring);
-          printf("%s ago\n", timestring);
-
-          item++;
+          network = htonl( b->subnets[j].network);
+          ip = (unsigned char *) &network;
+          printf("  %d.%d.%d.%d/%d: %d IOC%s\n", ip[0], ip[1], ip[2], ip[3],
+                 b->subnets[j].prefix_length, b->subnets[j].number,
+                 (b->subnets[j].number == 1) ? "" : "s");
         }
+      column = printf("  IOCs:");
+      for( j = 0; j < b->number_iocs; j++)
+        column = print_wrapped( column, tl->ioc_names[b->iocs[j]], 7);
+      printf("\n");
     }
-  alive_free_ioc_event_db( events);
+
+  alive_free_bursts( bursts, number_bursts);
+  alive_free_timeline( tl);
+  return 0;
 }
 
 
-void print_parameter( struct alive_env *env, char *os, char *par)
+static void print_drift_value( struct alive_drift_key *key,
+                               struct alive_drift_value *value)
 {
-  if( env == NULL)
-    return;
+  if( value->value != NULL)
+    printf("%s", value->value);
+  else if( (key->param != NULL) && (key->param->type == PARAM_UINT32) )
+    printf("%d", value->number_value);
+  else
+    printf("(unset)");
+}
 
-  //  printf("(%s) (%s)\n", os, par);
+// For each key with more than one value, the majority value and the
+// outliers with their IOCs.  A variable name or OS parameter limits it to
+// that key.
+int print_drift( struct alive_db *db, int *order, int number, char *name,
+                 const struct alive_os_param *param)
+{
+  struct alive_drift *drift;
+  struct alive_drift_key *key;
+  struct alive_drift_value *value;
+  int number_drifting;
+  int shared, column, printed;
+  int i, j, k;
+
+  drift = alive_db_drift( db, order, number);
+  if( drift == NULL)
+    return 1;
 
-  if( !strcasecmp( os, "vxworks") )
+  printed = 0;
+  number_drifting = 0;
+  for( k = 0; k < drift->number_keys; k++)
+    if( drift->keys[k].number_values > 1)
+      number_drifting++;
+  if( (name == NULL) && (param == NULL) )
     {
-      struct alive_iocinfo_extra_vxworks *vw;
-
-      if( env->extra_type != VXWORKS)
-        return;
-          
-      vw = env->extra;
+      printf("Drift over %d IOC%s with environments: %d key%s, %d with "
+             "more than one value\n", drift->number_iocs, 
+             (drift->number_iocs == 1) ? "" : "s", drift->number_keys,
+             (drift->number_keys == 1) ? "" : "s", number_drifting);
+      printed = 1;
+    }
 
-      if( !strcasecmp( "boot_device", par) )
-        printf("%s\n", vw->bootdev);
-      else if( !strcasecmp( "unit_number", par) )
-        printf("%d\n", vw->unitnum);
-      else if( !strcasecmp( "processor_number", par) )
-        printf("%d\n", vw->procnum);
-      else if( !strcasecmp( "boot_host_name", par) )
-        printf("%s\n", vw->boothost_name);
-      else if( !strcasecmp( "boot_file", par) )
-        printf("%s\n", vw->bootfile);
-      else if( !strcasecmp( "address", par) )
-        {
-          if( vw->address != NULL)
-            printf("%s\n", vw->address);
-        }
-      else if( !strcasecmp( "backplane_address", par) )
-        {
-          if( vw->backplane_address != NULL)
-            printf("%s\n", vw->backplane_address );
-        }
-      else if( !strcasecmp( "boot_host_address", par) )
-        {
-          if( vw->boothost_address != NULL)
-            printf("%s\n", vw->boothost_address);
-        }
-      else if( !strcasecmp( "gateway_address", par) )
-        {
-          if( vw->gateway_address != NULL)
-            printf("%s\n", vw->gateway_address);
-        }
-      else if( !strcasecmp( "flags", par) )
-        printf("%d\n", vw->flags );
-      else if( !strcasecmp( "target_name", par) )
-        {
-          if( vw->target_name != NULL)
-            printf("%s\n", vw->target_name);
-        }
-      else if( !strcasecmp( "startup_script", par) )
+  for( k = 0; k < drift->number_keys; k++)
+    {
+      key = &(drift->keys[k]);
+      if( (name != NULL) && 
+          ((key->name == NULL) || strcmp( key->name, name)) )
+        continue;
+      if( (param != NULL) && (key->param != param) )
+        continue;
+      if( (name == NULL) && (param == NULL) && (key->number_values < 2) )
+        continue;
+
+      if( printed++)
+        printf("\n");
+      if( key->name != NULL)
+        printf("%s", key->name);
+      else
+        printf("%s:%s", key->schema->name, key->param->name);
+      printf(": %d value%s over %d IOC%s", key->number_values,
+             (key->number_values == 1) ? "" : "s", key->number_iocs,
+             (key->number_iocs == 1) ? "" : "s");
+
+      // like TOP, where each IOC has its own
+      shared = 0;
+      for( i = 0; i < key->number_values; i++)
+        if( (key->values[i].number > 1) && 
+            ((key->values[i].value != NULL) || 
+             ((key->param != NULL) && (key->param->type == PARAM_UINT32))) )
+          shared = 1;
+      if( !shared && (key->number_values > 1) )
         {
-          if( vw->startup_script != NULL)
-            printf("%s\n", vw->startup_script);
+          printf(", none shared\n");
+          continue;
         }
-      else if( !strcasecmp( "other", par) )
+      printf("\n");
+
+      for( i = 0; i < key->number_values; i++)
         {
-          if( vw->other != NULL)
-            printf("%s\n", vw->other);
+          value = &(key->values[i]);
+          printf("  %5d  ", value->number);
+          print_drift_value( key, value);
+          printf("\n");
+          // the majority needs no list
+          if( !i)
+            continue;
+          column = printf("        ");
+          for( j = 0; j < value->number; j++)
+            column = print_wrapped( column, db->ioc[value->iocs[j]].ioc_name,
+                                    8);
+          printf("\n");
         }
     }
-  else if( !strcasecmp( os, "linux") )
-    {
-      struct alive_iocinfo_extra_linux *lnx;
-      
-      if( env->extra_type != LINUX)
-        return;
-      
-      lnx = env->extra;
 
-      if( !strcasecmp( "user", par) )
-        printf("%s\n", lnx->user);
-      else if( !strcasecmp( "group", par) )
-        printf("%s\n", lnx->group);
-      else if( !strcasecmp( "hostname", par) )
-        printf("%s\n", lnx->hostname);
-    }
-  else if( !strcasecmp( os, "darwin") )
-    {
-      struct alive_iocinfo_extra_darwin *dwn;
-      
-      if( env->extra_type != DARWIN)
-        return;
-      
-      dwn = env->extra;
+  alive_free_drift( drift);
+  return 0;
+}
 
-      if( !strcasecmp( "user", par) )
-        printf("%s\n", dwn->user);
-      else if( !strcasecmp( "group", par) )
-        printf("%s\n", dwn->group);
-      else if( !strcasecmp( "hostname", par) )
-        printf("%s\n", dwn->hostname);
-    }
-  else if( !strcasecmp( os, "windows") )
-    {
-      struct alive_iocinfo_extra_windows *win;
-      
-      if( env->extra_type != WINDOWS)
-        return;
-      
-      win = env->extra;
 
-      if( !strcasecmp( "user", par) )
-        printf("%s\n", win->user);
-      else if( !strcasecmp( "machine", par) )
-        printf("%s\n", win->machine);
-    }
+static char *trace_file = NULL;
+
+static void write_trace( void)
+{
+  alive_trace_stop();
+  alive_trace_write( trace_file);
 }
 
 
@@ -342,20 +1471,231 @@ int main(int argc, char *argv[])
 
   int verbosity_flag = 0;
 
-  int i, j;
+  int i, j, k;
   char *p;
 
   int vartype = 0;
   char *varval = NULL;
-
-  char timestring_prefix[32], timestring[256];
+  const struct alive_os_param *os_param = NULL;
+  int os_type = -1;
+
+  int subnet_bits = -1;
+  int number_cidr = 0;
+  uint32_t *networks = NULL;
+  int *prefixes = NULL;
+  int all_flag;
+
+  int *order;
+  int number_order;
+  int sort_key = -1;
+  int reverse_flag = 0;
+  int top = 0;
+  int group_flag = 0;
+  int groups[STATUS_CONFLICT+1];
+  int group, group_left;
+
+  int watch_interval = 0;
+  char *hook = NULL;
+  int interval = 10;
+  int metrics_port = 0;
+  char *shm_name = NULL;
+  char *record_dir = NULL;
+  char *batch_file = NULL;
+  char *history_dir = NULL;
+  struct alive_history *hist = NULL;
+  time_t history_at, history_since, history_until;
+  int since_flag = 0;
+  int availability_flag = 0;
+  int health_flag = 0;
+  double lag = 3.0;
+  int timeline_flag = 0;
+  int burst_threshold = 0;
+  int window = 10;
+  int drift_flag = 0;
+  int follow_flag = 0;
+  char *event_cache_dir = NULL;
+  char *where = NULL;
+  struct alive_filter *filter = NULL;
+  struct alive_event_cache *cache = NULL;
+  int threads = 16;
 
   int opt;
 
-  while((opt = getopt( argc, argv, "r:e:p:hldcsv")) != -1)
+  struct option long_options[] = 
+    {
+      {"watch", required_argument, NULL, OPT_WATCH},
+      {"hook", required_argument, NULL, OPT_HOOK},
+      {"interval", required_argument, NULL, OPT_INTERVAL},
+      {"serve-metrics", required_argument, NULL, OPT_SERVE_METRICS},
+      {"publish-shm", required_argument, NULL, OPT_PUBLISH_SHM},
+      {"record-history", required_argument, NULL, OPT_RECORD_HISTORY},
+      {"history", required_argument, NULL, OPT_HISTORY},
+      {"at", required_argument, NULL, OPT_AT},
+      {"since", required_argument, NULL, OPT_SINCE},
+      {"until", required_argument, NULL, OPT_UNTIL},
+      {"availability", no_argument, NULL, OPT_AVAILABILITY},
+      {"threads", required_argument, NULL, OPT_THREADS},
+      {"trace", required_argument, NULL, OPT_TRACE},
+      {"sort", required_argument, NULL, OPT_SORT},
+      {"reverse", no_argument, NULL, OPT_REVERSE},
+      {"top", required_argument, NULL, OPT_TOP},
+      {"group-by", required_argument, NULL, OPT_GROUP_BY},
+      {"health", no_argument, NULL, OPT_HEALTH},
+      {"lag", required_argument, NULL, OPT_LAG},
+      {"batch", required_argument, NULL, OPT_BATCH},
+      {"timeline", no_argument, NULL, OPT_TIMELINE},
+      {"bursts", required_argument, NULL, OPT_BURSTS},
+      {"window", required_argument, NULL, OPT_WINDOW},
+      {"drift", no_argument, NULL, OPT_DRIFT},
+      {"follow", no_argument, NULL, OPT_FOLLOW},
+      {"event-cache", required_argument, NULL, OPT_EVENT_CACHE},
+      {"where", required_argument, NULL, OPT_WHERE},
+      {NULL, 0, NULL, 0}
+    };
+
+  history_at = history_until = time(NULL);
+  while((opt = getopt_long( argc, argv, "r:e:p:n:hldcsv", long_options, 
+                            NULL)) != -1)
     {
       switch(opt)
         {
+        case OPT_WATCH:
+          watch_interval = atoi( optarg);
+          if( watch_interval <= 0)
+            {
+              printf("Error: watch interval must be positive.\n");
+              return -1;
+            }
+          break;
+        case OPT_HOOK:
+          hook = strdup( optarg);
+          break;
+        case OPT_INTERVAL:
+          interval = atoi( optarg);
+          if( interval <= 0)
+            {
+              printf("Error: interval must be positive.\n");
+              return -1;
+            }
+          break;
+        case OPT_PUBLISH_SHM:
+          shm_name = strdup( optarg);
+          break;
+        case OPT_RECORD_HISTORY:
+          record_dir = strdup( optarg);
+          break;
+        case OPT_HISTORY:
+          history_dir = strdup( optarg);
+          break;
+        case OPT_AT:
+        case OPT_SINCE:
+        case OPT_UNTIL:
+          if( parse_time( optarg, (opt == OPT_AT) ? &history_at :
+                          ((opt == OPT_SINCE) ? &history_since : 
+                           &history_until)) )
+            {
+              printf("Error: can't understand time \"%s\".\n", optarg);
+              return -1;
+            }
+          if( opt == OPT_SINCE)
+            since_flag = 1;
+          break;
+        case OPT_AVAILABILITY:
+          availability_flag = 1;
+          break;
+        case OPT_THREADS:
+          threads = atoi( optarg);
+          if( threads <= 0)
+            {
+              printf("Error: number of threads must be positive.\n");
+              return -1;
+            }
+          break;
+        case OPT_SORT:
+          sort_key = parse_sort_key( optarg);
+          if( sort_key < 0)
+            {
+              printf("Error: can't sort by \"%s\".\n", optarg);
+              return -1;
+            }
+          break;
+        case OPT_REVERSE:
+          reverse_flag = 1;
+          break;
+        case OPT_TOP:
+          top = atoi( optarg);
+          if( top <= 0)
+            {
+              printf("Error: top must be positive.\n");
+              return -1;
+            }
+          break;
+        case OPT_GROUP_BY:
+          if( strcmp( optarg, "status") )
+            {
+              printf("Error: can only group by status.\n");
+              return -1;
+            }
+          group_flag = 1;
+          break;
+        case OPT_HEALTH:
+          health_flag = 1;
+          break;
+        case OPT_LAG:
+          lag = atof( optarg);
+          if( lag <= 0)
+            {
+              printf("Error: lag must be positive.\n");
+              return -1;
+            }
+          break;
+        case OPT_BATCH:
+          batch_file = strdup( optarg);
+          break;
+        case OPT_TIMELINE:
+          timeline_flag = 1;
+          break;
+        case OPT_BURSTS:
+          timeline_flag = 1;
+          burst_threshold = atoi( optarg);
+          if( burst_threshold <= 0)
+            {
+              printf("Error: burst threshold must be positive.\n");
+              return -1;
+            }
+          break;
+        case OPT_WINDOW:
+          window = atoi( optarg);
+          if( window <= 0)
+            {
+              printf("Error: window must be positive.\n");
+              return -1;
+            }
+          break;
+        case OPT_DRIFT:
+          drift_flag = 1;
+          break;
+        case OPT_FOLLOW:
+          follow_flag = 1;
+          break;
+        case OPT_EVENT_CACHE:
+          event_cache_dir = strdup( optarg);
+          break;
+        case OPT_WHERE:
+          where = strdup( optarg);
+          break;
+        case OPT_TRACE:
+          trace_file = strdup( optarg);
+          break;
+        case OPT_SERVE_METRICS:
+          metrics_port = atoi( optarg);
+          if( (metrics_port <= 0) || (metrics_port > 65535) )
+            {
+              printf("Error: invalid metrics port.\n");
+              return -1;
+            }
+          break;
+
         case 'l':
           mode_flag = 1;
           break;
@@ -382,6 +1722,21 @@ int main(int argc, char *argv[])
         case 'p':
           vartype = 2;
           varval = strdup( optarg);
+          // looked up once here, not for every IOC
+          p = strchr( varval, ':');
+          if( p != NULL)
+            {
+              *p = '\0';
+              os_type = alive_find_os_param( varval, p + 1, &os_param);
+            }
+          break;
+        case 'n':
+          subnet_bits = atoi( optarg);
+          if( (subnet_bits < 0) || (subnet_bits > 32) )
+            {
+              printf("Error: subnet prefix length must be 0 to 32.\n");
+              return -1;
+            }
           break;
         case 'v':
           printf("alivedb %s\n", alive_client_api_version() );
@@ -395,6 +1750,12 @@ int main(int argc, char *argv[])
         }
     }
 
+  if( trace_file != NULL)
+    {
+      alive_trace_start( 0);
+      atexit( write_trace);
+    }
+
   if( cl_server != NULL)
     {
       server = cl_server;
@@ -412,110 +1773,205 @@ int main(int argc, char *argv[])
       port = alive_default_database_port();
     }
   
+  if( batch_file != NULL)
+    return run_batch( server, port, batch_file, threads);
+
+  if( where != NULL)
+    {
+      filter = alive_filter_compile( where);
+      if( filter == NULL)
+        // error written in library
+        return 1;
+      // following keeps the IOCs it started with
+      if( mode_flag)
+        {
+          printf("Error: --where can't be used with -l, -d, or -c.\n");
+          return 1;
+        }
+    }
+
+  // The modes that take names once get those of the IOCs that match
+  // instead.  Health scans and watching try the filter each time, and
+  // listings filter the database itself, keeping the other selectors.
+  if( (filter != NULL) && (history_dir == NULL) &&
+      (availability_flag || timeline_flag || 
+       ((event_cache_dir != NULL) && !mode_flag)) )
+    {
+      struct alive_db *where_db;
+      char **matched;
+      int number_matched;
+
+      matched = where_names( server, port, filter, argc - optind,
+                             &(argv[optind]), &number_matched, &where_db);
+      if( matched == NULL)
+        return 1;
+      if( !number_matched)
+        {
+          printf("No IOCs match.\n");
+          return 0;
+        }
+      argv = matched;
+      argc = number_matched;
+      optind = 0;
+    }
+
+  if( event_cache_dir != NULL)
+    {
+      cache = alive_event_cache_open( event_cache_dir);
+      if( cache == NULL)
+        // error written in library
+        return 1;
+    }
+
+  if( (mode_flag == 1) && follow_flag)
+    {
+      if( (argc - optind) == 0)
+        {
+          helper();
+          return 1;
+        }
+      if( ((argc - optind) == 1) && !strcmp( argv[optind], ".") )
+        return follow_events( server, port, 0, NULL, interval, threads);
+      return follow_events( server, port, argc - optind, &(argv[optind]),
+                            interval, threads);
+    }
+
   if( mode_flag)
     {
       struct alive_detailed_ioc *dioc;
-      struct alive_instance *inst;
 
-      time_t t;
-      struct tm *ct;
-      
       if((argc - optind) != 1)
         {
           helper();
           return 1;
         }
 
-      switch(mode_flag)
+      if( (mode_flag == 1) && (cache != NULL) )
+        print_cached_events( cache, argv[optind]);
+      else if( mode_flag == 1)
+        print_events( server, port, argv[optind]);
+      else
         {
-        case 1:
-          print_events( server, port, argv[optind]);
-          return 0;
-          break;
-        case 2:
-        case 3:
           if( mode_flag == 2)
             dioc = alive_get_debug( server, port, argv[optind]);
           else
             dioc = alive_get_conflicts( server, port, argv[optind]);
+          print_detailed( dioc, argv[optind], mode_flag == 3);
+          if( dioc != NULL)
+            alive_free_detailed( dioc);
+        }
+      return 0;
+    }
 
-          if( dioc == NULL)
-            {
-              printf("No IOC known as \"%s\".\n", argv[optind]);
-              return 0;
-            }
+  if( metrics_port)
+    return serve_metrics( server, port, metrics_port, interval);
+  if( shm_name != NULL)
+    return publish_shm( server, port, shm_name, interval);
+  if( record_dir != NULL)
+    return record_history( server, port, record_dir, interval);
 
-          if( dioc->number_instances == 0)
-            {
-              if( mode_flag == 2)
-                printf("No known IOC instances for \"%s\".\n", argv[optind]);
-              else
-                printf("No known IOC conflict for \"%s\".\n", argv[optind]);
-            }
-      
-          inst = dioc->instances;
-          for( i = 0; i < dioc->number_instances; i++)
-            {
-              if( mode_flag == 2)
-                printf("%s Instance #%d\n", dioc->ioc_name, i+1);
-              else
-                printf("%s Conflict #%d\n", dioc->ioc_name, i+1);
+  if( ((argc - optind) == 0) && (filter == NULL) )
+    {
+      helper();
+      return 0;
+    }
 
-              switch( inst->status)
-                {
-                case INSTANCE_STATUS_UP:
-                  printf("  Status = UP\n");
-                  break;
-                case INSTANCE_STATUS_DOWN:
-                  printf("  Status = DOWN\n");
-                  break;
-                case INSTANCE_STATUS_UNTIMED_DOWN:
-                  printf("  Status = UNTIMED_DOWN\n");
-                  break;
-                case INSTANCE_STATUS_MAYBE_UP:
-                  printf("  Status = MAYBE_UP\n");
-                  break;
-                case INSTANCE_STATUS_MAYBE_DOWN:
-                  printf("  Status = MAYBE_DOWN\n");
-                  break;
-                }
-              printf("  Address and Port = %d.%d.%d.%d:%d\n",
-                     inst->ip_address[0], inst->ip_address[1], 
-                     inst->ip_address[2], inst->ip_address[3], 
-                     inst->origin_port);
-              printf("  Incarnation = %d, Period = %d, Heartbeat = %d\n", 
-                     inst->incarnation, inst->period, inst->heartbeat);
-
-              t = (time_t) inst->boottime;
-              ct = localtime( &t);
-              strftime( timestring, 255, "%Y-%m-%d %H:%M:%S", ct);
-              printf("  Boot Time = %s\n", timestring);
-  
-              t = (time_t) inst->timestamp;
-              ct = localtime( &t);
-              strftime( timestring, 255, "%Y-%m-%d %H:%M:%S", ct);
-              printf("  Ping Timestamp = %s\n", timestring);
-  
-              printf("  Reply Port = %d, User Message = %d\n", 
-                     inst->reply_port, inst->user_msg);
+  if( availability_flag)
+    {
+      if( !since_flag)
+        history_since = history_until - 30*24*60*60;
+      if( ((argc - optind) == 1) && !strcmp( argv[optind], ".") )
+        return print_availability( server, port, 0, NULL, history_since,
+                                   history_until, threads, cache);
+      return print_availability( server, port, argc - optind, 
+                                 &(argv[optind]), history_since, 
+                                 history_until, threads, cache);
+    }
 
-              print_env( inst->environment, 1);
-              printf("\n");
-              
-              inst++;
-            }
+  if( timeline_flag)
+    {
+      if( !since_flag)
+        history_since = history_until - 24*60*60;
+      if( ((argc - optind) == 1) && !strcmp( argv[optind], ".") )
+        return print_timeline( server, port, 0, NULL, history_since,
+                               history_until, threads, burst_threshold,
+                               window, subnet_bits, cache);
+      return print_timeline( server, port, argc - optind, &(argv[optind]), 
+                             history_since, history_until, threads, 
+                             burst_threshold, window, subnet_bits, cache);
+    }
+
+  if( cache != NULL)
+    {
+      if( ((argc - optind) == 1) && !strcmp( argv[optind], ".") )
+        return refresh_event_cache( cache, server, port, 0, NULL, threads);
+      return refresh_event_cache( cache, server, port, argc - optind,
+                                  &(argv[optind]), threads);
+    }
+
+  if( health_flag)
+    {
+      if( ((argc - optind) == 1) && !strcmp( argv[optind], ".") )
+        return print_health( server, port, 0, NULL, filter, lag, threads, 
+                             watch_interval);
+      return print_health( server, port, argc - optind, &(argv[optind]),
+                           filter, lag, threads, watch_interval);
+    }
+
+  if( history_dir != NULL)
+    {
+      hist = alive_history_open( history_dir);
+      if( hist == NULL)
+        return 1;
+      if( since_flag)
+        {
+          if( ((argc - optind) == 1) && !strcmp( argv[optind], ".") )
+            print_history_changes( hist, history_since, history_until, 
+                                   0, NULL);
+          else
+            print_history_changes( hist, history_since, history_until, 
+                                   argc - optind, &(argv[optind]));
+          alive_history_close( hist);
           return 0;
-          break;
         }
     }
 
+  if( watch_interval)
+    {
+      if( ((argc - optind) == 1) && !strcmp( argv[optind], ".") )
+        return watch_database( server, port, 0, NULL, filter, 
+                               watch_interval, hook);
+      return watch_database( server, port, argc - optind, &(argv[optind]),
+                             filter, watch_interval, hook);
+    }
+
+  // IP address and subnet selectors need the whole database
+  all_flag = 0;
+  networks = malloc( (argc - optind) * sizeof( uint32_t));
+  prefixes = malloc( (argc - optind) * sizeof( int));
   if( (argc - optind) == 0)
+    all_flag = 1;
+  for( i = optind; i < argc; i++)
     {
-      helper();
-      return 0;
+      if( !strcmp( argv[i], ".") )
+        all_flag = 1;
+      else if( !alive_parse_cidr( argv[i], &networks[number_cidr], 
+                                  &prefixes[number_cidr]) )
+        number_cidr++;
+    }
+
+  if( hist != NULL)
+    {
+      // names are picked out below, like addresses
+      db = alive_history_db_at( hist, history_at);
+      alive_history_close( hist);
     }
-  else if( ((argc - optind) == 1) && !strcmp( argv[optind], ".") )
-    db = alive_get_db( server, port);
+  else if( filter != NULL)
+    // only the IOCs that match are decoded
+    db = alive_get_filtered_db( server, port, filter);
+  else if( all_flag || number_cidr || (subnet_bits >= 0) )
+    // the whole database can be large, so it is decoded by threads
+    db = alive_get_iocs_parallel( server, port, 0, NULL, threads);
   else if( (argc - optind) > 1)
     db = alive_get_iocs( server, port, argc - optind, &(argv[optind]) );
   else  // (argc - optind) == 1
@@ -524,47 +1980,119 @@ int main(int argc, char *argv[])
     // error written in library
     return 1;
 
-  for( i = 0; i < db->number_ioc; i++)
+  if( subnet_bits >= 0)
+    {
+      print_subnets( db, subnet_bits, all_flag ? 0 : number_cidr, 
+                     networks, prefixes);
+      alive_free_db( db);
+      return 0;
+    }
+
+  order = malloc( (db->number_ioc ? db->number_ioc : 1) * sizeof( int));
+  number_order = 0;
+  if( all_flag || (!number_cidr && (hist == NULL) && (filter == NULL)) )
+    {
+      for( i = 0; i < db->number_ioc; i++)
+        order[number_order++] = i;
+    }
+  else
+    {
+      struct alive_ip_index *index;
+      struct name_table nt;
+      char *selected;
+      uint32_t network;
+      int plen, first, count;
+
+      index = alive_ip_index_create( db);
+      selected = calloc( db->number_ioc + 1, sizeof( char));
+      if( (index == NULL) || (selected == NULL) || name_table_init( &nt, db) )
+        return 1;
+      // IOCs listed in selector order, each only once
+      for( i = optind; i < argc; i++)
+        {
+          if( !alive_parse_cidr( argv[i], &network, &plen) )
+            {
+              count = alive_ip_index_find_prefix( index, network, plen, 
+                                                  &first);
+              for( j = first; j < first + count; j++)
+                if( !selected[index->entries[j].ioc_index])
+                  {
+                    selected[index->entries[j].ioc_index] = 1;
+                    order[number_order++] = index->entries[j].ioc_index;
+                  }
+            }
+          else
+            {
+              j = name_table_find( &nt, db, argv[i]);
+              if( (j >= 0) && !selected[j])
+                {
+                  selected[j] = 1;
+                  order[number_order++] = j;
+                }
+            }
+        }
+      free( nt.slots);
+      free( selected);
+      alive_ip_index_free( index);
+    }
+
+  if( (filter != NULL) && (hist != NULL) )
+    number_order = alive_filter_iocs( filter, db, order, number_order);
+
+  if( drift_flag)
+    {
+      if( (vartype == 2) && (os_param == NULL) )
+        {
+          printf("Error: unknown parameter.\n");
+          return 1;
+        }
+      print_drift( db, order, number_order, (vartype == 1) ? varval : NULL,
+                   (vartype == 2) ? os_param : NULL);
+      free( order);
+      alive_free_db( db);
+      return 0;
+    }
+
+  if( reverse_flag && (sort_key < 0) )
+    sort_key = SORT_NAME;
+  if( reverse_flag)
+    sort_key |= SORT_REVERSE;
+  number_order = arrange_view( db, order, number_order, sort_key, top,
+                               group_flag ? groups : NULL);
+
+  group = -1;
+  group_left = 0;
+  for( k = 0; k < number_order; k++)
     {
+      i = order[k];
       ioc = &db->ioc[i];
 
       if( vartype == 0)
         {
-          switch( ioc->status)
+          if( group_flag)
             {
-            case STATUS_UNKNOWN:
-              strcpy( timestring_prefix, "Uncertain");
-              timestring[0] = '\0';
-              break;
-            case STATUS_DOWN_UNKNOWN:
-              strcpy( timestring_prefix, "Down time: > ");
-              time_string( db->current_time - db->start_time, timestring);
-              break;
-            case STATUS_DOWN:
-              strcpy( timestring_prefix, "Down time: ");
-              time_string( db->current_time - ioc->time_value, timestring);
-              break;
-            case STATUS_UP:
-              strcpy( timestring_prefix, "Up time: ");
-              time_string( db->current_time - ioc->time_value, timestring);
-              break;
-            case STATUS_CONFLICT:
-              strcpy( timestring_prefix, "Conflict time: ~ ");
-              time_string( db->current_time - ioc->time_value, timestring);
-              break;
+              if( !group_left)
+                {
+                  do
+                    group_left = groups[++group];
+                  while( !group_left);
+                  // full listings already end with a blank line
+                  printf("%s%s: %d IOC%s\n\n", 
+                         (k && verbosity_flag) ? "\n" : "",
+                         status_string( group), group_left,
+                         (group_left == 1) ? "" : "s");
+                }
+              group_left--;
             }
 
-          printf("%s (%d.%d.%d.%d) %d - %s%s\n",
-                 ioc->ioc_name, ioc->ip_address[0], ioc->ip_address[1], 
-                 ioc->ip_address[2], ioc->ip_address[3], ioc->user_msg,
-                 timestring_prefix, timestring );
+          print_ioc_line( db, ioc);
 
           if( verbosity_flag)
             continue;
 
           print_env( ioc->environment, 0);
           
-          if( i < (db->number_ioc - 1) )
+          if( k < (number_order - 1) )
             printf("\n\n");
         }
       else
@@ -583,21 +2111,13 @@ int main(int argc, char *argv[])
                       }
                 }
             }
-          else
-            {
-              char *os, *par;
-
-              os = strdup(varval);
-              par = strchr( os, ':');
-              if( par != NULL)
-                {
-                  *par = '\0';
-                  par++;
-                  print_parameter( ioc->environment, os, par);
-                }
-            }
+          else if( (os_type >= 0) && (ioc->environment != NULL) &&
+                   (ioc->environment->extra_type == os_type) &&
+                   (ioc->environment->extra != NULL) )
+            print_os_param( ioc->environment, os_param, NULL);
         }        
     }
+  free( order);
   alive_free_db( db);
   
   return 0;
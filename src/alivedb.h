@@ -0,0 +1,42 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Shared between the alivedb source files, not part of the library API.
+
+#ifndef ALIVEDB_H
+#define ALIVEDB_H 1
+
+#include <stdint.h>
+
+#include "alive_client.h"
+
+char *status_string( uint8_t status);
+void time_string( uint32_t timeval, char *buffer);
+void print_ioc_line( struct alive_db *db, struct alive_ioc *ioc);
+void print_env( struct alive_env *env, int style);
+void print_os_param( struct alive_env *env, const struct alive_os_param *param,
+                     char *prefix);
+void print_event_db( struct alive_ioc_event_db *events, char *iocname);
+void print_detailed( struct alive_detailed_ioc *dioc, char *iocname,
+                     int conflict_flag);
+void print_event_line( char *iocname, struct alive_ioc_event_item *item);
+char *lookup_server( char *server, char *address);
+
+// alivedb_metrics.c
+int serve_metrics( char *server, int port, int listen_port, int interval);
+
+// alivedb_batch.c
+int run_batch( char *server, int port, char *filename, int concurrency);
+
+// alivedb_follow.c
+int follow_events( char *server, int port, int number, char **names,
+                   int interval, int concurrency);
+
+#endif
@@ -0,0 +1,543 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Answers many queries from one process.  All the queries are read
+// first, so the IOCs they need from the database can be fetched with one
+// request, and each event, debug, or conflict fetch is made only once no
+// matter how many queries want it.  Those all run at the same time, and
+// the answers are printed in query order as soon as they are in.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <poll.h>
+#include <arpa/inet.h>
+
+#include "alive_client.h"
+#include "alivedb.h"
+
+
+// past this many IOCs, the whole database is cheaper to get
+#define BATCH_ALL_IOCS (256)
+
+enum batch_kinds { BATCH_FULL, BATCH_STATUS, BATCH_ENV, BATCH_PARAM,
+                   BATCH_EVENTS, BATCH_DEBUG, BATCH_CONFLICTS, BATCH_BAD };
+
+struct batch_query
+{
+  char *line;  // the strings point into this
+  int kind;
+  char *ioc;
+  char *arg;   // variable name, or the line if it is bad
+  int os_type;
+  const struct alive_os_param *param;
+  int fetch;   // the fetch that answers it, or -1
+};
+
+struct batch_fetch
+{
+  int type;
+  char *ioc;
+  struct alive_request *req;
+  int done;
+  void *data;  // decoded response, NULL if it failed
+};
+
+struct batch
+{
+  struct batch_query *queries;
+  int number_queries;
+  struct batch_fetch *fetches;
+  int number_fetches;
+
+  // IOCs asked for from the database, always fetch 0 when there are any
+  char **names;
+  int number_names;
+  struct alive_ioc **sorted;  // database IOCs by name
+};
+
+
+static int compare_ioc_name( const void *a, const void *b)
+{
+  return strcmp( (*((struct alive_ioc **) a))->ioc_name,
+                 (*((struct alive_ioc **) b))->ioc_name);
+}
+
+static struct alive_ioc *find_ioc( struct batch *batch, char *name)
+{
+  struct alive_db *db = batch->fetches[0].data;
+  struct alive_ioc key, *kp, **found;
+
+  key.ioc_name = name;
+  kp = &key;
+  found = bsearch( &kp, batch->sorted, db->number_ioc,
+                   sizeof( struct alive_ioc *), compare_ioc_name);
+  return (found != NULL) ? *found : NULL;
+}
+
+static int add_fetch( struct batch *batch, int type, char *ioc)
+{
+  struct batch_fetch *f;
+  int i;
+
+  for( i = 0; i < batch->number_fetches; i++)
+    if( (batch->fetches[i].type == type) &&
+        ((ioc == NULL) || !strcmp( batch->fetches[i].ioc, ioc)) )
+      return i;
+
+  // there's at most one fetch per query, so this has room
+  f = &(batch->fetches[batch->number_fetches]);
+  memset( f, 0, sizeof( struct batch_fetch));
+  f->type = type;
+  f->ioc = ioc;
+  return batch->number_fetches++;
+}
+
+// Of form "[-s | -e (var) | -p (os:param) | -l | -d | -c] (ioc)", like
+// the command line.  Returns 1 for a blank line or comment.
+static int parse_query( char *line, struct batch_query *q)
+{
+  char *words[3];
+  char *p, *save;
+  int number;
+
+  memset( q, 0, sizeof( struct batch_query));
+  q->fetch = -1;
+  q->os_type = -1;
+
+  number = 0;
+  for( p = strtok_r( line, " \t\r\n", &save); p != NULL;
+       p = strtok_r( NULL, " \t\r\n", &save) )
+    {
+      if( number == 0 && (*p == '#') )
+        break;
+      if( number == 3)
+        goto Bad;
+      words[number++] = p;
+    }
+  if( number == 0)
+    return 1;
+
+  q->ioc = words[number - 1];
+  if( number == 1)
+    q->kind = (words[0][0] == '-') ? BATCH_BAD : BATCH_FULL;
+  else if( number == 2)
+    {
+      if( !strcmp( words[0], "-s") )
+        q->kind = BATCH_STATUS;
+      else if( !strcmp( words[0], "-l") )
+        q->kind = BATCH_EVENTS;
+      else if( !strcmp( words[0], "-d") )
+        q->kind = BATCH_DEBUG;
+      else if( !strcmp( words[0], "-c") )
+        q->kind = BATCH_CONFLICTS;
+      else
+        goto Bad;
+    }
+  else if( !strcmp( words[0], "-e") )
+    {
+      q->kind = BATCH_ENV;
+      q->arg = words[1];
+    }
+  else if( !strcmp( words[0], "-p") )
+    {
+      q->kind = BATCH_PARAM;
+      p = strchr( words[1], ':');
+      if( p != NULL)
+        {
+          *p = '\0';
+          q->os_type = alive_find_os_param( words[1], p + 1, &q->param);
+          *p = ':';
+        }
+    }
+  else
+    goto Bad;
+  if( q->kind != BATCH_BAD)
+    return 0;
+
+ Bad:
+  q->kind = BATCH_BAD;
+  return 0;
+}
+
+static int read_queries( char *filename, struct batch *batch)
+{
+  FILE *fp;
+  char *line = NULL;
+  size_t line_size = 0;
+  struct batch_query *q;
+  char *copy;
+  int size;
+
+  if( !strcmp( filename, "-") )
+    fp = stdin;
+  else if( (fp = fopen( filename, "r")) == NULL)
+    {
+      printf("Error: can't open batch file \"%s\".\n", filename);
+      return 1;
+    }
+
+  size = 0;
+  while( getline( &line, &line_size, fp) >= 0)
+    {
+      if( batch->number_queries == size)
+        {
+          size = size ? 2 * size : 64;
+          q = realloc( batch->queries, size * sizeof( struct batch_query));
+          if( q == NULL)
+            break;
+          batch->queries = q;
+        }
+      line[ strcspn( line, "\r\n")] = '\0';
+      copy = strdup( line);
+      if( copy == NULL)
+        break;
+      q = &(batch->queries[batch->number_queries]);
+      if( parse_query( copy, q) )
+        {
+          free( copy);
+          continue;
+        }
+      // the words were split apart, so a bad line is kept whole
+      if( q->kind == BATCH_BAD)
+        {
+          strcpy( copy, line);
+          q->arg = copy;
+          q->ioc = NULL;
+        }
+      q->line = copy;
+      batch->number_queries++;
+    }
+  free( line);
+  if( fp != stdin)
+    fclose( fp);
+  return 0;
+}
+
+// the database IOCs asked for, each once, and the other fetches
+static int plan_fetches( struct batch *batch)
+{
+  struct batch_query *q;
+  int need_db;
+  int i, j;
+
+  batch->fetches = calloc( batch->number_queries + 1,
+                           sizeof( struct batch_fetch));
+  batch->names = calloc( batch->number_queries + 1, sizeof( char *));
+  if( (batch->fetches == NULL) || (batch->names == NULL) )
+    return 1;
+
+  need_db = 0;
+  for( i = 0; i < batch->number_queries; i++)
+    {
+      q = &(batch->queries[i]);
+      if( (q->kind == BATCH_FULL) || (q->kind == BATCH_STATUS) ||
+          (q->kind == BATCH_ENV) || (q->kind == BATCH_PARAM) )
+        {
+          need_db = 1;
+          q->fetch = 0;
+          for( j = 0; j < batch->number_names; j++)
+            if( !strcmp( batch->names[j], q->ioc) )
+              break;
+          if( j == batch->number_names)
+            batch->names[batch->number_names++] = q->ioc;
+        }
+    }
+  if( need_db)
+    add_fetch( batch, (batch->number_names > BATCH_ALL_IOCS) ?
+               REQUEST_ALL_IOCS : REQUEST_SOME_IOCS, NULL);
+
+  for( i = 0; i < batch->number_queries; i++)
+    {
+      q = &(batch->queries[i]);
+      switch( q->kind)
+        {
+        case BATCH_EVENTS:
+          q->fetch = add_fetch( batch, REQUEST_EVENTS, q->ioc);
+          break;
+        case BATCH_DEBUG:
+          q->fetch = add_fetch( batch, REQUEST_DEBUG, q->ioc);
+          break;
+        case BATCH_CONFLICTS:
+          q->fetch = add_fetch( batch, REQUEST_CONFLICTS, q->ioc);
+          break;
+        }
+    }
+  return 0;
+}
+
+static void start_fetch( struct batch *batch, char *server, int port,
+                         struct batch_fetch *f)
+{
+  if( f->type == REQUEST_SOME_IOCS)
+    f->req = alive_request_start( server, port, f->type,
+                                  batch->number_names, batch->names);
+  else
+    f->req = alive_request_start( server, port, f->type, 1, &f->ioc);
+  if( f->req == NULL)
+    f->done = 1;
+}
+
+static void finish_fetch( struct batch *batch, struct batch_fetch *f)
+{
+  struct alive_db *db;
+  char *data;
+  int length;
+  int i;
+
+  data = alive_request_response( f->req, &length);
+  if( data != NULL)
+    switch( f->type)
+      {
+      case REQUEST_ALL_IOCS:
+      case REQUEST_SOME_IOCS:
+        db = alive_decode_db( data, length);
+        if( db == NULL)
+          break;
+        batch->sorted = malloc( (db->number_ioc + 1) *
+                                sizeof( struct alive_ioc *));
+        if( batch->sorted == NULL)
+          {
+            alive_free_db( db);
+            break;
+          }
+        for( i = 0; i < db->number_ioc; i++)
+          batch->sorted[i] = &(db->ioc[i]);
+        qsort( batch->sorted, db->number_ioc, sizeof( struct alive_ioc *),
+               compare_ioc_name);
+        f->data = db;
+        break;
+      case REQUEST_EVENTS:
+        f->data = alive_decode_ioc_event_db( data, length);
+        break;
+      default:
+        f->data = alive_decode_detailed( data, length);
+        break;
+      }
+  alive_request_free( f->req);
+  f->req = NULL;
+  f->done = 1;
+}
+
+// Lookups of one value always print one line, empty if there is no
+// answer, so the output lines up with the queries.
+static void answer_query( struct batch *batch, struct batch_query *q)
+{
+  struct alive_ioc *ioc;
+  struct alive_env *env;
+  char *field;
+  int i;
+
+  ioc = NULL;
+  env = NULL;
+  if( q->fetch == 0)
+    {
+      ioc = find_ioc( batch, q->ioc);
+      env = (ioc != NULL) ? ioc->environment : NULL;
+    }
+
+  switch( q->kind)
+    {
+    case BATCH_FULL:
+      if( ioc == NULL)
+        printf("No IOC known as \"%s\".\n", q->ioc);
+      else
+        {
+          print_ioc_line( batch->fetches[0].data, ioc);
+          print_env( env, 0);
+          printf("\n");
+        }
+      break;
+    case BATCH_STATUS:
+      if( ioc == NULL)
+        printf("\n");
+      else
+        print_ioc_line( batch->fetches[0].data, ioc);
+      break;
+    case BATCH_ENV:
+      if( env != NULL)
+        for( i = 0; i < env->number_envvar; i++)
+          if( !strcmp( q->arg, env->envvar_key[i]) )
+            {
+              printf("%s\n", env->envvar_value[i]);
+              return;
+            }
+      printf("\n");
+      break;
+    case BATCH_PARAM:
+      if( (q->os_type >= 0) && (env != NULL) &&
+          (env->extra_type == q->os_type) && (env->extra != NULL) )
+        {
+          field = (char *) env->extra + q->param->offset;
+          if( (q->param->type != PARAM_STRING) ||
+              (*((char **) field) != NULL) )
+            {
+              print_os_param( env, q->param, NULL);
+              return;
+            }
+        }
+      printf("\n");
+      break;
+    case BATCH_EVENTS:
+      print_event_db( batch->fetches[q->fetch].data, q->ioc);
+      break;
+    case BATCH_DEBUG:
+    case BATCH_CONFLICTS:
+      print_detailed( batch->fetches[q->fetch].data, q->ioc,
+                      q->kind == BATCH_CONFLICTS);
+      break;
+    default:
+      printf("Bad query: %s\n", q->arg);
+      break;
+    }
+}
+
+static void free_batch( struct batch *batch)
+{
+  struct batch_fetch *f;
+  int i;
+
+  for( i = 0; i < batch->number_fetches; i++)
+    {
+      f = &(batch->fetches[i]);
+      if( f->req != NULL)
+        alive_request_free( f->req);
+      if( f->data == NULL)
+        continue;
+      switch( f->type)
+        {
+        case REQUEST_ALL_IOCS:
+        case REQUEST_SOME_IOCS:
+          alive_free_db( f->data);
+          break;
+        case REQUEST_EVENTS:
+          alive_free_ioc_event_db( f->data);
+          break;
+        default:
+          alive_free_detailed( f->data);
+          break;
+        }
+    }
+  for( i = 0; i < batch->number_queries; i++)
+    free( batch->queries[i].line);
+  free( batch->queries);
+  free( batch->fetches);
+  free( batch->names);
+  free( batch->sorted);
+}
+
+int run_batch( char *server, int port, char *filename, int concurrency)
+{
+  struct batch batch;
+  struct batch_fetch *f;
+  struct pollfd *fds;
+  int *polled;
+  int number_fds;
+  int next, started, in_flight;
+  char address[INET_ADDRSTRLEN];
+  int ret;
+  int i;
+
+  memset( &batch, 0, sizeof( struct batch));
+  if( read_queries( filename, &batch) || plan_fetches( &batch) )
+    {
+      free_batch( &batch);
+      return 1;
+    }
+
+  // the name is looked up once, not for each fetch
+  if( batch.number_fetches)
+    server = lookup_server( server, address);
+
+  if( concurrency < 1)
+    concurrency = 1;
+  fds = malloc( concurrency * sizeof( struct pollfd));
+  polled = malloc( concurrency * sizeof( int));
+  if( (fds == NULL) || (polled == NULL) )
+    {
+      free( fds);
+      free( polled);
+      free_batch( &batch);
+      return 1;
+    }
+
+  ret = 0;
+  next = started = in_flight = 0;
+  while( next < batch.number_queries)
+    {
+      while( (started < batch.number_fetches) && (in_flight < concurrency) )
+        {
+          f = &(batch.fetches[started++]);
+          start_fetch( &batch, server, port, f);
+          if( f->req != NULL)
+            in_flight++;
+        }
+
+      // answers go out in order, as soon as each one is in
+      for( ; next < batch.number_queries; next++)
+        {
+          i = batch.queries[next].fetch;
+          if( (i >= 0) && !batch.fetches[i].done)
+            break;
+          // only the queries needing the database go without
+          if( (i == 0) && (batch.fetches[0].data == NULL) )
+            {
+              printf("Error: couldn't get %s from the database.\n",
+                     batch.queries[next].ioc);
+              ret = 1;
+              continue;
+            }
+          answer_query( &batch, &batch.queries[next]);
+        }
+      fflush( stdout);
+      if( next == batch.number_queries)
+        break;
+
+      number_fds = 0;
+      for( i = 0; i < batch.number_fetches; i++)
+        if( batch.fetches[i].req != NULL)
+          {
+            fds[number_fds].fd = alive_request_fd( batch.fetches[i].req);
+            fds[number_fds].events =
+              alive_request_poll_events( batch.fetches[i].req);
+            polled[number_fds++] = i;
+          }
+      if( poll( fds, number_fds, -1) < 0)
+        continue;
+
+      for( i = 0; i < number_fds; i++)
+        {
+          if( !fds[i].revents)
+            continue;
+          f = &(batch.fetches[polled[i]]);
+          switch( alive_request_process( f->req) )
+            {
+            case 0:
+              continue;
+            case 1:
+              finish_fetch( &batch, f);
+              break;
+            default:
+              alive_request_free( f->req);
+              f->req = NULL;
+              f->done = 1;
+              break;
+            }
+          in_flight--;
+        }
+    }
+
+  free( fds);
+  free( polled);
+  free_batch( &batch);
+  return ret;
+}
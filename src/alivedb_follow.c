@@ -0,0 +1,246 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Follows the event lists of IOCs like tail -f.  Each round fetches all
+// of them at once, and each IOC's follower decodes only the events past
+// the last one it saw, so a long history costs only its transfer.  The
+// new events of a round are printed together in time order.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+
+#include "alive_client.h"
+#include "alivedb.h"
+
+
+// events of each IOC printed when starting
+#define FOLLOW_BACKLOG (10)
+
+struct follow_ioc
+{
+  char *name;
+  struct alive_event_follower *follower;
+  struct alive_request *req;
+  int failed;
+};
+
+struct follow_event
+{
+  int ioc;
+  int sequence;  // keeps each IOC's own order for equal times
+  struct alive_ioc_event_item item;
+};
+
+struct follow
+{
+  struct follow_ioc *iocs;
+  int number;
+
+  // the new events of a round, kept from round to round
+  struct follow_event *events;
+  int number_events;
+  int size_events;
+};
+
+
+static int compare_event( const void *a, const void *b)
+{
+  const struct follow_event *x = a;
+  const struct follow_event *y = b;
+
+  if( x->item.time != y->item.time)
+    return (x->item.time > y->item.time) - (x->item.time < y->item.time);
+  if( x->ioc != y->ioc)
+    return x->ioc - y->ioc;
+  return x->sequence - y->sequence;
+}
+
+static void finish_request( struct follow *fl, int i)
+{
+  struct follow_ioc *f = &(fl->iocs[i]);
+  struct alive_ioc_event_item *items;
+  struct follow_event *e;
+  char *data;
+  int length;
+  int number;
+  int j, n;
+
+  data = alive_request_response( f->req, &length);
+  number = alive_event_follower_update( f->follower, data, length, &items);
+  alive_request_free( f->req);
+  f->req = NULL;
+  if( number < 0)
+    {
+      if( !f->failed)
+        printf("Error: couldn't get the events of %s.\n", f->name);
+      f->failed = 1;
+      return;
+    }
+  f->failed = 0;
+
+  if( fl->number_events + number > fl->size_events)
+    {
+      n = fl->size_events ? fl->size_events : 64;
+      while( n < fl->number_events + number)
+        n *= 2;
+      e = realloc( fl->events, n * sizeof( struct follow_event));
+      if( e == NULL)
+        return;
+      fl->events = e;
+      fl->size_events = n;
+    }
+  for( j = 0; j < number; j++)
+    {
+      e = &(fl->events[fl->number_events++]);
+      e->ioc = i;
+      e->sequence = j;
+      e->item = items[j];
+    }
+}
+
+// one round of fetching every IOC, with at most concurrency at once
+static void poll_round( struct follow *fl, char *server, int port,
+                        int concurrency, struct pollfd *fds, int *polled)
+{
+  struct follow_ioc *f;
+  int number_fds;
+  int started, in_flight, done;
+  int i;
+
+  started = in_flight = done = 0;
+  while( done < fl->number)
+    {
+      while( (started < fl->number) && (in_flight < concurrency) )
+        {
+          f = &(fl->iocs[started++]);
+          f->req = alive_request_start( server, port, REQUEST_EVENTS, 1,
+                                        &f->name);
+          if( f->req != NULL)
+            in_flight++;
+          else
+            {
+              if( !f->failed)
+                printf("Error: couldn't get the events of %s.\n", f->name);
+              f->failed = 1;
+              done++;
+            }
+        }
+      if( !in_flight)
+        continue;
+
+      number_fds = 0;
+      for( i = 0; i < fl->number; i++)
+        if( fl->iocs[i].req != NULL)
+          {
+            fds[number_fds].fd = alive_request_fd( fl->iocs[i].req);
+            fds[number_fds].events =
+              alive_request_poll_events( fl->iocs[i].req);
+            polled[number_fds++] = i;
+          }
+      if( poll( fds, number_fds, -1) < 0)
+        continue;
+
+      for( i = 0; i < number_fds; i++)
+        {
+          if( !fds[i].revents)
+            continue;
+          f = &(fl->iocs[polled[i]]);
+          switch( alive_request_process( f->req) )
+            {
+            case 0:
+              continue;
+            case 1:
+              finish_request( fl, polled[i]);
+              break;
+            default:
+              alive_request_free( f->req);
+              f->req = NULL;
+              if( !f->failed)
+                printf("Error: couldn't get the events of %s.\n", f->name);
+              f->failed = 1;
+              break;
+            }
+          in_flight--;
+          done++;
+        }
+    }
+}
+
+int follow_events( char *server, int port, int number, char **names,
+                   int interval, int concurrency)
+{
+  struct follow fl;
+  struct alive_db *db;
+  struct pollfd *fds;
+  int *polled;
+  char address[INET_ADDRSTRLEN];
+  int i;
+
+  server = lookup_server( server, address);
+
+  // all of the IOCs in the database when starting
+  db = NULL;
+  if( !number)
+    {
+      db = alive_get_db( server, port);
+      if( db == NULL)
+        // error written in library
+        return 1;
+      number = db->number_ioc;
+    }
+
+  memset( &fl, 0, sizeof( struct follow));
+  fl.number = number;
+  fl.iocs = calloc( number ? number : 1, sizeof( struct follow_ioc));
+  if( concurrency > number)
+    concurrency = number;
+  if( concurrency < 1)
+    concurrency = 1;
+  fds = malloc( concurrency * sizeof( struct pollfd));
+  polled = malloc( concurrency * sizeof( int));
+  if( (fl.iocs == NULL) || (fds == NULL) || (polled == NULL) )
+    {
+      printf("Error: out of memory.\n");
+      return 1;
+    }
+  for( i = 0; i < number; i++)
+    {
+      fl.iocs[i].name = (db != NULL) ? db->ioc[i].ioc_name : names[i];
+      fl.iocs[i].follower = alive_event_follower_create( FOLLOW_BACKLOG);
+      if( fl.iocs[i].follower == NULL)
+        {
+          printf("Error: out of memory.\n");
+          return 1;
+        }
+    }
+
+  // runs until killed
+  while( 1)
+    {
+      fl.number_events = 0;
+      poll_round( &fl, server, port, concurrency, fds, polled);
+      if( fl.number_events)
+        qsort( fl.events, fl.number_events, sizeof( struct follow_event),
+               compare_event);
+      for( i = 0; i < fl.number_events; i++)
+        print_event_line( fl.iocs[fl.events[i].ioc].name,
+                          &(fl.events[i].item));
+      fflush( stdout);
+      sleep( interval);
+    }
+
+  return 0;
+}
@@ -0,0 +1,347 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// Prometheus-style metrics served over HTTP from a cached snapshot.  The
+// daemon is polled on a fixed interval no matter how many scrapers there
+// are, and the text is rendered once per poll, so a scrape is one write.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "alive_client.h"
+#include "alivedb.h"
+
+
+struct text_buffer
+{
+  char *text;
+  int length;
+  int size;
+};
+
+static void text_append( struct text_buffer *tb, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+  char *p;
+
+  while( 1)
+    {
+      va_start( ap, fmt);
+      n = vsnprintf( tb->text + tb->length, tb->size - tb->length, fmt, ap);
+      va_end( ap);
+      if( n < tb->size - tb->length)
+        break;
+      p = realloc( tb->text, 2 * tb->size + n);
+      if( p == NULL)
+        return;
+      tb->text = p;
+      tb->size = 2 * tb->size + n;
+    }
+  tb->length += n;
+}
+
+// label values may not contain unescaped backslashes, quotes, or newlines
+static void append_label( struct text_buffer *tb, char *value)
+{
+  for( ; *value; value++)
+    {
+      if( (*value == '\\') || (*value == '"') )
+        text_append( tb, "\\%c", *value);
+      else if( *value == '\n')
+        text_append( tb, "\\n");
+      else
+        text_append( tb, "%c", *value);
+    }
+}
+
+static void append_ioc_labels( struct text_buffer *tb, struct alive_ioc *ioc)
+{
+  text_append( tb, "{ioc=\"");
+  append_label( tb, ioc->ioc_name);
+  text_append( tb, "\",ip=\"%d.%d.%d.%d\"}", ioc->ip_address[0],
+               ioc->ip_address[1], ioc->ip_address[2], ioc->ip_address[3]);
+}
+
+
+struct metrics_state
+{
+  struct alive_poller *poller;
+  struct alive_db *db;  // latest good snapshot, owned by the poller
+  double fetch_seconds;
+  unsigned long fetch_count;
+  unsigned long fetch_errors;
+  time_t last_success;
+
+  struct text_buffer page;
+};
+
+static double monotonic_seconds( void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void render_metrics( struct metrics_state *ms)
+{
+  struct text_buffer *tb;
+  struct alive_db *db;
+  struct alive_ioc *ioc;
+  int counts[STATUS_CONFLICT+1];
+  int i;
+
+  tb = &ms->page;
+  tb->length = 0;
+  tb->text[0] = '\0';
+
+  text_append( tb, "# HELP alive_client_fetch_duration_seconds Time taken by the last database fetch.\n"
+               "# TYPE alive_client_fetch_duration_seconds gauge\n"
+               "alive_client_fetch_duration_seconds %.6f\n", ms->fetch_seconds);
+  text_append( tb, "# HELP alive_client_fetches_total Database fetches attempted.\n"
+               "# TYPE alive_client_fetches_total counter\n"
+               "alive_client_fetches_total %lu\n", ms->fetch_count);
+  text_append( tb, "# HELP alive_client_fetch_errors_total Database fetches that failed.\n"
+               "# TYPE alive_client_fetch_errors_total counter\n"
+               "alive_client_fetch_errors_total %lu\n", ms->fetch_errors);
+
+  db = ms->db;
+  if( db == NULL)
+    return;
+
+  text_append( tb, "# HELP alive_client_last_success_timestamp_seconds Local time of the last good fetch.\n"
+               "# TYPE alive_client_last_success_timestamp_seconds gauge\n"
+               "alive_client_last_success_timestamp_seconds %ld\n",
+               (long) ms->last_success);
+  text_append( tb, "# HELP alive_daemon_start_time_seconds Start time of the alive daemon.\n"
+               "# TYPE alive_daemon_start_time_seconds gauge\n"
+               "alive_daemon_start_time_seconds %ld\n", (long) db->start_time);
+  text_append( tb, "# HELP alive_daemon_current_time_seconds Time reported by the alive daemon.\n"
+               "# TYPE alive_daemon_current_time_seconds gauge\n"
+               "alive_daemon_current_time_seconds %ld\n",
+               (long) db->current_time);
+
+  memset( counts, 0, sizeof( counts));
+  text_append( tb, "# HELP alive_ioc_status IOC status (0 unknown, 1 down with unknown time, 2 down, 3 up, 4 conflict).\n"
+               "# TYPE alive_ioc_status gauge\n");
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      ioc = &(db->ioc[i]);
+      if( ioc->status <= STATUS_CONFLICT)
+        counts[ioc->status]++;
+      text_append( tb, "alive_ioc_status");
+      append_ioc_labels( tb, ioc);
+      text_append( tb, " %d\n", ioc->status);
+    }
+
+  text_append( tb, "# HELP alive_ioc_uptime_seconds Time an up IOC has been up.\n"
+               "# TYPE alive_ioc_uptime_seconds gauge\n");
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      ioc = &(db->ioc[i]);
+      if( ioc->status != STATUS_UP)
+        continue;
+      text_append( tb, "alive_ioc_uptime_seconds");
+      append_ioc_labels( tb, ioc);
+      text_append( tb, " %u\n", alive_ioc_status_time( db, ioc));
+    }
+
+  text_append( tb, "# HELP alive_ioc_downtime_seconds Time a down IOC has been down (a lower bound if the time is unknown).\n"
+               "# TYPE alive_ioc_downtime_seconds gauge\n");
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      ioc = &(db->ioc[i]);
+      if( (ioc->status != STATUS_DOWN) &&
+          (ioc->status != STATUS_DOWN_UNKNOWN) )
+        continue;
+      text_append( tb, "alive_ioc_downtime_seconds");
+      append_ioc_labels( tb, ioc);
+      text_append( tb, " %u\n", alive_ioc_status_time( db, ioc));
+    }
+
+  text_append( tb, "# HELP alive_ioc_user_message User message value sent by the IOC.\n"
+               "# TYPE alive_ioc_user_message gauge\n");
+  for( i = 0; i < db->number_ioc; i++)
+    {
+      ioc = &(db->ioc[i]);
+      text_append( tb, "alive_ioc_user_message");
+      append_ioc_labels( tb, ioc);
+      text_append( tb, " %u\n", ioc->user_msg);
+    }
+
+  text_append( tb, "# HELP alive_iocs Number of IOCs in each status.\n"
+               "# TYPE alive_iocs gauge\n");
+  for( i = 0; i <= STATUS_CONFLICT; i++)
+    text_append( tb, "alive_iocs{status=\"%s\"} %d\n", status_string( i),
+                 counts[i]);
+}
+
+static void poll_daemon( struct metrics_state *ms)
+{
+  double start;
+  int ret;
+
+  start = monotonic_seconds();
+  ret = alive_poller_poll( ms->poller);
+  ms->fetch_seconds = monotonic_seconds() - start;
+  ms->fetch_count++;
+
+  if( ret < 0)
+    // the poller keeps the last good snapshot
+    ms->fetch_errors++;
+  else
+    {
+      ms->db = alive_poller_db( ms->poller);
+      ms->last_success = time(NULL);
+    }
+
+  render_metrics( ms);
+}
+
+static void serve_client( int fd, struct metrics_state *ms)
+{
+  char request[1024];
+  char header[256];
+  struct timeval tv;
+  int n, len;
+  char *body;
+
+  // don't let a slow client hold up the others
+  tv.tv_sec = 2;
+  tv.tv_usec = 0;
+  setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  n = read( fd, request, sizeof(request) - 1);
+  if( n <= 0)
+    return;
+  request[n] = '\0';
+
+  if( strncmp( request, "GET ", 4) )
+    {
+      body = "Method not allowed\n";
+      len = snprintf( header, sizeof(header),
+                      "HTTP/1.0 405 Method Not Allowed\r\n"
+                      "Content-Type: text/plain\r\n"
+                      "Content-Length: %d\r\nConnection: close\r\n\r\n",
+                      (int) strlen(body));
+      write( fd, header, len);
+      write( fd, body, strlen(body));
+      return;
+    }
+  // the path must end after "/metrics", save for a query
+  if( !(!strncmp( request + 4, "/metrics", 8) &&
+        ((request[12] == ' ') || (request[12] == '?')) ) &&
+      strncmp( request + 4, "/ ", 2))
+    {
+      body = "Not found\n";
+      len = snprintf( header, sizeof(header),
+                      "HTTP/1.0 404 Not Found\r\n"
+                      "Content-Type: text/plain\r\n"
+                      "Content-Length: %d\r\nConnection: close\r\n\r\n",
+                      (int) strlen(body));
+      write( fd, header, len);
+      write( fd, body, strlen(body));
+      return;
+    }
+
+  len = snprintf( header, sizeof(header),
+                  "HTTP/1.0 200 OK\r\n"
+                  "Content-Type: text/plain; version=0.0.4\r\n"
+                  "Content-Length: %d\r\nConnection: close\r\n\r\n",
+                  ms->page.length);
+  write( fd, header, len);
+  write( fd, ms->page.text, ms->page.length);
+}
+
+
+int serve_metrics( char *server, int port, int listen_port, int interval)
+{
+  struct metrics_state ms;
+  struct sockaddr_in addr;
+  struct timeval tv;
+  fd_set fds;
+  double next_poll, now;
+  int lfd, cfd;
+  int on = 1;
+
+  signal( SIGPIPE, SIG_IGN);
+
+  lfd = socket( AF_INET, SOCK_STREAM, 0);
+  if( lfd == -1)
+    {
+      printf( "Can't open socket!\n");
+      return 1;
+    }
+  setsockopt( lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  memset( &addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(listen_port);
+  if( bind( lfd, (struct sockaddr *) &addr, sizeof(addr)) ||
+      listen( lfd, 64) )
+    {
+      printf( "Can't listen on port %d!\n", listen_port);
+      close( lfd);
+      return 1;
+    }
+
+  memset( &ms, 0, sizeof(ms));
+  ms.page.size = 4096;
+  ms.page.text = malloc( ms.page.size);
+  if( ms.page.text == NULL)
+    return 1;
+  ms.poller = alive_poller_create( server, port);
+  if( ms.poller == NULL)
+    return 1;
+
+  next_poll = monotonic_seconds();
+  while( 1)
+    {
+      now = monotonic_seconds();
+      if( now >= next_poll)
+        {
+          poll_daemon( &ms);
+          next_poll += interval;
+          now = monotonic_seconds();
+          // don't try to catch up after a slow fetch
+          if( next_poll < now)
+            next_poll = now + interval;
+        }
+
+      FD_ZERO( &fds);
+      FD_SET( lfd, &fds);
+      tv.tv_sec = (long) (next_poll - now);
+      tv.tv_usec = (long) ((next_poll - now - tv.tv_sec) * 1e6);
+      if( select( lfd + 1, &fds, NULL, NULL, &tv) <= 0)
+        continue;
+
+      cfd = accept( lfd, NULL, NULL);
+      if( cfd == -1)
+        continue;
+      serve_client( cfd, &ms);
+      close( cfd);
+    }
+
+  return 0;
+}
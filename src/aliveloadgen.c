@@ -0,0 +1,590 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// alive-loadgen: load generator for benchmarking an alive daemon (or
+// alive-proxy).  It sends a weighted mix of request types with many
+// requests in flight from one thread, using the library's non-blocking
+// requests, and reports throughput and latency percentiles for each
+// type.
+//
+// Closed loop keeps the given number of requests in flight, starting a
+// new one as each finishes.  Open loop starts requests at a fixed rate
+// no matter how the daemon keeps up, with latency measured from when a
+// request was due rather than when it could be sent, so a slow daemon
+// isn't flattered (up to the concurrency limit, requests wait their
+// turn).
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "alive_client.h"
+
+
+// Latency histogram in microseconds, HDR style: exact below 128, then
+// 64 buckets for each power of two, so within about 1.6% everywhere.
+#define HIST_SUB_BUCKETS (64)
+#define HIST_SIZE ((40 + 1) * HIST_SUB_BUCKETS)
+
+struct histogram
+{
+  uint64_t counts[HIST_SIZE];
+  uint64_t total;
+  uint64_t max;
+  double sum;
+};
+
+static int histogram_index( uint64_t v)
+{
+  int msb, shift, index;
+
+  if( v < 2 * HIST_SUB_BUCKETS)
+    return v;
+  msb = 63 - __builtin_clzll( v);
+  shift = msb - 6;
+  index = (shift + 1) * HIST_SUB_BUCKETS + (int) (v >> shift) -
+    HIST_SUB_BUCKETS;
+  return (index < HIST_SIZE) ? index : HIST_SIZE - 1;
+}
+
+// highest value that lands in the bucket
+static uint64_t histogram_value( int index)
+{
+  int shift;
+
+  if( index < 2 * HIST_SUB_BUCKETS)
+    return index;
+  shift = index / HIST_SUB_BUCKETS - 1;
+  return (((uint64_t) (index % HIST_SUB_BUCKETS + HIST_SUB_BUCKETS + 1))
+          << shift) - 1;
+}
+
+static void histogram_add( struct histogram *h, uint64_t v)
+{
+  h->counts[histogram_index( v)]++;
+  h->total++;
+  h->sum += v;
+  if( v > h->max)
+    h->max = v;
+}
+
+static uint64_t histogram_percentile( struct histogram *h, double percent)
+{
+  uint64_t target, seen;
+  int i;
+
+  if( !h->total)
+    return 0;
+  target = (uint64_t) (percent / 100.0 * h->total + 0.5);
+  if( target < 1)
+    target = 1;
+  seen = 0;
+  for( i = 0; i < HIST_SIZE; i++)
+    {
+      seen += h->counts[i];
+      if( seen >= target)
+        return (histogram_value( i) < h->max) ? histogram_value( i) : h->max;
+    }
+  return h->max;
+}
+
+
+struct request_kind
+{
+  char *name;
+  int type;
+  int weight;
+
+  struct histogram latency;
+  uint64_t errors;
+  uint64_t timeouts;
+};
+
+static struct request_kind kinds[] =
+  {
+    { "all", REQUEST_ALL_IOCS, 1 },
+    { "some", REQUEST_SOME_IOCS, 4 },
+    { "one", REQUEST_ONE_IOC, 20 },
+    { "events", REQUEST_EVENTS, 4 },
+    { "debug", REQUEST_DEBUG, 1 },
+    { "conflicts", REQUEST_CONFLICTS, 1 },
+  };
+#define NUMBER_KINDS ((int) (sizeof(kinds) / sizeof(kinds[0])))
+
+struct slot
+{
+  struct alive_request *req;
+  struct request_kind *kind;
+  double due;  // when the request was meant to start
+};
+
+static char *server;
+static int port;
+static char **ioc_names;
+static int number_iocs;
+static int names_per_request = 10;
+static int total_weight;
+static uint64_t random_state = 88172645463325252ull;
+
+
+static double monotonic_seconds( void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t next_random( void)
+{
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state >> 32;
+}
+
+static int parse_mix( char *mix)
+{
+  char *str, *item, *eq, *save;
+  int i;
+
+  for( i = 0; i < NUMBER_KINDS; i++)
+    kinds[i].weight = 0;
+  str = strdup( mix);
+  for( item = strtok_r( str, ",", &save); item != NULL;
+       item = strtok_r( NULL, ",", &save))
+    {
+      eq = strchr( item, '=');
+      if( eq != NULL)
+        *eq = '\0';
+      for( i = 0; i < NUMBER_KINDS; i++)
+        if( !strcmp( item, kinds[i].name) )
+          break;
+      if( i == NUMBER_KINDS)
+        {
+          printf("Error: unknown request type \"%s\".\n", item);
+          return 1;
+        }
+      kinds[i].weight = (eq == NULL) ? 1 : atoi( eq + 1);
+      if( kinds[i].weight < 0)
+        {
+          printf("Error: weights can't be negative.\n");
+          return 1;
+        }
+    }
+  free( str);
+  return 0;
+}
+
+static struct request_kind *pick_kind( void)
+{
+  int r, i;
+
+  r = next_random() % total_weight;
+  for( i = 0; i < NUMBER_KINDS; i++)
+    {
+      r -= kinds[i].weight;
+      if( r < 0)
+        break;
+    }
+  return &kinds[i];
+}
+
+static int start_request( struct slot *slot, double due)
+{
+  char *names[256];
+  int number, i;
+
+  slot->kind = pick_kind();
+  slot->due = due;
+
+  switch( slot->kind->type)
+    {
+    case REQUEST_ALL_IOCS:
+      number = 0;
+      break;
+    case REQUEST_SOME_IOCS:
+      number = names_per_request;
+      break;
+    default:
+      number = 1;
+      break;
+    }
+  for( i = 0; i < number; i++)
+    names[i] = ioc_names[next_random() % number_iocs];
+
+  slot->req = alive_request_start( server, port, slot->kind->type, number,
+                                   names);
+  if( slot->req == NULL)
+    {
+      slot->kind->errors++;
+      return 1;
+    }
+  return 0;
+}
+
+// A response only counts if it decodes.
+static int finish_request( struct slot *slot, double now)
+{
+  struct alive_db *db;
+  struct alive_detailed_ioc *dioc;
+  struct alive_ioc_event_db *events;
+  char *data;
+  int length;
+  int ok;
+
+  ok = 0;
+  data = alive_request_response( slot->req, &length);
+  if( data != NULL)
+    switch( slot->kind->type)
+      {
+      case REQUEST_ALL_IOCS:
+      case REQUEST_SOME_IOCS:
+      case REQUEST_ONE_IOC:
+        if( (db = alive_decode_db( data, length)) != NULL)
+          {
+            ok = 1;
+            alive_free_db( db);
+          }
+        break;
+      case REQUEST_EVENTS:
+        if( (events = alive_decode_ioc_event_db( data, length)) != NULL)
+          {
+            ok = 1;
+            alive_free_ioc_event_db( events);
+          }
+        break;
+      default:
+        if( (dioc = alive_decode_detailed( data, length)) != NULL)
+          {
+            ok = 1;
+            alive_free_detailed( dioc);
+          }
+        break;
+      }
+
+  if( ok)
+    histogram_add( &slot->kind->latency, (uint64_t) ((now - slot->due) * 1e6));
+  else
+    slot->kind->errors++;
+  alive_request_free( slot->req);
+  slot->req = NULL;
+  return ok;
+}
+
+
+static void print_report( double elapsed)
+{
+  struct histogram all;
+  struct histogram *h;
+  uint64_t errors, timeouts;
+  int i, j;
+
+  memset( &all, 0, sizeof( all));
+  errors = timeouts = 0;
+
+  printf("%-10s %9s %10s %9s %9s %9s %9s %9s %9s %7s %8s\n", "type",
+         "requests", "req/s", "mean ms", "p50 ms", "p90 ms", "p99 ms",
+         "p99.9 ms", "max ms", "errors", "timeouts");
+  for( i = 0; i <= NUMBER_KINDS; i++)
+    {
+      if( i < NUMBER_KINDS)
+        {
+          if( !kinds[i].weight)
+            continue;
+          h = &kinds[i].latency;
+          for( j = 0; j < HIST_SIZE; j++)
+            all.counts[j] += h->counts[j];
+          all.total += h->total;
+          all.sum += h->sum;
+          if( h->max > all.max)
+            all.max = h->max;
+          errors += kinds[i].errors;
+          timeouts += kinds[i].timeouts;
+        }
+      else
+        h = &all;
+
+      printf("%-10s %9llu %10.1f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %7llu %8llu\n",
+             (i < NUMBER_KINDS) ? kinds[i].name : "total",
+             (unsigned long long) h->total, h->total / elapsed,
+             h->total ? h->sum / h->total / 1000.0 : 0.0,
+             histogram_percentile( h, 50.0) / 1000.0,
+             histogram_percentile( h, 90.0) / 1000.0,
+             histogram_percentile( h, 99.0) / 1000.0,
+             histogram_percentile( h, 99.9) / 1000.0,
+             h->max / 1000.0,
+             (unsigned long long) ((i < NUMBER_KINDS) ? kinds[i].errors :
+                                   errors),
+             (unsigned long long) ((i < NUMBER_KINDS) ? kinds[i].timeouts :
+                                   timeouts));
+    }
+}
+
+
+void helper( void)
+{
+  printf("Usage: alive-loadgen [-h] [-v] [-r (server)[:(port)] ] [-c (number)]\n"
+         "       [-d (seconds)] [-R (rate)] [-m (mix)] [-n (number)] [-t (seconds)]\n");
+  printf("Load generator for the alive database server.\n");
+  printf("  -h  Show this help screen.\n");
+  printf("  -v  Show version.\n");
+  printf("  -r  Set the remote host and optionally the port.\n");
+  printf("  -c  Most requests in flight at once (default 10).\n");
+  printf("  -d  Length of the run in seconds (default 10).\n");
+  printf("  -R  Start requests at this many per second (open loop), instead of\n"
+         "      one whenever another finishes (closed loop).\n");
+  printf("  -m  Mix of request types, as type=weight,...  Types are all, some,\n"
+         "      one, events, debug, and conflicts\n"
+         "      (default all=1,some=4,one=20,events=4,debug=1,conflicts=1).\n");
+  printf("  -n  Number of IOCs in each \"some\" request (default 10).\n");
+  printf("  -t  Seconds before a request counts as timed out (default 5).\n");
+}
+
+int main(int argc, char *argv[])
+{
+  struct slot *slots;
+  struct pollfd *fds;
+  struct alive_db *db;
+  char *cl_server = NULL;
+  char *host;
+  char *mix = NULL;
+  char address[INET_ADDRSTRLEN];
+  struct addrinfo hints, *servinfo;
+  int concurrency = 10;
+  double duration = 10.0;
+  double rate = 0.0;
+  double timeout = 5.0;
+  double begin, end, now, due, wait;
+  uint64_t started;
+  int in_flight, number_fds, ret;
+  char *p;
+  int i;
+  int opt;
+
+  while((opt = getopt( argc, argv, "r:c:d:R:m:n:t:hv")) != -1)
+    {
+      switch(opt)
+        {
+        case 'r':
+          cl_server = strdup( optarg);
+          break;
+        case 'c':
+          concurrency = atoi( optarg);
+          break;
+        case 'd':
+          duration = atof( optarg);
+          break;
+        case 'R':
+          rate = atof( optarg);
+          break;
+        case 'm':
+          mix = strdup( optarg);
+          break;
+        case 'n':
+          names_per_request = atoi( optarg);
+          break;
+        case 't':
+          timeout = atof( optarg);
+          break;
+        case 'h':
+          helper();
+          exit(0);
+        case 'v':
+          printf("alive-loadgen %s\n", alive_client_api_version() );
+          return 0;
+        default:
+          return -1;
+        }
+    }
+  if( (concurrency <= 0) || (duration <= 0) || (rate < 0) || (timeout <= 0) ||
+      (names_per_request < 1) || (names_per_request > 256) )
+    {
+      printf("Error: invalid option value.\n");
+      return -1;
+    }
+  if( (mix != NULL) && parse_mix( mix) )
+    return -1;
+  total_weight = 0;
+  for( i = 0; i < NUMBER_KINDS; i++)
+    total_weight += kinds[i].weight;
+  if( !total_weight)
+    {
+      printf("Error: the mix has no requests in it.\n");
+      return -1;
+    }
+
+  if( cl_server != NULL)
+    {
+      server = cl_server;
+      if( (p = strchr(server, ':')) != NULL)
+        {
+          *p = '\0';
+          port = atoi( p+1);
+        }
+      else
+        port = alive_default_database_port();
+    }
+  else
+    {
+      server = alive_default_database_host();
+      port = alive_default_database_port();
+    }
+
+  // look the name up once, rather than for every request
+  host = server;
+  if( server[0] != '/')
+    {
+      memset( &hints, 0, sizeof hints);
+      hints.ai_family = AF_INET;
+      hints.ai_socktype = SOCK_STREAM;
+      if( getaddrinfo( server, NULL, &hints, &servinfo) )
+        {
+          printf("Can't find server \"%s\"!\n", server);
+          return 1;
+        }
+      inet_ntop( AF_INET,
+                 &((struct sockaddr_in *) servinfo->ai_addr)->sin_addr,
+                 address, sizeof( address));
+      freeaddrinfo( servinfo);
+      server = address;
+    }
+
+  // requests name IOCs the daemon actually has
+  db = alive_get_db( server, port);
+  if( db == NULL)
+    return 1;
+  if( !db->number_ioc)
+    {
+      printf("The server has no IOCs.\n");
+      return 1;
+    }
+  number_iocs = db->number_ioc;
+  ioc_names = malloc( number_iocs * sizeof( char *));
+  for( i = 0; i < number_iocs; i++)
+    ioc_names[i] = db->ioc[i].ioc_name;
+
+  signal( SIGPIPE, SIG_IGN);
+
+  slots = calloc( concurrency, sizeof( struct slot));
+  fds = calloc( concurrency, sizeof( struct pollfd));
+  if( (slots == NULL) || (fds == NULL) )
+    return 1;
+
+  printf("%s loop, %d at once, %g seconds, against %s:%d with %d IOCs\n",
+         (rate > 0) ? "Open" : "Closed", concurrency, duration,
+         host, port, number_iocs);
+  if( rate > 0)
+    printf("Rate %g requests per second\n", rate);
+  fflush(stdout);
+
+  begin = monotonic_seconds();
+  end = begin + duration;
+  started = 0;
+  in_flight = 0;
+  while( 1)
+    {
+      now = monotonic_seconds();
+
+      // fill empty slots with requests that are due
+      for( i = 0; (i < concurrency) && (now < end); i++)
+        {
+          if( slots[i].req != NULL)
+            continue;
+          if( rate > 0)
+            {
+              due = begin + started / rate;
+              if( due > now)
+                break;
+            }
+          else
+            due = now;
+          started++;
+          if( !start_request( &slots[i], due) )
+            in_flight++;
+        }
+      if( !in_flight && (now >= end) )
+        break;
+
+      number_fds = 0;
+      for( i = 0; i < concurrency; i++)
+        if( slots[i].req != NULL)
+          {
+            fds[i].fd = alive_request_fd( slots[i].req);
+            fds[i].events = alive_request_poll_events( slots[i].req);
+            number_fds = i + 1;
+          }
+        else
+          fds[i].fd = -1;
+
+      // wake for the next due request, or at least every 10 ms to check
+      // timeouts
+      wait = 0.01;
+      if( (rate > 0) && (now < end) )
+        {
+          due = begin + started / rate - now;
+          if( due < wait)
+            wait = (due > 0) ? due : 0;
+        }
+      if( poll( fds, number_fds, (int) (wait * 1000)) < 0)
+        continue;
+
+      now = monotonic_seconds();
+      for( i = 0; i < number_fds; i++)
+        {
+          if( slots[i].req == NULL)
+            continue;
+          ret = 0;
+          if( fds[i].revents)
+            ret = alive_request_process( slots[i].req);
+          if( ret > 0)
+            finish_request( &slots[i], now);
+          else if( ret < 0)
+            {
+              slots[i].kind->errors++;
+              alive_request_free( slots[i].req);
+              slots[i].req = NULL;
+            }
+          else if( now - slots[i].due > timeout)
+            {
+              slots[i].kind->timeouts++;
+              alive_request_free( slots[i].req);
+              slots[i].req = NULL;
+            }
+          else
+            continue;
+          in_flight--;
+        }
+    }
+
+  printf("\n");
+  print_report( monotonic_seconds() - begin);
+  if( (rate > 0) && (started < (uint64_t) (duration * rate)) )
+    printf("\n%llu requests never started, for lack of free slots.\n",
+           (unsigned long long) ((uint64_t) (duration * rate) - started));
+
+  free( slots);
+  free( fds);
+  free( ioc_names);
+  alive_free_db( db);
+
+  return 0;
+}
@@ -0,0 +1,776 @@
+/*************************************************************************\
+* Copyright (c) 2020 UChicago Argonne, LLC,
+*               as Operator of Argonne National Laboratory.
+\*************************************************************************/
+
+/*
+  Written by Dohn A. Arms (Advanced Photon Source, ANL)
+*/
+
+
+// alive-proxy: a local caching proxy for the alive daemon.  It speaks the
+// same client protocol, so existing clients can point "-r" at it.  Each
+// distinct request is cached for a short time, and identical requests
+// that arrive while one is being fetched wait for that fetch instead of
+// making their own.  Requests for some or one IOC (opcodes 2 and 3) are
+// answered from slices of the cached full database.  Connections are
+// served by a fixed number of worker threads, with the ones waiting for
+// a worker queued up to a limit and any past it refused.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "alive_client.h"
+#include "alive_wire.h"
+
+
+#define MAX_REQUEST (1 << 20)
+#define TABLE_SIZE (4096)
+#define DEFAULT_WORKERS (32)
+#define DEFAULT_QUEUE (1024)
+
+
+struct cached_response
+{
+  int refcount;  // protected by cache_lock
+  char *data;
+  int length;
+
+  // only for the full database
+  int number_records;
+  struct alive_raw_record *records;
+  int slots_size;
+  int *slots;  // hash of record names, -1 for empty
+};
+
+struct cache_entry
+{
+  char *key;  // the raw request
+  int key_length;
+  uint32_t hash;
+
+  struct cached_response *response;
+  double fetched_at;
+
+  int fetching;
+  int waiters;
+  unsigned long generation;  // bumped after every fetch
+  pthread_cond_t done;
+
+  struct cache_entry *next;
+};
+
+
+static char *upstream_server;
+static int upstream_port;
+static double ttl = 1.0;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_entry *table[TABLE_SIZE];
+static double last_sweep;
+
+// accepted connections waiting for a worker, as a ring
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static int *queue;
+static int queue_size = DEFAULT_QUEUE;
+static int queue_head, queue_number;
+
+
+static double monotonic_seconds( void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint32_t hash_bytes( char *p, int length)
+{
+  uint32_t h = 2166136261u;
+
+  while( length--)
+    {
+      h ^= (unsigned char) *p++;
+      h *= 16777619u;
+    }
+  return h;
+}
+
+
+static void release_response( struct cached_response *r)
+{
+  // called with cache_lock held
+  if( (r == NULL) || --r->refcount)
+    return;
+  free( r->data);
+  free( r->records);
+  free( r->slots);
+  free( r);
+}
+
+static struct cached_response *make_response( char *data, int length,
+                                              int full_db)
+{
+  struct cached_response *r;
+  uint32_t h;
+  int i;
+
+  r = calloc( 1, sizeof( struct cached_response));
+  if( r == NULL)
+    {
+      free( data);
+      return NULL;
+    }
+  r->data = data;
+  r->length = length;
+
+  if( full_db)
+    {
+      r->number_records = alive_raw_db_records( data, length, &r->records);
+      if( r->number_records < 0)
+        {
+          free( data);
+          free( r);
+          return NULL;
+        }
+      r->slots_size = 16;
+      while( r->slots_size < 2 * r->number_records)
+        r->slots_size <<= 1;
+      r->slots = malloc( r->slots_size * sizeof( int));
+      if( r->slots == NULL)
+        {
+          free( r->records);
+          free( data);
+          free( r);
+          return NULL;
+        }
+      memset( r->slots, 0xff, r->slots_size * sizeof( int));
+      for( i = 0; i < r->number_records; i++)
+        {
+          h = hash_bytes( r->records[i].name, r->records[i].name_length) &
+            (r->slots_size - 1);
+          while( r->slots[h] >= 0)
+            h = (h + 1) & (r->slots_size - 1);
+          r->slots[h] = i;
+        }
+    }
+
+  return r;
+}
+
+static int find_record( struct cached_response *r, char *name, int length)
+{
+  struct alive_raw_record *rec;
+  uint32_t h;
+
+  h = hash_bytes( name, length) & (r->slots_size - 1);
+  while( r->slots[h] >= 0)
+    {
+      rec = &(r->records[r->slots[h]]);
+      if( (rec->name_length == length) && !memcmp( rec->name, name, length))
+        return r->slots[h];
+      h = (h + 1) & (r->slots_size - 1);
+    }
+  return -1;
+}
+
+
+// Drops responses that have been stale for a while, and entries nobody
+// is using.  Called with cache_lock held.
+static void sweep_cache( double now)
+{
+  struct cache_entry **pe, *e;
+  int i;
+
+  if( now - last_sweep < 10 * ttl)
+    return;
+  last_sweep = now;
+
+  for( i = 0; i < TABLE_SIZE; i++)
+    {
+      pe = &table[i];
+      while( (e = *pe) != NULL)
+        {
+          if( !e->fetching && !e->waiters && (now - e->fetched_at > 10 * ttl))
+            {
+              *pe = e->next;
+              release_response( e->response);
+              pthread_cond_destroy( &e->done);
+              free( e->key);
+              free( e);
+            }
+          else
+            pe = &e->next;
+        }
+    }
+}
+
+// Returns a referenced response for the request, fetching it upstream
+// only if there is no fresh copy and no fetch already under way.
+static struct cached_response *cache_get( char *key, int key_length,
+                                          int full_db)
+{
+  struct cache_entry *e;
+  struct cached_response *r;
+  unsigned long generation;
+  uint32_t h;
+  double now;
+  char *data;
+  int length;
+
+  h = hash_bytes( key, key_length);
+
+  pthread_mutex_lock( &cache_lock);
+  now = monotonic_seconds();
+  sweep_cache( now);
+
+  for( e = table[h % TABLE_SIZE]; e != NULL; e = e->next)
+    if( (e->hash == h) && (e->key_length == key_length) &&
+        !memcmp( e->key, key, key_length) )
+      break;
+  if( e == NULL)
+    {
+      e = calloc( 1, sizeof( struct cache_entry));
+      if( e == NULL)
+        {
+          pthread_mutex_unlock( &cache_lock);
+          return NULL;
+        }
+      e->key = malloc( key_length);
+      if( e->key == NULL)
+        {
+          free( e);
+          pthread_mutex_unlock( &cache_lock);
+          return NULL;
+        }
+      memcpy( e->key, key, key_length);
+      e->key_length = key_length;
+      e->hash = h;
+      pthread_cond_init( &e->done, NULL);
+      e->next = table[h % TABLE_SIZE];
+      table[h % TABLE_SIZE] = e;
+    }
+
+  if( e->fetching)
+    {
+      // coalesce with the fetch in flight
+      generation = e->generation;
+      e->waiters++;
+      while( e->generation == generation)
+        pthread_cond_wait( &e->done, &cache_lock);
+      e->waiters--;
+      r = e->response;
+      if( r != NULL)
+        r->refcount++;
+      pthread_mutex_unlock( &cache_lock);
+      return r;
+    }
+
+  if( (e->response != NULL) && (now - e->fetched_at < ttl) )
+    {
+      r = e->response;
+      r->refcount++;
+      pthread_mutex_unlock( &cache_lock);
+      return r;
+    }
+
+  e->fetching = 1;
+  pthread_mutex_unlock( &cache_lock);
+
+  data = alive_request_raw( upstream_server, upstream_port, key, key_length,
+                            &length);
+  r = (data == NULL) ? NULL : make_response( data, length, full_db);
+
+  pthread_mutex_lock( &cache_lock);
+  if( r != NULL)
+    {
+      release_response( e->response);
+      e->response = r;
+      e->fetched_at = monotonic_seconds();
+      r->refcount = 2;  // one for the entry, one for the caller
+    }
+  else
+    {
+      // failures aren't cached, but waiters get nothing
+      release_response( e->response);
+      e->response = NULL;
+    }
+  e->fetching = 0;
+  e->generation++;
+  pthread_cond_broadcast( &e->done);
+  pthread_mutex_unlock( &cache_lock);
+
+  return r;
+}
+
+static void cache_release( struct cached_response *r)
+{
+  pthread_mutex_lock( &cache_lock);
+  release_response( r);
+  pthread_mutex_unlock( &cache_lock);
+}
+
+
+static int write_all( int fd, char *p, int length)
+{
+  int n;
+
+  while( length > 0)
+    {
+      n = write( fd, p, length);
+      if( n <= 0)
+        {
+          if( (n < 0) && (errno == EINTR) )
+            continue;
+          return 1;
+        }
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+// answers opcode 2 or 3 from the cached full database
+static void answer_subset( int fd, uint16_t opcode, char *request)
+{
+  static char full_request[2] = { 0, 1 };
+  struct cached_response *r;
+  struct alive_raw_record *rec;
+  struct alive_wire_db_header header;
+  char *out, *p, *name;
+  uint16_t number;
+  int *found;
+  int out_length;
+  int i, j, k, nlen;
+
+  r = cache_get( full_request, 2, 1);
+  if( r == NULL)
+    return;
+
+  p = request + 2;
+  if( opcode == 2)
+    {
+      number = ntohs( *((uint16_t *) p));
+      p += 2;
+    }
+  else
+    number = 1;
+
+  found = malloc( (number ? number : 1) * sizeof( int));
+  if( found == NULL)
+    {
+      cache_release( r);
+      return;
+    }
+
+  out_length = ALIVE_WIRE_SIZE( db_header);
+  k = 0;
+  for( i = 0; i < number; i++)
+    {
+      nlen = *((uint8_t *) p);
+      name = p + 1;
+      p += 1 + nlen;
+      j = find_record( r, name, nlen);
+      if( j >= 0)
+        {
+          found[k++] = j;
+          out_length += r->records[j].length;
+        }
+    }
+
+  out = malloc( out_length);
+  if( out != NULL)
+    {
+      // version and times from the cached response
+      alive_wire_get_db_header( r->data, &header);
+      header.number = k;
+      p = alive_wire_put_db_header( out, &header);
+      for( i = 0; i < k; i++)
+        {
+          rec = &(r->records[found[i]]);
+          memcpy( p, r->data + rec->offset, rec->length);
+          p += rec->length;
+        }
+      write_all( fd, out, out_length);
+      free( out);
+    }
+
+  free( found);
+  cache_release( r);
+}
+
+
+// Returns nonzero once a whole request of a known opcode has been read;
+// unknown opcodes are read until the client stops sending.
+static int request_complete( char *request, int length)
+{
+  uint16_t opcode, number;
+  int i, offset;
+
+  if( length < 2)
+    return 0;
+  opcode = ntohs( *((uint16_t *) request));
+  switch( opcode)
+    {
+    case 1:
+      return 1;
+    case 2:
+      if( length < 4)
+        return 0;
+      number = ntohs( *((uint16_t *) (request + 2)));
+      offset = 4;
+      for( i = 0; i < number; i++)
+        {
+          if( offset >= length)
+            return 0;
+          offset += 1 + *((uint8_t *) (request + offset));
+        }
+      return offset <= length;
+    case 3:
+    case 15:
+    case 21:
+    case 22:
+      if( length < 3)
+        return 0;
+      return 3 + *((uint8_t *) (request + 2)) <= length;
+    }
+  return 0;
+}
+
+static void serve_connection( int fd)
+{
+  struct cached_response *r;
+  struct timeval tv;
+  char *request, *data;
+  int length, n, size;
+  uint16_t opcode;
+
+  tv.tv_sec = 10;
+  tv.tv_usec = 0;
+  setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  size = 256;
+  length = 0;
+  request = malloc( size);
+  while( request != NULL)
+    {
+      if( request_complete( request, length) )
+        break;
+      if( length == size)
+        {
+          if( size >= MAX_REQUEST)
+            break;
+          size *= 2;
+          data = realloc( request, size);
+          if( data == NULL)
+            break;
+          request = data;
+        }
+      n = read( fd, request + length, size - length);
+      if( n < 0 && errno == EINTR)
+        continue;
+      if( n <= 0)
+        break;
+      length += n;
+    }
+
+  if( (request != NULL) && (length >= 2) )
+    {
+      opcode = ntohs( *((uint16_t *) request));
+      switch( opcode)
+        {
+        case 1:
+          r = cache_get( request, 2, 1);
+          if( r != NULL)
+            {
+              write_all( fd, r->data, r->length);
+              cache_release( r);
+            }
+          break;
+        case 2:
+        case 3:
+          if( request_complete( request, length) )
+            answer_subset( fd, opcode, request);
+          break;
+        case 15:
+        case 21:
+        case 22:
+          if( !request_complete( request, length) )
+            break;
+          r = cache_get( request, 3 + *((uint8_t *) (request + 2)), 0);
+          if( r != NULL)
+            {
+              write_all( fd, r->data, r->length);
+              cache_release( r);
+            }
+          break;
+        default:
+          // not cached, just passed along
+          data = alive_request_raw( upstream_server, upstream_port,
+                                    request, length, &n);
+          if( data != NULL)
+            {
+              write_all( fd, data, n);
+              free( data);
+            }
+          break;
+        }
+    }
+
+  free( request);
+  shutdown( fd, SHUT_RDWR);
+  close( fd);
+}
+
+// returns 1 if the queue is full
+static int queue_connection( int fd)
+{
+  pthread_mutex_lock( &queue_lock);
+  if( queue_number == queue_size)
+    {
+      pthread_mutex_unlock( &queue_lock);
+      return 1;
+    }
+  queue[(queue_head + queue_number) % queue_size] = fd;
+  queue_number++;
+  pthread_cond_signal( &queue_ready);
+  pthread_mutex_unlock( &queue_lock);
+  return 0;
+}
+
+static void *worker( void *arg)
+{
+  int fd;
+
+  while( 1)
+    {
+      pthread_mutex_lock( &queue_lock);
+      while( !queue_number)
+        pthread_cond_wait( &queue_ready, &queue_lock);
+      fd = queue[queue_head];
+      queue_head = (queue_head + 1) % queue_size;
+      queue_number--;
+      pthread_mutex_unlock( &queue_lock);
+
+      serve_connection( fd);
+    }
+
+  return NULL;
+}
+
+
+static int listen_tcp( int port)
+{
+  struct sockaddr_in addr;
+  int fd;
+  int on = 1;
+
+  fd = socket( AF_INET, SOCK_STREAM, 0);
+  if( fd == -1)
+    return -1;
+  setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  memset( &addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if( bind( fd, (struct sockaddr *) &addr, sizeof(addr)) || listen( fd, 512))
+    {
+      close( fd);
+      return -1;
+    }
+  return fd;
+}
+
+static int listen_unix( char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  if( strlen( path) >= sizeof(addr.sun_path) )
+    return -1;
+  fd = socket( AF_UNIX, SOCK_STREAM, 0);
+  if( fd == -1)
+    return -1;
+  memset( &addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy( addr.sun_path, path);
+  unlink( path);
+  if( bind( fd, (struct sockaddr *) &addr, sizeof(addr)) || listen( fd, 512))
+    {
+      close( fd);
+      return -1;
+    }
+  return fd;
+}
+
+
+void helper( void)
+{
+  printf("Usage: alive-proxy [-h] [-v] [-r (server)[:(port)] ] [-p (port)] [-u (path)]\n"
+         "       [-t (seconds)] [-w (number)] [-q (number)]\n");
+  printf("Caching proxy for the alive database server.\n");
+  printf("  -h  Show this help screen.\n");
+  printf("  -v  Show version.\n");
+  printf("  -r  Set the upstream host and optionally the port.\n");
+  printf("  -p  Listen on this TCP port.\n");
+  printf("  -u  Listen on this UNIX socket path.\n");
+  printf("  -t  Time in seconds responses stay cached (default 1).\n");
+  printf("  -w  Number of worker threads serving connections (default %d).\n",
+         DEFAULT_WORKERS);
+  printf("  -q  Most connections waiting for a worker, past which they are\n"
+         "      refused (default %d).\n", DEFAULT_QUEUE);
+}
+
+int main(int argc, char *argv[])
+{
+  struct pollfd fds[2];
+  pthread_attr_t attr;
+  pthread_t thread;
+  int number_fds;
+  int workers = DEFAULT_WORKERS;
+  char *cl_server = NULL;
+  char *unix_path = NULL;
+  int listen_port = 0;
+  char *p;
+  int fd, i;
+  int opt;
+
+  while((opt = getopt( argc, argv, "r:p:u:t:w:q:hv")) != -1)
+    {
+      switch(opt)
+        {
+        case 'r':
+          cl_server = strdup( optarg);
+          break;
+        case 'p':
+          listen_port = atoi( optarg);
+          break;
+        case 'u':
+          unix_path = strdup( optarg);
+          break;
+        case 't':
+          ttl = atof( optarg);
+          break;
+        case 'w':
+          workers = atoi( optarg);
+          if( workers < 1)
+            {
+              printf("Error: there must be at least one worker.\n");
+              return 1;
+            }
+          break;
+        case 'q':
+          queue_size = atoi( optarg);
+          if( queue_size < 1)
+            {
+              printf("Error: the queue must hold at least one connection.\n");
+              return 1;
+            }
+          break;
+        case 'h':
+          helper();
+          exit(0);
+        case 'v':
+          printf("alive-proxy %s\n", alive_client_api_version() );
+          return 0;
+        default:
+          return -1;
+        }
+    }
+
+  if( cl_server != NULL)
+    {
+      upstream_server = cl_server;
+      if( (p = strchr(upstream_server, ':')) != NULL)
+        {
+          *p = '\0';
+          upstream_port = atoi( p+1);
+        }
+      else
+        upstream_port = alive_default_database_port();
+    }
+  else
+    {
+      upstream_server = alive_default_database_host();
+      upstream_port = alive_default_database_port();
+    }
+
+  if( !listen_port && (unix_path == NULL) )
+    {
+      helper();
+      return 1;
+    }
+
+  signal( SIGPIPE, SIG_IGN);
+
+  number_fds = 0;
+  if( listen_port)
+    {
+      fd = listen_tcp( listen_port);
+      if( fd < 0)
+        {
+          printf("Can't listen on port %d!\n", listen_port);
+          return 1;
+        }
+      fds[number_fds].fd = fd;
+      fds[number_fds++].events = POLLIN;
+    }
+  if( unix_path != NULL)
+    {
+      fd = listen_unix( unix_path);
+      if( fd < 0)
+        {
+          printf("Can't listen on \"%s\"!\n", unix_path);
+          return 1;
+        }
+      fds[number_fds].fd = fd;
+      fds[number_fds++].events = POLLIN;
+    }
+
+  queue = malloc( queue_size * sizeof( int));
+  if( queue == NULL)
+    return 1;
+  pthread_attr_init( &attr);
+  pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED);
+  for( i = 0; i < workers; i++)
+    if( pthread_create( &thread, &attr, worker, NULL) )
+      {
+        printf("Can't start the worker threads!\n");
+        return 1;
+      }
+
+  while( 1)
+    {
+      if( poll( fds, number_fds, -1) <= 0)
+        continue;
+      for( i = 0; i < number_fds; i++)
+        {
+          if( !(fds[i].revents & POLLIN) )
+            continue;
+          fd = accept( fds[i].fd, NULL, NULL);
+          if( fd < 0)
+            continue;
+          // refused rather than left to pile up
+          if( queue_connection( fd) )
+            close( fd);
+        }
+    }
+
+  return 0;
+}